@@ -51,4 +51,43 @@ void *array_pop(Array *array)
     return (void *)r;
 }
 
+// Appends all of the items of the src to the end of the dest
+void array_add_all(Array *dest, Array *src)
+{
+    if (dest->count + src->count > dest->allocated) {
+        s64 reserve = dest->count + src->count;
+        dest->data = realloc(dest->data, sizeof(void *) * reserve);
+        dest->allocated = reserve;
+    }
+
+    memcpy(dest->data + dest->count, src->data, sizeof(void *) * src->count);
+    dest->count += src->count;
+}
+
+// A simple bump allocator for the tokens and the instructions. Those are never freed one by one,
+// so we don't want to pay for a malloc() per item (and for the lock inside the malloc with many threads).
+typedef struct {
+    u8 *block;
+    size_t used;
+    size_t block_size;
+} Pool;
+
+#define POOL_BLOCK_SIZE (64 * 1024)
+
+void *pool_alloc(Pool *pool, size_t size)
+{
+    size = (size + 7) & ~((size_t)7);
+
+    if (pool->block == NULL || pool->used + size > pool->block_size) {
+        pool->block_size = size > POOL_BLOCK_SIZE ? size : POOL_BLOCK_SIZE;
+        pool->block = (u8 *)malloc(pool->block_size); // @Leak: we keep them until the exit
+        pool->used = 0;
+    }
+
+    void *result = pool->block + pool->used;
+    pool->used += size;
+
+    return result;
+}
+
 #endif
\ No newline at end of file
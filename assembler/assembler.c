@@ -1,21 +1,96 @@
 #include "assembler.h"
 #include "new_string.h"
 #include "array.h"
+#include "platform.h"
 
 #include "lexer.c"
 #include "parser.c"
 #include "bytecode_builder.c"
+#include "fragment.c"
+#include "debug_info.c"
 
 int main(int argc, char **argv)
 {
-    String input = read_entire_file("mock/listing_0039_more_movs.asm");
-    tokenize(input);
+    char *output_filename = "mock/a.out";
+    char *cache_dir = ".asm_cache";
+    int thread_count = 1;
 
-    parse_tokens();
+    Array input_filenames = array_create(8);
 
-    build_bytecodes(parser.instructions);
+    for (int i = 1; i < argc; i++) {
+        if (CSTR_EQUAL(argv[i], "-o") && i+1 < argc) {
+            output_filename = argv[++i];
+        }
+        else if (CSTR_EQUAL(argv[i], "-j") && i+1 < argc) {
+            thread_count = atoi(argv[++i]);
+            if (thread_count <= 0) thread_count = cpu_core_count();
+        }
+        else if (CSTR_EQUAL(argv[i], "--cache") && i+1 < argc) {
+            cache_dir = argv[++i];
+        }
+        else if (CSTR_EQUAL(argv[i], "--no-cache")) {
+            cache_dir = NULL;
+        }
+        else {
+            array_add(&input_filenames, argv[i]);
+        }
+    }
 
-    printf(COLOR_CYAN"\n%d instructions assembled!\n"COLOR_DEFAULT, parser.instructions.count);
+    if (input_filenames.count == 0) {
+        array_add(&input_filenames, "mock/listing_0039_more_movs.asm");
+    }
+
+    if (cache_dir) {
+        make_directory(cache_dir);
+    }
+
+    double start = seconds_now();
+
+    int fragment_count = input_filenames.count;
+    Fragment **fragments = (Fragment **)malloc(sizeof(Fragment *) * fragment_count);
+    u32 *bases = (u32 *)malloc(sizeof(u32) * fragment_count);
+
+    int cached = 0;
+    double cold_seconds = 0;
+    Bytecode_Stats stats = {0};
+
+    for (int i = 0; i < fragment_count; i++) {
+        fragments[i] = assemble_file((char *)input_filenames.data[i], cache_dir, thread_count);
+
+        cached += fragments[i]->from_cache;
+        cold_seconds += fragments[i]->assemble_seconds;
+        stats.emitted_bytes += fragments[i]->stats.emitted_bytes;
+        stats.saved_bytes += fragments[i]->stats.saved_bytes;
+    }
+
+    double assembled = seconds_now();
+
+    u32 image_size = 0;
+    u8 *image = link_fragments(fragments, fragment_count, bases, &image_size);
+
+    FILE *fp = fopen(output_filename, "wb");
+    if (fp == NULL) {
+        printf("\n[ERROR]: Failed to open %s file. Probably it is not exists.\n", output_filename);
+        assert(0);
+    }
+    fwrite(image, image_size, 1, fp);
+    fclose(fp);
+
+    write_debug_info(output_filename, fragments, bases, (char **)input_filenames.data, fragment_count);
+
+    double linked = seconds_now();
+
+    u32 naive_bytes = stats.emitted_bytes + stats.saved_bytes;
+    printf(
+        COLOR_CYAN"\n%d bytes emitted, %d bytes saved by the encoding selection (%.1f%% of %d)\n"COLOR_DEFAULT,
+        stats.emitted_bytes, stats.saved_bytes, naive_bytes ? (100.0f * stats.saved_bytes / naive_bytes) : 0.0f, naive_bytes
+    );
+
+    // The cold time is the sum of the original assemble times of the fragments (the cached ones included)
+    printf(
+        COLOR_CYAN"\n%d file(s), %d from the cache, assemble: %.3fs, link: %.3fs (cold build: %.3fs, %d thread(s))\n"COLOR_DEFAULT,
+        fragment_count, cached, assembled - start, linked - assembled, cold_seconds + (linked - assembled), thread_count
+    );
 
     return 0;
 }
@@ -8,6 +8,8 @@
 #include <string.h>
 #include <stdbool.h>
 
+#include "new_string.h"
+
 typedef char s8;
 typedef short s16;
 typedef int s32;
@@ -43,6 +45,8 @@ typedef unsigned long u64;
 
 #define BYTE_SWAP(__val) (((__val >> 8)) | ((__val << 8)))
 #define IS_16BIT(_num) (_num & 0xFF00)
+// The value fits into a sign-extended byte (imm8/disp8 forms) if we look at it as a 16bit number
+#define FITS_SIGNED_8BIT(_num) ((s16)(_num) >= -128 && (s16)(_num) <= 127)
 
 //////////////////
 
@@ -59,10 +63,46 @@ typedef enum {
 
 typedef enum {
     M_MOV,
+
+    // ALU group, they share the same encoding forms
     M_ADD,
+    M_OR,
+    M_ADC,
+    M_SBB,
+    M_AND,
     M_SUB,
+    M_XOR,
+    M_CMP,
+
+    // Jumps with 8bit relative displacement. The order of the conditional jumps follows the opcodes (0x70-0x7F).
+    M_JO,
+    M_JNO,
+    M_JB,
+    M_JNB,
+    M_JZ,
+    M_JNZ,
+    M_JBE,
+    M_JA,
+    M_JS,
+    M_JNS,
+    M_JP,
+    M_JNP,
+    M_JL,
+    M_JNL,
+    M_JLE,
+    M_JG,
+
+    M_LOOPNZ,
+    M_LOOPZ,
+    M_LOOP,
+    M_JCXZ,
+
+    M_JMP, // short or near, decided at the layout
 } Mnemonic;
 
+#define IS_ALU_MNEMONIC(_m) (_m >= M_ADD && _m <= M_CMP)
+#define IS_JUMP_MNEMONIC(_m) (_m >= M_JO && _m <= M_JMP)
+
 typedef enum {
     REG_NONE,
 
@@ -147,6 +187,7 @@ typedef struct {
         Register reg;
         Effective_Address_Expression address;
         s32 immediate;
+        String label; // OPERAND_RELATIVE_IMMEDIATE, the target is resolved by resolve_symbols()
     };
 
 } Operand;
@@ -192,9 +233,14 @@ struct Instruction {
 
     Register segment_reg; // segment override
 
+    s64 target_index; // jumps: index of the target instruction in the merged instruction array
+    bool is_near;     // jumps: the rel16 form of the jmp is required (explicit "near" or out of the short range)
+
+    u32 line; // in the source file, 1-based
+
 };
 
-inline Width register_size(Register r)
+static inline Width register_size(Register r)
 {
     // @Cleanup
     switch (r) {
@@ -288,6 +334,28 @@ u8 reg_rm(Operand op)
     return 0; // dummy compiler
 }
 
+// Picks the shortest mod field for the effective address, the same way as the NASM does:
+//  - direct address:                  mod=00, r/m=110 and always a 16bit displacement
+//  - no displacement (except the bp): mod=00
+//  - fits into a signed byte:         mod=01 (the [bp] is encoded as [bp+0])
+//  - otherwise:                       mod=10
+MOD choose_memory_mod(Effective_Address_Expression *address)
+{
+    if (address->base == EFFECTIVE_ADDR_DIRECT) {
+        return MOD_MEM;
+    }
+
+    if (address->displacement == 0 && address->base != EFFECTIVE_ADDR_BP) {
+        return MOD_MEM;
+    }
+
+    if (FITS_SIGNED_8BIT(address->displacement)) {
+        return MOD_MEM_8BIT_DISP;
+    }
+
+    return MOD_MEM_16BIT_DISP;
+}
+
 #define IS_OPERAND_REG(_op, _reg) (_op.type == OPERAND_REGISTER && _op.reg == _reg)
 #define IS_OPERAND_MEM(_op) (_op.type == OPERAND_MEMORY)
 
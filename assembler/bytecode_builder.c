@@ -2,135 +2,344 @@
 
 #define W(_inst) (_inst->size == W_WORD)
 
-#define OUT(_data, _bytes) { u16 _out = (_data); fwrite(&_out, _bytes, 1, fp); }
+#define OUT(_data, _bytes) { u16 _out = (_data); memcpy(out+size, &_out, _bytes); size += _bytes; stats->emitted_bytes += _bytes; }
 #define OUTB(_data) OUT(_data, W_BYTE)
 #define OUTW(_data) OUT(_data, W_WORD)
 
 #define MOD_XXX_RM(_mod, _xxx, _rm) \
     OUTB(( 0b00000000 | ((_mod & 3) << 6) | ((_xxx & 7) << 3) | ((_rm & 7) << 0) ));
 
-// Encode displacement by the MOD field and the operand (memory) address type
-// @Testit
+// Encode displacement by the MOD field (see choose_memory_mod()) and the operand (memory) address type
 #define DISP_MOD(_operand) { \
     if (_operand.type == OPERAND_MEMORY) { \
-        u16 _disp = _operand.address.displacement; \
-        if (inst->mod != MOD_MEM) { \
-            /* 8 or 16 bit displacement @todo */ \
-            if (_operand.address.base == EFFECTIVE_ADDR_BP) { \
-                OUT(_operand.address.displacement, IS_16BIT(_disp) ? W_WORD : W_BYTE); \
-            } else { \
-                if (_disp) {\
-                    OUT(_operand.address.displacement, IS_16BIT(_disp) ? W_WORD : W_BYTE); \
-                }\
-            }\
-        } else if (_disp != 0) { \
-            OUT(_operand.address.displacement, W_WORD); \
+        if (_operand.address.base == EFFECTIVE_ADDR_DIRECT || inst->mod == MOD_MEM_16BIT_DISP) { \
+            OUTW(_operand.address.displacement); \
+        } else if (inst->mod == MOD_MEM_8BIT_DISP) { \
+            OUTB(_operand.address.displacement); \
         } \
+        SAVED_BY_MOD(inst->mod, _operand); \
     } \
 } \
 
+// Without the selection every non-direct effective address would have a 16bit displacement
+#define SAVED_BY_MOD(_mod, _operand) { \
+    if (_operand.address.base != EFFECTIVE_ADDR_DIRECT) { \
+        if (_mod == MOD_MEM)           stats->saved_bytes += 2; \
+        if (_mod == MOD_MEM_8BIT_DISP) stats->saved_bytes += 1; \
+    } \
+}
+
 #define DECIDE_REG(_inst) _inst->a.type == OPERAND_REGISTER ? _inst->a : _inst->b
 // DECIDE_RM will return a register type operand if both a and b is register type
 #define DECIDE_RM(_inst)  _inst->a.type == OPERAND_MEMORY   ? _inst->a : _inst->b
- 
-void build_bytecodes(Array instructions)
+
+#define MAX_INSTRUCTION_SIZE 8
+
+typedef struct {
+    u32 emitted_bytes;
+    u32 saved_bytes; // compared to the encoding which always uses the full width immediate/displacement and the r/m forms
+} Bytecode_Stats;
+
+// A jump to a label which is defined in an other source file, the rel8/rel16 is patched by the link_fragments()
+typedef struct {
+    String label;
+    u32 patch_offset; // where the displacement starts in the fragment
+    u32 end_offset;   // the end of the jump instruction, the displacement is relative to this
+    u8  size;         // 1 or 2 bytes
+    u32 line;         // of the jump in the source file, for the diagnostics
+} Fixup;
+
+// Maps the bytes [start, end) of the fragment to a line of the source file
+typedef struct {
+    u32 start;
+    u32 end;
+    u32 line;
+} Line_Entry;
+
+// The encoded bytes of one source file. The fragments are position independent, the labels (symbols) are
+// relative to the start of the fragment, so those can be cached and concatenated in any order.
+typedef struct {
+    u64 hash; // of the source content, see fragment_cache_path()
+    char *filename; // the source file, for the diagnostics
+
+    u8 *bytes;
+    u32 byte_count;
+
+    Array symbols; // Label, the value is the byte offset
+    Array fixups;  // Fixup
+
+    Line_Entry *lines; // sorted by the start
+    u32 line_count;
+
+    Bytecode_Stats stats;
+    double assemble_seconds; // how long it took to lex, parse and encode this without the cache
+
+    bool from_cache;
+} Fragment;
+
+// The 3bit opcode extension of the ALU group. This goes into the reg field of the 0x80-0x83 opcodes
+// and into the bits 3-5 of the reg/mem and accumulator forms.
+static u8 alu_op_extension[] = {
+    [M_ADD] = 0b000, [M_OR]  = 0b001, [M_ADC] = 0b010, [M_SBB] = 0b011,
+    [M_AND] = 0b100, [M_SUB] = 0b101, [M_XOR] = 0b110, [M_CMP] = 0b111,
+};
+
+// Returns the size of the jump instructions, those are depend on the layout (see layout_instructions())
+u8 jump_size(Instruction *inst)
 {
-    FILE *fp = fopen("mock/a.out", "wb");
-    if (fp == NULL) {
-        printf("\n[ERROR]: Failed to open %s file. Probably it is not exists.\n", "a.out");
-        assert(0);
+    return (inst->mnemonic == M_JMP && inst->is_near) ? 3 : 2;
+}
+
+// Encodes one instruction into the out (at least MAX_INSTRUCTION_SIZE bytes) and returns its size. The offsets
+// are the byte offsets of the instructions (see layout_instructions()), only the jumps are using those.
+u8 encode_instruction(Instruction *inst, s64 index, u32 *offsets, u8 *out, Bytecode_Stats *stats)
+{
+    u8 size = 0;
+
+    if (IS_JUMP_MNEMONIC(inst->mnemonic)) {
+        // The external targets are patched at the linking (see link_fragments())
+        s32 rel = 0;
+        if (inst->target_index >= 0) {
+            rel = (s32)offsets[inst->target_index] - (s32)(offsets[index] + jump_size(inst));
+        }
+
+        if (inst->mnemonic == M_JMP) {
+            if (inst->is_near) {
+                OUTB(0b11101001);
+                OUTW(rel);
+            } else {
+                OUTB(0b11101011);
+                OUTB(rel);
+                stats->saved_bytes += 1;
+            }
+        } else {
+            ASSERT(rel >= -128 && rel <= 127, "Short jump is out of range -> '"SFMT"' (%d bytes)", SARG(inst->a.label), rel);
+
+            if (inst->mnemonic >= M_LOOPNZ) {
+                OUTB(0b11100000 | (inst->mnemonic - M_LOOPNZ));
+            } else {
+                OUTB(0b01110000 | (inst->mnemonic - M_JO));
+            }
+            OUTB(rel);
+        }
+
+        return size;
     }
 
-    for (int i = 0; i < instructions.count; i++) {
-        Instruction *inst = (Instruction *)instructions.data[i];
+    if (inst->prefixes & INST_PREFIX_SEGMENT) {
+        OUTB(0b00100110 | (segreg(inst->segment_reg) << 3));
+    }
+
+    if (IS_ALU_MNEMONIC(inst->mnemonic)) {
+        u8 ext = alu_op_extension[inst->mnemonic];
+
+        if (inst->b.type == OPERAND_IMMEDIATE) {
+            s32 imm = inst->b.immediate;
+
+            // Like the NASM, we prefer the sign-extended imm8 (0x83) even over the accumulator form
+            // because the size is the same, but this way the output stays byte-identical.
+            if (W(inst) && FITS_SIGNED_8BIT(imm)) {
+                // Immediate (sign-extended byte) to register/memory
+                OUTB(0b10000011);
+                MOD_XXX_RM(inst->mod, ext, reg_rm(inst->a));
+                DISP_MOD(inst->a);
+                OUTB(imm);
+                stats->saved_bytes += 1;
+            }
+            else if (OPERAND_ACC(inst->a)) {
+                // Immediate to accumulator
+                OUTB((ext << 3) | 0b00000100 | W(inst));
+                OUT(imm, inst->size);
+                stats->saved_bytes += 1;
+            }
+            else {
+                // Immediate to register/memory
+                OUTB(0b10000000 | W(inst));
+                MOD_XXX_RM(inst->mod, ext, reg_rm(inst->a));
+                DISP_MOD(inst->a);
+                OUT(imm, inst->size);
+            }
+
+        } else {
+            Operand reg, r_m;
+
+            if (inst->a.type == OPERAND_REGISTER && inst->b.type == OPERAND_REGISTER) {
+                // The NASM encodes the register to register forms with d=0, so the source goes into the reg field
+                reg = inst->b;
+                r_m = inst->a;
+                OUTB((ext << 3) | W(inst));
+            } else {
+                // Register/memory with register to either
+                reg = DECIDE_REG(inst);
+                r_m = DECIDE_RM(inst);
+                OUTB((ext << 3) | (inst->d << 1) | W(inst));
+            }
 
-        if (inst->prefixes & INST_PREFIX_SEGMENT) {
-            OUTB(0b00100110 | (segreg(inst->segment_reg) << 3));
+            MOD_XXX_RM(inst->mod, reg_rm(reg), reg_rm(r_m));
+            DISP_MOD(r_m);
         }
 
-        switch (inst->mnemonic) {
-            case M_MOV: {
-                if (OPERAND_ACC(inst->a) && IS_OPERAND_MEM(inst->b) && inst->b.address.base == EFFECTIVE_ADDR_DIRECT) {
-                    // Memory to accumulator
-                    OUTB(0b10100000 | W(inst));
-                    DISP_MOD(inst->b);
-                }
-                else if (OPERAND_ACC(inst->b) && IS_OPERAND_MEM(inst->a) && inst->a.address.base == EFFECTIVE_ADDR_DIRECT) {
-                    // Accumulator to memory
-                    OUTB(0b10100010 | W(inst));
+        return size;
+    }
+
+    switch (inst->mnemonic) {
+        case M_MOV: {
+            if (OPERAND_ACC(inst->a) && IS_OPERAND_MEM(inst->b) && inst->b.address.base == EFFECTIVE_ADDR_DIRECT) {
+                // Memory to accumulator
+                OUTB(0b10100000 | W(inst));
+                OUTW(inst->b.address.displacement);
+                stats->saved_bytes += 1;
+            }
+            else if (OPERAND_ACC(inst->b) && IS_OPERAND_MEM(inst->a) && inst->a.address.base == EFFECTIVE_ADDR_DIRECT) {
+                // Accumulator to memory
+                OUTB(0b10100010 | W(inst));
+                OUTW(inst->a.address.displacement);
+                stats->saved_bytes += 1;
+            }
+            else if (inst->b.type == OPERAND_IMMEDIATE) {
+                if (inst->a.type == OPERAND_REGISTER) {
+                    // Immediate to register
+                    OUTB(0b10110000 | (W(inst)<<3) | reg_rm(inst->a));
+                    stats->saved_bytes += 1;
+                } else {
+                    // Immediate to register / memory
+                    OUTB(0b11000110 | W(inst));
+                    MOD_XXX_RM(inst->mod, 0b000, reg_rm(inst->a));
                     DISP_MOD(inst->a);
                 }
-                else if (inst->b.type == OPERAND_IMMEDIATE) {
-                    if (inst->a.type == OPERAND_REGISTER) {
-                        // Immediate to register
-                        OUTB(0b10110000 | (W(inst)<<3) | reg_rm(inst->a));
-                    } else {
-                        // When are we using this to encode immediate to register???
 
-                        // Immediate to register / memory
-                        OUTB(0b11000110 | W(inst));
-                        MOD_XXX_RM(inst->mod, 0b000, reg_rm(inst->a));
-                        DISP_MOD(inst->a);
-                    }
+                OUT(inst->b.immediate, inst->size);
 
-                    OUT(inst->b.immediate, inst->size); 
+            } else {
+                Operand reg_or_sr, r_m;
 
+                if (IS_SEGREG(inst->a.reg)) {
+                    // Register/memory to segment register
+                    reg_or_sr  = inst->a;
+                    r_m        = inst->b;
+                    OUTB(0b10001110);
+                } else if (IS_SEGREG(inst->b.reg)) {
+                    // Segment register to register/memory
+                    reg_or_sr = inst->b;
+                    r_m       = inst->a;
+                    OUTB(0b10001100);
+                } else if (inst->a.type == OPERAND_REGISTER && inst->b.type == OPERAND_REGISTER) {
+                    // Register to register, encoded with d=0 like the NASM does
+                    reg_or_sr = inst->b;
+                    r_m       = inst->a;
+                    OUTB(0b10001000 | W(inst));
                 } else {
-                    Operand reg_or_sr, r_m;
-
-                    if (IS_SEGREG(inst->a.reg)) {
-                        // Register/memory to segment register
-                        reg_or_sr  = inst->a;
-                        r_m        = inst->b;
-                        OUTB(0b10001110);                    
-                    } else if (IS_SEGREG(inst->b.reg)) {
-                        // Segment register to register/memory
-                        reg_or_sr = inst->b;
-                        r_m       = inst->a; 
-                        OUTB(0b10001100);
-                    } else {
-                        // Register/memory to/from register
-                        reg_or_sr = DECIDE_REG(inst);
-                        r_m       = DECIDE_RM(inst);
-                        OUTB((0b10001000 | (inst->d << 1) | W(inst)));
-                    }
-
-                    MOD_XXX_RM(inst->mod, reg_rm(reg_or_sr), reg_rm(r_m));
-                    DISP_MOD(r_m);
+                    // Register/memory to/from register
+                    reg_or_sr = DECIDE_REG(inst);
+                    r_m       = DECIDE_RM(inst);
+                    OUTB((0b10001000 | (inst->d << 1) | W(inst)));
                 }
 
-                break;
+                MOD_XXX_RM(inst->mod, reg_rm(reg_or_sr), reg_rm(r_m));
+                DISP_MOD(r_m);
             }
-            case M_ADD: {
-                if (inst->b.type == OPERAND_IMMEDIATE) {
-                    if (OPERAND_ACC(inst->a)) {
-                        OUTB(0b00000100 | W(inst));
-                    } else {
-                        u8 s = 0; // @Incomplete: immediate size by 's' and 'w' field
-                        OUTB(0b10000000 | (s << 1) | W(inst));
-                        MOD_XXX_RM(inst->mod, 0b000, reg_rm(inst->a));
-                        DISP_MOD(inst->a);
-                    }
-
-                    OUT(inst->b.immediate, inst->size); // @Incomplete: s: w=01
 
-                } else {
-                    
-                    // Register/memory with register to either
-                    OUTB(0b00000000 | (inst->d << 1) | W(inst));
+            break;
+        }
+
+        default: {
+            // The ALU group and the jumps are encoded above
+            ASSERT(0, "Unsupported mnemonic -> %d at the line %u", inst->mnemonic, inst->line);
+        }
+    }
 
-                    Operand reg = DECIDE_REG(inst);
-                    Operand r_m = DECIDE_RM(inst);
+    return size;
+}
 
-                    MOD_XXX_RM(inst->mod, reg_rm(reg), reg_rm(r_m));
-                    DISP_MOD(r_m);
+// Calculates the byte offset of every instruction (plus the end offset at offsets[count]). The jmp starts
+// as short and it grows to near if the target is out of the short range, this repeats until nothing changes
+// (like the NASM does with the optimization enabled).
+u32 *layout_instructions(Array instructions)
+{
+    u32 *offsets = (u32 *)malloc(sizeof(u32) * (instructions.count + 1));
+    u8 *sizes = (u8 *)malloc(instructions.count + 1);
 
-                }
-                break;
+    u8 scratch[MAX_INSTRUCTION_SIZE];
+    Bytecode_Stats dummy = {0};
+
+    for (int i = 0; i < instructions.count; i++) {
+        Instruction *inst = (Instruction *)instructions.data[i];
+        sizes[i] = IS_JUMP_MNEMONIC(inst->mnemonic) ? jump_size(inst) : encode_instruction(inst, i, offsets, scratch, &dummy);
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        u32 offset = 0;
+        for (int i = 0; i < instructions.count; i++) {
+            offsets[i] = offset;
+            offset += sizes[i];
+        }
+        offsets[instructions.count] = offset;
+
+        for (int i = 0; i < instructions.count; i++) {
+            Instruction *inst = (Instruction *)instructions.data[i];
+            if (inst->mnemonic != M_JMP || inst->is_near || inst->target_index < 0) continue;
+
+            s32 rel = (s32)offsets[inst->target_index] - (s32)(offsets[i] + sizes[i]);
+            if (rel < -128 || rel > 127) {
+                inst->is_near = true;
+                sizes[i] = jump_size(inst);
+                changed = true;
             }
         }
+    }
+
+    free(sizes);
+    return offsets;
+}
+
+// Encodes the parsed instructions into the fragment. The jumps to the labels of the other source files are
+// recorded as fixups and the labels are converted to byte offsets.
+void build_bytecodes(Fragment *fragment, Parser *parser)
+{
+    Array instructions = parser->instructions;
+
+    u32 *offsets = layout_instructions(instructions);
+
+    fragment->byte_count = offsets[instructions.count];
+    fragment->bytes = (u8 *)malloc(fragment->byte_count + MAX_INSTRUCTION_SIZE);
+    fragment->fixups = array_create(8);
+    fragment->symbols = parser->labels;
+    fragment->lines = (Line_Entry *)malloc(sizeof(Line_Entry) * (instructions.count + 1));
+    fragment->line_count = 0;
+
+    for (int i = 0; i < instructions.count; i++) {
+        Instruction *inst = (Instruction *)instructions.data[i];
+        u8 size = encode_instruction(inst, i, offsets, fragment->bytes + offsets[i], &fragment->stats);
+        assert(offsets[i] + size == offsets[i+1]);
+
+        if (IS_JUMP_MNEMONIC(inst->mnemonic) && inst->target_index < 0) {
+            Fixup *fixup = NEW(Fixup);
+            fixup->label        = inst->a.label;
+            fixup->patch_offset = offsets[i] + 1;
+            fixup->end_offset   = offsets[i] + size;
+            fixup->size         = size - 1;
+            fixup->line         = inst->line;
+            array_add(&fragment->fixups, fixup);
+        }
+
+        Line_Entry *last = fragment->line_count ? &fragment->lines[fragment->line_count-1] : NULL;
+        if (last && last->line == inst->line && last->end == offsets[i]) {
+            last->end += size;
+        } else {
+            Line_Entry *entry = &fragment->lines[fragment->line_count++];
+            entry->start = offsets[i];
+            entry->end   = offsets[i] + size;
+            entry->line  = inst->line;
+        }
+    }
 
+    for (int i = 0; i < fragment->symbols.count; i++) {
+        Label *label = (Label *)fragment->symbols.data[i];
+        label->value = offsets[label->value];
     }
 
-    fclose(fp);
-}
\ No newline at end of file
+    free(offsets);
+}
@@ -0,0 +1,164 @@
+#include "assembler.h"
+#include "array.h"
+#include "new_string.h"
+
+// Writes the line table (<output>.lines) and the symbol table (<output>.syms) of the linked image, so the
+// simulator can map the addresses back to the source (see the src/debug_info.h, the layout must match).
+//
+// .lines: header | entries (sorted by the start) | file name offsets | string table
+// .syms:  header | entries (sorted by the address) | string table
+//
+// Every address is an offset from the start of the image.
+
+#define LINE_TABLE_MAGIC   0x4C363853 // "S86L"
+#define SYMBOL_TABLE_MAGIC 0x53363853 // "S86S"
+#define DEBUG_INFO_VERSION 1
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 entry_count;
+    u32 file_count;
+    u32 string_table_size;
+} Line_Table_Header;
+
+typedef struct {
+    u32 start;
+    u32 end;
+    u32 file;
+    u32 line;
+} Line_Table_Entry;
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 entry_count;
+    u32 string_table_size;
+} Symbol_Table_Header;
+
+typedef struct {
+    u32 address;
+    u32 name; // offset in the string table
+} Symbol_Table_Entry;
+
+int compare_symbol_entries(const void *a, const void *b)
+{
+    const Symbol_Table_Entry *x = (const Symbol_Table_Entry *)a;
+    const Symbol_Table_Entry *y = (const Symbol_Table_Entry *)b;
+    if (x->address != y->address) return x->address < y->address ? -1 : 1;
+    return x->name < y->name ? -1 : (x->name > y->name);
+}
+
+FILE *open_debug_info_file(char *output_filename, char *extension)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s%s", output_filename, extension);
+
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        printf("\n[ERROR]: Failed to open %s file. Probably it is not exists.\n", path);
+        assert(0);
+    }
+
+    return fp;
+}
+
+void write_line_table(char *output_filename, Fragment **fragments, u32 *bases, char **filenames, int fragment_count)
+{
+    u32 entry_count = 0;
+    u32 string_table_size = 0;
+    for (int i = 0; i < fragment_count; i++) {
+        entry_count += fragments[i]->line_count;
+        string_table_size += strlen(filenames[i]) + 1;
+    }
+
+    Line_Table_Header header = {0};
+    header.magic             = LINE_TABLE_MAGIC;
+    header.version           = DEBUG_INFO_VERSION;
+    header.entry_count       = entry_count;
+    header.file_count        = fragment_count;
+    header.string_table_size = string_table_size;
+
+    FILE *fp = open_debug_info_file(output_filename, ".lines");
+    fwrite(&header, sizeof(header), 1, fp);
+
+    // The fragments are linked in order, so the entries are already sorted
+    for (int i = 0; i < fragment_count; i++) {
+        for (u32 j = 0; j < fragments[i]->line_count; j++) {
+            Line_Entry *line = &fragments[i]->lines[j];
+
+            Line_Table_Entry entry;
+            entry.start = bases[i] + line->start;
+            entry.end   = bases[i] + line->end;
+            entry.file  = i;
+            entry.line  = line->line;
+            fwrite(&entry, sizeof(entry), 1, fp);
+        }
+    }
+
+    u32 name_offset = 0;
+    for (int i = 0; i < fragment_count; i++) {
+        fwrite(&name_offset, sizeof(u32), 1, fp);
+        name_offset += strlen(filenames[i]) + 1;
+    }
+
+    for (int i = 0; i < fragment_count; i++) {
+        fwrite(filenames[i], 1, strlen(filenames[i]) + 1, fp);
+    }
+
+    fclose(fp);
+}
+
+void write_symbol_table(char *output_filename, Fragment **fragments, u32 *bases, int fragment_count)
+{
+    u32 entry_count = 0;
+    for (int i = 0; i < fragment_count; i++) {
+        entry_count += fragments[i]->symbols.count;
+    }
+
+    Symbol_Table_Entry *entries = (Symbol_Table_Entry *)malloc(sizeof(Symbol_Table_Entry) * (entry_count + 1));
+
+    u32 count = 0;
+    u32 string_table_size = 0;
+    for (int i = 0; i < fragment_count; i++) {
+        for (int j = 0; j < fragments[i]->symbols.count; j++) {
+            Label *label = (Label *)fragments[i]->symbols.data[j];
+            entries[count].address = bases[i] + (u32)label->value;
+            entries[count].name    = string_table_size;
+            string_table_size += label->name.count + 1;
+            count += 1;
+        }
+    }
+
+    Symbol_Table_Header header = {0};
+    header.magic             = SYMBOL_TABLE_MAGIC;
+    header.version           = DEBUG_INFO_VERSION;
+    header.entry_count       = entry_count;
+    header.string_table_size = string_table_size;
+
+    FILE *fp = open_debug_info_file(output_filename, ".syms");
+    fwrite(&header, sizeof(header), 1, fp);
+
+    // The name offsets are already assigned, so the string table is written in the original label order
+    qsort(entries, entry_count, sizeof(Symbol_Table_Entry), compare_symbol_entries);
+    fwrite(entries, sizeof(Symbol_Table_Entry), entry_count, fp);
+
+    char zero = 0;
+    for (int i = 0; i < fragment_count; i++) {
+        for (int j = 0; j < fragments[i]->symbols.count; j++) {
+            Label *label = (Label *)fragments[i]->symbols.data[j];
+            fwrite(label->name.data, 1, label->name.count, fp);
+            fwrite(&zero, 1, 1, fp);
+        }
+    }
+
+    fclose(fp);
+
+    free(entries);
+}
+
+void write_debug_info(char *output_filename, Fragment **fragments, u32 *bases, char **filenames, int fragment_count)
+{
+    write_line_table(output_filename, fragments, bases, filenames, fragment_count);
+    write_symbol_table(output_filename, fragments, bases, fragment_count);
+}
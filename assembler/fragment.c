@@ -0,0 +1,279 @@
+#include "assembler.h"
+#include "array.h"
+#include "new_string.h"
+#include "platform.h"
+
+// Incremental assembling: every source file is assembled into a position independent fragment, which is cached
+// in the cache directory by the hash of the source content. At the next run only the changed files are lexed,
+// parsed and encoded again, the rest is loaded from the cache, then every fragment is linked into the image.
+
+#define FRAGMENT_MAGIC   0x46363841 // "A86F"
+#define FRAGMENT_VERSION 3
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u64 hash;
+
+    u32 byte_count;
+    u32 symbol_count;
+    u32 fixup_count;
+    u32 line_count;
+
+    u32 emitted_bytes;
+    u32 saved_bytes;
+    double assemble_seconds;
+} Fragment_Header;
+
+bool read_file(char *filename, String *out)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) return false;
+
+    fseek(fp, 0, SEEK_END);
+    u32 fsize = ftell(fp);
+    rewind(fp);
+
+    *out = string_make_alloc(fsize);
+    bool ok = fread(out->data, 1, fsize, fp) == fsize;
+    fclose(fp);
+
+    return ok;
+}
+
+void fragment_cache_path(char *dest, size_t dest_size, char *cache_dir, u64 hash)
+{
+    snprintf(dest, dest_size, "%s/%016llx.frag", cache_dir, (unsigned long long)hash);
+}
+
+void write_string(FILE *fp, String s)
+{
+    u32 count = s.count;
+    fwrite(&count, sizeof(count), 1, fp);
+    fwrite(s.data, 1, count, fp);
+}
+
+void fragment_save(Fragment *fragment, char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        printf(COLOR_YELLOW"[WARNING]: Failed to write the cache file %s\n"COLOR_DEFAULT, path);
+        return;
+    }
+
+    Fragment_Header header = {0};
+    header.magic            = FRAGMENT_MAGIC;
+    header.version          = FRAGMENT_VERSION;
+    header.hash             = fragment->hash;
+    header.byte_count       = fragment->byte_count;
+    header.symbol_count     = fragment->symbols.count;
+    header.fixup_count      = fragment->fixups.count;
+    header.line_count       = fragment->line_count;
+    header.emitted_bytes    = fragment->stats.emitted_bytes;
+    header.saved_bytes      = fragment->stats.saved_bytes;
+    header.assemble_seconds = fragment->assemble_seconds;
+
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(fragment->bytes, 1, fragment->byte_count, fp);
+
+    for (int i = 0; i < fragment->symbols.count; i++) {
+        Label *label = (Label *)fragment->symbols.data[i];
+        u32 offset = label->value;
+        fwrite(&offset, sizeof(offset), 1, fp);
+        fwrite(&label->line, sizeof(u32), 1, fp);
+        write_string(fp, label->name);
+    }
+
+    for (int i = 0; i < fragment->fixups.count; i++) {
+        Fixup *fixup = (Fixup *)fragment->fixups.data[i];
+        fwrite(&fixup->patch_offset, sizeof(u32), 1, fp);
+        fwrite(&fixup->end_offset, sizeof(u32), 1, fp);
+        fwrite(&fixup->size, sizeof(u8), 1, fp);
+        fwrite(&fixup->line, sizeof(u32), 1, fp);
+        write_string(fp, fixup->label);
+    }
+
+    fwrite(fragment->lines, sizeof(Line_Entry), fragment->line_count, fp);
+
+    fclose(fp);
+}
+
+#define READ_FIELD(_dest, _bytes) { \
+    if (cursor + (_bytes) > file.count) return false; \
+    memcpy((_dest), file.data + cursor, (_bytes)); \
+    cursor += (_bytes); \
+}
+
+#define READ_STRING(_dest) { \
+    u32 _count; \
+    READ_FIELD(&_count, sizeof(u32)); \
+    if (cursor + _count > file.count) return false; \
+    (_dest).data = file.data + cursor; \
+    (_dest).count = _count; \
+    cursor += _count; \
+}
+
+// The strings of the loaded fragment are pointing into the file content, so that is never freed
+bool fragment_load(Fragment *fragment, char *path, u64 hash)
+{
+    String file;
+    if (!read_file(path, &file)) return false;
+
+    u32 cursor = 0;
+
+    Fragment_Header header;
+    READ_FIELD(&header, sizeof(header));
+
+    if (header.magic != FRAGMENT_MAGIC || header.version != FRAGMENT_VERSION || header.hash != hash) {
+        return false;
+    }
+
+    fragment->hash                = hash;
+    fragment->byte_count          = header.byte_count;
+    fragment->stats.emitted_bytes = header.emitted_bytes;
+    fragment->stats.saved_bytes   = header.saved_bytes;
+    fragment->assemble_seconds    = header.assemble_seconds;
+
+    if (cursor + header.byte_count > file.count) return false;
+    fragment->bytes = (u8 *)file.data + cursor;
+    cursor += header.byte_count;
+
+    fragment->symbols = array_create(header.symbol_count + 1);
+    for (u32 i = 0; i < header.symbol_count; i++) {
+        Label *label = NEW(Label);
+        ZERO_MEMORY(label, sizeof(Label));
+        u32 offset;
+        READ_FIELD(&offset, sizeof(offset));
+        READ_FIELD(&label->line, sizeof(u32));
+        READ_STRING(label->name);
+        label->value = offset;
+        array_add(&fragment->symbols, label);
+    }
+
+    fragment->fixups = array_create(header.fixup_count + 1);
+    for (u32 i = 0; i < header.fixup_count; i++) {
+        Fixup *fixup = NEW(Fixup);
+        READ_FIELD(&fixup->patch_offset, sizeof(u32));
+        READ_FIELD(&fixup->end_offset, sizeof(u32));
+        READ_FIELD(&fixup->size, sizeof(u8));
+        READ_FIELD(&fixup->line, sizeof(u32));
+        READ_STRING(fixup->label);
+        array_add(&fragment->fixups, fixup);
+    }
+
+    fragment->line_count = header.line_count;
+    fragment->lines = (Line_Entry *)malloc(sizeof(Line_Entry) * (header.line_count + 1));
+    READ_FIELD(fragment->lines, sizeof(Line_Entry) * header.line_count);
+
+    fragment->from_cache = true;
+    return true;
+}
+
+// Loads the fragment of the source file from the cache or assembles it (and saves it into the cache)
+// if the content of the file is changed. The cache_dir can be NULL to disable the caching.
+Fragment *assemble_file(char *filename, char *cache_dir, int thread_count)
+{
+    Fragment *fragment = NEW(Fragment);
+    ZERO_MEMORY(fragment, sizeof(Fragment));
+    fragment->filename = filename;
+
+    String input = read_entire_file(filename);
+    fragment->hash = string_hash(input);
+
+    char path[1024];
+    if (cache_dir) {
+        fragment_cache_path(path, sizeof(path), cache_dir, fragment->hash);
+        if (fragment_load(fragment, path, fragment->hash)) {
+            return fragment;
+        }
+    }
+
+    double start = seconds_now();
+
+    Parser parser;
+    parse_source(&parser, input, thread_count, filename);
+    build_bytecodes(fragment, &parser);
+
+    fragment->assemble_seconds = seconds_now() - start;
+
+    if (cache_dir) {
+        fragment_save(fragment, path);
+    }
+
+    return fragment;
+}
+
+// Concatenates the fragments (in the given order) and patches the jumps between them. The bases receives
+// the start offset of every fragment in the image. The fixups are only the labels which are not defined in their
+// own fragment (see resolve_symbols()), so the same local label can be in more files. Only a reference to a label
+// which is defined in more than one other file is an error.
+u8 *link_fragments(Fragment **fragments, int fragment_count, u32 *bases, u32 *image_size)
+{
+    u32 size = 0;
+    s64 symbol_count = 0;
+    for (int i = 0; i < fragment_count; i++) {
+        bases[i] = size;
+        size += fragments[i]->byte_count;
+        symbol_count += fragments[i]->symbols.count;
+    }
+
+    u8 *image = (u8 *)malloc(size + 1);
+
+    // The global symbols with absolute (image) offsets
+    Array symbols = array_create(symbol_count + 1);
+    for (int i = 0; i < fragment_count; i++) {
+        memcpy(image + bases[i], fragments[i]->bytes, fragments[i]->byte_count);
+
+        for (int j = 0; j < fragments[i]->symbols.count; j++) {
+            Label *label = NEW(Label);
+            *label = *(Label *)fragments[i]->symbols.data[j];
+            label->value += bases[i];
+            label->fragment = i;
+            array_add(&symbols, label);
+        }
+    }
+
+    Symbol_Table table = build_symbol_table(symbols);
+
+    u32 error_count = 0;
+    for (int i = 0; i < fragment_count; i++) {
+        for (int j = 0; j < fragments[i]->fixups.count; j++) {
+            Fixup *fixup = (Fixup *)fragments[i]->fixups.data[j];
+
+            Label *label = symbol_table_find(&table, fixup->label);
+            if (!label) {
+                printf(COLOR_RED"%s:%u: [ERROR]: Undefined label -> '"SFMT"'\n"COLOR_DEFAULT,
+                       fragments[i]->filename, fixup->line, SARG(fixup->label));
+                error_count += 1;
+                continue;
+            }
+            if (label->duplicate) {
+                printf(COLOR_RED"%s:%u: [ERROR]: Ambiguous label -> '"SFMT"', it is defined in more files:\n"COLOR_DEFAULT,
+                       fragments[i]->filename, fixup->line, SARG(fixup->label));
+                for (Label *d = label; d; d = d->duplicate) {
+                    printf(COLOR_RED"    %s:%u\n"COLOR_DEFAULT, fragments[d->fragment]->filename, d->line);
+                }
+                error_count += 1;
+                continue;
+            }
+
+            s32 rel = (s32)label->value - (s32)(bases[i] + fixup->end_offset);
+            if (fixup->size == 1) {
+                ASSERT(rel >= -128 && rel <= 127, "Short jump is out of range -> '"SFMT"' (%d bytes)", SARG(fixup->label), rel);
+                image[bases[i] + fixup->patch_offset] = (u8)rel;
+            } else {
+                u16 rel16 = (u16)rel;
+                memcpy(image + bases[i] + fixup->patch_offset, &rel16, sizeof(u16));
+            }
+        }
+    }
+
+    free(table.slots);
+
+    if (error_count) {
+        exit(1);
+    }
+
+    *image_size = size;
+    return image;
+}
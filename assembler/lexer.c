@@ -63,18 +63,21 @@ typedef enum {
 typedef struct {
     String     value;
     Token_Type type;
+    u32        line; // 1-based, relative to the start of the chunk
 } Token;
 
 typedef struct {
-    String str;
+    String str; // The whole input or only one chunk of it (see split_into_chunks())
     int cl;  
     int cr;
     
     Array tokens;
     int ti;
-} Lexer;
 
-Lexer lexer; // @XXX: Multi-thread
+    u32 line;
+
+    Pool pool;
+} Lexer;
 
 const char *token_type_name_as_cstr(Token_Type type) {
     switch (type) {
@@ -119,44 +122,46 @@ const char *token_type_name_as_cstr(Token_Type type) {
 
 #define TOKSTR(_token_type) (token_type_name_as_cstr(_token_type))
 
-void lexer_add_token(String value, Token_Type type)
+void lexer_add_token(Lexer *l, String value, Token_Type type)
 {
-    //printf("[add_token] -> " SFMT " ; %s ; #%d\n", SARG(value), TOKSTR(type), lexer.tokens.count); 
+    //printf("[add_token] -> " SFMT " ; %s ; #%d\n", SARG(value), TOKSTR(type), l->tokens.count); 
     
-    Token *token = (Token *)malloc(sizeof(Token));
+    Token *token = (Token *)pool_alloc(&l->pool, sizeof(Token));
     token->value = value;
     token->type = type;
-    array_add(&lexer.tokens, token);
+    token->line = l->line;
+    array_add(&l->tokens, token);
 }
 
-inline void eat_next_char()
+static inline void eat_next_char(Lexer *l)
 {
-    lexer.cr += 1;  
+    l->cr += 1;  
 }
 
-inline char peak_next_char()
+// The chunks are not null-terminated, so we're returning zero at the end of the chunk
+static inline char peak_next_char(Lexer *l)
 {
     // @Todo: Proper error message at assertion
-    assert(lexer.cr+1 <= lexer.str.count);
-    return lexer.str.data[lexer.cr+1];
+    assert(l->cr+1 <= l->str.count);
+    return l->cr+1 < l->str.count ? l->str.data[l->cr+1] : 0;
 }
 
-inline char current_char()
+static inline char current_char(Lexer *l)
 {
-    return lexer.str.data[lexer.cr];
+    return l->cr < l->str.count ? l->str.data[l->cr] : 0;
 }
 
-inline void keep_up_left_cursor()
+static inline void keep_up_left_cursor(Lexer *l)
 {
-    lexer.cl = lexer.cr;
+    l->cl = l->cr;
 }
 
-#define eat_next_char_and_keep_up_left_cursor() { eat_next_char(); keep_up_left_cursor(); }
+#define eat_next_char_and_keep_up_left_cursor(_l) { eat_next_char(_l); keep_up_left_cursor(_l); }
 
-inline String get_cursor_range(bool closed_interval)
+static inline String get_cursor_range(Lexer *l, bool closed_interval)
 {
-    String s = string_advance(lexer.str, lexer.cl);
-    s.count = lexer.cl == lexer.cr ? 1 : (lexer.cr - lexer.cl) + (closed_interval ? 0 : 1);
+    String s = string_advance(l->str, l->cl);
+    s.count = l->cl == l->cr ? 1 : (l->cr - l->cl) + (closed_interval ? 0 : 1);
     return s;
 }
 
@@ -186,52 +191,52 @@ Token_Type decide_single_char_token_type(char c)
     return T_UNKNOWN;
 }
 
-void parse_identifier(bool expect_label)
+void parse_identifier(Lexer *l, bool expect_label)
 {
     char c;
-    while ((c = current_char())) {
+    while ((c = current_char(l))) {
         // @Temporary: this is temporary, so at some point we have to decide which chars can separate the identifiers
 
-        if (IS_ALNUM(c) && peak_next_char()) {
-            eat_next_char();
+        if (IS_ALNUM(c) && peak_next_char(l)) {
+            eat_next_char(l);
             continue;
         } else {                        
             if (expect_label && !IS_SPACE(c)) {
-                ASSERT(false, "Invalid label -> "SFMT, SARG(get_cursor_range(true)));
+                ASSERT(false, "Invalid label -> "SFMT, SARG(get_cursor_range(l, true)));
             }
 
-            String identifier = get_cursor_range(true);
+            String identifier = get_cursor_range(l, true);
 
             Token_Type type = T_IDENTIFIER;
             if (expect_label && c == ':') {
                 type = T_LABEL;
-                eat_next_char();
+                eat_next_char(l);
             }
 
-            lexer_add_token(identifier, type);
-            keep_up_left_cursor();
+            lexer_add_token(l, identifier, type);
+            keep_up_left_cursor(l);
 
             return;
         }
         
-        ASSERT(false, "Invalid identifier -> "SFMT, SARG(get_cursor_range(true)));
+        ASSERT(false, "Invalid identifier -> "SFMT, SARG(get_cursor_range(l, true)));
     }
     
 }
 
-void parse_string_literal()
+void parse_string_literal(Lexer *l)
 {
-    eat_next_char_and_keep_up_left_cursor(); // step from "
+    eat_next_char_and_keep_up_left_cursor(l); // step from "
     
     bool escaped = false;
     
     char c;
-    while ((c = current_char())) {
+    while ((c = current_char(l))) {
         if (c == '\\') {
-            char next_char = peak_next_char(); 
+            char next_char = peak_next_char(l); 
             ASSERT(next_char, "Unclosed string (escaped)!");
             if (next_char == '\"') {
-                eat_next_char();
+                eat_next_char(l);
                 escaped = !escaped;
             }
             
@@ -240,102 +245,99 @@ void parse_string_literal()
         } else if (c == '\"') {
             ASSERT(!escaped, "Unclosed string (escaped)!");
             
-            String literal = get_cursor_range(true);
-            lexer_add_token(literal, T_STRING_LITERAL);
+            String literal = get_cursor_range(l, true);
+            lexer_add_token(l, literal, T_STRING_LITERAL);
 
-            eat_next_char_and_keep_up_left_cursor(); // step from "
+            eat_next_char_and_keep_up_left_cursor(l); // step from "
             return;
         }
 
-        eat_next_char();
+        eat_next_char(l);
     }
     
     ASSERT(false, "Invalid, unclosed string literal!");
 }
 
-void parse_numeric_literal()
+void parse_numeric_literal(Lexer *l)
 {
     // @Todo: Parse signed numbers
 
-    char c = current_char();
+    char c = current_char(l);
 
-    bool is_hex = c == '0' && peak_next_char() == 'x';
-    bool is_bin = c == '0' && peak_next_char() == 'b';
+    bool is_hex = c == '0' && peak_next_char(l) == 'x';
+    bool is_bin = c == '0' && peak_next_char(l) == 'b';
     
-    while ((c = current_char())) {
+    while ((c = current_char(l))) {
         if (IS_DIGIT(c)) {
-            eat_next_char();
+            eat_next_char(l);
             continue;
         }
         else if (IS_SPACE(c) || decide_single_char_token_type(c) != T_UNKNOWN) {
             // @Temporary: this is temporary, so at some point we have to decide which chars can separate the numeric literals
             
-            String s = get_cursor_range(true);
-            keep_up_left_cursor();
+            String s = get_cursor_range(l, true);
+            keep_up_left_cursor(l);
             
             // @Incomplete: More validation
             if (is_hex) ASSERT(s.count > 2, "Invalid hex decimal value -> "SFMT, SARG(s));
             if (is_bin) ASSERT(s.count > 2, "Invalid bin decimal value -> "SFMT, SARG(s));
             
-            lexer_add_token(s, T_NUMERIC_LITERAL);
+            lexer_add_token(l, s, T_NUMERIC_LITERAL);
             
             return;
         }
 
-        ASSERT(false, "Invalid numeric value -> "SFMT, SARG(get_cursor_range(true)));
+        ASSERT(false, "Invalid numeric value -> "SFMT, SARG(get_cursor_range(l, true)));
     }
 }
 
-void parse_comment()
+void parse_comment(Lexer *l)
 {
-    eat_next_char_and_keep_up_left_cursor(); // step from ;
+    eat_next_char_and_keep_up_left_cursor(l); // step from ;
 
     char c;
-    while (c = current_char()) {
+    while (c = current_char(l)) {
         if (c == '\n' || c == '\r') {
-            String s = get_cursor_range(true); 
+            String s = get_cursor_range(l, true); 
 
-            // Skip all of the line breaks after comment until an instruction not appear           
-            do {
-                eat_next_char();
-            } while (current_char() == '\n' || current_char() == '\r');
-            
-            keep_up_left_cursor();
+            // The line break itself is left for the tokenize(), because that terminates the instruction
+            // before the comment (e.g. mov al, 1 ; comment).
+            keep_up_left_cursor(l);
             
-            // lexer_add_token(string_trim_white(s), COMMENT);
+            // lexer_add_token(l, string_trim_white(s), COMMENT);
             
             return;
         }
-        eat_next_char();
+        eat_next_char(l);
     }
 }
 
-void parse_simple_token()
+void parse_simple_token(Lexer *l)
 {
-    keep_up_left_cursor();
+    keep_up_left_cursor(l);
     
-    char c          = current_char();
+    char c          = current_char(l);
     Token_Type type = decide_single_char_token_type(c);
     ASSERT(type != T_UNKNOWN, "UNKNOWN token -> %c", c);
 
-    // char next_char  = peak_next_char();
+    // char next_char  = peak_next_char(l);
     // if (type == EQUAL && next_char == '=') {
-    //     eat_next_char();
+    //     eat_next_char(l);
     //     type = T_COMPARE_OP;
     // } 
     // else if (type == GREATER_OP && next_char == '=') {
-    //     eat_next_char();
+    //     eat_next_char(l);
     //     type = T_GREATER_THAN_EQUAL_OP;
     // } 
     // else if (type == LESS_OP && next_char == '=') {
-    //     eat_next_char();
+    //     eat_next_char(l);
     //     type = T_LESS_THAN_EQUAL_OP;
     // }
     
-    String t = get_cursor_range(false);
-    lexer_add_token(t, type);
+    String t = get_cursor_range(l, false);
+    lexer_add_token(l, t, type);
     
-    eat_next_char_and_keep_up_left_cursor();
+    eat_next_char_and_keep_up_left_cursor(l);
 }
 
 void print_token(Token *t)
@@ -350,42 +352,73 @@ void dump_tokens_out(Lexer *l)
     }
 }
 
-void tokenize(String input)
+void tokenize(Lexer *l, String input)
 {
-    lexer.str    = input;
-    lexer.tokens = array_create(64);
+    ZERO_MEMORY(l, sizeof(Lexer));
+    l->str    = input;
+    l->tokens = array_create(64);
+    l->line   = 1;
 
     char c;
-    while ((c = current_char())) {
+    while ((c = current_char(l))) {
         if (IS_ALPHA(c) || c == '_') {
             // identifier, label
-            parse_identifier(false);
+            parse_identifier(l, false);
         }
         else if (c == '%') {
             // directive
-            parse_identifier(true);
+            parse_identifier(l, true);
         }
         else if (c == ';') {
-            parse_comment();
+            parse_comment(l);
         }
         else if (IS_DIGIT(c)) {
-            parse_numeric_literal();
+            parse_numeric_literal(l);
         }
         else if (IS_SPACE(c)) {
             if (c == '\n') {
                 // Instructions separated by at least one new line
-                Token *token = (Token *)lexer.tokens.data[lexer.tokens.count-1];
-                if (lexer.tokens.count > 0 && token->type != T_LINE_BREAK) {
-                    keep_up_left_cursor();
-                    lexer_add_token(string_create(""), T_LINE_BREAK);
+                Token *token = (Token *)array_last_item(&l->tokens);
+                if (token && token->type != T_LINE_BREAK) {
+                    keep_up_left_cursor(l);
+                    lexer_add_token(l, string_create(""), T_LINE_BREAK);
                 }
+                l->line += 1;
             }
-            eat_next_char_and_keep_up_left_cursor();
+            eat_next_char_and_keep_up_left_cursor(l);
         }
         else {
-            parse_simple_token();
+            parse_simple_token(l);
         }
     }
     
-    // dump_tokens_out(&lexer);
-}
\ No newline at end of file
+    // dump_tokens_out(l);
+}
+
+// Splits the input at line boundaries into (at most) chunk_count pieces. Every chunk ends with a line break
+// (the read_entire_file() appends one to the end of the input), so the chunks can be tokenized and parsed
+// independently and the concatenated token streams are the same as the sequentially tokenized one.
+int split_into_chunks(String input, String *chunks, int chunk_count)
+{
+    int count = 0;
+    int start = 0;
+    int chunk_size = input.count / chunk_count;
+
+    for (int i = 0; i < chunk_count && start < input.count; i++) {
+        int end = (i == chunk_count-1) ? input.count : start + chunk_size;
+        if (end <= start)      end = start + 1;
+        if (end > input.count) end = input.count;
+
+        while (end < input.count && input.data[end-1] != '\n') {
+            end += 1;
+        }
+
+        chunks[count].data  = input.data + start;
+        chunks[count].count = end - start;
+        count += 1;
+
+        start = end;
+    }
+
+    return count;
+}
@@ -76,7 +76,7 @@ bool string_equal(String a, String b)
 //     assert(0);
 // }
 
-inline bool string_equal_cstr(String a, char *b)
+static inline bool string_equal_cstr(String a, char *b)
 {
     return string_equal(a, string_create(b));
 }
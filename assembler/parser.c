@@ -1,46 +1,63 @@
 #include "assembler.h"
 #include "new_string.h"
+#include "platform.h"
+
+typedef struct Label {
+    String name;
+    // The label points to the instruction which follows it. This is the index of that instruction after the
+    // parsing and the byte offset of it after the build_bytecodes().
+    s64 value;
+    u32 line; // of the definition in the source file, 1-based
+
+    struct Label *duplicate; // the next definition of the same name, see the build_symbol_table()
+    int fragment;            // the index of the source file, only in the global table of the link_fragments()
+} Label;
 
 typedef struct {
     int byte_offset; // we have to track this because of jumps
 
     Array instructions;
+    Array labels;
 
     Array tokens;
     u64 ti; // tokens iterator index
     Token *last_token;
-} Parser;
 
-Parser parser; // @XXX: Multi-Thread
+    u32 line_count; // lines of the parsed chunk, the merge_parsers() uses this to make the line numbers global
+
+    Pool pool;
+} Parser;
 
 #define NEW_INST() \
-    Instruction *inst = NEW(Instruction); \
+    Instruction *inst = (Instruction *)pool_alloc(&parser->pool, sizeof(Instruction)); \
     ZERO_MEMORY(inst, sizeof(Instruction)); \
     inst->a.inst = inst; \
     inst->b.inst = inst; \
-    array_add(&parser.instructions, inst); \
+    inst->target_index = -1; \
+    inst->line = current_token(parser)->line; \
+    array_add(&parser->instructions, inst); \
 
-inline Token *current_token()
+static inline Token *current_token(Parser *parser)
 {
-    if (parser.ti >= parser.tokens.count) return NULL;
-    return (Token *)parser.tokens.data[parser.ti];
+    if (parser->ti >= parser->tokens.count) return NULL;
+    return (Token *)parser->tokens.data[parser->ti];
 }
 
-inline void eat_token()
+static inline void eat_token(Parser *parser)
 {
-    parser.ti += 1;
+    parser->ti += 1;
 }
 
-inline Token *eat_and_get_next_token()
+static inline Token *eat_and_get_next_token(Parser *parser)
 {
-    eat_token();
-    return current_token();
+    eat_token(parser);
+    return current_token(parser);
 }
 
-inline Token *peak_next_token()
+static inline Token *peak_next_token(Parser *parser)
 {
-    ASSERT(parser.ti+1 < parser.tokens.count, "Next token is not exists!");
-    return (Token *)parser.tokens.data[parser.ti+1];
+    ASSERT(parser->ti+1 < parser->tokens.count, "Next token is not exists!");
+    return (Token *)parser->tokens.data[parser->ti+1];
 }
 
 Register decide_register(String s)
@@ -83,16 +100,16 @@ int operator_scores[] = {
     [T_DIVIDE_OP] = 2,
 };
 
-int eval_numeric_expr()
+int eval_numeric_expr(Parser *parser)
 {
     // @Incomplete
 
     // #define VALID_NUM_T(_t) (_t == T_NUMERIC_LITERAL || _t == T_PLUS_OP || _t == T_MINUS_OP || _t == T_MULTIPLY_OP || _t == T_DIVIDE_OP || _t == T_LEFT_ROUND_BRACKET || _t == T_RIGHT_ROUND_BRACKET)
 
-    Token *t = current_token();
+    Token *t = current_token(parser);
     bool is_signed = t->type == T_MINUS_OP;
     if (t->type == T_PLUS_OP || t->type == T_MINUS_OP) {
-        t = eat_and_get_next_token();
+        t = eat_and_get_next_token(parser);
     }
 
     ASSERT(t && t->type == T_NUMERIC_LITERAL, "Invalid token!");
@@ -102,28 +119,28 @@ int eval_numeric_expr()
     ASSERT(!failed, "Failed atoi() -> '"SFMT"'", SARG(t->value));
 
     if (is_signed) {
-        ASSERT(!is_signed, "Signed numbers are not implemented yet!");
+        num = -num;
     }
 
     return num;
 }
 
-void parse_effective_addr_expr(Instruction *inst, Operand *operand)
+void parse_effective_addr_expr(Parser *parser, Instruction *inst, Operand *operand)
 {
-    assert(current_token()->type == T_LEFT_BLOCK_BRACKET);
+    assert(current_token(parser)->type == T_LEFT_BLOCK_BRACKET);
 
     operand->type = OPERAND_MEMORY;
 
-    Token *t = eat_and_get_next_token();
+    Token *t = eat_and_get_next_token(parser);
     if (t->type == T_IDENTIFIER) {
 
         if (string_equal_cstr(t->value, "bx")) {
             operand->address.base = EFFECTIVE_ADDR_BX;
 
-            t = eat_and_get_next_token();
+            t = eat_and_get_next_token(parser);
 
             if (t->type == T_PLUS_OP) {
-                t = eat_and_get_next_token();
+                t = eat_and_get_next_token(parser);
 
                 if (string_equal_cstr(t->value, "si")) {
                     operand->address.base = EFFECTIVE_ADDR_BX_SI;
@@ -132,19 +149,19 @@ void parse_effective_addr_expr(Instruction *inst, Operand *operand)
                     operand->address.base = EFFECTIVE_ADDR_BX_DI;
                 } 
                 else if (t->type == T_NUMERIC_LITERAL) {
-                    operand->address.displacement = eval_numeric_expr();
+                    operand->address.displacement = eval_numeric_expr(parser);
                 }
                 else {
                     ASSERT(0, "Invalid memory address at -> "SFMT " ; %s", SARG(t->value), TOKSTR(t->type));
                 }
 
-                t = eat_and_get_next_token();
+                t = eat_and_get_next_token(parser);
                 if (t->type == T_PLUS_OP) {
-                    t = eat_and_get_next_token();
+                    t = eat_and_get_next_token(parser);
                     ASSERT(t->type == T_NUMERIC_LITERAL, "Expect number as displacement");
 
-                    operand->address.displacement = eval_numeric_expr();
-                    t = eat_and_get_next_token();
+                    operand->address.displacement = eval_numeric_expr(parser);
+                    t = eat_and_get_next_token(parser);
                 }
             }
 
@@ -152,10 +169,10 @@ void parse_effective_addr_expr(Instruction *inst, Operand *operand)
         else if (string_equal_cstr(t->value, "bp")) {
             operand->address.base = EFFECTIVE_ADDR_BP;
 
-            t = eat_and_get_next_token();
+            t = eat_and_get_next_token(parser);
 
             if (t->type == T_PLUS_OP) {
-                t = eat_and_get_next_token();
+                t = eat_and_get_next_token(parser);
 
                 if (string_equal_cstr(t->value, "si")) {
                     operand->address.base = EFFECTIVE_ADDR_BP_SI;
@@ -164,40 +181,40 @@ void parse_effective_addr_expr(Instruction *inst, Operand *operand)
                     operand->address.base = EFFECTIVE_ADDR_BP_DI;
                 }
                 else if (t->type == T_NUMERIC_LITERAL) {
-                    operand->address.displacement = eval_numeric_expr();
+                    operand->address.displacement = eval_numeric_expr(parser);
                 }
                 else {
                     ASSERT(0, "Invalid memory address at -> "SFMT " ; %s", SARG(t->value), TOKSTR(t->type));
                 }
 
-                t = eat_and_get_next_token();
+                t = eat_and_get_next_token(parser);
                 if (t->type == T_PLUS_OP) {
-                    t = eat_and_get_next_token();
+                    t = eat_and_get_next_token(parser);
                     ASSERT(t->type == T_NUMERIC_LITERAL, "Expect number as displacement");
 
-                    operand->address.displacement = eval_numeric_expr();
-                    t = eat_and_get_next_token();
+                    operand->address.displacement = eval_numeric_expr(parser);
+                    t = eat_and_get_next_token(parser);
                 }
             }
         }
         else if (string_equal_cstr(t->value, "si")) {
             operand->address.base = EFFECTIVE_ADDR_SI;
 
-            t = eat_and_get_next_token();
+            t = eat_and_get_next_token(parser);
 
             if (t->type == T_PLUS_OP) {
-                operand->address.displacement = eval_numeric_expr();
-                t = eat_and_get_next_token();
+                operand->address.displacement = eval_numeric_expr(parser);
+                t = eat_and_get_next_token(parser);
             }
         }
         else if (string_equal_cstr(t->value, "di")) {
             operand->address.base = EFFECTIVE_ADDR_DI;
 
-            t = eat_and_get_next_token();
+            t = eat_and_get_next_token(parser);
 
             if (t->type == T_PLUS_OP) {
-                operand->address.displacement = eval_numeric_expr();
-                t = eat_and_get_next_token();
+                operand->address.displacement = eval_numeric_expr(parser);
+                t = eat_and_get_next_token(parser);
             }
         }
         else {
@@ -208,57 +225,52 @@ void parse_effective_addr_expr(Instruction *inst, Operand *operand)
     else if (t->type == T_NUMERIC_LITERAL) {
         // expect direct address
         operand->address.base = EFFECTIVE_ADDR_DIRECT;
-        operand->address.displacement = eval_numeric_expr();
+        operand->address.displacement = eval_numeric_expr(parser);
         inst->mod = MOD_MEM;
 
-        t = eat_and_get_next_token();
+        t = eat_and_get_next_token(parser);
 
     } else {
         ASSERT(0, "Unexpected token -> "SFMT" ; type: %s\n", SARG(t->value), TOKSTR(t->type));
     }
 
-    // @Testit
-    if (operand->address.base != EFFECTIVE_ADDR_DIRECT) {
-        if (operand->address.base == EFFECTIVE_ADDR_BP || operand->address.displacement != 0) {
-            inst->mod = (IS_16BIT(operand->address.displacement) ? MOD_MEM_16BIT_DISP : MOD_MEM_8BIT_DISP);
-        }
-    }
+    inst->mod = choose_memory_mod(&operand->address);
 
-    t = current_token();
-    Token *pt = (Token *)parser.tokens.data[parser.ti-1];
+    t = current_token(parser);
+    Token *pt = (Token *)parser->tokens.data[parser->ti-1];
     ASSERT(t->type == T_RIGHT_BLOCK_BRACKET, "Unexpected token -> "SFMT"\n ; prev: "SFMT " , type: %s", SARG(t->value), SARG(pt->value), TOKSTR(pt->type));
     return;
 }
 
-void parse_basic_reg_mem_imm(Instruction *inst)
+void parse_basic_reg_mem_imm(Parser *parser, Instruction *inst)
 {
-    Token *t = eat_and_get_next_token();
+    Token *t = eat_and_get_next_token(parser);
 
     if (t->type == T_IDENTIFIER) {
         // Specification of operand type
         if (string_equal_cstr(t->value, "byte")) {
             inst->size = W_BYTE;
-            t = eat_and_get_next_token();
+            t = eat_and_get_next_token(parser);
         }
         else if (string_equal_cstr(t->value, "word")) {
             inst->size = W_WORD;
-            t = eat_and_get_next_token();
+            t = eat_and_get_next_token(parser);
         }
     }
 
     if (t->type == T_IDENTIFIER) {
-        if (peak_next_token()->type == T_COLON) {
-            eat_token();
+        if (peak_next_token(parser)->type == T_COLON) {
+            eat_token(parser);
 
             inst->segment_reg = decide_register(t->value);
             inst->prefixes |= INST_PREFIX_SEGMENT;
 
             ASSERT(IS_SEGREG(inst->segment_reg), "Invalid segment override -> '"SFMT"' is invalid segment register!", SARG(t->value));
-            t = eat_and_get_next_token(); // expected token -> '['
+            t = eat_and_get_next_token(parser); // expected token -> '['
 
             ASSERT(t->type == T_LEFT_BLOCK_BRACKET, "An effective address expected after segment register, but '"SFMT"' (%s) was received instead!", SARG(t->value), TOKSTR(t->type));
 
-            parse_effective_addr_expr(inst, &inst->a);
+            parse_effective_addr_expr(parser, inst, &inst->a);
 
         } else {
             inst->a.reg  = decide_register(t->value);
@@ -271,31 +283,31 @@ void parse_basic_reg_mem_imm(Instruction *inst)
     } 
     else if (t->type == T_LEFT_BLOCK_BRACKET) {
         inst->a.type = OPERAND_MEMORY;
-        parse_effective_addr_expr(inst, &inst->a);
+        parse_effective_addr_expr(parser, inst, &inst->a);
     }
     else {
         ASSERT(0, "Unexpected identifier -> "SFMT, SARG(t->value));
     }
 
-    ASSERT(eat_and_get_next_token()->type == T_COMMA, "Expect ',' after first operand");
-    t = eat_and_get_next_token();
+    ASSERT(eat_and_get_next_token(parser)->type == T_COMMA, "Expect ',' after first operand");
+    t = eat_and_get_next_token(parser);
 
     if (t->type == T_IDENTIFIER) {
-        if (peak_next_token()->type == T_COLON) {
+        if (peak_next_token(parser)->type == T_COLON) {
             ASSERT(inst->a.type == OPERAND_REGISTER, "Invalid combination of opcode and operands");
             
-            eat_token();
+            eat_token(parser);
 
             inst->segment_reg = decide_register(t->value);
             inst->prefixes |= INST_PREFIX_SEGMENT;
 
             ASSERT(IS_SEGREG(inst->segment_reg), "Invalid segment override -> "SFMT" is invalid segment register!", SARG(t->value));
-            t = eat_and_get_next_token(); // expected token -> '['
+            t = eat_and_get_next_token(parser); // expected token -> '['
 
             ASSERT(t->type == T_LEFT_BLOCK_BRACKET, "An effective address expected after segment register, but %s was received instead!", TOKSTR(t->type));
 
             inst->d = REG_FIELD_IS_DEST;
-            parse_effective_addr_expr(inst, &inst->b);
+            parse_effective_addr_expr(parser, inst, &inst->b);
         }
         else {
             inst->b.reg  = decide_register(t->value);
@@ -318,13 +330,13 @@ void parse_basic_reg_mem_imm(Instruction *inst)
         ASSERT(inst->a.type == OPERAND_REGISTER, "Invalid combination of opcode and operands");
 
         inst->d = REG_FIELD_IS_DEST;
-        parse_effective_addr_expr(inst, &inst->b);
+        parse_effective_addr_expr(parser, inst, &inst->b);
     }
     else if (t->type == T_NUMERIC_LITERAL || t->type == T_PLUS_OP || t->type == T_MINUS_OP) {
 
         inst->b.type      = OPERAND_IMMEDIATE;
-        inst->b.immediate = eval_numeric_expr();
-        ASSERT(!(inst->b.immediate & 0xFFFF0000), "The value can't be larger, than 65535");
+        inst->b.immediate = eval_numeric_expr(parser);
+        ASSERT(inst->b.immediate >= -32768 && inst->b.immediate <= 65535, "The value can't be larger, than 65535 or smaller than -32768");
 
         inst->d = REG_FIELD_IS_DEST;
 
@@ -343,13 +355,13 @@ void parse_basic_reg_mem_imm(Instruction *inst)
     ASSERT(inst->size != W_UNDEFINED, "Operation size is not specified!");
 }
 
-void parse_mov()
+void parse_mov(Parser *parser)
 {
     NEW_INST();
     inst->mnemonic = M_MOV;
     inst->type     = INST_MOVE;
 
-    parse_basic_reg_mem_imm(inst);
+    parse_basic_reg_mem_imm(parser, inst);
 
     ASSERT(
         !(inst->mod == MOD_REG && IS_SEGREG(inst->a.reg) && IS_SEGREG(inst->b.reg)),
@@ -357,47 +369,121 @@ void parse_mov()
     );
 }
 
-void parse_add()
+void parse_alu(Parser *parser, Mnemonic mnemonic)
 {
     NEW_INST();
-    inst->mnemonic = M_ADD;
-    inst->type     = INST_ARITHMETIC;
+    inst->mnemonic = mnemonic;
+    inst->type     = (mnemonic == M_OR || mnemonic == M_AND || mnemonic == M_XOR) ? INST_LOGICAL : INST_ARITHMETIC;
 
-    parse_basic_reg_mem_imm(inst);
+    parse_basic_reg_mem_imm(parser, inst);
 }
 
-void parse_sub()
+static struct { char *name; Mnemonic mnemonic; } jump_mnemonics[] = {
+    {"jo",  M_JO},  {"jno",  M_JNO}, {"jb",   M_JB},  {"jc",   M_JB},  {"jnae", M_JB},
+    {"jnb", M_JNB}, {"jae",  M_JNB}, {"jnc",  M_JNB}, {"jz",   M_JZ},  {"je",   M_JZ},
+    {"jnz", M_JNZ}, {"jne",  M_JNZ}, {"jbe",  M_JBE}, {"jna",  M_JBE}, {"ja",   M_JA},
+    {"jnbe",M_JA},  {"js",   M_JS},  {"jns",  M_JNS}, {"jp",   M_JP},  {"jpe",  M_JP},
+    {"jnp", M_JNP}, {"jpo",  M_JNP}, {"jl",   M_JL},  {"jnge", M_JL},  {"jnl",  M_JNL},
+    {"jge", M_JNL}, {"jle",  M_JLE}, {"jng",  M_JLE}, {"jg",   M_JG},  {"jnle", M_JG},
+    {"loopnz", M_LOOPNZ}, {"loopne", M_LOOPNZ}, {"loopz", M_LOOPZ}, {"loope", M_LOOPZ},
+    {"loop", M_LOOP}, {"jcxz", M_JCXZ}, {"jmp", M_JMP},
+};
+
+void parse_jump(Parser *parser, Mnemonic mnemonic)
 {
     NEW_INST();
-    inst->mnemonic = M_SUB;
-    inst->type     = INST_ARITHMETIC;
+    inst->mnemonic = mnemonic;
+    inst->type     = INST_FLOW;
 
-    parse_basic_reg_mem_imm(inst);
+    Token *t = eat_and_get_next_token(parser);
+    ASSERT(t && t->type == T_IDENTIFIER, "Expect label after the jump");
+
+    if (string_equal_cstr(t->value, "short")) {
+        t = eat_and_get_next_token(parser);
+    }
+    else if (string_equal_cstr(t->value, "near")) {
+        ASSERT(mnemonic == M_JMP, "Only the jmp has near (rel16) form on the 8086");
+        inst->is_near = true;
+        t = eat_and_get_next_token(parser);
+    }
+
+    ASSERT(t && t->type == T_IDENTIFIER, "Expect label after the jump");
+
+    inst->a.type  = OPERAND_RELATIVE_IMMEDIATE;
+    inst->a.label = t->value;
 }
 
-void parse_tokens()
+void parse_tokens(Parser *parser, Array tokens)
 {
-    parser.instructions = array_create(32);
+    ZERO_MEMORY(parser, sizeof(Parser));
+    parser->instructions = array_create(32);
+    parser->labels = array_create(8);
 
-    parser.tokens = lexer.tokens;
-    parser.last_token = (Token *)array_last_item(&lexer.tokens);
+    parser->tokens = tokens;
+    parser->last_token = (Token *)array_last_item(&tokens);
 
     Token *t = NULL;
 
-    while (t = current_token()) {
+    while (t = current_token(parser)) {
+
+        if (t->type == T_IDENTIFIER && parser->ti+1 < parser->tokens.count && peak_next_token(parser)->type == T_COLON) {
+            Label *label = (Label *)pool_alloc(&parser->pool, sizeof(Label));
+            ZERO_MEMORY(label, sizeof(Label));
+            label->name = t->value;
+            label->value = parser->instructions.count;
+            label->line = t->line;
+            array_add(&parser->labels, label);
+
+            eat_token(parser); // label name
+            t = eat_and_get_next_token(parser); // colon
+            if (!t) break;
+
+            if (t->type == T_LINE_BREAK) {
+                eat_token(parser);
+                continue;
+            }
+            // There is an instruction after the label in the same line
+        }
 
         if (t->type == T_IDENTIFIER) {
-            if (string_equal_cstr(t->value, "mov")) {
-                parse_mov();
+            Mnemonic jump = 0;
+            char first = t->value.data[0];
+            for (int i = 0; (first == 'j' || first == 'l') && i < ARRAY_SIZE(jump_mnemonics); i++) {
+                if (string_equal_cstr(t->value, jump_mnemonics[i].name)) {
+                    jump = jump_mnemonics[i].mnemonic;
+                    break;
+                }
+            }
+
+            if (jump) {
+                parse_jump(parser, jump);
+            } else if (string_equal_cstr(t->value, "mov")) {
+                parse_mov(parser);
             } else if (string_equal_cstr(t->value, "add")) {
-                parse_add();
+                parse_alu(parser, M_ADD);
+            } else if (string_equal_cstr(t->value, "or")) {
+                parse_alu(parser, M_OR);
+            } else if (string_equal_cstr(t->value, "adc")) {
+                parse_alu(parser, M_ADC);
+            } else if (string_equal_cstr(t->value, "sbb")) {
+                parse_alu(parser, M_SBB);
+            } else if (string_equal_cstr(t->value, "and")) {
+                parse_alu(parser, M_AND);
             } else if (string_equal_cstr(t->value, "sub")) {
-                parse_sub();
+                parse_alu(parser, M_SUB);
+            } else if (string_equal_cstr(t->value, "xor")) {
+                parse_alu(parser, M_XOR);
+            } else if (string_equal_cstr(t->value, "cmp")) {
+                parse_alu(parser, M_CMP);
             } 
             else if (string_equal_cstr(t->value, "cpu")) {
-                t = eat_and_get_next_token();
+                t = eat_and_get_next_token(parser);
                 ASSERT(string_equal_cstr(t->value, "8086"), "Non-supported cpu type -> '"SFMT"'", SARG(t->value));
             }
+            else if (string_equal_cstr(t->value, "bits")) {
+                t = eat_and_get_next_token(parser);
+                ASSERT(string_equal_cstr(t->value, "16"), "Non-supported bits -> '"SFMT"'", SARG(t->value));
+            }
             else {
                 ASSERT(0, "Unexpected identifier -> "SFMT, SARG(t->value));
             }
@@ -410,14 +496,204 @@ void parse_tokens()
             ASSERT(0, "Unexpected token -> "SFMT " ; %s", SARG(t->value), TOKSTR(t->type));
         }
 
-        t = eat_and_get_next_token();
+        t = eat_and_get_next_token(parser);
         ASSERT(!t || t->type == T_LINE_BREAK, "Expect line break after instruction");
-        eat_token();
+        eat_token(parser);
     };
 
-    // for (int i = 0; i < parser.instructions.count; i++) {
-    //     Instruction* inst = parser.instructions.data[i];
+    // for (int i = 0; i < parser->instructions.count; i++) {
+    //     Instruction* inst = parser->instructions.data[i];
     // }
 
     // printf("DONE!\n");
-}
\ No newline at end of file
+}
+
+// Merges the chunk parsers (in the order of the chunks) into the dest. The labels are indexing into
+// the instructions of their own chunk, so we have to shift them by the instructions of the previous chunks.
+void merge_parsers(Parser *dest, Parser *chunks, int chunk_count)
+{
+    ZERO_MEMORY(dest, sizeof(Parser));
+
+    s64 instruction_count = 0;
+    s64 label_count = 0;
+    for (int i = 0; i < chunk_count; i++) {
+        instruction_count += chunks[i].instructions.count;
+        label_count += chunks[i].labels.count;
+    }
+
+    dest->instructions = array_create(instruction_count + 1);
+    dest->labels = array_create(label_count + 1);
+
+    u32 line_base = 0;
+    for (int i = 0; i < chunk_count; i++) {
+        s64 base = dest->instructions.count;
+
+        for (int j = 0; j < chunks[i].labels.count; j++) {
+            Label *label = (Label *)chunks[i].labels.data[j];
+            label->value += base;
+            label->line += line_base;
+        }
+
+        for (int j = 0; j < chunks[i].instructions.count; j++) {
+            Instruction *inst = (Instruction *)chunks[i].instructions.data[j];
+            inst->line += line_base;
+        }
+        line_base += chunks[i].line_count;
+
+        array_add_all(&dest->instructions, &chunks[i].instructions);
+        array_add_all(&dest->labels, &chunks[i].labels);
+    }
+}
+
+u64 string_hash(String s)
+{
+    // FNV-1a
+    u64 hash = 14695981039346656037ULL;
+    for (int i = 0; i < s.count; i++) {
+        hash ^= (u8)s.data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Open addressing hash table from the label names to the labels
+typedef struct {
+    Label **slots;
+    u64 slot_count; // power of two
+
+    u32 duplicate_count; // the definitions which are chained by the Label.duplicate
+} Symbol_Table;
+
+Label *symbol_table_find(Symbol_Table *table, String name)
+{
+    u64 mask = table->slot_count - 1;
+    for (u64 i = string_hash(name) & mask; table->slots[i]; i = (i + 1) & mask) {
+        if (string_equal(table->slots[i]->name, name)) return table->slots[i];
+    }
+    return NULL;
+}
+
+// The first definition of a name is in the table, the later ones are chained to it by the Label.duplicate, so the
+// caller decides whether those are errors (the same source file) or not (the labels of the other source files,
+// which are only errors if they are referenced, see the link_fragments()).
+Symbol_Table build_symbol_table(Array labels)
+{
+    Symbol_Table table = {0};
+    table.slot_count = 16;
+    while (table.slot_count < (u64)labels.count * 2) table.slot_count *= 2;
+    table.slots = (Label **)calloc(table.slot_count, sizeof(Label *));
+
+    u64 mask = table.slot_count - 1;
+    for (int i = 0; i < labels.count; i++) {
+        Label *label = (Label *)labels.data[i];
+
+        label->duplicate = NULL;
+
+        u64 slot = string_hash(label->name) & mask;
+        while (table.slots[slot] && !string_equal(table.slots[slot]->name, label->name)) {
+            slot = (slot + 1) & mask;
+        }
+
+        if (table.slots[slot]) {
+            Label *last = table.slots[slot];
+            while (last->duplicate) last = last->duplicate;
+            last->duplicate = label;
+            table.duplicate_count += 1;
+        } else {
+            table.slots[slot] = label;
+        }
+    }
+
+    return table;
+}
+
+// Resolves the label operands of the jumps to instruction indices in the merged instruction array. The labels
+// which are not defined in this source left unresolved (target_index = -1), those are patched at the linking
+// (see link_fragments()). A label which is defined more than once in the source is an error.
+void resolve_symbols(Parser *parser, char *filename)
+{
+    Symbol_Table table = build_symbol_table(parser->labels);
+
+    if (table.duplicate_count) {
+        for (u64 i = 0; i < table.slot_count; i++) {
+            Label *first = table.slots[i];
+            if (!first) continue;
+
+            for (Label *label = first->duplicate; label; label = label->duplicate) {
+                printf(COLOR_RED"%s:%u: [ERROR]: Label redefined -> '"SFMT"' (first defined at the line %u)\n"COLOR_DEFAULT,
+                       filename, label->line, SARG(label->name), first->line);
+            }
+        }
+        exit(1);
+    }
+
+    for (int i = 0; i < parser->instructions.count; i++) {
+        Instruction *inst = (Instruction *)parser->instructions.data[i];
+        if (inst->a.type != OPERAND_RELATIVE_IMMEDIATE) continue;
+
+        Label *label = symbol_table_find(&table, inst->a.label);
+        if (label) {
+            inst->target_index = label->value;
+        } else if (inst->mnemonic == M_JMP) {
+            // We don't know the distance until the linking, so the external jmp is always near
+            inst->is_near = true;
+        }
+    }
+
+    free(table.slots);
+}
+
+// Every worker takes the next chunk until there is no more, the chunks are tokenized and parsed independently
+typedef struct {
+    String *chunks;
+    Lexer *lexers;
+    Parser *parsers;
+    int chunk_count;
+
+    volatile long next_chunk;
+} Assemble_Job;
+
+THREAD_PROC(assemble_worker)
+{
+    Assemble_Job *job = (Assemble_Job *)data;
+
+    long i;
+    while ((i = atomic_increment(&job->next_chunk)) < job->chunk_count) {
+        tokenize(&job->lexers[i], job->chunks[i]);
+        parse_tokens(&job->parsers[i], job->lexers[i].tokens);
+        job->parsers[i].line_count = job->lexers[i].line - 1;
+    }
+
+    return 0;
+}
+
+// Splits the input at line boundaries, tokenizes and parses the chunks on thread_count threads and merges the
+// result into the dest. With one thread this is the same as the sequential tokenize() + parse_tokens(). The
+// filename is only for the diagnostics.
+void parse_source(Parser *dest, String input, int thread_count, char *filename)
+{
+    // A few chunks per thread, so a slow chunk doesn't keep the other threads waiting
+    int chunk_count = thread_count == 1 ? 1 : thread_count * 4;
+
+    Assemble_Job job = {0};
+    job.chunks  = (String *)calloc(chunk_count, sizeof(String));
+    job.lexers  = (Lexer *)calloc(chunk_count, sizeof(Lexer));
+    job.parsers = (Parser *)calloc(chunk_count, sizeof(Parser));
+    job.chunk_count = split_into_chunks(input, job.chunks, chunk_count);
+
+    if (thread_count == 1) {
+        assemble_worker(&job);
+    } else {
+        Thread *threads = (Thread *)calloc(thread_count, sizeof(Thread));
+        for (int i = 0; i < thread_count; i++) threads[i] = thread_start(assemble_worker, &job);
+        for (int i = 0; i < thread_count; i++) thread_join(threads[i]);
+        free(threads);
+    }
+
+    merge_parsers(dest, job.parsers, job.chunk_count);
+    resolve_symbols(dest, filename);
+
+    free(job.chunks);
+    free(job.lexers);
+    free(job.parsers);
+}
@@ -0,0 +1,103 @@
+#ifndef H_PLATFORM
+#define H_PLATFORM
+
+// Minimal platform layer (threads, timer, file system), so the same code builds with the cl (build.bat)
+// and with the gcc/clang.
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <direct.h>
+
+typedef HANDLE Thread;
+typedef DWORD (WINAPI *Thread_Proc)(void *);
+#define THREAD_PROC(_name) DWORD WINAPI _name(void *data)
+
+static inline Thread thread_start(Thread_Proc proc, void *data)
+{
+    return CreateThread(NULL, 0, proc, data, 0, NULL);
+}
+
+static inline void thread_join(Thread t)
+{
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+
+static inline long atomic_increment(volatile long *value)
+{
+    // Returns the value before the increment
+    return InterlockedIncrement(value) - 1;
+}
+
+static inline int cpu_core_count()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+}
+
+static inline double seconds_now()
+{
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+}
+
+static inline void make_directory(char *path)
+{
+    _mkdir(path); // it's fine if it's already exists
+}
+
+#else
+
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+typedef pthread_t Thread;
+typedef void *(*Thread_Proc)(void *);
+#define THREAD_PROC(_name) void *_name(void *data)
+
+static inline Thread thread_start(Thread_Proc proc, void *data)
+{
+    Thread t;
+    int err = pthread_create(&t, NULL, proc, data);
+    assert(err == 0);
+    return t;
+}
+
+static inline void thread_join(Thread t)
+{
+    pthread_join(t, NULL);
+}
+
+static inline long atomic_increment(volatile long *value)
+{
+    // Returns the value before the increment
+    return __atomic_fetch_add(value, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline int cpu_core_count()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static inline double seconds_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static inline void make_directory(char *path)
+{
+    mkdir(path, 0755); // it's fine if it's already exists
+}
+
+#endif
+
+#endif
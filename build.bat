@@ -5,5 +5,11 @@ pushd .\build
 
 cl -Zi ..\src\main.c
 cl -Zi ..\assembler\assembler.c
+cl -Zi -c ..\src\libsim86.c
+lib libsim86.obj
+cl -O2 ..\src\decoder_bench.c
+cl -O2 ..\src\trace_tool.c
+cl -O2 ..\src\breakpoint_bench.c
+cl -O2 ..\src\hle_bench.c
 
 popd .\build
\ No newline at end of file
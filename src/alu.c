@@ -0,0 +1,175 @@
+#include "alu.h"
+
+// F_PARITY if the low byte has an even number of set bits (only the low byte counts, for the words too)
+static inline u16 alu_parity(u32 value)
+{
+    value &= 0xFF;
+    value ^= value >> 4;
+    value ^= value >> 2;
+    value ^= value >> 1;
+    return (value & 1) ? 0 : F_PARITY;
+}
+
+#define ALU_BITS 8
+#include "alu_ops.h"
+#undef ALU_BITS
+
+#define ALU_BITS 16
+#include "alu_ops.h"
+#undef ALU_BITS
+
+// The operations which are the same at every model
+#define ALU_COMMON_BINARY_FUNCTIONS                      \
+    [Mnemonic_add]  = {alu_add_8,  alu_add_16},          \
+    [Mnemonic_adc]  = {alu_adc_8,  alu_adc_16},          \
+    [Mnemonic_sub]  = {alu_sub_8,  alu_sub_16},          \
+    [Mnemonic_sbb]  = {alu_sbb_8,  alu_sbb_16},          \
+    [Mnemonic_cmp]  = {alu_cmp_8,  alu_cmp_16},          \
+    [Mnemonic_inc]  = {alu_inc_8,  alu_inc_16},          \
+    [Mnemonic_dec]  = {alu_dec_8,  alu_dec_16},          \
+    [Mnemonic_neg]  = {alu_neg_8,  alu_neg_16},          \
+    [Mnemonic_and]  = {alu_and_8,  alu_and_16},          \
+    [Mnemonic_or]   = {alu_or_8,   alu_or_16},           \
+    [Mnemonic_xor]  = {alu_xor_8,  alu_xor_16},          \
+    [Mnemonic_test] = {alu_test_8, alu_test_16},         \
+    [Mnemonic_not]  = {alu_not_8,  alu_not_16}
+
+Alu_Binary_Function *alu_binary_functions[Mnemonic_count][2] = {
+    ALU_COMMON_BINARY_FUNCTIONS,
+    [Mnemonic_shl]  = {alu_shl_8,  alu_shl_16},
+    [Mnemonic_shr]  = {alu_shr_8,  alu_shr_16},
+    [Mnemonic_sar]  = {alu_sar_8,  alu_sar_16},
+    [Mnemonic_rol]  = {alu_rol_8,  alu_rol_16},
+    [Mnemonic_ror]  = {alu_ror_8,  alu_ror_16},
+    [Mnemonic_rcl]  = {alu_rcl_8,  alu_rcl_16},
+    [Mnemonic_rcr]  = {alu_rcr_8,  alu_rcr_16},
+};
+
+Alu_Multiply_Function *alu_multiply_functions[Mnemonic_count][2] = {
+    [Mnemonic_mul]  = {alu_mul_8,  alu_mul_16},
+    [Mnemonic_imul] = {alu_imul_8, alu_imul_16},
+    [Mnemonic_div]  = {alu_div_8,  alu_div_16},
+    [Mnemonic_idiv] = {alu_idiv_8, alu_idiv_16},
+};
+
+Alu_Binary_Function *alu_binary_functions_80186[Mnemonic_count][2] = {
+    ALU_COMMON_BINARY_FUNCTIONS,
+    [Mnemonic_shl]  = {alu_shl_80186_8,  alu_shl_80186_16},
+    [Mnemonic_shr]  = {alu_shr_80186_8,  alu_shr_80186_16},
+    [Mnemonic_sar]  = {alu_sar_80186_8,  alu_sar_80186_16},
+    [Mnemonic_rol]  = {alu_rol_80186_8,  alu_rol_80186_16},
+    [Mnemonic_ror]  = {alu_ror_80186_8,  alu_ror_80186_16},
+    [Mnemonic_rcl]  = {alu_rcl_80186_8,  alu_rcl_80186_16},
+    [Mnemonic_rcr]  = {alu_rcr_80186_8,  alu_rcr_80186_16},
+};
+
+Alu_Multiply_Function *alu_multiply_functions_80186[Mnemonic_count][2] = {
+    [Mnemonic_mul]  = {alu_mul_8,  alu_mul_16},
+    [Mnemonic_imul] = {alu_imul_8, alu_imul_16},
+    [Mnemonic_div]  = {alu_div_8,  alu_div_16},
+    [Mnemonic_idiv] = {alu_idiv_80186_8, alu_idiv_80186_16},
+};
+
+#undef ALU_COMMON_BINARY_FUNCTIONS
+
+///////////////////////////////////////////////////
+// :Decimal
+//
+// The OF is undefined after every adjust (the SF, the ZF and the PF after the aaa and the aas), those are kept.
+
+u16 alu_daa(u16 ax, u16 *flags)
+{
+    u32 al = ax & 0xFF;
+    u32 old_al = al;
+    u16 old_carry = *flags & F_CARRY;
+    u16 f = *flags & ~(F_CARRY|F_AUXILIARY);
+
+    if ((al & 0x0F) > 9 || (*flags & F_AUXILIARY)) {
+        al += 0x06;
+        f |= F_AUXILIARY;
+        f |= (old_carry || al > 0xFF) ? F_CARRY : 0;
+    }
+    if (old_al > 0x99 || old_carry) {
+        al += 0x60;
+        f |= F_CARRY;
+    } else {
+        f &= ~F_CARRY;
+    }
+
+    *flags = alu_result_flags_8(f, al);
+    return (ax & 0xFF00) | (al & 0xFF);
+}
+
+u16 alu_das(u16 ax, u16 *flags)
+{
+    u32 al = ax & 0xFF;
+    u32 old_al = al;
+    u16 old_carry = *flags & F_CARRY;
+    u16 f = *flags & ~(F_CARRY|F_AUXILIARY);
+
+    if ((al & 0x0F) > 9 || (*flags & F_AUXILIARY)) {
+        f |= F_AUXILIARY;
+        f |= (old_carry || al < 0x06) ? F_CARRY : 0;
+        al -= 0x06;
+    }
+    if (old_al > 0x99 || old_carry) {
+        al -= 0x60;
+        f |= F_CARRY;
+    }
+
+    *flags = alu_result_flags_8(f, al);
+    return (ax & 0xFF00) | (al & 0xFF);
+}
+
+u16 alu_aaa(u16 ax, u16 *flags)
+{
+    u32 al = ax & 0xFF;
+    u32 ah = ax >> 8;
+
+    if ((al & 0x0F) > 9 || (*flags & F_AUXILIARY)) {
+        al += 6;
+        ah += 1;
+        *flags |= F_AUXILIARY|F_CARRY;
+    } else {
+        *flags &= ~(F_AUXILIARY|F_CARRY);
+    }
+
+    return ((ah & 0xFF) << 8) | (al & 0x0F);
+}
+
+u16 alu_aas(u16 ax, u16 *flags)
+{
+    u32 al = ax & 0xFF;
+    u32 ah = ax >> 8;
+
+    if ((al & 0x0F) > 9 || (*flags & F_AUXILIARY)) {
+        al -= 6;
+        ah -= 1;
+        *flags |= F_AUXILIARY|F_CARRY;
+    } else {
+        *flags &= ~(F_AUXILIARY|F_CARRY);
+    }
+
+    return ((ah & 0xFF) << 8) | (al & 0x0F);
+}
+
+u8 alu_aam(u16 *ax, u8 base, u16 *flags)
+{
+    if (base == 0) return 0;
+
+    u32 al = *ax & 0xFF;
+    u32 ah = al / base;
+    al = al % base;
+
+    *ax = (ah << 8) | al;
+    *flags = alu_result_flags_8(*flags, al);
+    return 1;
+}
+
+u16 alu_aad(u16 ax, u8 base, u16 *flags)
+{
+    u32 al = ((ax >> 8) * base + (ax & 0xFF)) & 0xFF;
+
+    *flags = alu_result_flags_8(*flags, al);
+    return al;
+}
@@ -0,0 +1,48 @@
+#ifndef _H_ALU
+#define _H_ALU
+
+#include "sim86.h"
+#include "i8086table.h"
+
+// The integer operations of the 8086, apart from the cpu: the operands are values and the flags register is a
+// pointer, so the same code is run by the execute_instruction() and checked against the host cpu by the alu_diff.c.
+//
+// Every operation has a byte and a word version, both are generated from the one source of the alu_ops.h (it's
+// included twice by the alu.c). The execute_instruction() picks the version once, by the width as the index of the
+// tables, so no operation checks the width at run time:
+//
+//     cpu->model->alu_binary_functions[i->mnemonic][is_wide](left, right, &cpu->flags)
+//
+// The tables are picked by the cpu model (see the cpu_model.h). The shift and rotate counts of the 8086 are not
+// masked, a count above the width shifts out every bit, the 80186 masks them to 5 bits first. The idiv of the 8086
+// can't return the lowest negative quotient (-128, -32768), the 80186 can. The flags which are undefined by the Intel manual are kept as they are, except the AF of the logical
+// operations which is cleared, and the OF of the shifts and rotates by more than 1, which is set by the same rule as
+// by 1 (see the alu_ops.h).
+
+#define ALU_FLAGS (F_CARRY|F_PARITY|F_AUXILIARY|F_ZERO|F_SIGNED|F_OVERFLOW)
+
+// Returns the result. The unary operations (inc, dec, neg, not) ignore the right, the shifts and the rotates use it
+// as the count. The cmp and the test return the left, they only set the flags.
+typedef u16 Alu_Binary_Function(u16 left, u16 right, u16 *flags);
+
+// mul, imul, div, idiv. The byte versions use only the ax (the al is multiplied, the ax is divided), the word
+// versions the dx:ax. Returns 0 at the divide error, then the ax and the dx are not changed.
+typedef u8 Alu_Multiply_Function(u16 *ax, u16 *dx, u16 source, u16 *flags);
+
+// [mnemonic][is_wide], NULL if the mnemonic is not such an operation
+extern Alu_Binary_Function *alu_binary_functions[Mnemonic_count][2];
+extern Alu_Multiply_Function *alu_multiply_functions[Mnemonic_count][2];
+extern Alu_Binary_Function *alu_binary_functions_80186[Mnemonic_count][2];
+extern Alu_Multiply_Function *alu_multiply_functions_80186[Mnemonic_count][2];
+
+// The decimal adjusts are on the al (the aaa and the aas change the ah too), the new ax is returned. These are the
+// 8086 versions: the aaa and the aas add or subtract 1 to the ah, without the carry of the al.
+u16 alu_daa(u16 ax, u16 *flags);
+u16 alu_das(u16 ax, u16 *flags);
+u16 alu_aaa(u16 ax, u16 *flags);
+u16 alu_aas(u16 ax, u16 *flags);
+// Returns 0 at the divide error (the base is 0)
+u8 alu_aam(u16 *ax, u8 base, u16 *flags);
+u16 alu_aad(u16 ax, u8 base, u16 *flags);
+
+#endif
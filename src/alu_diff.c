@@ -0,0 +1,450 @@
+// Differential check of the alu.c against the host x86 cpu: the same operands and input flags are run by the
+// byte and the word operations of the alu.h and by the same instruction of the host (inline asm), then the results
+// and the defined flags are compared. The byte operations get every operand (and both carries), the words get the
+// edge values and a random sample, the shifts and the rotates every count below 32.
+//
+//     alu_diff [--samples N] [--seed N] [--cpu 8086|80186]
+//
+// The exit code is 1 if there is a mismatch, the first mismatches of every operation are printed.
+//
+// The flags which are undefined by the Intel manual are not compared (e.g. the AF of the logical operations, the
+// OF of the shifts by more than 1, the CF of the shl and the shr by the width or more). The host masks the shift
+// counts to 5 bits, the 8086 doesn't, so the counts above 31 are not checked. The host idiv can return the -128 and
+// the -32768, the 8086 can't, these are checked as divide errors without the host. The tables of the 80186 (--cpu
+// 80186) are the same as the host, there every count below 256 is checked. The decimal adjusts (daa, das,
+// aaa, aas, aam, aad) are invalid in the 64 bit mode, they are not checked.
+//
+// Only with the GCC or the Clang on an x86-64 host.
+
+#if !defined(__x86_64__) || !(defined(__GNUC__) || defined(__clang__))
+#error "The alu_diff needs the GCC or the Clang on an x86-64 host"
+#endif
+
+#include "sim86.h"
+#include "alu.h"
+
+#include "alu.c"
+
+#define MAX_PRINTED_MISMATCH_COUNT 8
+
+// The input flags: the status flags (a few of them set) and the bit 1 which is always set in the host eflags
+static const u16 input_flags[] = {0, F_CARRY, ALU_FLAGS, ALU_FLAGS & ~F_CARRY, F_CARRY|F_ZERO|F_AUXILIARY};
+
+static const u16 word_edge_values[] = {
+    0x0000, 0x0001, 0x0002, 0x000F, 0x0010, 0x007F, 0x0080, 0x00FF, 0x0100, 0x0101, 0x0FFF, 0x1000,
+    0x5555, 0xAAAA, 0x7FFE, 0x7FFF, 0x8000, 0x8001, 0xFF00, 0xFF7F, 0xFF80, 0xFFFE, 0xFFFF,
+};
+
+static u64 random_state = 0x9E3779B97F4A7C15;
+
+// The tables of the --cpu, see the cpu_model.h
+static u8 is_80186 = 0;
+static Alu_Binary_Function *(*binary_functions)[2] = alu_binary_functions;
+static Alu_Multiply_Function *(*multiply_functions)[2] = alu_multiply_functions;
+
+static u64 next_random(void)
+{
+    // xorshift64
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+///////////////////////////////////////////////////
+// Host
+
+// The red zone below the rsp is skipped, the pushf and the popf would overwrite it
+#define HOST_PROLOGUE "lea -128(%%rsp), %%rsp\n\tpush %[f]\n\tpopfq\n\t"
+#define HOST_EPILOGUE "\n\tpushfq\n\tpop %[f]\n\tlea 128(%%rsp), %%rsp"
+
+#define HOST_BINARY(name, instruction, type)                                                              \
+    static u16 host_##name(u16 left, u16 right, u16 *flags)                                               \
+    {                                                                                                     \
+        type a = left, b = right;                                                                         \
+        u64 f = (*flags & ALU_FLAGS) | 2;                                                                 \
+        __asm__ volatile (HOST_PROLOGUE instruction " %[b], %[a]" HOST_EPILOGUE                           \
+                          : [a] "+q" (a), [f] "+r" (f) : [b] "q" (b) : "cc", "memory");                  \
+        *flags = f & ALU_FLAGS;                                                                           \
+        return a;                                                                                         \
+    }
+
+#define HOST_UNARY(name, instruction, type)                                                               \
+    static u16 host_##name(u16 left, u16 right, u16 *flags)                                               \
+    {                                                                                                     \
+        type a = left;                                                                                    \
+        u64 f = (*flags & ALU_FLAGS) | 2;                                                                 \
+        __asm__ volatile (HOST_PROLOGUE instruction " %[a]" HOST_EPILOGUE                                 \
+                          : [a] "+q" (a), [f] "+r" (f) : : "cc", "memory");                               \
+        *flags = f & ALU_FLAGS;                                                                           \
+        return a;                                                                                         \
+    }
+
+#define HOST_SHIFT(name, instruction, type)                                                               \
+    static u16 host_##name(u16 left, u16 right, u16 *flags)                                               \
+    {                                                                                                     \
+        type a = left;                                                                                    \
+        u8 count = right;                                                                                 \
+        u64 f = (*flags & ALU_FLAGS) | 2;                                                                 \
+        __asm__ volatile (HOST_PROLOGUE instruction " %%cl, %[a]" HOST_EPILOGUE                           \
+                          : [a] "+q" (a), [f] "+r" (f) : "c" (count) : "cc", "memory");                   \
+        *flags = f & ALU_FLAGS;                                                                           \
+        return a;                                                                                         \
+    }
+
+// The byte versions are on the ax only, the word versions on the dx:ax
+#define HOST_MULTIPLY_8(name, instruction)                                                                \
+    static void host_##name(u16 *ax, u16 *dx, u16 source, u16 *flags)                                     \
+    {                                                                                                     \
+        u16 a = *ax;                                                                                      \
+        u8 s = source;                                                                                    \
+        u64 f = (*flags & ALU_FLAGS) | 2;                                                                 \
+        __asm__ volatile (HOST_PROLOGUE instruction " %[s]" HOST_EPILOGUE                                 \
+                          : "+a" (a), [f] "+r" (f) : [s] "q" (s) : "cc", "memory");                       \
+        *ax = a;                                                                                          \
+        *flags = f & ALU_FLAGS;                                                                           \
+    }
+
+#define HOST_MULTIPLY_16(name, instruction)                                                               \
+    static void host_##name(u16 *ax, u16 *dx, u16 source, u16 *flags)                                     \
+    {                                                                                                     \
+        u16 a = *ax, d = *dx;                                                                             \
+        u16 s = source;                                                                                   \
+        u64 f = (*flags & ALU_FLAGS) | 2;                                                                 \
+        __asm__ volatile (HOST_PROLOGUE instruction " %[s]" HOST_EPILOGUE                                 \
+                          : "+a" (a), "+d" (d), [f] "+r" (f) : [s] "r" (s) : "cc", "memory");             \
+        *ax = a;                                                                                          \
+        *dx = d;                                                                                          \
+        *flags = f & ALU_FLAGS;                                                                           \
+    }
+
+HOST_BINARY(add_8, "add", u8)   HOST_BINARY(add_16, "add", u16)
+HOST_BINARY(adc_8, "adc", u8)   HOST_BINARY(adc_16, "adc", u16)
+HOST_BINARY(sub_8, "sub", u8)   HOST_BINARY(sub_16, "sub", u16)
+HOST_BINARY(sbb_8, "sbb", u8)   HOST_BINARY(sbb_16, "sbb", u16)
+HOST_BINARY(cmp_8, "cmp", u8)   HOST_BINARY(cmp_16, "cmp", u16)
+HOST_BINARY(and_8, "and", u8)   HOST_BINARY(and_16, "and", u16)
+HOST_BINARY(or_8,  "or",  u8)   HOST_BINARY(or_16,  "or",  u16)
+HOST_BINARY(xor_8, "xor", u8)   HOST_BINARY(xor_16, "xor", u16)
+HOST_BINARY(test_8, "test", u8) HOST_BINARY(test_16, "test", u16)
+
+HOST_UNARY(inc_8, "inc", u8)    HOST_UNARY(inc_16, "inc", u16)
+HOST_UNARY(dec_8, "dec", u8)    HOST_UNARY(dec_16, "dec", u16)
+HOST_UNARY(neg_8, "neg", u8)    HOST_UNARY(neg_16, "neg", u16)
+HOST_UNARY(not_8, "not", u8)    HOST_UNARY(not_16, "not", u16)
+
+HOST_SHIFT(shl_8, "shl", u8)    HOST_SHIFT(shl_16, "shl", u16)
+HOST_SHIFT(shr_8, "shr", u8)    HOST_SHIFT(shr_16, "shr", u16)
+HOST_SHIFT(sar_8, "sar", u8)    HOST_SHIFT(sar_16, "sar", u16)
+HOST_SHIFT(rol_8, "rol", u8)    HOST_SHIFT(rol_16, "rol", u16)
+HOST_SHIFT(ror_8, "ror", u8)    HOST_SHIFT(ror_16, "ror", u16)
+HOST_SHIFT(rcl_8, "rcl", u8)    HOST_SHIFT(rcl_16, "rcl", u16)
+HOST_SHIFT(rcr_8, "rcr", u8)    HOST_SHIFT(rcr_16, "rcr", u16)
+
+HOST_MULTIPLY_8(mul_8, "mulb")   HOST_MULTIPLY_16(mul_16, "mulw")
+HOST_MULTIPLY_8(imul_8, "imulb") HOST_MULTIPLY_16(imul_16, "imulw")
+HOST_MULTIPLY_8(div_8, "divb")   HOST_MULTIPLY_16(div_16, "divw")
+HOST_MULTIPLY_8(idiv_8, "idivb") HOST_MULTIPLY_16(idiv_16, "idivw")
+
+///////////////////////////////////////////////////
+// Operations
+
+typedef enum {
+    Operation_Arithmetic, // every status flag is defined
+    Operation_Logical,    // the AF is undefined
+    Operation_Shift,
+    Operation_Rotate,
+    Operation_Multiply,   // only the CF and the OF are defined
+    Operation_Divide,     // no flag is defined
+} Operation_Kind;
+
+typedef u16 Host_Binary_Function(u16 left, u16 right, u16 *flags);
+typedef void Host_Multiply_Function(u16 *ax, u16 *dx, u16 source, u16 *flags);
+
+typedef struct {
+    const char *name;
+    Mnemonic mnemonic;
+    Operation_Kind kind;
+    u8 is_unary;
+    Host_Binary_Function *host[2];          // the binary, the unary, the shift and the rotate operations
+    Host_Multiply_Function *host_multiply[2];
+} Operation;
+
+#define BINARY(name, kind) {#name, Mnemonic_##name, kind, 0, {host_##name##_8, host_##name##_16}, {NULL, NULL}}
+#define UNARY(name)        {#name, Mnemonic_##name, Operation_Arithmetic, 1, {host_##name##_8, host_##name##_16}, {NULL, NULL}}
+#define MULTIPLY(name, kind) {#name, Mnemonic_##name, kind, 0, {NULL, NULL}, {host_##name##_8, host_##name##_16}}
+
+static const Operation operations[] = {
+    BINARY(add, Operation_Arithmetic),
+    BINARY(adc, Operation_Arithmetic),
+    BINARY(sub, Operation_Arithmetic),
+    BINARY(sbb, Operation_Arithmetic),
+    BINARY(cmp, Operation_Arithmetic),
+    BINARY(and, Operation_Logical),
+    BINARY(or,  Operation_Logical),
+    BINARY(xor, Operation_Logical),
+    BINARY(test, Operation_Logical),
+    UNARY(inc),
+    UNARY(dec),
+    UNARY(neg),
+    UNARY(not),
+    BINARY(shl, Operation_Shift),
+    BINARY(shr, Operation_Shift),
+    BINARY(sar, Operation_Shift),
+    BINARY(rol, Operation_Rotate),
+    BINARY(ror, Operation_Rotate),
+    BINARY(rcl, Operation_Rotate),
+    BINARY(rcr, Operation_Rotate),
+    MULTIPLY(mul,  Operation_Multiply),
+    MULTIPLY(imul, Operation_Multiply),
+    MULTIPLY(div,  Operation_Divide),
+    MULTIPLY(idiv, Operation_Divide),
+};
+
+// The flags which are defined after the operation
+static u16 defined_flags(const Operation *operation, u8 is_wide, u32 count)
+{
+    switch (operation->kind) {
+        case Operation_Arithmetic: return ALU_FLAGS;
+        case Operation_Logical:    return ALU_FLAGS & ~F_AUXILIARY;
+        case Operation_Shift: {
+            if (count == 0) return ALU_FLAGS;
+
+            u16 flags = F_CARRY|F_PARITY|F_ZERO|F_SIGNED;
+            if (count == 1) flags |= F_OVERFLOW;
+            if (count >= (is_wide ? 16u : 8u) && operation->mnemonic != Mnemonic_sar) flags &= ~F_CARRY;
+            return flags;
+        }
+        case Operation_Rotate:     return (count == 1 || count == 0) ? ALU_FLAGS : (ALU_FLAGS & ~F_OVERFLOW);
+        case Operation_Multiply:   return F_CARRY|F_OVERFLOW;
+        case Operation_Divide:     return 0;
+    }
+    return 0;
+}
+
+typedef struct {
+    u64 case_count;
+    u64 mismatch_count;
+} Diff_Result;
+
+static void report_binary_mismatch(const Operation *operation, u8 is_wide, u16 left, u16 right, u16 flags,
+                                   u16 result, u16 result_flags, u16 host_result, u16 host_flags, u16 mask)
+{
+    printf("  %s%s %#x, %#x (flags %#05x): %#x flags %#05x, the host: %#x flags %#05x (compared flags %#05x)\n",
+           operation->name, is_wide ? "w" : "b", left, right, flags, result, result_flags & mask, host_result,
+           host_flags & mask, mask);
+}
+
+static void diff_binary_case(const Operation *operation, u8 is_wide, u16 left, u16 right, u16 flags,
+                             Diff_Result *diff)
+{
+    u16 mask_value = is_wide ? 0xFFFF : 0xFF;
+    left &= mask_value;
+    right &= mask_value;
+    if ((operation->kind == Operation_Shift || operation->kind == Operation_Rotate) && !is_80186) right &= 31;
+
+    u16 result_flags = flags;
+    u16 result = binary_functions[operation->mnemonic][is_wide](left, right, &result_flags);
+
+    u16 host_flags = flags;
+    u16 host_result = operation->host[is_wide](left, right, &host_flags);
+
+    u16 mask = defined_flags(operation, is_wide, right & 31); // the count of the host
+    diff->case_count += 1;
+    if (result != host_result || (result_flags & mask) != (host_flags & mask)) {
+        if (diff->mismatch_count < MAX_PRINTED_MISMATCH_COUNT) {
+            report_binary_mismatch(operation, is_wide, left, right, flags, result, result_flags, host_result,
+                                   host_flags, mask);
+        }
+        diff->mismatch_count += 1;
+    }
+}
+
+static void diff_multiply_case(const Operation *operation, u8 is_wide, u16 ax, u16 dx, u16 source, u16 flags,
+                               Diff_Result *diff)
+{
+    if (!is_wide) {
+        source &= 0xFF;
+        dx = 0;
+    }
+
+    u16 result_ax = ax, result_dx = dx, result_flags = flags;
+    u8 ok = multiply_functions[operation->mnemonic][is_wide](&result_ax, &result_dx, source, &result_flags);
+
+    // The host would raise the #DE, so its divide errors are found here. The -128 and the -32768 quotients are
+    // errors only on the 8086.
+    u8 host_ok = 1;
+    u8 only_8086_error = 0;
+    if (operation->kind == Operation_Divide) {
+        s64 dividend, divisor, quotient;
+        if (operation->mnemonic == Mnemonic_div) {
+            dividend = is_wide ? (s64)(((u32)dx << 16) | ax) : ax;
+            divisor  = source;
+        } else {
+            dividend = is_wide ? (s64)(s32)(((u32)dx << 16) | ax) : (s16)ax;
+            divisor  = is_wide ? (s16)source : (s8)source;
+        }
+
+        if (divisor == 0) {
+            host_ok = 0;
+        } else {
+            quotient = dividend / divisor;
+            if (operation->mnemonic == Mnemonic_div) {
+                host_ok = quotient <= (is_wide ? 0xFFFF : 0xFF);
+            } else {
+                s64 limit = is_wide ? 32767 : 127;
+                host_ok = quotient >= -limit - 1 && quotient <= limit;
+                only_8086_error = quotient == -limit - 1 && !is_80186;
+            }
+        }
+    }
+
+    diff->case_count += 1;
+
+    if (ok != (host_ok && !only_8086_error)) {
+        if (diff->mismatch_count < MAX_PRINTED_MISMATCH_COUNT) {
+            printf("  %s%s ax=%#x dx=%#x by %#x: the divide error is %s\n", operation->name, is_wide ? "w" : "b", ax,
+                   dx, source, ok ? "missing" : "not expected");
+        }
+        diff->mismatch_count += 1;
+        return;
+    }
+    if (!ok) return;
+
+    u16 host_ax = ax, host_dx = dx, host_flags = flags;
+    operation->host_multiply[is_wide](&host_ax, &host_dx, source, &host_flags);
+
+    u16 mask = defined_flags(operation, is_wide, 0);
+    if (result_ax != host_ax || result_dx != host_dx || (result_flags & mask) != (host_flags & mask)) {
+        if (diff->mismatch_count < MAX_PRINTED_MISMATCH_COUNT) {
+            printf("  %s%s ax=%#x dx=%#x by %#x: ax=%#x dx=%#x flags %#05x, the host: ax=%#x dx=%#x flags %#05x\n",
+                   operation->name, is_wide ? "w" : "b", ax, dx, source, result_ax, result_dx, result_flags & mask,
+                   host_ax, host_dx, host_flags & mask);
+        }
+        diff->mismatch_count += 1;
+    }
+}
+
+static Diff_Result diff_operation(const Operation *operation, u8 is_wide, u64 sample_count)
+{
+    Diff_Result diff = {0};
+
+    if (operation->kind == Operation_Multiply || operation->kind == Operation_Divide) {
+        if (!is_wide) {
+            // Every ax and source of the bytes
+            for (u32 ax = 0; ax <= 0xFFFF; ax++) {
+                for (u32 source = 0; source <= 0xFF; source++) {
+                    diff_multiply_case(operation, is_wide, ax, 0, source, input_flags[(ax ^ source) % ARRAY_SIZE(input_flags)], &diff);
+                }
+            }
+            return diff;
+        }
+
+        for (u32 a = 0; a < ARRAY_SIZE(word_edge_values); a++) {
+            for (u32 d = 0; d < ARRAY_SIZE(word_edge_values); d++) {
+                for (u32 s = 0; s < ARRAY_SIZE(word_edge_values); s++) {
+                    diff_multiply_case(operation, is_wide, word_edge_values[a], word_edge_values[d],
+                                       word_edge_values[s], 0, &diff);
+                }
+            }
+        }
+        for (u64 n = 0; n < sample_count; n++) {
+            u64 r = next_random();
+            // The small dx too, otherwise nearly every division overflows
+            u16 dx = (r & (1ull << 48)) ? (u16)(r >> 32) : (u16)((r >> 32) & 0xFF);
+            diff_multiply_case(operation, is_wide, (u16)r, dx, (u16)(r >> 16), input_flags[(r >> 56) % ARRAY_SIZE(input_flags)], &diff);
+        }
+        return diff;
+    }
+
+    if (operation->kind == Operation_Shift || operation->kind == Operation_Rotate) {
+        u32 value_count = is_wide ? 0x10000 : 0x100;
+        for (u32 value = 0; value < value_count; value++) {
+            for (u32 count = 0; count < (is_80186 ? 256u : 32u); count++) {
+                for (u32 f = 0; f < 2; f++) {
+                    diff_binary_case(operation, is_wide, value, count, input_flags[f], &diff);
+                }
+            }
+        }
+        return diff;
+    }
+
+    if (operation->is_unary) {
+        u32 value_count = is_wide ? 0x10000 : 0x100;
+        for (u32 value = 0; value < value_count; value++) {
+            for (u32 f = 0; f < ARRAY_SIZE(input_flags); f++) {
+                diff_binary_case(operation, is_wide, value, 0, input_flags[f], &diff);
+            }
+        }
+        return diff;
+    }
+
+    if (!is_wide) {
+        // Every operand pair of the bytes
+        for (u32 left = 0; left <= 0xFF; left++) {
+            for (u32 right = 0; right <= 0xFF; right++) {
+                for (u32 f = 0; f < 2; f++) {
+                    diff_binary_case(operation, is_wide, left, right, input_flags[f], &diff);
+                }
+            }
+        }
+        return diff;
+    }
+
+    for (u32 l = 0; l < ARRAY_SIZE(word_edge_values); l++) {
+        for (u32 r = 0; r < ARRAY_SIZE(word_edge_values); r++) {
+            for (u32 f = 0; f < ARRAY_SIZE(input_flags); f++) {
+                diff_binary_case(operation, is_wide, word_edge_values[l], word_edge_values[r], input_flags[f], &diff);
+            }
+        }
+    }
+    for (u64 n = 0; n < sample_count; n++) {
+        u64 r = next_random();
+        diff_binary_case(operation, is_wide, (u16)r, (u16)(r >> 16), input_flags[(r >> 32) % ARRAY_SIZE(input_flags)], &diff);
+    }
+
+    return diff;
+}
+
+int main(int argc, char **argv)
+{
+    u64 sample_count = 1000000;
+
+    for (int i = 1; i < argc; i++) {
+        if (STR_EQUAL(argv[i], "--samples") && i+1 < argc) {
+            sample_count = strtoull(argv[++i], NULL, 0);
+        } else if (STR_EQUAL(argv[i], "--seed") && i+1 < argc) {
+            random_state = strtoull(argv[++i], NULL, 0);
+            if (random_state == 0) random_state = 1; // the xorshift stays 0
+        } else if (STR_EQUAL(argv[i], "--cpu") && i+1 < argc && STR_EQUAL(argv[i+1], "80186")) {
+            is_80186 = 1;
+            binary_functions = alu_binary_functions_80186;
+            multiply_functions = alu_multiply_functions_80186;
+            i++;
+        } else if (STR_EQUAL(argv[i], "--cpu") && i+1 < argc && STR_EQUAL(argv[i+1], "8086")) {
+            i++;
+        } else {
+            fprintf(stderr, "usage: %s [--samples N] [--seed N] [--cpu 8086|80186]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    u64 total_case_count = 0;
+    u64 total_mismatch_count = 0;
+
+    for (u32 i = 0; i < ARRAY_SIZE(operations); i++) {
+        for (u8 is_wide = 0; is_wide < 2; is_wide++) {
+            Diff_Result diff = diff_operation(&operations[i], is_wide, sample_count);
+            printf("%-4s %2d: %10llu cases, %llu mismatches\n", operations[i].name, is_wide ? 16 : 8,
+                   (unsigned long long)diff.case_count, (unsigned long long)diff.mismatch_count);
+
+            total_case_count += diff.case_count;
+            total_mismatch_count += diff.mismatch_count;
+        }
+    }
+
+    printf("total: %llu cases, %llu mismatches\n", (unsigned long long)total_case_count,
+           (unsigned long long)total_mismatch_count);
+
+    return total_mismatch_count ? 1 : 0;
+}
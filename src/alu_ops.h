@@ -0,0 +1,451 @@
+// The byte and the word operations of the alu.h. This is not a normal header: the alu.c includes it once for each
+// width, with the ALU_BITS defined to 8 or 16, and every name of the ALU_NAME() gets the width as a suffix:
+//
+//     ALU_NAME(add)  ->  alu_add_8, alu_add_16
+//
+// The operands are masked to the width first, the results are in the low bits of the u32 (the carry is above them).
+
+#if ALU_BITS == 8
+#define ALU_MASK   0xFFu
+#define ALU_SIGN   0x80u
+#define ALU_SIGNED s8
+#elif ALU_BITS == 16
+#define ALU_MASK   0xFFFFu
+#define ALU_SIGN   0x8000u
+#define ALU_SIGNED s16
+#else
+#error "The ALU_BITS has to be 8 or 16"
+#endif
+
+#define ALU_PASTE(name, bits) alu_##name##_##bits
+#define ALU_EXPAND(name, bits) ALU_PASTE(name, bits)
+#define ALU_NAME(name) ALU_EXPAND(name, ALU_BITS)
+
+// Sets the SF, the ZF and the PF by the result
+static inline u16 ALU_NAME(result_flags)(u16 flags, u32 result)
+{
+    result &= ALU_MASK;
+
+    flags &= ~(F_SIGNED|F_ZERO|F_PARITY);
+    flags |= (result & ALU_SIGN) ? F_SIGNED : 0;
+    flags |= (result == 0) ? F_ZERO : 0;
+    flags |= alu_parity(result);
+
+    return flags;
+}
+
+///////////////////////////////////////////////////
+// :Arithmatic
+
+static inline u16 ALU_NAME(add_with_carry)(u32 left, u32 right, u32 carry, u16 *flags)
+{
+    left &= ALU_MASK;
+    right &= ALU_MASK;
+    u32 result = left + right + carry;
+
+    u16 f = *flags & ~(F_CARRY|F_OVERFLOW|F_AUXILIARY);
+    f |= (result > ALU_MASK) ? F_CARRY : 0;
+    f |= ((left ^ result) & (right ^ result) & ALU_SIGN) ? F_OVERFLOW : 0;
+    f |= ((left ^ right ^ result) & 0x10) ? F_AUXILIARY : 0;
+    *flags = ALU_NAME(result_flags)(f, result);
+
+    return result & ALU_MASK;
+}
+
+static inline u16 ALU_NAME(subtract_with_borrow)(u32 left, u32 right, u32 borrow, u16 *flags)
+{
+    left &= ALU_MASK;
+    right &= ALU_MASK;
+    u32 result = left - right - borrow;
+
+    u16 f = *flags & ~(F_CARRY|F_OVERFLOW|F_AUXILIARY);
+    f |= (left < right + borrow) ? F_CARRY : 0;
+    f |= ((left ^ right) & (left ^ result) & ALU_SIGN) ? F_OVERFLOW : 0;
+    f |= ((left ^ right ^ result) & 0x10) ? F_AUXILIARY : 0;
+    *flags = ALU_NAME(result_flags)(f, result);
+
+    return result & ALU_MASK;
+}
+
+u16 ALU_NAME(add)(u16 left, u16 right, u16 *flags)
+{
+    return ALU_NAME(add_with_carry)(left, right, 0, flags);
+}
+
+u16 ALU_NAME(adc)(u16 left, u16 right, u16 *flags)
+{
+    return ALU_NAME(add_with_carry)(left, right, *flags & F_CARRY, flags);
+}
+
+u16 ALU_NAME(sub)(u16 left, u16 right, u16 *flags)
+{
+    return ALU_NAME(subtract_with_borrow)(left, right, 0, flags);
+}
+
+u16 ALU_NAME(sbb)(u16 left, u16 right, u16 *flags)
+{
+    return ALU_NAME(subtract_with_borrow)(left, right, *flags & F_CARRY, flags);
+}
+
+u16 ALU_NAME(cmp)(u16 left, u16 right, u16 *flags)
+{
+    ALU_NAME(subtract_with_borrow)(left, right, 0, flags);
+    return left;
+}
+
+// The inc and the dec keep the CF
+u16 ALU_NAME(inc)(u16 left, u16 right, u16 *flags)
+{
+    u16 carry = *flags & F_CARRY;
+    u16 result = ALU_NAME(add_with_carry)(left, 1, 0, flags);
+    *flags = (*flags & ~F_CARRY) | carry;
+    return result;
+}
+
+u16 ALU_NAME(dec)(u16 left, u16 right, u16 *flags)
+{
+    u16 carry = *flags & F_CARRY;
+    u16 result = ALU_NAME(subtract_with_borrow)(left, 1, 0, flags);
+    *flags = (*flags & ~F_CARRY) | carry;
+    return result;
+}
+
+// 0 - left, so the CF is set if the left is not 0
+u16 ALU_NAME(neg)(u16 left, u16 right, u16 *flags)
+{
+    return ALU_NAME(subtract_with_borrow)(0, left, 0, flags);
+}
+
+///////////////////////////////////////////////////
+// :Logical
+
+static inline u16 ALU_NAME(logical_flags)(u32 result, u16 *flags)
+{
+    *flags = ALU_NAME(result_flags)(*flags & ~(F_CARRY|F_OVERFLOW|F_AUXILIARY), result);
+    return result & ALU_MASK;
+}
+
+u16 ALU_NAME(and)(u16 left, u16 right, u16 *flags)
+{
+    return ALU_NAME(logical_flags)(left & right, flags);
+}
+
+u16 ALU_NAME(or)(u16 left, u16 right, u16 *flags)
+{
+    return ALU_NAME(logical_flags)(left | right, flags);
+}
+
+u16 ALU_NAME(xor)(u16 left, u16 right, u16 *flags)
+{
+    return ALU_NAME(logical_flags)(left ^ right, flags);
+}
+
+u16 ALU_NAME(test)(u16 left, u16 right, u16 *flags)
+{
+    ALU_NAME(logical_flags)(left & right, flags);
+    return left;
+}
+
+// No flag is changed
+u16 ALU_NAME(not)(u16 left, u16 right, u16 *flags)
+{
+    return ~left & ALU_MASK;
+}
+
+///////////////////////////////////////////////////
+// :Shift
+//
+// The count 0 changes nothing (not even the flags). The AF is undefined, it's kept.
+
+u16 ALU_NAME(shl)(u16 left, u16 right, u16 *flags)
+{
+    u32 count = right & 0xFF;
+    left &= ALU_MASK;
+    if (count == 0) return left;
+
+    // The last bit which is shifted out is the bit above the width
+    u32 result = (count > ALU_BITS) ? 0 : ((u32)left << count);
+    u32 carry = (result >> ALU_BITS) & 1;
+
+    u16 f = *flags & ~(F_CARRY|F_OVERFLOW);
+    f |= carry ? F_CARRY : 0;
+    f |= (((result >> (ALU_BITS - 1)) & 1) ^ carry) ? F_OVERFLOW : 0;
+    *flags = ALU_NAME(result_flags)(f, result);
+
+    return result & ALU_MASK;
+}
+
+u16 ALU_NAME(shr)(u16 left, u16 right, u16 *flags)
+{
+    u32 count = right & 0xFF;
+    left &= ALU_MASK;
+    if (count == 0) return left;
+
+    // Shifted by one less, so the last bit which is shifted out is the bit 0
+    u32 result = (count > ALU_BITS) ? 0 : ((u32)left >> (count - 1));
+    u32 carry = result & 1;
+    result >>= 1;
+
+    u16 f = *flags & ~(F_CARRY|F_OVERFLOW);
+    f |= carry ? F_CARRY : 0;
+    f |= (left & ALU_SIGN) ? F_OVERFLOW : 0;
+    *flags = ALU_NAME(result_flags)(f, result);
+
+    return result;
+}
+
+u16 ALU_NAME(sar)(u16 left, u16 right, u16 *flags)
+{
+    u32 count = right & 0xFF;
+    left &= ALU_MASK;
+    if (count == 0) return left;
+
+    // Every bit is the sign after the width
+    if (count > ALU_BITS) count = ALU_BITS;
+    s32 result = (s32)(ALU_SIGNED)left >> (count - 1);
+    u32 carry = result & 1;
+    result >>= 1;
+
+    u16 f = *flags & ~(F_CARRY|F_OVERFLOW);
+    f |= carry ? F_CARRY : 0;
+    *flags = ALU_NAME(result_flags)(f, (u32)result);
+
+    return (u32)result & ALU_MASK;
+}
+
+///////////////////////////////////////////////////
+// :Rotate
+//
+// Only the CF and the OF are changed. The OF is the xor of the top two bits of the result (the rol and the rcl:
+// the top bit and the CF), it's defined only for the count 1.
+
+u16 ALU_NAME(rol)(u16 left, u16 right, u16 *flags)
+{
+    u32 count = right & 0xFF;
+    left &= ALU_MASK;
+    if (count == 0) return left;
+
+    u32 n = count & (ALU_BITS - 1);
+    u32 result = (((u32)left << n) | ((u32)left >> (ALU_BITS - n))) & ALU_MASK;
+    u32 carry = result & 1;
+
+    u16 f = *flags & ~(F_CARRY|F_OVERFLOW);
+    f |= carry ? F_CARRY : 0;
+    f |= (((result >> (ALU_BITS - 1)) & 1) ^ carry) ? F_OVERFLOW : 0;
+    *flags = f;
+
+    return result;
+}
+
+u16 ALU_NAME(ror)(u16 left, u16 right, u16 *flags)
+{
+    u32 count = right & 0xFF;
+    left &= ALU_MASK;
+    if (count == 0) return left;
+
+    u32 n = count & (ALU_BITS - 1);
+    u32 result = (((u32)left >> n) | ((u32)left << (ALU_BITS - n))) & ALU_MASK;
+
+    u16 f = *flags & ~(F_CARRY|F_OVERFLOW);
+    f |= (result & ALU_SIGN) ? F_CARRY : 0;
+    f |= ((result ^ (result << 1)) & ALU_SIGN) ? F_OVERFLOW : 0;
+    *flags = f;
+
+    return result;
+}
+
+// The rcl and the rcr rotate the width+1 bits of the CF and the operand
+u16 ALU_NAME(rcl)(u16 left, u16 right, u16 *flags)
+{
+    u32 count = right & 0xFF;
+    left &= ALU_MASK;
+    if (count == 0) return left;
+
+    u32 n = count % (ALU_BITS + 1);
+    u32 value = left | ((*flags & F_CARRY) ? (ALU_MASK + 1) : 0);
+    value = ((value << n) | (value >> (ALU_BITS + 1 - n))) & (2*ALU_MASK + 1);
+
+    u32 result = value & ALU_MASK;
+    u32 carry = value >> ALU_BITS;
+
+    u16 f = *flags & ~(F_CARRY|F_OVERFLOW);
+    f |= carry ? F_CARRY : 0;
+    f |= (((result >> (ALU_BITS - 1)) & 1) ^ carry) ? F_OVERFLOW : 0;
+    *flags = f;
+
+    return result;
+}
+
+u16 ALU_NAME(rcr)(u16 left, u16 right, u16 *flags)
+{
+    u32 count = right & 0xFF;
+    left &= ALU_MASK;
+    if (count == 0) return left;
+
+    u32 n = count % (ALU_BITS + 1);
+    u32 value = left | ((*flags & F_CARRY) ? (ALU_MASK + 1) : 0);
+    value = ((value >> n) | (value << (ALU_BITS + 1 - n))) & (2*ALU_MASK + 1);
+
+    u32 result = value & ALU_MASK;
+    u32 carry = value >> ALU_BITS;
+
+    u16 f = *flags & ~(F_CARRY|F_OVERFLOW);
+    f |= carry ? F_CARRY : 0;
+    f |= ((result ^ (result << 1)) & ALU_SIGN) ? F_OVERFLOW : 0;
+    *flags = f;
+
+    return result;
+}
+
+// The 80186 masks the count to 5 bits, then it's the same
+#define ALU_80186_SHIFT(name) \
+    u16 ALU_NAME(name##_80186)(u16 left, u16 right, u16 *flags) { return ALU_NAME(name)(left, right & 0x1F, flags); }
+
+ALU_80186_SHIFT(shl)
+ALU_80186_SHIFT(shr)
+ALU_80186_SHIFT(sar)
+ALU_80186_SHIFT(rol)
+ALU_80186_SHIFT(ror)
+ALU_80186_SHIFT(rcl)
+ALU_80186_SHIFT(rcr)
+
+#undef ALU_80186_SHIFT
+
+///////////////////////////////////////////////////
+// :Multiply
+//
+// The mul and the imul set the CF and the OF if the upper half of the result is needed, the other flags are
+// undefined and kept. The div and the idiv keep every flag.
+
+#if ALU_BITS == 8
+
+u8 alu_mul_8(u16 *ax, u16 *dx, u16 source, u16 *flags)
+{
+    u32 result = (*ax & 0xFF) * (source & 0xFF);
+    *ax = result;
+
+    *flags &= ~(F_CARRY|F_OVERFLOW);
+    *flags |= (result > 0xFF) ? (F_CARRY|F_OVERFLOW) : 0;
+    return 1;
+}
+
+u8 alu_imul_8(u16 *ax, u16 *dx, u16 source, u16 *flags)
+{
+    s32 result = (s8)*ax * (s8)source;
+    *ax = (u16)result;
+
+    *flags &= ~(F_CARRY|F_OVERFLOW);
+    *flags |= (result != (s8)result) ? (F_CARRY|F_OVERFLOW) : 0;
+    return 1;
+}
+
+// The al is the quotient, the ah is the remainder
+u8 alu_div_8(u16 *ax, u16 *dx, u16 source, u16 *flags)
+{
+    u32 dividend = *ax;
+    u32 divisor = source & 0xFF;
+    if (divisor == 0) return 0;
+
+    u32 quotient = dividend / divisor;
+    if (quotient > 0xFF) return 0;
+
+    *ax = ((dividend % divisor) << 8) | quotient;
+    return 1;
+}
+
+// The lowest quotient is the -127 at the 8086, the -128 at the 80186
+static inline u8 alu_signed_divide_8(u16 *ax, u16 source, s32 lowest_quotient)
+{
+    s32 dividend = (s16)*ax;
+    s32 divisor = (s8)source;
+    if (divisor == 0) return 0;
+
+    s32 quotient = dividend / divisor;
+    if (quotient > 127 || quotient < lowest_quotient) return 0;
+
+    *ax = (((dividend % divisor) & 0xFF) << 8) | (quotient & 0xFF);
+    return 1;
+}
+
+u8 alu_idiv_8(u16 *ax, u16 *dx, u16 source, u16 *flags)
+{
+    return alu_signed_divide_8(ax, source, -127);
+}
+
+u8 alu_idiv_80186_8(u16 *ax, u16 *dx, u16 source, u16 *flags)
+{
+    return alu_signed_divide_8(ax, source, -128);
+}
+
+#else
+
+u8 alu_mul_16(u16 *ax, u16 *dx, u16 source, u16 *flags)
+{
+    u32 result = (u32)*ax * source;
+    *ax = result & 0xFFFF;
+    *dx = result >> 16;
+
+    *flags &= ~(F_CARRY|F_OVERFLOW);
+    *flags |= (*dx != 0) ? (F_CARRY|F_OVERFLOW) : 0;
+    return 1;
+}
+
+u8 alu_imul_16(u16 *ax, u16 *dx, u16 source, u16 *flags)
+{
+    s32 result = (s32)(s16)*ax * (s16)source;
+    *ax = (u32)result & 0xFFFF;
+    *dx = (u32)result >> 16;
+
+    *flags &= ~(F_CARRY|F_OVERFLOW);
+    *flags |= (result != (s16)result) ? (F_CARRY|F_OVERFLOW) : 0;
+    return 1;
+}
+
+// The ax is the quotient, the dx is the remainder
+u8 alu_div_16(u16 *ax, u16 *dx, u16 source, u16 *flags)
+{
+    u32 dividend = ((u32)*dx << 16) | *ax;
+    u32 divisor = source;
+    if (divisor == 0) return 0;
+
+    u32 quotient = dividend / divisor;
+    if (quotient > 0xFFFF) return 0;
+
+    *ax = quotient;
+    *dx = dividend % divisor;
+    return 1;
+}
+
+// The lowest quotient is the -32767 at the 8086, the -32768 at the 80186
+static inline u8 alu_signed_divide_16(u16 *ax, u16 *dx, u16 source, s64 lowest_quotient)
+{
+    s64 dividend = (s32)(((u32)*dx << 16) | *ax);
+    s64 divisor = (s16)source;
+    if (divisor == 0) return 0;
+
+    s64 quotient = dividend / divisor;
+    if (quotient > 32767 || quotient < lowest_quotient) return 0;
+
+    *ax = (u16)quotient;
+    *dx = (u16)(dividend % divisor);
+    return 1;
+}
+
+u8 alu_idiv_16(u16 *ax, u16 *dx, u16 source, u16 *flags)
+{
+    return alu_signed_divide_16(ax, dx, source, -32767);
+}
+
+u8 alu_idiv_80186_16(u16 *ax, u16 *dx, u16 source, u16 *flags)
+{
+    return alu_signed_divide_16(ax, dx, source, -32768);
+}
+
+#endif
+
+#undef ALU_MASK
+#undef ALU_SIGN
+#undef ALU_SIGNED
+#undef ALU_PASTE
+#undef ALU_EXPAND
+#undef ALU_NAME
@@ -0,0 +1,405 @@
+#include "batch.h"
+#include "simulator.h"
+#include "printer.h"
+#include "platform.h"
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME        0x00000100000001b3ULL
+
+static u64 fnv1a(u64 hash, u8 *data, u64 size)
+{
+    for (u64 i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+u64 hash_registers(CPU *cpu)
+{
+    // ax..di and the segment registers (see the register_access table), then the ip and the flags
+    u64 hash = fnv1a(FNV_OFFSET_BASIS, cpu->regmem, 24);
+    hash = fnv1a(hash, (u8 *)&cpu->ip, sizeof(cpu->ip));
+    hash = fnv1a(hash, (u8 *)&cpu->flags, sizeof(cpu->flags));
+    return hash;
+}
+
+u64 hash_memory(CPU *cpu)
+{
+    return fnv1a(FNV_OFFSET_BASIS, cpu->memory, MAX_MEMORY);
+}
+
+const char *batch_status_name(Batch_Status status)
+{
+    static const char *const batch_status_names[] = {
+        [Batch_Status_Pass]      = "pass",
+        [Batch_Status_Fail]      = "fail",
+        [Batch_Status_Unchecked] = "unchecked",
+        [Batch_Status_Error]     = "error",
+    };
+
+    assert(status < ARRAY_SIZE(batch_status_names));
+
+    return batch_status_names[status];
+}
+
+///////////////////////////////////////////////////
+// Job list
+
+typedef struct {
+    Batch_Job *jobs;
+    u32 count;
+    u32 capacity;
+} Batch_Job_List;
+
+static Batch_Job *add_job(Batch_Job_List *list, char *path)
+{
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->jobs = (Batch_Job *)realloc(list->jobs, sizeof(Batch_Job) * list->capacity);
+    }
+
+    Batch_Job *job = &list->jobs[list->count++];
+    ZERO_MEMORY(job, sizeof(Batch_Job));
+    job->path = strdup(path);
+
+    return job;
+}
+
+static char *join_path(char *dir, char *name)
+{
+    u32 size = STR_LEN(dir) + STR_LEN(name) + 2;
+    char *result = (char *)malloc(size);
+    snprintf(result, size, "%s/%s", dir, name);
+    return result;
+}
+
+static u8 has_extension(char *name, char *extension)
+{
+    u32 name_len = STR_LEN(name);
+    u32 ext_len = STR_LEN(extension);
+    return name_len > ext_len && STR_EQUAL(name + name_len - ext_len, extension);
+}
+
+typedef struct {
+    Batch_Job_List *list;
+    char *dir;
+} Directory_Scan;
+
+static void add_directory_entry(char *name, void *user)
+{
+    Directory_Scan *scan = (Directory_Scan *)user;
+
+    // Skip the sources, the debug info and the reports which are usually next to the binaries
+    static const char *const skipped_extensions[] = {".asm", ".lines", ".syms", ".frag", ".txt", ".json", ".md"};
+    if (name[0] == '.') return;
+    for (u32 i = 0; i < ARRAY_SIZE(skipped_extensions); i++) {
+        if (has_extension(name, (char *)skipped_extensions[i])) return;
+    }
+
+    char *path = join_path(scan->dir, name);
+    add_job(scan->list, path);
+    free(path);
+}
+
+static int compare_jobs(const void *a, const void *b)
+{
+    return strcmp(((Batch_Job *)a)->path, ((Batch_Job *)b)->path);
+}
+
+static u8 parse_hash(char *token, u64 *hash)
+{
+    if (token == NULL || STR_EQUAL(token, "-")) return 0;
+    *hash = strtoull(token, NULL, 16);
+    return 1;
+}
+
+static u8 load_manifest(Batch_Job_List *list, char *manifest_filename)
+{
+    FILE *fp = fopen(manifest_filename, "r");
+    if (fp == NULL) return 0;
+
+    // The paths are relative to the directory of the manifest
+    char dir[1024];
+    snprintf(dir, sizeof(dir), "%s", manifest_filename);
+    char *slash = strrchr(dir, '/');
+    if (!slash) slash = strrchr(dir, '\\');
+    if (slash) *slash = '\0';
+    else       snprintf(dir, sizeof(dir), ".");
+
+    char line[2048];
+    while (fgets(line, sizeof(line), fp)) {
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        char *name = strtok(line, " \t\r\n");
+        if (name == NULL) continue;
+
+        char *path = join_path(dir, name);
+        Batch_Job *job = add_job(list, path);
+        free(path);
+
+        job->check_registers = parse_hash(strtok(NULL, " \t\r\n"), &job->expected_registers_hash);
+        job->check_memory    = parse_hash(strtok(NULL, " \t\r\n"), &job->expected_memory_hash);
+    }
+
+    fclose(fp);
+    return 1;
+}
+
+///////////////////////////////////////////////////
+// Worker pool
+
+// Every worker has its own range of the job indices. The owner takes the jobs from the front, and if a worker
+// has no more job, then it steals the back half of the range of an other worker. So the long running binaries
+// are not blocking the rest of the queue of that worker.
+typedef struct {
+    Mutex lock;
+    u32 begin;
+    u32 end;
+} Work_Queue;
+
+typedef struct {
+    Batch_Job *jobs;
+    Work_Queue *queues;
+    int worker_count;
+    Batch_Options *options;
+} Batch_Pool;
+
+typedef struct {
+    Batch_Pool *pool;
+    int index;
+} Batch_Worker;
+
+static u8 take_job(Work_Queue *queue, u32 *job_index)
+{
+    u8 found = 0;
+
+    mutex_lock(&queue->lock);
+    if (queue->begin < queue->end) {
+        *job_index = queue->begin++;
+        found = 1;
+    }
+    mutex_unlock(&queue->lock);
+
+    return found;
+}
+
+static u8 steal_jobs(Batch_Pool *pool, int thief)
+{
+    for (int i = 1; i < pool->worker_count; i++) {
+        Work_Queue *victim = &pool->queues[(thief + i) % pool->worker_count];
+
+        mutex_lock(&victim->lock);
+        u32 remaining = victim->end - victim->begin;
+        if (remaining == 0) {
+            mutex_unlock(&victim->lock);
+            continue;
+        }
+
+        u32 stolen = (remaining + 1) / 2;
+        u32 end = victim->end;
+        victim->end -= stolen;
+        mutex_unlock(&victim->lock);
+
+        Work_Queue *own = &pool->queues[thief];
+        mutex_lock(&own->lock);
+        own->begin = end - stolen;
+        own->end = end;
+        mutex_unlock(&own->lock);
+
+        return 1;
+    }
+
+    return 0;
+}
+
+static void run_job(Batch_Job *job, Batch_Options *options)
+{
+    double start = seconds_now();
+
+    CPU cpu = {0};
+    cpu.trace = NULL; // quiet, the threads are not writing the stdout
+    cpu.graphics = NULL; // headless, see the graphics.h
+    cpu.instruction_limit = options->instruction_limit;
+    cpu.cycle_limit = options->cycle_limit;
+    cpu.model = options->model;
+    cpu.predecode = 1;
+    cpu.idle_skip = 1;
+    boot(&cpu);
+
+    if (!load_executable(&cpu, job->path)) {
+        job->status = Batch_Status_Error;
+        free(cpu.memory);
+        return;
+    }
+
+    run(&cpu);
+
+    job->exit_reason       = cpu.exit_reason;
+    job->instruction_count = cpu.instruction_count;
+    job->registers_hash    = hash_registers(&cpu);
+    job->memory_hash       = hash_memory(&cpu);
+    job->seconds           = seconds_now() - start;
+
+    if (!job->check_registers && !job->check_memory) {
+        job->status = Batch_Status_Unchecked;
+    } else if ((job->check_registers && job->registers_hash != job->expected_registers_hash) ||
+               (job->check_memory && job->memory_hash != job->expected_memory_hash)) {
+        job->status = Batch_Status_Fail;
+    } else {
+        job->status = Batch_Status_Pass;
+    }
+
+    destroy_code_map(&cpu);
+    free(cpu.memory);
+}
+
+static THREAD_PROC(batch_worker)
+{
+    Batch_Worker *worker = (Batch_Worker *)data;
+    Batch_Pool *pool = worker->pool;
+
+    for (;;) {
+        u32 job_index;
+        if (take_job(&pool->queues[worker->index], &job_index)) {
+            run_job(&pool->jobs[job_index], pool->options);
+        } else if (!steal_jobs(pool, worker->index)) {
+            break; // every queue is empty, and the jobs are never added later
+        }
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////////////////
+// Report
+
+static void write_json_string(FILE *fp, char *str)
+{
+    fputc('"', fp);
+    for (char *c = str; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', fp);
+            fputc(*c, fp);
+        } else if ((u8)*c < 0x20) {
+            fprintf(fp, "\\u%04x", (u8)*c);
+        } else {
+            fputc(*c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+static void write_report(FILE *fp, Batch_Job_List *list, int thread_count, double seconds)
+{
+    u32 counts[Batch_Status_Count] = {0};
+    for (u32 i = 0; i < list->count; i++) {
+        counts[list->jobs[i].status] += 1;
+    }
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"threads\": %d,\n", thread_count);
+    fprintf(fp, "  \"seconds\": %.6f,\n", seconds);
+    fprintf(fp, "  \"total\": %u,\n", list->count);
+    for (int i = 0; i < Batch_Status_Count; i++) {
+        fprintf(fp, "  \"%s\": %u,\n", batch_status_name((Batch_Status)i), counts[i]);
+    }
+    fprintf(fp, "  \"results\": [\n");
+
+    for (u32 i = 0; i < list->count; i++) {
+        Batch_Job *job = &list->jobs[i];
+
+        fprintf(fp, "    {\"path\": ");
+        write_json_string(fp, job->path);
+        fprintf(fp, ", \"status\": \"%s\"", batch_status_name(job->status));
+
+        if (job->status != Batch_Status_Error) {
+            fprintf(fp, ", \"exit_reason\": \"%s\", \"instructions\": %llu, \"seconds\": %.6f",
+                exit_reason_name(job->exit_reason), (unsigned long long)job->instruction_count, job->seconds);
+            fprintf(fp, ", \"registers_hash\": \"%016llx\", \"memory_hash\": \"%016llx\"",
+                (unsigned long long)job->registers_hash, (unsigned long long)job->memory_hash);
+        }
+
+        fprintf(fp, "}%s\n", i + 1 < list->count ? "," : "");
+    }
+
+    fprintf(fp, "  ]\n");
+    fprintf(fp, "}\n");
+}
+
+///////////////////////////////////////////////////
+
+int run_batch(char *path, Batch_Options *options)
+{
+    Batch_Job_List list = {0};
+
+    if (is_directory(path)) {
+        Directory_Scan scan = {&list, path};
+        for_each_file_in_directory(path, add_directory_entry, &scan);
+        // The directory order is random, but the report should be comparable between the runs
+        qsort(list.jobs, list.count, sizeof(Batch_Job), compare_jobs);
+    } else if (!load_manifest(&list, path)) {
+        fprintf(stderr, "[ERROR]: Failed to open %s file. Probably it is not exists.\n", path);
+        return 1;
+    }
+
+    int thread_count = options->thread_count > 0 ? options->thread_count : cpu_core_count();
+    if (thread_count > (int)list.count) thread_count = list.count ? list.count : 1;
+
+    Batch_Pool pool = {0};
+    pool.jobs         = list.jobs;
+    pool.worker_count = thread_count;
+    pool.options      = options;
+    pool.queues       = (Work_Queue *)malloc(sizeof(Work_Queue) * thread_count);
+
+    // The initial split is even, the stealing balances the rest
+    for (int i = 0; i < thread_count; i++) {
+        mutex_init(&pool.queues[i].lock);
+        pool.queues[i].begin = (u32)((u64)list.count * i / thread_count);
+        pool.queues[i].end   = (u32)((u64)list.count * (i + 1) / thread_count);
+    }
+
+    double start = seconds_now();
+
+    Thread *threads = (Thread *)malloc(sizeof(Thread) * thread_count);
+    Batch_Worker *workers = (Batch_Worker *)malloc(sizeof(Batch_Worker) * thread_count);
+    for (int i = 0; i < thread_count; i++) {
+        workers[i].pool = &pool;
+        workers[i].index = i;
+        threads[i] = thread_start(batch_worker, &workers[i]);
+    }
+    for (int i = 0; i < thread_count; i++) {
+        thread_join(threads[i]);
+    }
+
+    double seconds = seconds_now() - start;
+
+    FILE *fp = stdout;
+    if (options->report_filename) {
+        fp = fopen(options->report_filename, "w");
+        if (fp == NULL) {
+            fprintf(stderr, "[ERROR]: Failed to open %s file.\n", options->report_filename);
+            return 1;
+        }
+    }
+
+    write_report(fp, &list, thread_count, seconds);
+
+    if (fp != stdout) fclose(fp);
+
+    int exit_code = 0;
+    for (u32 i = 0; i < list.count; i++) {
+        if (list.jobs[i].status == Batch_Status_Fail || list.jobs[i].status == Batch_Status_Error) {
+            exit_code = 1;
+        }
+        free(list.jobs[i].path);
+    }
+
+    free(list.jobs);
+    free(pool.queues);
+    free(threads);
+    free(workers);
+
+    return exit_code;
+}
@@ -0,0 +1,57 @@
+#ifndef _H_BATCH
+#define _H_BATCH
+
+#include "sim86.h"
+
+// Batch mode: runs a whole corpus of binaries (a directory or a manifest file) on a pool of worker threads,
+// every binary with its own CPU and memory, then writes a JSON report.
+//
+// The manifest is a text file, one binary per line (the path is relative to the manifest):
+//
+//     # path                  registers hash     memory hash
+//     listing_0039_more_movs  4081b10fda197304   d83e5ce374aeba5a
+//
+// The hashes are optional ("-" or missing means not checked). The report contains the hashes of every run,
+// so the expectations can be copied from the report of a known good build.
+
+typedef enum {
+    Batch_Status_Pass,
+    Batch_Status_Fail,
+    Batch_Status_Unchecked, // no expected hash in the manifest
+    Batch_Status_Error,     // failed to load
+
+    Batch_Status_Count,
+} Batch_Status;
+
+typedef struct {
+    char *path;
+
+    u8 check_registers;
+    u8 check_memory;
+    u64 expected_registers_hash;
+    u64 expected_memory_hash;
+
+    // Result
+    Batch_Status status;
+    Exit_Reason exit_reason;
+    u64 instruction_count;
+    u64 registers_hash;
+    u64 memory_hash;
+    double seconds;
+} Batch_Job;
+
+typedef struct {
+    int thread_count;       // 0 = all cores
+    u64 instruction_limit;  // per binary, so an infinite loop doesn't hang the whole batch
+    u64 cycle_limit;        // per binary, 0 = unlimited
+    char *report_filename;  // NULL = stdout
+    const CPU_Model *model; // NULL = the 8086
+} Batch_Options;
+
+u64 hash_registers(CPU *cpu);
+u64 hash_memory(CPU *cpu);
+
+// Returns the process exit code, 0 if every checked binary is passed
+int run_batch(char *path, Batch_Options *options);
+
+#endif
@@ -0,0 +1,251 @@
+// Cost of the armed but not hit breakpoints and watchpoints. Runs the binary to the end (quiet) four ways, the best
+// of the repeats is printed:
+//
+//     plain     the step_instruction() loop of the run()
+//     empty     the debug_continue() of the debugger without breakpoints
+//     armed     the debug_continue() with N breakpoints outside of the image and watchpoints on the last pages
+//     hot       the debug_continue() with false conditional breakpoints on the image, so the condition is evaluated
+//               at every instruction (of the images up to 64 bytes)
+//
+// Before the benchmark the conditions are checked against the expected values, the exit code is 1 if one is wrong.
+//
+//     breakpoint_bench <binary> [--breakpoints N] [--repeat N] [--limit N]
+
+#include "sim86.h"
+#include "decoder.h"
+#include "simulator.h"
+#include "alu.h"
+#include "cpu_model.h"
+#include "graphics.h"
+#include "debug_info.h"
+#include "code_map.h"
+#include "trace.h"
+#include "history.h"
+#include "condition.h"
+#include "breakpoints.h"
+#include "hle.h"
+#include "loader.h"
+#include "platform.h"
+
+#include "sim86.c"
+#include "simulator.c"
+#include "alu.c"
+#include "cpu_model.c"
+#include "graphics.c"
+#include "decoder.c"
+#include "printer.c"
+#include "debug_info.c"
+#include "code_map.c"
+#include "trace.c"
+#include "history.c"
+#include "condition.c"
+#include "breakpoints.c"
+#include "hle.c"
+#include "loader.c"
+
+typedef enum {
+    Bench_Plain,
+    Bench_Empty,
+    Bench_Armed,
+    Bench_Hot,
+
+    Bench_Count,
+} Bench_Mode;
+
+// It's never true in the hot mode (the cx is not 0xffff there)
+#define HOT_CONDITION "cx == 0xffff && [bp+2] > 0x80"
+
+typedef struct {
+    const char *source;
+    u32 expected;
+} Condition_Check;
+
+// ax=1234 cx=0003 bx=0200 bp=0100 si=0010 di=0005 es=1000, ip=0120, flags=CF,
+// [0102]=81 [020c]=12 34 [10005]=41
+static const Condition_Check condition_checks[] = {
+    {"cx == 3", 1},
+    {"cx == 3 && [bp+2] > 0x80", 1},
+    {"cx == 3 && [bp+2] > 0x81", 0},
+    {"word [bx+si-4]", 0x3412},
+    {"byte [bx + si - 4] == 0x12", 1},
+    {"[0x20d]", 0x34},
+    {"es:[di] == 0x41", 1},
+    {"[di] == 0x41", 0},
+    {"word es:[di-5+5]", 0x0041},
+    {"ax == 0x1234", 1},
+    {"al == 0x34 && ah == 0x12", 1},
+    {"ip == 0x120", 1},
+    {"cf && !zf", 1},
+    {"zf || of", 0},
+    {"flags & 0x41", 1},
+    {"flags", F_CARRY},
+    {"1 + 2 * 3 == 7", 1},
+    {"(1 + 2) * 3", 9},
+    {"1 << 4 | 1", 17},
+    {"0x12 ^ 0x10 & 0x30", 0x02},
+    {"~0 >> 28", 15},
+    {"-1 == 0xffffffff", 1},
+    {"10 - 2 - 3", 5},
+    {"3 < 4 == 1", 1},
+    {"cx <= 2 || cx >= 3", 1},
+    {"CX != 3", 0},
+};
+
+static u8 check_conditions(CPU *cpu)
+{
+    reset(cpu);
+    set_to_register(cpu, Register_ax, 0x1234);
+    set_to_register(cpu, Register_cx, 0x0003);
+    set_to_register(cpu, Register_bx, 0x0200);
+    set_to_register(cpu, Register_bp, 0x0100);
+    set_to_register(cpu, Register_si, 0x0010);
+    set_to_register(cpu, Register_di, 0x0005);
+    set_to_register(cpu, Register_es, 0x1000);
+    cpu->ip = 0x120;
+    cpu->flags = F_CARRY;
+    cpu->memory[0x102] = 0x81;
+    cpu->memory[0x20c] = 0x12;
+    cpu->memory[0x20d] = 0x34;
+    cpu->memory[0x10005] = 0x41;
+
+    u32 ok_count = 0;
+    for (u32 i = 0; i < ARRAY_SIZE(condition_checks); i++) {
+        Break_Condition condition;
+        u32 value = 0;
+        u8 compiled = compile_condition(condition_checks[i].source, &condition);
+        if (compiled) value = evaluate_condition(&condition, cpu);
+
+        if (compiled && value == condition_checks[i].expected) {
+            ok_count++;
+        } else {
+            printf("condition \"%s\" = %#x, expected %#x\n", condition_checks[i].source, value, condition_checks[i].expected);
+        }
+    }
+
+    printf("conditions: %u/%u ok\n", ok_count, (u32)ARRAY_SIZE(condition_checks));
+
+    // The cost of one evaluation alone (the sum keeps the evaluations)
+    Break_Condition condition;
+    compile_condition(HOT_CONDITION, &condition);
+    u32 evaluation_count = 10 * 1000 * 1000;
+    u32 sum = 0;
+    double start = seconds_now();
+    for (u32 i = 0; i < evaluation_count; i++) {
+        sum += evaluate_condition(&condition, cpu);
+    }
+    double seconds = seconds_now() - start;
+    printf("condition \"%s\": %u instructions, %.2f ns/evaluation (%u)\n", HOT_CONDITION, condition.code_size,
+           seconds * 1e9 / evaluation_count, sum);
+
+    return ok_count == ARRAY_SIZE(condition_checks);
+}
+
+static double bench_run(CPU *cpu, char *filename, Bench_Mode mode, Breakpoints *breakpoints, u64 limit)
+{
+    reset(cpu);
+    if (!load_executable(cpu, filename)) {
+        fprintf(stderr, "[ERROR]: Failed to open %s file. Probably it is not exists.\n", filename);
+        exit(1);
+    }
+
+    double start = seconds_now();
+    if (mode == Bench_Plain) {
+        while (step_instruction(cpu)) {
+            if (limit && cpu->instruction_count >= limit) break;
+        }
+    } else {
+        cpu->breakpoints = breakpoints;
+        Debug_Stop stop = debug_continue(cpu, breakpoints, limit);
+        cpu->breakpoints = NULL;
+
+        if (stop == Debug_Stop_Breakpoint || stop == Debug_Stop_Watchpoint) {
+            fprintf(stderr, "[WARNING]: A breakpoint is hit at %llu instructions, the result is not comparable\n",
+                    (unsigned long long)cpu->instruction_count);
+        }
+    }
+    return seconds_now() - start;
+}
+
+int main(int argc, char **argv)
+{
+    char *filename = NULL;
+    u32 breakpoint_count = 1000;
+    int repeat = 5;
+    u64 limit = 100000000;
+
+    for (int i = 1; i < argc; i++) {
+        if (STR_EQUAL(argv[i], "--breakpoints") && i+1 < argc) {
+            breakpoint_count = (u32)atoi(argv[++i]);
+        } else if (STR_EQUAL(argv[i], "--repeat") && i+1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (STR_EQUAL(argv[i], "--limit") && i+1 < argc) {
+            limit = strtoull(argv[++i], NULL, 10);
+        } else {
+            filename = argv[i];
+        }
+    }
+    if (!filename) {
+        fprintf(stderr, "usage: breakpoint_bench <binary> [--breakpoints N] [--repeat N] [--limit N]\n");
+        return 1;
+    }
+
+    CPU cpu = {0};
+    cpu.predecode = 1;
+    boot(&cpu);
+    assert(cpu.memory);
+
+    if (!check_conditions(&cpu)) {
+        return 1;
+    }
+
+    Breakpoints *empty = create_breakpoints();
+
+    // Below the image, which is loaded to the F000:0100, so they are never hit by the code of the image
+    Breakpoints *armed = create_breakpoints();
+    u32 exec_start = 0xF0100;
+    for (u32 i = 0; i < breakpoint_count; i++) {
+        set_breakpoint(armed, (u32)(((u64)i * 7919) % exec_start));
+    }
+    add_watchpoint(armed, 0xEF000, 16, Watch_Read | Watch_Write);
+    add_watchpoint(armed, 0xEFF00, 2, Watch_Write);
+
+    // Every byte of the image (the instruction starts are among them), the condition is never true there
+    Breakpoints *hot = create_breakpoints();
+    reset(&cpu);
+    if (!load_executable(&cpu, filename)) {
+        fprintf(stderr, "[ERROR]: Failed to open %s file. Probably it is not exists.\n", filename);
+        return 1;
+    }
+    for (u32 address = cpu.exec_start; address < cpu.exec_end; address++) {
+        if (!set_conditional_breakpoint(hot, address, HOT_CONDITION)) break;
+    }
+
+    const char *names[] = {"plain", "empty", "armed", "hot"};
+    Breakpoints *sets[] = {NULL, empty, armed, hot};
+    double best[Bench_Count] = {0};
+    u64 instruction_count = 0;
+
+    for (int r = 0; r < repeat; r++) {
+        for (int mode = 0; mode < Bench_Count; mode++) {
+            double seconds = bench_run(&cpu, filename, (Bench_Mode)mode, sets[mode], limit);
+            if (r == 0 || seconds < best[mode]) best[mode] = seconds;
+            instruction_count = cpu.instruction_count;
+        }
+    }
+
+    for (int mode = 0; mode < Bench_Count; mode++) {
+        printf("%-6s %10llu inst  %8.3f ms  %7.2f ns/inst  %+6.2f%%\n", names[mode],
+               (unsigned long long)instruction_count, best[mode] * 1000.0, best[mode] * 1e9 / instruction_count,
+               (best[mode] / best[Bench_Plain] - 1.0) * 100.0);
+    }
+    printf("armed: %u breakpoints, %u watchpoints, hot: %u conditional breakpoints\n",
+           armed->breakpoint_count, armed->watchpoint_count, hot->conditional_count);
+
+    destroy_breakpoints(empty);
+    destroy_breakpoints(armed);
+    destroy_breakpoints(hot);
+    destroy_code_map(&cpu);
+    free(cpu.memory);
+
+    return 0;
+}
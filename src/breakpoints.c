@@ -0,0 +1,192 @@
+#include "breakpoints.h"
+#include "simulator.h"
+
+Breakpoints *create_breakpoints(void)
+{
+    Breakpoints *breakpoints = (Breakpoints *)calloc(1, sizeof(Breakpoints));
+    assert(breakpoints);
+    return breakpoints;
+}
+
+void destroy_breakpoints(Breakpoints *breakpoints)
+{
+    free(breakpoints);
+}
+
+u8 is_breakpoint(Breakpoints *breakpoints, u32 address)
+{
+    address &= SEGMENT_MASK;
+    return (breakpoints->bitmap[address >> 3] >> (address & 7)) & 1;
+}
+
+// Returns the index of the condition, -1 if there is no one
+static s32 find_conditional(Breakpoints *breakpoints, u32 address)
+{
+    for (u32 i = 0; i < breakpoints->conditional_count; i++) {
+        if (breakpoints->conditional_addresses[i] == address) return (s32)i;
+    }
+    return -1;
+}
+
+static void remove_conditional(Breakpoints *breakpoints, u32 address)
+{
+    s32 index = find_conditional(breakpoints, address);
+    if (index >= 0) {
+        u32 last = --breakpoints->conditional_count;
+        breakpoints->conditional_addresses[index] = breakpoints->conditional_addresses[last];
+        breakpoints->conditions[index] = breakpoints->conditions[last];
+    }
+}
+
+static void set_bit(Breakpoints *breakpoints, u32 address)
+{
+    if (is_breakpoint(breakpoints, address)) return;
+
+    breakpoints->bitmap[address >> 3] |= 1 << (address & 7);
+    breakpoints->breakpoint_count += 1;
+}
+
+void set_breakpoint(Breakpoints *breakpoints, u32 address)
+{
+    address &= SEGMENT_MASK;
+    remove_conditional(breakpoints, address);
+    set_bit(breakpoints, address);
+}
+
+u8 set_conditional_breakpoint(Breakpoints *breakpoints, u32 address, const char *source)
+{
+    address &= SEGMENT_MASK;
+
+    s32 index = find_conditional(breakpoints, address);
+    if (index < 0) {
+        if (breakpoints->conditional_count == MAX_CONDITIONAL_BREAKPOINT_COUNT) return 0;
+        index = (s32)breakpoints->conditional_count;
+    }
+
+    Break_Condition condition;
+    if (!compile_condition(source, &condition)) return 0;
+
+    if (index == (s32)breakpoints->conditional_count) {
+        breakpoints->conditional_count += 1;
+    }
+    breakpoints->conditional_addresses[index] = address;
+    breakpoints->conditions[index] = condition;
+    set_bit(breakpoints, address);
+
+    return 1;
+}
+
+void clear_breakpoint(Breakpoints *breakpoints, u32 address)
+{
+    address &= SEGMENT_MASK;
+    if (!is_breakpoint(breakpoints, address)) return;
+
+    remove_conditional(breakpoints, address);
+    breakpoints->bitmap[address >> 3] &= ~(1 << (address & 7));
+    breakpoints->breakpoint_count -= 1;
+}
+
+u8 breakpoint_hit(Breakpoints *breakpoints, CPU *cpu, u32 address)
+{
+    if (!is_breakpoint(breakpoints, address)) return 0;
+    if (!breakpoints->conditional_count) return 1;
+
+    s32 index = find_conditional(breakpoints, address & SEGMENT_MASK);
+    return index < 0 || evaluate_condition(&breakpoints->conditions[index], cpu) != 0;
+}
+
+static void mark_watched_pages(Breakpoints *breakpoints, Watchpoint *watchpoint, s32 delta)
+{
+    u32 first = watchpoint->address >> WATCH_PAGE_SHIFT;
+    u32 last = (watchpoint->address + watchpoint->size - 1) >> WATCH_PAGE_SHIFT;
+    for (u32 page = first; page <= last && page < WATCH_PAGE_COUNT; page++) {
+        breakpoints->watched_pages[page] += delta;
+    }
+}
+
+u8 add_watchpoint(Breakpoints *breakpoints, u32 address, u32 size, u8 type)
+{
+    if (breakpoints->watchpoint_count == MAX_WATCHPOINT_COUNT) return 0;
+
+    Watchpoint *watchpoint = &breakpoints->watchpoints[breakpoints->watchpoint_count++];
+    watchpoint->address = address & SEGMENT_MASK;
+    watchpoint->size = size ? size : 1;
+    watchpoint->type = type;
+    mark_watched_pages(breakpoints, watchpoint, 1);
+
+    return 1;
+}
+
+void remove_watchpoints(Breakpoints *breakpoints, u32 address)
+{
+    address &= SEGMENT_MASK;
+
+    for (u32 i = 0; i < breakpoints->watchpoint_count;) {
+        Watchpoint *watchpoint = &breakpoints->watchpoints[i];
+        if (watchpoint->address == address) {
+            mark_watched_pages(breakpoints, watchpoint, -1);
+            *watchpoint = breakpoints->watchpoints[--breakpoints->watchpoint_count];
+        } else {
+            i++;
+        }
+    }
+}
+
+void check_watchpoints(Breakpoints *breakpoints, u32 address, u32 size, u8 type)
+{
+    // The word access can be on two pages
+    if (!breakpoints->watched_pages[address >> WATCH_PAGE_SHIFT] &&
+        !breakpoints->watched_pages[((address + size - 1) & SEGMENT_MASK) >> WATCH_PAGE_SHIFT]) {
+        return;
+    }
+
+    for (u32 i = 0; i < breakpoints->watchpoint_count; i++) {
+        Watchpoint *watchpoint = &breakpoints->watchpoints[i];
+        if ((watchpoint->type & type) && address < watchpoint->address + watchpoint->size &&
+            watchpoint->address < address + size) {
+            breakpoints->watch_hit = 1;
+            breakpoints->hit_watchpoint = i;
+            breakpoints->hit_address = address;
+            breakpoints->hit_type = type;
+            return;
+        }
+    }
+}
+
+Debug_Stop debug_continue(CPU *cpu, Breakpoints *breakpoints, u64 step_count)
+{
+    breakpoints->watch_hit = 0;
+
+    for (u64 i = 0; step_count == 0 || i < step_count; i++) {
+        if (cpu->exit_reason != Exit_Reason_None || !step_instruction(cpu)) {
+            return Debug_Stop_Exit;
+        }
+        if (breakpoints->watch_hit) {
+            return Debug_Stop_Watchpoint;
+        }
+
+        // The bit test is inlined, the condition is only evaluated if the bit is set
+        u32 address = calc_inst_pointer_address(cpu);
+        if (((breakpoints->bitmap[address >> 3] >> (address & 7)) & 1) && breakpoint_hit(breakpoints, cpu, address)) {
+            return Debug_Stop_Breakpoint;
+        }
+    }
+
+    return Debug_Stop_Step_Count;
+}
+
+Debug_Stop debug_run_until(CPU *cpu, Breakpoints *breakpoints, u32 address)
+{
+    // A conditional breakpoint at the address is kept, then the run stops there only if the condition is true
+    u8 was_set = is_breakpoint(breakpoints, address);
+    if (!was_set) {
+        set_breakpoint(breakpoints, address);
+    }
+
+    Debug_Stop stop = debug_continue(cpu, breakpoints, 0);
+
+    if (!was_set) {
+        clear_breakpoint(breakpoints, address);
+    }
+    return stop;
+}
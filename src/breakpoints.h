@@ -0,0 +1,94 @@
+#ifndef _H_BREAKPOINTS
+#define _H_BREAKPOINTS
+
+#include "sim86.h"
+#include "condition.h"
+
+// Breakpoints and watchpoints of the debugger (see the debugger.h), made for the cost of the not hit case:
+//
+// - The execution breakpoints are a bitmap over the physical memory (1 Mbit), the check after every instruction
+//   is one bit test, independent of the number of breakpoints.
+// - The conditional breakpoint is a bit of the bitmap too, its condition (see the condition.h) is evaluated only
+//   when the bit is hit.
+// - The watchpoints are filtered by the pages: the memory access of a page without a watchpoint is one byte test,
+//   only the accesses of the watched pages are compared to the watchpoint list.
+//
+// Without the debugger the cpu->breakpoints is NULL, then the memory access is only a pointer test.
+
+#define BREAKPOINT_BITMAP_SIZE (MAX_MEMORY / 8)
+
+#define WATCH_PAGE_SHIFT 12
+#define WATCH_PAGE_COUNT (MAX_MEMORY >> WATCH_PAGE_SHIFT)
+#define MAX_WATCHPOINT_COUNT 64
+#define MAX_CONDITIONAL_BREAKPOINT_COUNT 64
+
+typedef enum {
+    Watch_Read  = (1 << 0),
+    Watch_Write = (1 << 1),
+} Watch_Type;
+
+typedef struct {
+    u32 address; // absolute
+    u32 size;
+    u8 type;     // Watch_Type flags
+} Watchpoint;
+
+// Why the debug_continue() is returned
+typedef enum {
+    Debug_Stop_Breakpoint,
+    Debug_Stop_Watchpoint,
+    Debug_Stop_Step_Count,
+    Debug_Stop_Exit,         // the execution is stopped, see the cpu->exit_reason
+} Debug_Stop;
+
+struct Breakpoints {
+    u8 bitmap[BREAKPOINT_BITMAP_SIZE];
+    u32 breakpoint_count;
+
+    // The addresses are apart from the conditions, so the search of the address is short
+    u32 conditional_addresses[MAX_CONDITIONAL_BREAKPOINT_COUNT];
+    Break_Condition conditions[MAX_CONDITIONAL_BREAKPOINT_COUNT];
+    u32 conditional_count;
+
+    u8 watched_pages[WATCH_PAGE_COUNT]; // the number of the watchpoints on the page
+    Watchpoint watchpoints[MAX_WATCHPOINT_COUNT];
+    u32 watchpoint_count;
+
+    // The last watchpoint hit, set by the memory access
+    u8 watch_hit;
+    u32 hit_watchpoint;
+    u32 hit_address;
+    u8 hit_type;
+};
+
+Breakpoints *create_breakpoints(void);
+void destroy_breakpoints(Breakpoints *breakpoints);
+
+void set_breakpoint(Breakpoints *breakpoints, u32 address);
+void clear_breakpoint(Breakpoints *breakpoints, u32 address);
+u8 is_breakpoint(Breakpoints *breakpoints, u32 address);
+
+// Returns 0 if the condition is invalid (the error is printed) or there are more than the
+// MAX_CONDITIONAL_BREAKPOINT_COUNT conditional breakpoints. The set_breakpoint() at the
+// same address removes the condition.
+u8 set_conditional_breakpoint(Breakpoints *breakpoints, u32 address, const char *condition);
+
+// The breakpoint is set at the address and its condition (if it has one) is true
+u8 breakpoint_hit(Breakpoints *breakpoints, CPU *cpu, u32 address);
+
+// Returns 0 if there are too many watchpoints
+u8 add_watchpoint(Breakpoints *breakpoints, u32 address, u32 size, u8 type);
+// Removes the watchpoints which start at the address
+void remove_watchpoints(Breakpoints *breakpoints, u32 address);
+
+// Called by the memory access of the simulator (only if the cpu->breakpoints is set)
+void check_watchpoints(Breakpoints *breakpoints, u32 address, u32 size, u8 type);
+
+// Executes at most step_count instructions (0 = unlimited), stops before the instruction at a breakpoint which is
+// hit (not before the first one) or after the instruction which hits a watchpoint.
+Debug_Stop debug_continue(CPU *cpu, Breakpoints *breakpoints, u64 step_count);
+
+// Continues to the instruction at the address (a temporary breakpoint), the other breakpoints stop it too
+Debug_Stop debug_run_until(CPU *cpu, Breakpoints *breakpoints, u32 address);
+
+#endif
@@ -0,0 +1,381 @@
+#include "code_map.h"
+#include "decoder.h"
+#include "printer.h"
+#include "simulator.h"
+#include "platform.h"
+
+enum {
+    Code_Byte_Leader  = (1 << 0), // a basic block starts here
+    Code_Byte_Decoded = (1 << 1), // a part of an instruction
+};
+
+static inline u32 image_offset(Code_Map *map, u32 address)
+{
+    return address - map->image_start;
+}
+
+Predecoded_Instruction *find_predecoded(Code_Map *map, u32 address)
+{
+    if (!map || address < map->image_start || address >= map->image_end) return NULL;
+
+    u32 slot = map->index[image_offset(map, address)];
+    if (slot == 0 || !map->instructions[slot-1].valid) return NULL;
+
+    return &map->instructions[slot-1];
+}
+
+void store_predecoded(Code_Map *map, u32 address, Instruction *inst, u32 length, u32 prefix_length)
+{
+    if (!map || address < map->image_start || address + length > map->image_end) return;
+    if (length > CODE_MAX_INSTRUCTION_LENGTH) return;
+
+    u32 *slot = &map->index[image_offset(map, address)];
+    if (*slot == 0) {
+        if (map->instruction_count == map->instruction_capacity) {
+            map->instruction_capacity = map->instruction_capacity ? map->instruction_capacity * 2 : 1024;
+            map->instructions = (Predecoded_Instruction *)realloc(map->instructions, map->instruction_capacity * sizeof(Predecoded_Instruction));
+            assert(map->instructions);
+        }
+        *slot = ++map->instruction_count;
+    }
+
+    // The slot of the offset is reused, so the self-modifying code doesn't grow the array
+    Predecoded_Instruction *predecoded = &map->instructions[*slot - 1];
+    predecoded->inst = *inst;
+    predecoded->inst.mem_address = address;
+    predecoded->length = (u8)length;
+    predecoded->prefix_length = (u8)prefix_length;
+    predecoded->valid = 1;
+
+    for (u32 page = address >> CODE_PAGE_SHIFT; page <= (address + length - 1) >> CODE_PAGE_SHIFT; page++) {
+        map->code_pages[page] = 1;
+    }
+}
+
+void invalidate_code_range(Code_Map *map, u32 address, u32 size)
+{
+    u32 first = address >= map->image_start + CODE_MAX_INSTRUCTION_LENGTH - 1 ? address - (CODE_MAX_INSTRUCTION_LENGTH - 1) : map->image_start;
+    u32 last = address + size < map->image_end ? address + size : map->image_end;
+
+    for (u32 at = first; at < last; at++) {
+        u32 slot = map->index[image_offset(map, at)];
+        if (slot == 0) continue;
+
+        Predecoded_Instruction *predecoded = &map->instructions[slot-1];
+        if (predecoded->valid && at + predecoded->length > address) {
+            predecoded->valid = 0;
+            map->invalidation_count += 1;
+        }
+    }
+}
+
+// Decodes the instruction with its prefixes the same way as the step_instruction(), returns 0 if it's not valid
+static u8 decode_at(CPU *cpu, u32 address, Instruction *inst, u8 *length, u8 *prefix_length)
+{
+    Instruction prefix;
+    const Instruction *pending_prefix = NULL;
+
+    u32 cursor = address;
+    for (;;) {
+        if (cursor - address >= CODE_MAX_INSTRUCTION_LENGTH) return 0;
+
+        u32 size = decode_instruction(cpu->model->opcodes, cpu->memory + cursor, MAX_MEMORY + MEMORY_PADDING - cursor, pending_prefix, inst);
+        if (size == 0) return 0;
+
+        if (!inst->is_prefix) {
+            *prefix_length = (u8)(cursor - address);
+            *length = (u8)(cursor + size - address);
+            return inst->mnemonic != Mnemonic_db && inst->mnemonic != Mnemonic_invalid;
+        }
+
+        prefix = *inst;
+        pending_prefix = &prefix;
+        cursor += size;
+    }
+}
+
+// How the instruction ends the block, Block_End_Count if it's not ending it
+static Block_End classify_instruction(Instruction *inst)
+{
+    Mnemonic m = inst->mnemonic;
+
+    if (inst->operands[0].type == Operand_Relative_Immediate) {
+        if (m == Mnemonic_jmp)  return Block_End_Jump;
+        if (m == Mnemonic_call) return Block_End_Call;
+        return Block_End_Branch;
+    }
+    if (m == Mnemonic_jmp) return Block_End_Indirect;
+    if (m == Mnemonic_ret || m == Mnemonic_retf || m == Mnemonic_iret) return Block_End_Return;
+    if (m == Mnemonic_hlt) return Block_End_Halt;
+
+    return Block_End_Count;
+}
+
+static u32 branch_target(Predecoded_Instruction *predecoded)
+{
+    // The relative target is from the end of the instruction
+    return (u32)(predecoded->inst.mem_address + predecoded->length + predecoded->inst.operands[0].immediate);
+}
+
+typedef struct {
+    u32 *items;
+    u32 count;
+    u32 capacity;
+} Address_Stack;
+
+static void push_address(Address_Stack *stack, u32 address)
+{
+    if (stack->count == stack->capacity) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : 256;
+        stack->items = (u32 *)realloc(stack->items, stack->capacity * sizeof(u32));
+        assert(stack->items);
+    }
+    stack->items[stack->count++] = address;
+}
+
+static void mark_leader(Code_Map *map, u8 *bytes, Address_Stack *work, u32 address)
+{
+    if (address < map->image_start || address >= map->image_end) return;
+
+    bytes[image_offset(map, address)] |= Code_Byte_Leader;
+    push_address(work, address);
+}
+
+static s32 find_block(Code_Map *map, u32 address)
+{
+    s64 lo = 0, hi = (s64)map->block_count - 1;
+    while (lo <= hi) {
+        s64 mid = (lo + hi) / 2;
+        if (map->blocks[mid].start == address) return (s32)mid;
+        if (map->blocks[mid].start < address) lo = mid + 1;
+        else                                  hi = mid - 1;
+    }
+    return -1;
+}
+
+void build_code_map(CPU *cpu)
+{
+    double start = seconds_now();
+
+    destroy_code_map(cpu);
+
+    Code_Map *map = (Code_Map *)calloc(1, sizeof(Code_Map));
+    assert(map);
+    map->image_start = cpu->exec_start;
+    map->image_end = cpu->exec_end;
+
+    u32 image_size = map->image_end - map->image_start;
+    map->index = (u32 *)calloc(image_size ? image_size : 1, sizeof(u32));
+    u8 *bytes = (u8 *)calloc(image_size ? image_size : 1, 1);
+    assert(map->index && bytes);
+
+    // Tracing from the entry point, every instruction is decoded once
+    Address_Stack work = {0};
+    mark_leader(map, bytes, &work, calc_inst_pointer_address(cpu));
+
+    while (work.count) {
+        u32 address = work.items[--work.count];
+
+        while (address >= map->image_start && address < map->image_end) {
+            u32 offset = image_offset(map, address);
+            if (bytes[offset] & Code_Byte_Decoded) break; // already traced (or it's inside of an instruction)
+
+            Instruction inst;
+            u8 length, prefix_length;
+            if (!decode_at(cpu, address, &inst, &length, &prefix_length) || address + length > map->image_end) break;
+
+            u8 overlap = 0;
+            for (u32 i = 1; i < length; i++) {
+                if (bytes[offset + i] & Code_Byte_Decoded) overlap = 1;
+            }
+            if (overlap) break;
+
+            for (u32 i = 0; i < length; i++) {
+                bytes[offset + i] |= Code_Byte_Decoded;
+            }
+            store_predecoded(map, address, &inst, length, prefix_length);
+
+            Predecoded_Instruction *predecoded = find_predecoded(map, address);
+            Block_End end = classify_instruction(&predecoded->inst);
+            if (end == Block_End_Count) {
+                address += length;
+                continue;
+            }
+
+            if (end == Block_End_Jump || end == Block_End_Branch || end == Block_End_Call) {
+                mark_leader(map, bytes, &work, branch_target(predecoded));
+            }
+            if (end == Block_End_Branch || end == Block_End_Call) {
+                mark_leader(map, bytes, &work, address + length);
+            }
+            break;
+        }
+    }
+
+    map->static_instruction_count = map->instruction_count;
+
+    // The basic blocks, from every leader until the next leader or the end of the traced code
+    u32 block_capacity = 0;
+    for (u32 offset = 0; offset < image_size; offset++) {
+        if (!(bytes[offset] & Code_Byte_Leader) || map->index[offset] == 0) continue;
+
+        if (map->block_count == block_capacity) {
+            block_capacity = block_capacity ? block_capacity * 2 : 256;
+            map->blocks = (Basic_Block *)realloc(map->blocks, block_capacity * sizeof(Basic_Block));
+            assert(map->blocks);
+        }
+
+        Basic_Block *block = &map->blocks[map->block_count++];
+        block->start = map->image_start + offset;
+        block->instruction_count = 0;
+        block->successors[0] = block->successors[1] = -1;
+        block->end_kind = Block_End_Invalid;
+
+        u32 address = block->start;
+        for (;;) {
+            Predecoded_Instruction *predecoded = find_predecoded(map, address);
+            if (!predecoded) {
+                block->end_kind = Block_End_Invalid;
+                break;
+            }
+
+            block->instruction_count += 1;
+            address += predecoded->length;
+
+            Block_End end = classify_instruction(&predecoded->inst);
+            if (end != Block_End_Count) {
+                block->end_kind = end;
+                break;
+            }
+            if (address < map->image_end && (bytes[image_offset(map, address)] & Code_Byte_Leader)) {
+                block->end_kind = Block_End_Fallthrough;
+                break;
+            }
+        }
+        block->end = address;
+    }
+
+    // The edges, the blocks are sorted by the start
+    for (u32 i = 0; i < map->block_count; i++) {
+        Basic_Block *block = &map->blocks[i];
+
+        u32 last = block->start;
+        for (u32 n = 1; n < block->instruction_count; n++) {
+            last += find_predecoded(map, last)->length;
+        }
+        Predecoded_Instruction *predecoded = find_predecoded(map, last);
+
+        switch (block->end_kind) {
+            case Block_End_Fallthrough: {
+                block->successors[0] = find_block(map, block->end);
+                break;
+            }
+            case Block_End_Jump: {
+                block->successors[0] = find_block(map, branch_target(predecoded));
+                break;
+            }
+            case Block_End_Branch:
+            case Block_End_Call: {
+                block->successors[0] = find_block(map, branch_target(predecoded));
+                block->successors[1] = find_block(map, block->end);
+                break;
+            }
+            default: break;
+        }
+    }
+
+    free(bytes);
+    free(work.items);
+
+    map->build_seconds = seconds_now() - start;
+    cpu->code_map = map;
+}
+
+void destroy_code_map(CPU *cpu)
+{
+    Code_Map *map = cpu->code_map;
+    if (!map) return;
+
+    free(map->index);
+    free(map->instructions);
+    free(map->blocks);
+    free(map);
+
+    cpu->code_map = NULL;
+}
+
+static void write_dot_escaped(FILE *fp, const char *text, u32 length)
+{
+    for (u32 i = 0; i < length; i++) {
+        char c = text[i];
+        if (c == '"' || c == '\\' || c == '{' || c == '}' || c == '<' || c == '>' || c == '|') fputc('\\', fp);
+        if (c == '\n') {
+            fputs("\\l", fp);
+        } else if (c == '\t') {
+            fputs("  ", fp);
+        } else {
+            fputc(c, fp);
+        }
+    }
+}
+
+u8 write_code_map_dot(Code_Map *map, char *filename)
+{
+    FILE *fp = fopen(filename, "w");
+    if (!fp) return 0;
+
+    static const char *const edge_labels[Block_End_Count][2] = {
+        [Block_End_Fallthrough] = {"", ""},
+        [Block_End_Jump]        = {"jmp", ""},
+        [Block_End_Branch]      = {"taken", "not taken"},
+        [Block_End_Call]        = {"call", "return"},
+    };
+
+    fprintf(fp, "digraph cfg {\n");
+    fprintf(fp, "    node [shape=box, fontname=\"monospace\"];\n");
+
+    Format_Options format = {0};
+    format.image_start = map->image_start;
+    format.image_end = map->image_end;
+
+    for (u32 i = 0; i < map->block_count; i++) {
+        Basic_Block *block = &map->blocks[i];
+
+        fprintf(fp, "    b%u [label=\"", i);
+
+        u32 address = block->start;
+        for (u32 n = 0; n < block->instruction_count; n++) {
+            Predecoded_Instruction *predecoded = find_predecoded(map, address);
+
+            char text[MAX_FORMATTED_INSTRUCTION_SIZE];
+            u32 length = format_instruction(&predecoded->inst, &format, text, sizeof(text));
+            text[length++] = '\n';
+            write_dot_escaped(fp, text, length);
+
+            address += predecoded->length;
+        }
+
+        fprintf(fp, "\"];\n");
+    }
+
+    for (u32 i = 0; i < map->block_count; i++) {
+        Basic_Block *block = &map->blocks[i];
+        for (u32 j = 0; j < 2; j++) {
+            if (block->successors[j] < 0) continue;
+
+            const char *label = edge_labels[block->end_kind][j];
+            if (label && label[0]) {
+                fprintf(fp, "    b%u -> b%d [label=\"%s\"];\n", i, block->successors[j], label);
+            } else {
+                fprintf(fp, "    b%u -> b%d;\n", i, block->successors[j]);
+            }
+        }
+    }
+
+    fprintf(fp, "}\n");
+
+    u8 ok = !ferror(fp);
+    fclose(fp);
+
+    return ok;
+}
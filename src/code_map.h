@@ -0,0 +1,93 @@
+#ifndef _H_CODE_MAP
+#define _H_CODE_MAP
+
+#include "sim86.h"
+
+// Load-time analysis of the loaded image. The code is traced from the entry point (following the jumps, the calls
+// and the branches), every reached instruction is decoded once into a flat array which is indexed by the offset
+// in the image, and the basic blocks with their edges are collected into the control-flow graph.
+//
+// The step_instruction() takes the instruction from here instead of decoding it again. The instructions which are
+// not found by the analysis (e.g. the targets of the indirect jumps) are decoded at the first execution and stored
+// too. A write into a page which has code invalidates the instructions which are overlapping the written bytes,
+// so the self-modifying code is decoded again. The graph is not updated, it's the result of the static analysis.
+
+#define CODE_PAGE_SHIFT 8 // 256 byte pages
+#define CODE_PAGE_COUNT ((MAX_MEMORY >> CODE_PAGE_SHIFT) + 1) // +1 for the word write at the end of the memory
+
+// The longer ones (a lot of repeated prefixes) are not stored, so the invalidation looks back only this much
+#define CODE_MAX_INSTRUCTION_LENGTH 16
+
+typedef struct {
+    Instruction inst;       // with the prefixes, the mem_address is the absolute address of the first prefix
+    u8 length;              // with the prefixes
+    u8 prefix_length;
+    u8 valid;               // 0 if it's invalidated by a write
+} Predecoded_Instruction;
+
+// How the basic block is ended
+typedef enum {
+    Block_End_Fallthrough,  // the next instruction is a leader
+    Block_End_Jump,
+    Block_End_Branch,       // conditional, the jump and the fallthrough
+    Block_End_Call,         // the call and the return address
+    Block_End_Return,
+    Block_End_Indirect,     // indirect or far jump, the target is not known
+    Block_End_Halt,
+    Block_End_Invalid,      // not an instruction, or the end of the image
+
+    Block_End_Count,
+} Block_End;
+
+typedef struct {
+    u32 start;              // absolute address
+    u32 end;                // after the last instruction
+    u32 instruction_count;
+    s32 successors[2];      // the index of the block, -1 if not exists (or it's outside of the image)
+    Block_End end_kind;
+} Basic_Block;
+
+struct Code_Map {
+    u32 image_start;
+    u32 image_end;
+
+    u32 *index;             // per byte of the image, 0 = not decoded, otherwise 1 + the index in the instructions
+    Predecoded_Instruction *instructions;
+    u32 instruction_count;
+    u32 instruction_capacity;
+
+    u8 code_pages[CODE_PAGE_COUNT]; // 1 if the page has an instruction
+
+    Basic_Block *blocks;    // sorted by the start
+    u32 block_count;
+
+    // Statistics
+    u32 static_instruction_count; // found by the analysis
+    double build_seconds;
+    u64 hit_count;
+    u64 miss_count;
+    u64 invalidation_count;
+};
+
+// Analyses the image which is loaded to the [exec_start, exec_end) of the memory, the entry point is the cs:ip
+void build_code_map(CPU *cpu);
+void destroy_code_map(CPU *cpu);
+
+// Returns NULL if the instruction at the address is not decoded yet (or it's invalidated)
+Predecoded_Instruction *find_predecoded(Code_Map *map, u32 address);
+void store_predecoded(Code_Map *map, u32 address, Instruction *inst, u32 length, u32 prefix_length);
+
+// Graphviz DOT, returns 0 if the file can't be written
+u8 write_code_map_dot(Code_Map *map, char *filename);
+
+void invalidate_code_range(Code_Map *map, u32 address, u32 size);
+
+// Must be called at every write into the memory, it's cheap if the page has no code
+static inline void invalidate_code(Code_Map *map, u32 address, u32 size)
+{
+    if (map && (map->code_pages[address >> CODE_PAGE_SHIFT] || map->code_pages[(address + size - 1) >> CODE_PAGE_SHIFT])) {
+        invalidate_code_range(map, address, size);
+    }
+}
+
+#endif
@@ -0,0 +1,413 @@
+#include "condition.h"
+#include "simulator.h"
+#include "printer.h"
+
+#include <ctype.h>
+
+typedef struct {
+    const char *source;
+    const char *at;
+    Break_Condition *condition;
+
+    u32 stack_size;
+    u8 failed;
+} Condition_Parser;
+
+typedef struct {
+    const char *token;
+    Condition_Op op;
+    u8 level; // the higher is the stronger
+} Binary_Operator;
+
+// The two character operators are before their prefixes
+static const Binary_Operator binary_operators[] = {
+    {"||", Condition_Op_Logical_Or,    0},
+    {"&&", Condition_Op_Logical_And,   1},
+    {"==", Condition_Op_Equal,         5},
+    {"!=", Condition_Op_Not_Equal,     5},
+    {"<<", Condition_Op_Shift_Left,    7},
+    {">>", Condition_Op_Shift_Right,   7},
+    {"<=", Condition_Op_Less_Equal,    6},
+    {">=", Condition_Op_Greater_Equal, 6},
+    {"|",  Condition_Op_Or,            2},
+    {"^",  Condition_Op_Xor,           3},
+    {"&",  Condition_Op_And,           4},
+    {"<",  Condition_Op_Less,          6},
+    {">",  Condition_Op_Greater,       6},
+    {"+",  Condition_Op_Add,           8},
+    {"-",  Condition_Op_Subtract,      8},
+    {"*",  Condition_Op_Multiply,      9},
+};
+#define CONDITION_MAX_LEVEL 9
+
+typedef struct {
+    const char *name;
+    u16 mask;
+} Condition_Flag;
+
+static const Condition_Flag condition_flags[] = {
+    {"cf", F_CARRY}, {"pf", F_PARITY}, {"af", F_AUXILIARY}, {"zf", F_ZERO}, {"sf", F_SIGNED},
+    {"tf", F_TRAP}, {"if", F_INTERRUPT}, {"df", F_DIRECTION}, {"of", F_OVERFLOW},
+};
+
+static void parse_error(Condition_Parser *parser, const char *message)
+{
+    if (!parser->failed) {
+        fprintf(stderr, "[WARNING]: Invalid condition at column %d: %s\n", (int)(parser->at - parser->source) + 1, message);
+    }
+    parser->failed = 1;
+}
+
+static void emit(Condition_Parser *parser, Condition_Op op, u32 operand)
+{
+    if (parser->failed) return;
+
+    Break_Condition *condition = parser->condition;
+    if (condition->code_size == CONDITION_MAX_CODE_SIZE) {
+        parse_error(parser, "the condition is too long");
+        return;
+    }
+    Condition_Code *code = &condition->code[condition->code_size++];
+    code->op = op;
+    if (op == Condition_Op_Register) {
+        code->reg = register_access_by_enum((Register)operand);
+    } else {
+        code->operand = operand;
+    }
+
+    // The operands are pushed, the unary operators are in place, the binary operators pop one
+    if (op <= Condition_Op_Load_Word) {
+        parser->stack_size += 1;
+    } else if (op > Condition_Op_Negate) {
+        parser->stack_size -= 1;
+    }
+    if (parser->stack_size > CONDITION_MAX_STACK_SIZE) {
+        parse_error(parser, "the condition is too deep");
+    }
+}
+
+static void skip_spaces(Condition_Parser *parser)
+{
+    while (isspace((u8)*parser->at)) parser->at++;
+}
+
+static u8 accept_char(Condition_Parser *parser, char c)
+{
+    skip_spaces(parser);
+    if (*parser->at != c) return 0;
+    parser->at++;
+    return 1;
+}
+
+// Reads a lowercase identifier into the name, returns its length (0 if it's not an identifier)
+static u32 read_identifier(Condition_Parser *parser, char *name, u32 capacity)
+{
+    skip_spaces(parser);
+
+    u32 length = 0;
+    while (isalpha((u8)parser->at[length])) {
+        if (length + 1 < capacity) name[length] = (char)tolower((u8)parser->at[length]);
+        length++;
+    }
+    name[length < capacity ? length : capacity - 1] = 0;
+
+    return length;
+}
+
+static Register find_register(const char *name)
+{
+    for (u32 reg = Register_al; reg <= Register_ip; reg++) {
+        if (STR_EQUAL(register_name((Register)reg), name)) return (Register)reg;
+    }
+    return Register_none;
+}
+
+// [byte|word] [segment:] [<effective address>], the size and the segment are already parsed
+static void parse_memory(Condition_Parser *parser, u8 wide, Register segment)
+{
+    if (!accept_char(parser, '[')) {
+        parse_error(parser, "expected [");
+        return;
+    }
+
+    u8 bx = 0, bp = 0, si = 0, di = 0;
+    s32 displacement = 0;
+
+    do {
+        s32 sign = 1;
+        while (accept_char(parser, '-')) sign = -sign;
+        skip_spaces(parser);
+
+        if (isdigit((u8)*parser->at)) {
+            char *end;
+            displacement += sign * (s32)strtoul(parser->at, &end, 0);
+            parser->at = end;
+            continue;
+        }
+
+        char name[8];
+        u32 length = read_identifier(parser, name, sizeof(name));
+        Register reg = find_register(name);
+        if (sign < 0 || (reg != Register_bx && reg != Register_bp && reg != Register_si && reg != Register_di)) {
+            parse_error(parser, "expected bx, bp, si, di or a number in the address");
+            return;
+        }
+        parser->at += length;
+
+        if (reg == Register_bx) bx++;
+        if (reg == Register_bp) bp++;
+        if (reg == Register_si) si++;
+        if (reg == Register_di) di++;
+    } while (accept_char(parser, '+') || (skip_spaces(parser), *parser->at == '-'));
+
+    if (!accept_char(parser, ']')) {
+        parse_error(parser, "expected ]");
+        return;
+    }
+    if (bx + bp > 1 || si + di > 1) {
+        parse_error(parser, "not an 8086 effective address");
+        return;
+    }
+
+    Break_Condition *condition = parser->condition;
+    if (condition->address_count == CONDITION_MAX_ADDRESS_COUNT) {
+        parse_error(parser, "too many memory operands");
+        return;
+    }
+
+    Effective_Address_Base base = Effective_Address_direct;
+    if      (bx && si) base = Effective_Address_bx_si;
+    else if (bx && di) base = Effective_Address_bx_di;
+    else if (bp && si) base = Effective_Address_bp_si;
+    else if (bp && di) base = Effective_Address_bp_di;
+    else if (si)       base = Effective_Address_si;
+    else if (di)       base = Effective_Address_di;
+    else if (bp)       base = Effective_Address_bp;
+    else if (bx)       base = Effective_Address_bx;
+
+    Condition_Address *address = &condition->addresses[condition->address_count];
+    ZERO_MEMORY(address, sizeof(Condition_Address));
+    address->expression.base = base;
+    address->expression.displacement = displacement;
+    address->segment = segment;
+
+    emit(parser, wide ? Condition_Op_Load_Word : Condition_Op_Load_Byte, condition->address_count++);
+}
+
+static void parse_binary(Condition_Parser *parser, u32 level);
+
+static void parse_primary(Condition_Parser *parser)
+{
+    skip_spaces(parser);
+
+    if (accept_char(parser, '(')) {
+        parse_binary(parser, 0);
+        if (!accept_char(parser, ')')) parse_error(parser, "expected )");
+        return;
+    }
+
+    if (isdigit((u8)*parser->at)) {
+        char *end;
+        emit(parser, Condition_Op_Constant, (u32)strtoul(parser->at, &end, 0));
+        parser->at = end;
+        return;
+    }
+
+    if (*parser->at == '[') {
+        parse_memory(parser, 0, Register_none);
+        return;
+    }
+
+    char name[16];
+    u32 length = read_identifier(parser, name, sizeof(name));
+    if (length == 0) {
+        parse_error(parser, "expected a number, a register, a flag or a memory operand");
+        return;
+    }
+    parser->at += length;
+
+    u8 sized = 0;
+    u8 wide = 0;
+    if (STR_EQUAL(name, "byte") || STR_EQUAL(name, "word")) {
+        sized = 1;
+        wide = name[0] == 'w';
+
+        skip_spaces(parser);
+        if (*parser->at == '[') {
+            parse_memory(parser, wide, Register_none);
+            return;
+        }
+        length = read_identifier(parser, name, sizeof(name));
+        parser->at += length;
+    }
+
+    Register reg = find_register(name);
+
+    // The segment prefix of a memory operand
+    if (reg >= Register_es && reg <= Register_ds && accept_char(parser, ':')) {
+        parse_memory(parser, wide, reg);
+        return;
+    }
+    if (sized) {
+        parse_error(parser, "expected a memory operand after the size");
+        return;
+    }
+
+    if (reg == Register_ip) {
+        emit(parser, Condition_Op_Ip, 0);
+        return;
+    }
+    if (reg != Register_none) {
+        emit(parser, Condition_Op_Register, reg);
+        return;
+    }
+    if (STR_EQUAL(name, "flags")) {
+        emit(parser, Condition_Op_Flags, 0);
+        return;
+    }
+    for (u32 i = 0; i < ARRAY_SIZE(condition_flags); i++) {
+        if (STR_EQUAL(name, condition_flags[i].name)) {
+            emit(parser, Condition_Op_Flags, condition_flags[i].mask);
+            return;
+        }
+    }
+
+    parser->at -= length;
+    parse_error(parser, "unknown name");
+}
+
+static void parse_unary(Condition_Parser *parser)
+{
+    if (accept_char(parser, '!')) {
+        parse_unary(parser);
+        emit(parser, Condition_Op_Not, 0);
+    } else if (accept_char(parser, '~')) {
+        parse_unary(parser);
+        emit(parser, Condition_Op_Complement, 0);
+    } else if (accept_char(parser, '-')) {
+        parse_unary(parser);
+        emit(parser, Condition_Op_Negate, 0);
+    } else {
+        parse_primary(parser);
+    }
+}
+
+static const Binary_Operator *peek_binary_operator(Condition_Parser *parser)
+{
+    skip_spaces(parser);
+    for (u32 i = 0; i < ARRAY_SIZE(binary_operators); i++) {
+        const char *token = binary_operators[i].token;
+        if (strncmp(parser->at, token, strlen(token)) == 0) return &binary_operators[i];
+    }
+    return NULL;
+}
+
+static void parse_binary(Condition_Parser *parser, u32 level)
+{
+    if (level > CONDITION_MAX_LEVEL) {
+        parse_unary(parser);
+        return;
+    }
+
+    parse_binary(parser, level + 1);
+
+    const Binary_Operator *op;
+    while (!parser->failed && (op = peek_binary_operator(parser)) && op->level == level) {
+        parser->at += strlen(op->token);
+        parse_binary(parser, level + 1);
+        emit(parser, op->op, 0);
+    }
+}
+
+u8 compile_condition(const char *source, Break_Condition *condition)
+{
+    ZERO_MEMORY(condition, sizeof(Break_Condition));
+    snprintf(condition->source, sizeof(condition->source), "%s", source);
+
+    Condition_Parser parser = {0};
+    parser.source = source;
+    parser.at = source;
+    parser.condition = condition;
+
+    parse_binary(&parser, 0);
+
+    skip_spaces(&parser);
+    if (*parser.at) {
+        parse_error(&parser, "unexpected character");
+    }
+
+    return !parser.failed;
+}
+
+// The memory operand as the operand of the current instruction, the instruction state is restored after
+static u32 load_condition_memory(CPU *cpu, Condition_Address *address, u8 wide)
+{
+    Instruction_Flag flags = cpu->instruction.flags;
+    Register segment = cpu->instruction.extend_with_this_segment;
+
+    cpu->instruction.flags = wide ? Inst_Wide : 0;
+    cpu->instruction.extend_with_this_segment = address->segment;
+    if (address->segment != Register_none) {
+        cpu->instruction.flags |= Inst_Segment;
+    }
+
+    u32 value = read_memory(cpu, calc_absolute_memory_address(cpu, &address->expression));
+
+    cpu->instruction.flags = flags;
+    cpu->instruction.extend_with_this_segment = segment;
+
+    return value;
+}
+
+u32 evaluate_condition(Break_Condition *condition, CPU *cpu)
+{
+    u32 stack[CONDITION_MAX_STACK_SIZE];
+    u32 top = 0;
+
+    for (u32 i = 0; i < condition->code_size; i++) {
+        Condition_Code *code = &condition->code[i];
+
+        switch (code->op) {
+            case Condition_Op_Constant:  stack[top++] = code->operand; break;
+            case Condition_Op_Register:  stack[top++] = get_data_from_register(cpu, code->reg); break;
+            case Condition_Op_Ip:        stack[top++] = cpu->ip; break;
+            case Condition_Op_Flags:     stack[top++] = code->operand ? (cpu->flags & code->operand) != 0 : cpu->flags; break;
+            case Condition_Op_Load_Byte: stack[top++] = load_condition_memory(cpu, &condition->addresses[code->operand], 0); break;
+            case Condition_Op_Load_Word: stack[top++] = load_condition_memory(cpu, &condition->addresses[code->operand], 1); break;
+
+            case Condition_Op_Not:        stack[top-1] = !stack[top-1]; break;
+            case Condition_Op_Complement: stack[top-1] = ~stack[top-1]; break;
+            case Condition_Op_Negate:     stack[top-1] = -stack[top-1]; break;
+
+            default: {
+                u32 b = stack[--top];
+                u32 a = stack[top-1];
+                u32 result = 0;
+
+                switch (code->op) {
+                    case Condition_Op_Multiply:      result = a * b; break;
+                    case Condition_Op_Add:           result = a + b; break;
+                    case Condition_Op_Subtract:      result = a - b; break;
+                    case Condition_Op_Shift_Left:    result = a << (b & 31); break;
+                    case Condition_Op_Shift_Right:   result = a >> (b & 31); break;
+                    case Condition_Op_Less:          result = a < b; break;
+                    case Condition_Op_Less_Equal:    result = a <= b; break;
+                    case Condition_Op_Greater:       result = a > b; break;
+                    case Condition_Op_Greater_Equal: result = a >= b; break;
+                    case Condition_Op_Equal:         result = a == b; break;
+                    case Condition_Op_Not_Equal:     result = a != b; break;
+                    case Condition_Op_And:           result = a & b; break;
+                    case Condition_Op_Xor:           result = a ^ b; break;
+                    case Condition_Op_Or:            result = a | b; break;
+                    case Condition_Op_Logical_And:   result = a && b; break;
+                    case Condition_Op_Logical_Or:    result = a || b; break;
+                    default: assert(0);
+                }
+
+                stack[top-1] = result;
+            } break;
+        }
+    }
+
+    return top ? stack[0] : 0;
+}
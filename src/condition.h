@@ -0,0 +1,85 @@
+#ifndef _H_CONDITION
+#define _H_CONDITION
+
+#include "sim86.h"
+
+// Conditions of the conditional breakpoints (b <address> if <condition>, see the debugger.h), compiled once to a
+// small stack bytecode, which is evaluated only when the breakpoint bitmap is hit.
+//
+//     cx == 3 && [bp+2] > 0x80
+//     word [bx+si-4] != ax || zf
+//     es:[di] == 0x41 && !(flags & 0x400)
+//
+// The operands are the numbers (C syntax), the registers (ax..di, al..bh, es..ds, ip), the flags (cf, pf, af, zf,
+// sf, tf, if, df, of are 0 or 1, flags is the whole register) and the memory: [byte|word] [segment:] [<address>]
+// where the address is an 8086 effective address (bx/bp + si/di + displacement). The memory address is calculated
+// by the calc_absolute_memory_address() as the address of an instruction operand, the default is the byte.
+//
+// The operators in the C precedence: ! ~ - (unary), *, + -, << >>, < <= > >=, == !=, &, ^, |, &&, ||. The values
+// are 32 bit unsigned. The && and the || are not short-circuit (there are no side effects).
+
+#define CONDITION_MAX_CODE_SIZE     64
+#define CONDITION_MAX_STACK_SIZE    16
+#define CONDITION_MAX_ADDRESS_COUNT 8
+
+typedef enum {
+    Condition_Op_Constant,  // operand = the value
+    Condition_Op_Register,  // reg
+    Condition_Op_Ip,
+    Condition_Op_Flags,     // operand = the mask, 0 = the whole register
+    Condition_Op_Load_Byte, // operand = the index of the address
+    Condition_Op_Load_Word,
+
+    // Unary
+    Condition_Op_Not,
+    Condition_Op_Complement,
+    Condition_Op_Negate,
+
+    // Binary
+    Condition_Op_Multiply,
+    Condition_Op_Add,
+    Condition_Op_Subtract,
+    Condition_Op_Shift_Left,
+    Condition_Op_Shift_Right,
+    Condition_Op_Less,
+    Condition_Op_Less_Equal,
+    Condition_Op_Greater,
+    Condition_Op_Greater_Equal,
+    Condition_Op_Equal,
+    Condition_Op_Not_Equal,
+    Condition_Op_And,
+    Condition_Op_Xor,
+    Condition_Op_Or,
+    Condition_Op_Logical_And,
+    Condition_Op_Logical_Or,
+} Condition_Op;
+
+typedef struct {
+    u8 op;        // Condition_Op
+    union {
+        u32 operand;
+        Register_Access *reg; // resolved at the compile
+    };
+} Condition_Code;
+
+typedef struct {
+    Effective_Address_Expression expression;
+    Register segment; // the segment prefix, Register_none if there is no one
+} Condition_Address;
+
+typedef struct {
+    Condition_Code code[CONDITION_MAX_CODE_SIZE];
+    u32 code_size;
+
+    Condition_Address addresses[CONDITION_MAX_ADDRESS_COUNT];
+    u32 address_count;
+
+    char source[128]; // for the printing
+} Break_Condition;
+
+// Returns 0 and prints the error if the source is not a valid condition
+u8 compile_condition(const char *source, Break_Condition *condition);
+
+u32 evaluate_condition(Break_Condition *condition, CPU *cpu);
+
+#endif
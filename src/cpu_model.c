@@ -0,0 +1,42 @@
+#include "cpu_model.h"
+#include "simulator.h"
+#include "i80186table.h"
+
+const CPU_Model cpu_models[CPU_Model_Count] = {
+    [CPU_Model_8086] = {
+        .type = CPU_Model_8086,
+        .name = "8086",
+        .opcodes = i8086_inst_table,
+        .alu_binary_functions = alu_binary_functions,
+        .alu_multiply_functions = alu_multiply_functions,
+        .estimate_cycles = estimate_instruction_cycles,
+    },
+    [CPU_Model_8088] = {
+        .type = CPU_Model_8088,
+        .name = "8088",
+        .opcodes = i8086_inst_table,
+        .alu_binary_functions = alu_binary_functions,
+        .alu_multiply_functions = alu_multiply_functions,
+        .estimate_cycles = estimate_8088_cycles,
+    },
+    [CPU_Model_80186] = {
+        .type = CPU_Model_80186,
+        .name = "80186",
+        .opcodes = i80186_inst_table,
+        .alu_binary_functions = alu_binary_functions_80186,
+        .alu_multiply_functions = alu_multiply_functions_80186,
+        .estimate_cycles = estimate_instruction_cycles,
+        .invalid_opcode_interrupt = 1,
+    },
+};
+
+const CPU_Model *find_cpu_model(const char *name)
+{
+    for (u32 i = 0; i < CPU_Model_Count; i++) {
+        if (STR_EQUAL(cpu_models[i].name, name)) {
+            return &cpu_models[i];
+        }
+    }
+
+    return NULL;
+}
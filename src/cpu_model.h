@@ -0,0 +1,48 @@
+#ifndef _H_CPU_MODEL
+#define _H_CPU_MODEL
+
+#include "sim86.h"
+#include "alu.h"
+
+// The emulated cpu (--cpu 8086|8088|80186). Everything which differs between the models is a table or a function
+// of the model, which is picked once at the start, so the execute_instruction() never checks the model:
+//
+//     8086   the default
+//     8088   the 8086 with the 8-bit data bus, every word transfer of the memory takes 4 more cycles
+//     80186  the opcodes of the i80186table.h (pusha, popa, bound, push imm, imul imm, ins, outs, shifts by imm,
+//            enter, leave), the shift counts are masked to 5 bits, the idiv can return the -128 and the -32768, and
+//            the undefined opcodes are the invalid opcode interrupt (int 6)
+//
+// @Incomplete: The 80186 runs the 8086 instructions in fewer cycles (the effective address is calculated by its
+// own unit), those are estimated by the 8086 table. The prefetch queue of the 8088 (4 bytes, 1 byte per bus cycle)
+// is not modeled.
+
+typedef enum {
+    CPU_Model_8086,
+    CPU_Model_8088,
+    CPU_Model_80186,
+
+    CPU_Model_Count,
+} CPU_Model_Type;
+
+// See the estimate_instruction_cycles()
+typedef u32 Estimate_Cycles_Function(CPU *cpu, Instruction *i, u8 branch_taken, u32 repeat_count);
+
+struct CPU_Model {
+    CPU_Model_Type type;
+    const char *name;
+
+    const i8086_Inst_Table *opcodes;                      // [256], see the decode_instruction()
+    Alu_Binary_Function *(*alu_binary_functions)[2];      // [Mnemonic_count][2], see the alu.h
+    Alu_Multiply_Function *(*alu_multiply_functions)[2];
+    Estimate_Cycles_Function *estimate_cycles;
+
+    u8 invalid_opcode_interrupt; // the undefined opcodes are the int 6, otherwise the run is stopped at them
+};
+
+extern const CPU_Model cpu_models[CPU_Model_Count];
+
+// By the name of the --cpu, NULL if there is no such model
+const CPU_Model *find_cpu_model(const char *name);
+
+#endif
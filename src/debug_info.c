@@ -0,0 +1,142 @@
+#include "debug_info.h"
+#include "platform.h"
+
+static u8 *map_debug_info_file(char *binary_filename, char *extension, u64 *size)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s%s", binary_filename, extension);
+    return map_file(path, size);
+}
+
+// The offset has to point into the string table and the string has to end in it
+static u8 is_valid_string(const char *strings, u32 string_table_size, u32 offset)
+{
+    return offset < string_table_size && memchr(strings + offset, 0, string_table_size - offset) != NULL;
+}
+
+u8 load_debug_info(Debug_Info *info, char *binary_filename, u32 image_size)
+{
+    ZERO_MEMORY(info, sizeof(Debug_Info));
+    info->image_size = image_size;
+
+    info->line_file = map_debug_info_file(binary_filename, ".lines", &info->line_file_size);
+    if (info->line_file) {
+        // The header is checked only if the file is large enough for it
+        Line_Table_Header *header = (Line_Table_Header *)info->line_file;
+        u8 valid = info->line_file_size >= sizeof(Line_Table_Header) &&
+                   header->magic == LINE_TABLE_MAGIC && header->version == DEBUG_INFO_VERSION;
+        if (valid) {
+            u64 expected = sizeof(Line_Table_Header) + (u64)header->entry_count * sizeof(Line_Table_Entry)
+                         + (u64)header->file_count * sizeof(u32) + header->string_table_size;
+            valid = expected <= info->line_file_size;
+        }
+
+        if (valid) {
+            Line_Table_Entry *lines = (Line_Table_Entry *)(header + 1);
+            u32 *file_names = (u32 *)(lines + header->entry_count);
+            char *strings = (char *)(file_names + header->file_count);
+            for (u32 i = 0; i < header->file_count && valid; i++) {
+                valid = is_valid_string(strings, header->string_table_size, file_names[i]);
+            }
+
+            if (valid) {
+                info->line_header  = header;
+                info->lines        = lines;
+                info->file_names   = file_names;
+                info->line_strings = strings;
+            }
+        }
+        if (!valid) {
+            fprintf(stderr, "[WARNING]: Invalid line table for %s\n", binary_filename);
+        }
+    }
+
+    info->symbol_file = map_debug_info_file(binary_filename, ".syms", &info->symbol_file_size);
+    if (info->symbol_file) {
+        Symbol_Table_Header *header = (Symbol_Table_Header *)info->symbol_file;
+        u8 valid = info->symbol_file_size >= sizeof(Symbol_Table_Header) &&
+                   header->magic == SYMBOL_TABLE_MAGIC && header->version == DEBUG_INFO_VERSION;
+        if (valid) {
+            u64 expected = sizeof(Symbol_Table_Header) + (u64)header->entry_count * sizeof(Symbol_Table_Entry) + header->string_table_size;
+            valid = expected <= info->symbol_file_size;
+        }
+
+        if (valid) {
+            Symbol_Table_Entry *symbols = (Symbol_Table_Entry *)(header + 1);
+            char *strings = (char *)(symbols + header->entry_count);
+            for (u32 i = 0; i < header->entry_count && valid; i++) {
+                valid = is_valid_string(strings, header->string_table_size, symbols[i].name);
+            }
+
+            if (valid) {
+                info->symbol_header  = header;
+                info->symbols        = symbols;
+                info->symbol_strings = strings;
+            }
+        }
+        if (!valid) {
+            fprintf(stderr, "[WARNING]: Invalid symbol table for %s\n", binary_filename);
+        }
+    }
+
+    return info->line_header != NULL || info->symbol_header != NULL;
+}
+
+void unload_debug_info(Debug_Info *info)
+{
+    unmap_file(info->line_file, info->line_file_size);
+    unmap_file(info->symbol_file, info->symbol_file_size);
+    ZERO_MEMORY(info, sizeof(Debug_Info));
+}
+
+u8 find_source_line(Debug_Info *info, u32 address, const char **file, u32 *line)
+{
+    if (!info || !info->line_header) return 0;
+
+    // The last entry which starts at or before the address
+    s64 lo = 0, hi = (s64)info->line_header->entry_count - 1, found = -1;
+    while (lo <= hi) {
+        s64 mid = (lo + hi) / 2;
+        if (info->lines[mid].start <= address) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    if (found < 0 || address >= info->lines[found].end) return 0;
+
+    Line_Table_Entry *entry = &info->lines[found];
+    *file = entry->file < info->line_header->file_count ? info->line_strings + info->file_names[entry->file] : "?";
+    *line = entry->line;
+
+    return 1;
+}
+
+u8 find_symbol(Debug_Info *info, u32 address, const char **name, u32 *offset)
+{
+    if (!info || !info->symbol_header) return 0;
+    if (address >= info->image_size) return 0;
+
+    // The last symbol at or before the address. If more label points to the same address, then the first one.
+    s64 lo = 0, hi = (s64)info->symbol_header->entry_count - 1, found = -1;
+    while (lo <= hi) {
+        s64 mid = (lo + hi) / 2;
+        if (info->symbols[mid].address <= address) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    if (found < 0) return 0;
+
+    while (found > 0 && info->symbols[found-1].address == info->symbols[found].address) found--;
+
+    *name   = info->symbol_strings + info->symbols[found].name;
+    *offset = address - info->symbols[found].address;
+
+    return 1;
+}
@@ -0,0 +1,67 @@
+#ifndef _H_DEBUG_INFO
+#define _H_DEBUG_INFO
+
+#include "sim86.h"
+
+// The line table (<binary>.lines) and the symbol table (<binary>.syms) which are written by the assembler
+// (see the assembler/debug_info.c, the layout must match). Both are mapped into the memory and searched
+// with binary search. Every address is an offset from the start of the loaded image.
+
+#define LINE_TABLE_MAGIC   0x4C363853 // "S86L"
+#define SYMBOL_TABLE_MAGIC 0x53363853 // "S86S"
+#define DEBUG_INFO_VERSION 1
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 entry_count;
+    u32 file_count;
+    u32 string_table_size;
+} Line_Table_Header;
+
+typedef struct {
+    u32 start;
+    u32 end;
+    u32 file;
+    u32 line;
+} Line_Table_Entry;
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 entry_count;
+    u32 string_table_size;
+} Symbol_Table_Header;
+
+typedef struct {
+    u32 address;
+    u32 name; // offset in the string table
+} Symbol_Table_Entry;
+
+struct Debug_Info {
+    u8 *line_file;
+    u64 line_file_size;
+    Line_Table_Header *line_header;
+    Line_Table_Entry *lines;
+    u32 *file_names;
+    char *line_strings;
+
+    u8 *symbol_file;
+    u64 symbol_file_size;
+    Symbol_Table_Header *symbol_header;
+    Symbol_Table_Entry *symbols;
+    char *symbol_strings;
+
+    u32 image_size;         // the size of the loaded program, the find_symbol() doesn't find the addresses past it
+};
+
+// Returns 0 if neither of the files are exist or valid. The image_size is the size of the loaded program (without
+// the PSP and the MZ header), the symbols past it are not found.
+u8 load_debug_info(Debug_Info *info, char *binary_filename, u32 image_size);
+void unload_debug_info(Debug_Info *info);
+
+// These return 0 if the address is not covered
+u8 find_source_line(Debug_Info *info, u32 address, const char **file, u32 *line);
+u8 find_symbol(Debug_Info *info, u32 address, const char **name, u32 *offset);
+
+#endif
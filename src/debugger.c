@@ -0,0 +1,158 @@
+#include "debugger.h"
+#include "history.h"
+#include "breakpoints.h"
+#include "simulator.h"
+#include "decoder.h"
+#include "printer.h"
+
+// The stop proc of the reverse continue
+static u8 at_breakpoint(CPU *cpu, void *user)
+{
+    return breakpoint_hit((Breakpoints *)user, cpu, calc_inst_pointer_address(cpu));
+}
+
+// Prints the instruction count and the next instruction (it's decoded again, but not executed)
+static void print_position(CPU *cpu)
+{
+    u32 address = calc_inst_pointer_address(cpu);
+    printf("[%llu] ", (unsigned long long)cpu->instruction_count);
+
+    if (cpu->exit_reason != Exit_Reason_None) {
+        printf("stopped: %s\n", exit_reason_name(cpu->exit_reason));
+        return;
+    }
+
+    Instruction prefix;
+    Instruction *pending_prefix = NULL;
+    Instruction inst = {0};
+    u32 cursor = address;
+    for (;;) {
+        u32 length = decode_instruction(cpu->model->opcodes, cpu->memory + cursor, MAX_MEMORY + MEMORY_PADDING - cursor, pending_prefix, &inst);
+        if (length == 0) break;
+        cursor += length;
+
+        if (!inst.is_prefix) break;
+        prefix = inst;
+        pending_prefix = &prefix;
+    }
+    inst.mem_address = address;
+
+    Format_Options options = {0};
+    options.hide_address   = cpu->hide_inst_mem_addr;
+    options.show_raw_bytes = cpu->show_raw_bin;
+    options.debug_info     = cpu->debug_info;
+    options.image_start    = cpu->image_base;
+    options.image_end      = cpu->exec_end;
+
+    char buffer[MAX_FORMATTED_INSTRUCTION_SIZE];
+    u32 length = format_instruction(&inst, &options, buffer, sizeof(buffer));
+    printf("%.*s\n", length, buffer);
+}
+
+static void print_registers(CPU *cpu)
+{
+    for (u32 i = 0; i < 12; i++) {
+        u16 value = *(u16 *)(cpu->regmem + i * 2);
+        printf("%s=%04x%s", register_name((Register)(Register_ax + i)), value, i == 7 || i == 11 ? "\n" : " ");
+    }
+    printf("ip=%04x flags=[", cpu->ip);
+    print_flags(stdout, cpu->flags);
+    printf(" ]\n");
+}
+
+static void print_stop(CPU *cpu, Breakpoints *breakpoints, Debug_Stop stop)
+{
+    if (stop == Debug_Stop_Watchpoint) {
+        Watchpoint *watchpoint = &breakpoints->watchpoints[breakpoints->hit_watchpoint];
+        printf("watchpoint %05x: %s at %05x\n", watchpoint->address,
+               breakpoints->hit_type == Watch_Write ? "write" : "read", breakpoints->hit_address);
+    }
+    print_position(cpu);
+}
+
+void run_debugger(CPU *cpu, Debugger *debugger)
+{
+    History *history = create_history(cpu, debugger->checkpoint_interval, debugger->history_bytes);
+    Breakpoints *breakpoints = create_breakpoints();
+    cpu->breakpoints = breakpoints;
+
+    char input[128] = {0};
+    while (fgets(input, sizeof(input), stdin)) {
+        char command[16] = {0};
+        char argument[64] = {0};
+        char size_argument[64] = {0};
+        sscanf(input, "%15s %63s %63s", command, argument, size_argument);
+
+        u32 address = (u32)strtoul(argument, NULL, 0);
+        u32 size = size_argument[0] ? (u32)strtoul(size_argument, NULL, 0) : 1;
+
+        if (command[0] == 0) {
+            debug_continue(cpu, breakpoints, 1);
+        }
+        else if (STR_EQUAL(command, "s")) {
+            u64 count = argument[0] ? strtoull(argument, NULL, 0) : 1;
+            if (count) {
+                print_stop(cpu, breakpoints, debug_continue(cpu, breakpoints, count));
+            }
+        }
+        else if (STR_EQUAL(command, "c")) {
+            print_stop(cpu, breakpoints, debug_continue(cpu, breakpoints, 0));
+        }
+        else if (STR_EQUAL(command, "u") && argument[0]) {
+            print_stop(cpu, breakpoints, debug_run_until(cpu, breakpoints, address));
+        }
+        else if (STR_EQUAL(command, "rs")) {
+            if (cpu->instruction_count == history_start(history) ||
+                !history_go_to(history, cpu, cpu->instruction_count - 1)) {
+                fprintf(stderr, "[WARNING]: The previous instruction is not in the history\n");
+            }
+            print_position(cpu);
+        }
+        else if (STR_EQUAL(command, "rc")) {
+            if (!history_find_last(history, cpu, at_breakpoint, breakpoints)) {
+                fprintf(stderr, "[WARNING]: No breakpoint is hit in the history\n");
+            }
+            print_position(cpu);
+        }
+        else if (STR_EQUAL(command, "b") && argument[0]) {
+            // b <address> if <condition>
+            char *condition = strstr(input, " if ");
+            if (!condition) {
+                set_breakpoint(breakpoints, address);
+            } else if (!set_conditional_breakpoint(breakpoints, address, condition + 4)) {
+                fprintf(stderr, "[WARNING]: The conditional breakpoint is not set\n");
+            }
+        }
+        else if (STR_EQUAL(command, "d") && argument[0]) {
+            clear_breakpoint(breakpoints, address);
+        }
+        else if ((STR_EQUAL(command, "w") || STR_EQUAL(command, "rw")) && argument[0]) {
+            u8 type = command[0] == 'r' ? Watch_Read | Watch_Write : Watch_Write;
+            if (!add_watchpoint(breakpoints, address, size, type)) {
+                fprintf(stderr, "[WARNING]: Too many watchpoints, the maximum is %d\n", MAX_WATCHPOINT_COUNT);
+            }
+        }
+        else if (STR_EQUAL(command, "dw") && argument[0]) {
+            remove_watchpoints(breakpoints, address);
+        }
+        else if (STR_EQUAL(command, "r")) {
+            print_registers(cpu);
+        }
+        else if (STR_EQUAL(command, "q") || STR_EQUAL(command, "exit")) {
+            cpu->exit_reason = Exit_Reason_User_Quit;
+            break;
+        }
+        else {
+            fprintf(stderr, "[WARNING]: Unknown command: %s", input);
+        }
+    }
+
+    // The end of the input is the quit too
+    if (cpu->exit_reason == Exit_Reason_None) {
+        cpu->exit_reason = Exit_Reason_User_Quit;
+    }
+
+    cpu->breakpoints = NULL;
+    destroy_breakpoints(breakpoints);
+    destroy_history(cpu);
+}
@@ -0,0 +1,34 @@
+#ifndef _H_DEBUGGER
+#define _H_DEBUGGER
+
+#include "sim86.h"
+
+// Interactive debugger of the --debug mode, one command per line from the stdin:
+//
+//     <enter>, s [n]   step one (or n) instructions
+//     c                continue to the next breakpoint or watchpoint (or the end)
+//     u <address>      run until the instruction at the address
+//     rs               reverse step, the state before the previous instruction
+//     rc               reverse continue, back to the last time a breakpoint was hit
+//     b <address>      breakpoint before the instruction at the absolute address
+//     b <address> if <condition>
+//                      conditional breakpoint, see the condition.h for the conditions
+//     d <address>      delete the breakpoint
+//     w <address> [n]  watchpoint of the writes of the n bytes (default 1) at the absolute address
+//     rw <address> [n] watchpoint of the reads and the writes
+//     dw <address>     delete the watchpoints at the address
+//     r                print the registers
+//     q, exit          quit
+//
+// The breakpoints and the watchpoints are in the breakpoints.h. The reverse commands use the execution history
+// (see the history.h), which is recorded from the start of the debugger. The --checkpoint_interval and the
+// --history_mb are the parameters of the history.
+
+typedef struct {
+    u64 checkpoint_interval; // 0 = the default of the history
+    u64 history_bytes;       // 0 = the default of the history
+} Debugger;
+
+void run_debugger(CPU *cpu, Debugger *debugger);
+
+#endif
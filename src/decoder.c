@@ -2,12 +2,36 @@
 #include "printer.h"
 #include "simulator.h"
 
-#define ASMD_CURR_BYTE(_d) _d->memory[_d->decoder_cursor]
-u8 ASMD_NEXT_BYTE(CPU *_d) { return _d->memory[++_d->decoder_cursor]; }
-#define ASMD_NEXT_BYTE_WITHOUT_STEP(_d) _d->memory[_d->decoder_cursor+1]
-#define ASMD_CURR_BYTE_INDEX(_d) _d->decoder_cursor
+// Every decoder function reads the bytes through this, so the decoder is not depends on the CPU and the guest memory.
+// It's never reads out of the buffer, the missing bytes are 0 and the overrun is set.
+typedef struct {
+    const u8 *data;
+    u32 size;
+    u32 cursor;
+    u8 overrun;
+
+    Instruction *inst;
+} Decoder;
+
+static inline u8 ASMD_NEXT_BYTE(Decoder *_d)
+{
+    if (++_d->cursor >= _d->size) {
+        _d->overrun = 1;
+        return 0;
+    }
+    return _d->data[_d->cursor];
+}
 
-static Mnemonic extended_mnemonic_lookup[][8] = {
+// The low byte is first ("Intel convention"). These are two statements, because the evaluation order of the
+// arguments (e.g. of the BYTE_LOHI_TO_HILO) is unspecified.
+static inline u16 ASMD_NEXT_WORD(Decoder *_d)
+{
+    u16 lo = ASMD_NEXT_BYTE(_d);
+    u16 hi = ASMD_NEXT_BYTE(_d);
+    return BYTE_LOHI_TO_HILO(lo, hi);
+}
+
+static const Mnemonic extended_mnemonic_lookup[][8] = {
     [Mnemonic_grp1]  = {Mnemonic_add, Mnemonic_or, Mnemonic_adc, Mnemonic_sbb, Mnemonic_and, Mnemonic_sub, Mnemonic_xor, Mnemonic_cmp},
     [Mnemonic_grp2]  = {Mnemonic_rol, Mnemonic_ror, Mnemonic_rcl, Mnemonic_rcr, Mnemonic_shl, Mnemonic_shr, Mnemonic_invalid, Mnemonic_sar},
     [Mnemonic_grp3b] = {Mnemonic_test, Mnemonic_invalid, Mnemonic_not, Mnemonic_neg, Mnemonic_mul, Mnemonic_imul, Mnemonic_div, Mnemonic_idiv},
@@ -16,7 +40,7 @@ static Mnemonic extended_mnemonic_lookup[][8] = {
     [Mnemonic_grp5]  = {Mnemonic_inc, Mnemonic_dec, Mnemonic_call, Mnemonic_call, Mnemonic_jmp, Mnemonic_jmp, Mnemonic_push, Mnemonic_invalid}
 };
 
-static const char *i8086_inst_ext_table[][8][2] = {
+static const char *const i8086_inst_ext_table[][8][2] = {
     [Mnemonic_grp1]  = {{NULL, NULL}, {NULL, NULL}, {NULL, NULL}, {NULL, NULL}, {NULL, NULL}, {NULL, NULL}, {NULL, NULL}, {NULL, NULL}},
     [Mnemonic_grp2]  = {{NULL, NULL}, {NULL, NULL}, {NULL, NULL}, {NULL, NULL}, {NULL, NULL}, {NULL, NULL}, {NULL, NULL}, {NULL, NULL}},
     [Mnemonic_grp3a] = {{"Eb", "Ib"}, {NULL, NULL}, {NULL, NULL}, {NULL, NULL}, {NULL, NULL}, {NULL, NULL}, {NULL, NULL}, {NULL, NULL}},
@@ -49,19 +73,23 @@ Effective_Address_Base get_address_base(u8 r_m, u8 mod)
 }
 
 
-void decode_memory_address_with_displacement(CPU *cpu, Instruction_Operand *operand)
+void decode_memory_address_with_displacement(Decoder *d, Instruction_Operand *operand)
 {
-    Instruction *inst = &cpu->instruction;
+    Instruction *inst = d->inst;
 
     operand->type = Operand_Memory;
     operand->address.base = get_address_base(inst->r_m, inst->mod);
     operand->address.displacement = 0;
 
-    if ((inst->mod == 0x00 && inst->r_m == 0x06) || inst->mod == 0x02) {
-        operand->address.displacement = (u16)(BYTE_LOHI_TO_HILO(ASMD_NEXT_BYTE(cpu), ASMD_NEXT_BYTE(cpu)));
+    // The displacements are signed (the direct address is not)
+    if (inst->mod == 0x00 && inst->r_m == 0x06) {
+        operand->address.displacement = ASMD_NEXT_WORD(d);
+    }
+    else if (inst->mod == 0x02) {
+        operand->address.displacement = (s16)ASMD_NEXT_WORD(d);
     }
     else if (inst->mod == 0x01) {
-        operand->address.displacement = (u8)ASMD_NEXT_BYTE(cpu);
+        operand->address.displacement = (s8)ASMD_NEXT_BYTE(d);
     }
 
     // printf(
@@ -70,10 +98,10 @@ void decode_memory_address_with_displacement(CPU *cpu, Instruction_Operand *oper
     // );
 }
 
-void mod_reg_rm(CPU *cpu, Instruction *inst)
+void mod_reg_rm(Decoder *d, Instruction *inst)
 {
     if (inst->mod_reg_rm_decoded == 0) {
-        u8 byte = ASMD_NEXT_BYTE(cpu);
+        u8 byte = ASMD_NEXT_BYTE(d);
 
         inst->mod = (byte >> 6) & 0b11;
         inst->reg = (byte >> 3) & 0b111;
@@ -85,74 +113,55 @@ void mod_reg_rm(CPU *cpu, Instruction *inst)
     }
 }
 
-void decode_arg(CPU *cpu, Instruction_Operand *op, const char *arg)
+void decode_arg(Decoder *d, Instruction_Operand *op, const char *arg)
 {
-    Instruction *inst = &cpu->instruction;
+    Instruction *inst = d->inst;
 
     if (arg == NULL) {
         return;
     }
 
-    if (arg[0] == 'e' || arg[STR_LEN(arg)-1] == 'X' || arg[STR_LEN(arg)-1] == 'I') {
+    u8 arg_strlen = STR_LEN(arg);
+
+    if (arg[0] == 'e' || arg[arg_strlen-1] == 'X' || arg[arg_strlen-1] == 'I') {
         inst->flags |= Inst_Wide;
         op->flags |= Inst_Wide;
     }
 
-    if (STR_EQUAL("AL", arg) || STR_EQUAL("eAX", arg)) {
-        op->type = Operand_Register;
-        op->reg  = 0; // encoded binary value of the reg
-        return;
-    } else if (STR_EQUAL("CL", arg) || STR_EQUAL("eCX", arg)) {
-        op->type = Operand_Register;
-        op->reg  = 1;
-        return;
-    } else if (STR_EQUAL("AH", arg) || STR_EQUAL("eSP", arg)) {
-        op->type = Operand_Register;
-        op->reg  = 4;
-        return;
-    } else if (STR_EQUAL("CH", arg) || STR_EQUAL("eBP", arg)) {
-        op->type = Operand_Register;
-        op->reg  = 5;
-        return;
-    } else if (STR_EQUAL("DL", arg) || STR_EQUAL("eDX", arg) || STR_EQUAL("DX", arg)) {
-        op->type = Operand_Register;
-        op->reg  = 2;
-        return;
-    } else if (STR_EQUAL("DH", arg) || STR_EQUAL("eSI", arg)) {
-        op->type = Operand_Register;
-        op->reg  = 6;
-        return;
-    } else if (STR_EQUAL("BL", arg) || STR_EQUAL("eBX", arg)) {
-        op->type = Operand_Register;
-        op->reg  = 3;
-        return;
-    } else if (STR_EQUAL("BH", arg) || STR_EQUAL("eDI", arg)) {
-        op->type = Operand_Register;
-        op->reg  = 7;
-        return;
-    } else if (STR_EQUAL("CS", arg)) {
-        op->type = Operand_Register;
-        op->flags |= Inst_Segment;
-        op->reg = 1;
-        return;
-    } else if (STR_EQUAL("DS", arg)) {
-        op->type = Operand_Register;
-        op->flags |= Inst_Segment;
-        op->reg = 3;
-        return;
-    } else if (STR_EQUAL("SS", arg)) {
-        op->type = Operand_Register;
-        op->flags |= Inst_Segment;
-        op->reg = 2;
-        return;
-    } else if (STR_EQUAL("ES", arg)) {
-        op->type = Operand_Register;
-        op->flags |= Inst_Segment;
-        op->reg = 0;
-        return;
+    // Fixed registers, like the "AL", "DX", "CS" or "eAX" (the e means the width is set by the instruction, which is
+    // always a word at the 8086). These are two uppercase letters, unlike the addressing methods below ("Eb", "Iv").
+    // This is a switch instead of string compares, because it's called for every operand.
+    const char *name = (arg[0] == 'e') ? arg+1 : arg;
+    if (name[0] >= 'A' && name[0] <= 'Z' && name[1] >= 'A' && name[1] <= 'Z') {
+        u8 is_segment = 0;
+        s8 reg = -1;
+
+        switch ((name[0] << 8) | name[1]) {
+            case ('A'<<8)|'L': case ('A'<<8)|'X': reg = 0; break;
+            case ('C'<<8)|'L': case ('C'<<8)|'X': reg = 1; break;
+            case ('D'<<8)|'L': case ('D'<<8)|'X': reg = 2; break;
+            case ('B'<<8)|'L': case ('B'<<8)|'X': reg = 3; break;
+            case ('A'<<8)|'H': case ('S'<<8)|'P': reg = 4; break;
+            case ('C'<<8)|'H': case ('B'<<8)|'P': reg = 5; break;
+            case ('D'<<8)|'H': case ('S'<<8)|'I': reg = 6; break;
+            case ('B'<<8)|'H': case ('D'<<8)|'I': reg = 7; break;
+
+            case ('E'<<8)|'S': reg = 0; is_segment = 1; break;
+            case ('C'<<8)|'S': reg = 1; is_segment = 1; break;
+            case ('S'<<8)|'S': reg = 2; is_segment = 1; break;
+            case ('D'<<8)|'S': reg = 3; is_segment = 1; break;
+        }
+
+        if (reg >= 0) {
+            op->type = Operand_Register;
+            op->reg  = reg; // encoded binary value of the reg
+            if (is_segment) {
+                op->flags |= Inst_Segment;
+            }
+            return;
+        }
     }
 
-    u8 arg_strlen = STR_LEN(arg);
     for (u64 i = 0; i < arg_strlen; i++) {
         if (arg[i] == 'A') {
             // Direct address. The instruction has no ModR/M byte; the address of the operand
@@ -164,9 +173,9 @@ void decode_arg(CPU *cpu, Instruction_Operand *op, const char *arg)
             op->type = Operand_Memory;
             op->address.base = Effective_Address_direct;
             // this is the offset
-            op->address.displacement = (u16)(BYTE_LOHI_TO_HILO(ASMD_NEXT_BYTE(cpu), ASMD_NEXT_BYTE(cpu)));
+            op->address.displacement = ASMD_NEXT_WORD(d);
             // segment are encoded next to the offset
-            op->address.segment = (u16)(BYTE_LOHI_TO_HILO(ASMD_NEXT_BYTE(cpu), ASMD_NEXT_BYTE(cpu)));
+            op->address.segment = ASMD_NEXT_WORD(d);
 
             // the result will be segment:offset
 
@@ -177,9 +186,9 @@ void decode_arg(CPU *cpu, Instruction_Operand *op, const char *arg)
             op->type = Operand_Relative_Immediate;
             if (arg[++i] == 'v') {
                 // @Todo: Set the op->flags |= Inst_Wide;???
-                op->immediate = (s16)(BYTE_LOHI_TO_HILO(ASMD_NEXT_BYTE(cpu), ASMD_NEXT_BYTE(cpu)));
+                op->immediate = (s16)ASMD_NEXT_WORD(d);
             } else {
-                op->immediate = (s8)(ASMD_NEXT_BYTE(cpu));
+                op->immediate = (s8)(ASMD_NEXT_BYTE(d));
             }
 
         } else if (arg[i] == 'E') {
@@ -187,19 +196,19 @@ void decode_arg(CPU *cpu, Instruction_Operand *op, const char *arg)
             // purpose register or a memory address. If it is a memory address, the address is computed from a
             // segment register and any of the following values: a base register, an index register, a displacement.
 
-            mod_reg_rm(cpu, inst);
+            mod_reg_rm(d, inst);
 
             if (inst->mod == MOD_REGISTER) {
                 op->type = Operand_Register;
                 op->reg = inst->r_m;
             } else {
-                decode_memory_address_with_displacement(cpu, op);
+                decode_memory_address_with_displacement(d, op);
             }
 
         } else if (arg[i] == 'G') {
             // The reg field of the ModR/M byte selects a general register.
 
-            mod_reg_rm(cpu, inst);
+            mod_reg_rm(d, inst);
 
             op->type = Operand_Register;
             op->reg = inst->reg;
@@ -207,7 +216,7 @@ void decode_arg(CPU *cpu, Instruction_Operand *op, const char *arg)
         } else if (arg[i] == 'I') {
             // Immediate data. The operand value is encoded in subsequent bytes of the instruction.
 
-            s16 immediate = ASMD_NEXT_BYTE(cpu);
+            s16 immediate = ASMD_NEXT_BYTE(d);
             op->type = Operand_Immediate;
 
             assert(arg[i+1] != '\0');
@@ -216,15 +225,20 @@ void decode_arg(CPU *cpu, Instruction_Operand *op, const char *arg)
             if (next_char == 'v' || next_char == 'w') {
                 inst->flags |= Inst_Wide;
                 op->flags |= Inst_Wide;
-                op->immediate = (s16)BYTE_LOHI_TO_HILO(immediate, ASMD_NEXT_BYTE(cpu));
+                op->immediate = (s16)BYTE_LOHI_TO_HILO(immediate, ASMD_NEXT_BYTE(d));
             } else if (next_char == '0') {
-                // @Todo: This is ok?
-                op->type = Operand_Immediate;
-                s16 immediate = ASMD_NEXT_BYTE(cpu);
-                if (immediate == 0xa) continue;
-                op->immediate = immediate;
+                // The base of the aam/aad, the default 10 is not printed
+                if (immediate == 0xa) {
+                    op->type = Operand_None;
+                } else {
+                    op->immediate = immediate;
+                }
             } else if (next_char == 'b') {
                 op->immediate = immediate;
+            } else if (next_char == 's') {
+                // Byte, sign-extended to the word (the push and the imul of the 80186)
+                inst->flags |= Inst_Sign;
+                op->immediate = (s8)immediate;
             } else {
                 assert(0);
             }
@@ -242,23 +256,23 @@ void decode_arg(CPU *cpu, Instruction_Operand *op, const char *arg)
                 inst->flags |= Inst_Wide; // @Todo: investigate, because I guess this is not required
             }
 
-            u16 displacement = (u16)BYTE_LOHI_TO_HILO(ASMD_NEXT_BYTE(cpu), ASMD_NEXT_BYTE(cpu));
+            u16 displacement = ASMD_NEXT_WORD(d);
             op->address.displacement = displacement;
 
         } else if (arg[i] == 'S') {
             // The reg field of the ModR/M byte selects a segment register.
 
-            mod_reg_rm(cpu, inst);
+            mod_reg_rm(d, inst);
 
             op->type = Operand_Register;
             op->flags |= Inst_Segment;
-            op->reg  = inst->reg;
+            op->reg  = inst->reg & 0b11; // the 8086 only uses the low 2 bit, so the 4-7 are aliases of the es-ds
 
         } else if (arg[i] == 'M') {
             // The ModR/M byte may refer only to memory. Applicable, e.g., to LES and LDS.
 
-            mod_reg_rm(cpu, inst);
-            decode_memory_address_with_displacement(cpu, op);
+            mod_reg_rm(d, inst);
+            decode_memory_address_with_displacement(d, op);
 
         } else if (arg[i] == 'v' || arg[i] == 'w') {
             // Word argument. (The 'v' code has a more complex meaning in later x86 opcode maps,
@@ -293,23 +307,30 @@ void decode_arg(CPU *cpu, Instruction_Operand *op, const char *arg)
 
 }
 
-void decode_next_instruction(CPU *cpu)
+u32 decode_instruction(const i8086_Inst_Table *opcodes, const u8 *data, u32 size, const Instruction *prefix, Instruction *inst)
 {
-    Instruction *inst = &cpu->instruction;
-    cpu->decoder_cursor = calc_inst_pointer_address(cpu);
-
-    u8 byte = ASMD_CURR_BYTE(cpu);
+    if (size == 0) {
+        return 0;
+    }
 
-    if (!inst->is_prefix) {
+    if (prefix && prefix->is_prefix) {
+        // Continue the instruction with the state of the decoded prefixes
+        *inst = *prefix;
+    } else {
         ZERO_MEMORY(inst, sizeof(Instruction));
         inst->extend_with_this_segment = Register_none;
-        inst->mem_address = cpu->decoder_cursor;
     }
     inst->is_prefix = 0;
 
-    u32 instruction_byte_start_offset = cpu->decoder_cursor;
+    Decoder decoder = {0};
+    Decoder *d = &decoder;
+    d->data = data;
+    d->size = size;
+    d->inst = inst;
+
+    u8 byte = data[0];
 
-    i8086_Inst_Table lookup_result = i8086_inst_table[byte];
+    i8086_Inst_Table lookup_result = opcodes[byte];
     inst->mnemonic = lookup_result.mnemonic;
     inst->type = lookup_result.type;
 
@@ -317,7 +338,7 @@ void decode_next_instruction(CPU *cpu)
 
     // Overwrite the arguments if the extenstion table lookup is find something
     if (lookup_result.mnemonic >= Mnemonic_grp1) {
-        mod_reg_rm(cpu, inst);
+        mod_reg_rm(d, inst);
 
         inst->mnemonic = extended_mnemonic_lookup[lookup_result.mnemonic][inst->reg];
 
@@ -329,8 +350,20 @@ void decode_next_instruction(CPU *cpu)
         }
     }
 
-    decode_arg(cpu, &inst->operands[0], lookup_result.arg1);
-    decode_arg(cpu, &inst->operands[1], lookup_result.arg2);
+    decode_arg(d, &inst->operands[0], lookup_result.arg1);
+    decode_arg(d, &inst->operands[1], lookup_result.arg2);
+    decode_arg(d, &inst->operands[2], lookup_result.arg3);
+
+    // The word string instructions (movsw, cmpsw, stosw, lodsw, scasw) have no operand which sets the width
+    if (byte >= 0xA4 && byte <= 0xAF && (byte & 1)) {
+        inst->flags |= Inst_Wide;
+    }
+
+    // The byte immediate of the 0x83 is sign-extended to the word
+    if (byte == 0x83) {
+        inst->flags |= Inst_Sign;
+        inst->operands[1].immediate = (s8)inst->operands[1].immediate;
+    }
 
     // Set prefixes
     // @Todo: Handle more prefixes
@@ -368,23 +401,48 @@ void decode_next_instruction(CPU *cpu)
     }
 
     if ((inst->flags & Inst_Lock) && inst->is_prefix == 0) {
-        // Flip memory, register because the lock prefix must be follow a memory operand
-        if (inst->operands[0].type != Operand_Memory) {
-            // DONT DELETE THIS ASSERT!
-            assert(inst->operands[1].type == Operand_Memory);
-
+        // Flip memory, register because the lock prefix must be follow a memory operand (nasm syntax).
+        // The 8086 accepts the lock before any instruction, so if there is no memory operand then it stays as it is.
+        if (inst->operands[0].type != Operand_Memory && inst->operands[1].type == Operand_Memory) {
             Instruction_Operand temp = inst->operands[0];
             inst->operands[0] = inst->operands[1];
             inst->operands[1] = temp;
         }
     }
 
-    cpu->decoder_cursor++;
-    cpu->instruction.size = cpu->decoder_cursor - instruction_byte_start_offset;
+    if (d->overrun) {
+        // The instruction is truncated by the end of the buffer
+        return 0;
+    }
+
+    inst->size = d->cursor + 1;
     inst->raw = 0;
-    for (int i = 0; i < cpu->instruction.size; i++) {
-        u32 start = cpu->decoder_cursor-inst->size;
-        u8 b = cpu->memory[start+i];
-        inst->raw |= ( b << (8*(inst->size-i-1)) );
+    for (int i = 0; i < inst->size; i++) {
+        inst->raw |= ((u64)data[i] << (8*(inst->size-i-1)));
+    }
+
+    return inst->size;
+}
+
+void decode_next_instruction(CPU *cpu)
+{
+    Instruction *inst = &cpu->instruction;
+    u32 address = calc_inst_pointer_address(cpu);
+
+    // The prefix state is copied, because the result is written to the same place
+    Instruction prefix;
+    u8 has_prefix = inst->is_prefix;
+    if (has_prefix) {
+        prefix = *inst;
     }
-}
\ No newline at end of file
+
+    // The memory is padded, so an instruction at the end of the memory is never truncated
+    u32 size = decode_instruction(cpu->model->opcodes, cpu->memory + address, MAX_MEMORY + MEMORY_PADDING - address, has_prefix ? &prefix : NULL, inst);
+    assert(size != 0);
+
+    if (!has_prefix) {
+        inst->mem_address = address;
+    }
+
+    cpu->decoder_cursor = address + size;
+}
@@ -3,6 +3,18 @@
 
 #include "sim86.h"
 
+// Decodes one instruction from the buffer. It's not depends on the CPU, has no global state and never allocates,
+// so it's safe to call from any thread. The opcodes are the table of the cpu model (the i8086_inst_table or the
+// cpu->model->opcodes, see the cpu_model.h).
+//
+// A prefix byte is decoded alone (inst->is_prefix = 1), then it must be passed as the prefix to the next call,
+// which continues that instruction. Otherwise the prefix must be NULL. The mem_address is not set (except the
+// prefixed instruction keeps the address of the prefix).
+//
+// Returns the length of the decoded part in bytes, or 0 if the buffer is empty or the instruction is truncated
+// by the end of the buffer.
+u32 decode_instruction(const i8086_Inst_Table *opcodes, const u8 *data, u32 size, const Instruction *prefix, Instruction *inst);
+
 void decode_next_instruction(CPU *cpu);
 
 #endif
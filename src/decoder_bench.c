@@ -0,0 +1,170 @@
+// Throughput benchmark of the decode_instruction(). Decodes a random buffer and (if a binary is given) a real code
+// buffer which is the binary repeated up to the same size. Every thread decodes the whole buffer, so the results
+// must be the same on every thread.
+//
+//     decoder_bench [binary] [--mb N] [--threads N]
+
+#include "sim86.h"
+#include "decoder.h"
+#include "simulator.h"
+#include "alu.h"
+#include "cpu_model.h"
+#include "graphics.h"
+#include "debug_info.h"
+#include "code_map.h"
+#include "trace.h"
+#include "history.h"
+#include "condition.h"
+#include "breakpoints.h"
+#include "hle.h"
+#include "platform.h"
+
+#include "sim86.c"
+#include "simulator.c"
+#include "alu.c"
+#include "cpu_model.c"
+#include "graphics.c"
+#include "decoder.c"
+#include "printer.c"
+#include "debug_info.c"
+#include "code_map.c"
+#include "trace.c"
+#include "history.c"
+#include "condition.c"
+#include "breakpoints.c"
+#include "hle.c"
+
+typedef struct {
+    const u8 *data;
+    u32 size;
+
+    u64 instruction_count;
+    u64 checksum;
+} Decode_Job;
+
+static void decode_buffer(Decode_Job *job)
+{
+    Instruction inst;
+    Instruction prefix;
+    const Instruction *pending_prefix = NULL;
+
+    u64 count = 0;
+    u64 checksum = 0;
+
+    u32 cursor = 0;
+    while (cursor < job->size) {
+        u32 length = decode_instruction(i8086_inst_table, job->data + cursor, job->size - cursor, pending_prefix, &inst);
+        if (length == 0) break; // truncated at the end
+
+        cursor += length;
+
+        if (inst.is_prefix) {
+            prefix = inst;
+            pending_prefix = &prefix;
+            continue;
+        }
+        pending_prefix = NULL;
+
+        count += 1;
+        checksum = checksum * 31 + inst.mnemonic * 7 + inst.size + inst.operands[0].type + inst.operands[1].immediate;
+    }
+
+    job->instruction_count = count;
+    job->checksum = checksum;
+}
+
+static THREAD_PROC(decode_worker)
+{
+    decode_buffer((Decode_Job *)data);
+    return 0;
+}
+
+static void bench(const char *name, u8 *buffer, u32 size, int thread_count)
+{
+    Decode_Job *jobs = (Decode_Job *)malloc(sizeof(Decode_Job) * thread_count);
+    Thread *threads = (Thread *)malloc(sizeof(Thread) * thread_count);
+
+    // Warm up, and the reference result
+    Decode_Job reference = {buffer, size};
+    decode_buffer(&reference);
+
+    double start = seconds_now();
+    for (int i = 0; i < thread_count; i++) {
+        jobs[i] = (Decode_Job){buffer, size};
+        threads[i] = thread_start(decode_worker, &jobs[i]);
+    }
+    for (int i = 0; i < thread_count; i++) {
+        thread_join(threads[i]);
+    }
+    double seconds = seconds_now() - start;
+
+    u8 same = 1;
+    for (int i = 0; i < thread_count; i++) {
+        if (jobs[i].checksum != reference.checksum || jobs[i].instruction_count != reference.instruction_count) same = 0;
+    }
+
+    double total_bytes = (double)size * thread_count;
+    double total_instructions = (double)reference.instruction_count * thread_count;
+
+    printf("%-6s %8.2f MB  %2d thread(s)  %8.3f s  %9.2f MB/s  %8.2f M inst/s  avg %.2f bytes/inst  %s\n",
+        name, size / (1024.0 * 1024.0), thread_count, seconds,
+        total_bytes / (1024.0 * 1024.0) / seconds, total_instructions / 1e6 / seconds,
+        (double)size / (double)reference.instruction_count,
+        same ? "ok" : "MISMATCH");
+
+    free(jobs);
+    free(threads);
+}
+
+int main(int argc, char **argv)
+{
+    char *binary_filename = NULL;
+    u32 megabytes = 16;
+    int thread_count = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (STR_EQUAL(argv[i], "--mb") && i+1 < argc) {
+            megabytes = atoi(argv[++i]);
+        } else if (STR_EQUAL(argv[i], "--threads") && i+1 < argc) {
+            thread_count = atoi(argv[++i]);
+        } else {
+            binary_filename = argv[i];
+        }
+    }
+
+    if (thread_count <= 0) thread_count = cpu_core_count();
+
+    u32 size = megabytes * 1024 * 1024;
+    u8 *buffer = (u8 *)malloc(size);
+
+    // xorshift64, the same buffer at every run
+    u64 state = 0x9E3779B97F4A7C15ULL;
+    for (u32 i = 0; i < size; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        buffer[i] = (u8)state;
+    }
+    bench("random", buffer, size, thread_count);
+
+    if (binary_filename) {
+        u64 file_size;
+        u8 *file = map_file(binary_filename, &file_size);
+        if (!file) {
+            fprintf(stderr, "[ERROR]: Failed to open %s file. Probably it is not exists.\n", binary_filename);
+            return 1;
+        }
+
+        // Repeated, the cut at the end of the copies only makes a few instructions wrong
+        for (u32 i = 0; i < size; i += file_size) {
+            u32 count = (size - i) < file_size ? (size - i) : (u32)file_size;
+            memcpy(buffer + i, file, count);
+        }
+        bench("code", buffer, size, thread_count);
+
+        unmap_file(file, file_size);
+    }
+
+    free(buffer);
+    return 0;
+}
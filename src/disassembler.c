@@ -0,0 +1,777 @@
+#include "disassembler.h"
+#include "decoder.h"
+#include "printer.h"
+#include "platform.h"
+
+static void flush_output(Output_Buffer *out)
+{
+    if (out->count && !out->failed) {
+        if (!write_stdout(out->data, out->count)) {
+            out->failed = 1;
+        }
+        out->written += out->count;
+    }
+    out->count = 0;
+}
+
+static inline char *reserve_output(Output_Buffer *out, u32 size)
+{
+    if (out->count + size > out->capacity) {
+        if (out->growable) {
+            out->capacity = out->capacity * 2 > out->count + size ? out->capacity * 2 : out->count + size;
+            out->data = (char *)realloc(out->data, out->capacity);
+            assert(out->data);
+        } else {
+            flush_output(out);
+        }
+    }
+    return out->data + out->count;
+}
+
+// Writes the already formatted text (the output of a chunk) directly, without copying it to the buffer
+static void write_output(Output_Buffer *out, const char *data, u64 size)
+{
+    flush_output(out);
+    if (size && !out->failed) {
+        if (!write_stdout(data, size)) {
+            out->failed = 1;
+        }
+        out->written += size;
+    }
+}
+
+static void output_invalid_byte(Output_Buffer *out, Format_Options *format, u32 address, u8 byte)
+{
+    char *at = reserve_output(out, 32);
+    char *start = at;
+
+    static const char *const hex_digits = "0123456789ABCDEF";
+    if (!format->hide_address) {
+        for (int i = 7; i >= 0; i--) *at++ = hex_digits[(address >> (4*i)) & 0xF];
+        *at++ = '\t';
+    }
+
+    memcpy(at, "db 0x", 5);
+    at += 5;
+    *at++ = "0123456789abcdef"[byte >> 4];
+    *at++ = "0123456789abcdef"[byte & 0xF];
+    *at++ = '\n';
+
+    out->count += (u32)(at - start);
+}
+
+// Decodes the instruction (with its prefixes) at the start, returns 0 if it's not a valid instruction. The next is
+// the start of the next instruction (the next byte for the invalid one).
+static u8 decode_unit(const u8 *data, u64 size, u64 start, Instruction *inst, u64 *next)
+{
+    Instruction prefix;
+    const Instruction *pending_prefix = NULL;
+
+    u64 cursor = start;
+    for (;;) {
+        // An instruction is never longer than this (except the repeated prefixes, which are decoded one by one)
+        u64 window = size - cursor < 16 ? size - cursor : 16;
+        // @Incomplete: Only the 8086 opcodes, the nasm_encodes_same() has no rules for the ones of the 80186
+        u32 length = decode_instruction(i8086_inst_table, data + cursor, (u32)window, pending_prefix, inst);
+        if (length == 0) break; // truncated by the end of the file
+
+        cursor += length;
+
+        // The prefixes are decoded one by one, then the instruction continues the state of them
+        if (inst->is_prefix) {
+            prefix = *inst;
+            pending_prefix = &prefix;
+            if (cursor >= size) break;
+            continue;
+        }
+
+        if (inst->mnemonic != Mnemonic_db && inst->mnemonic != Mnemonic_invalid) {
+            *next = cursor;
+            return 1;
+        }
+        break;
+    }
+
+    *next = start + 1;
+    return 0;
+}
+
+static void output_unit(Output_Buffer *out, Format_Options *format, const u8 *data, u64 start, u8 valid, Instruction *inst, Disasm_Stats *stats)
+{
+    u32 address = format->image_start + (u32)start;
+
+    if (!valid) {
+        output_invalid_byte(out, format, address, data[start]);
+        stats->invalid_byte_count += 1;
+        return;
+    }
+
+    inst->mem_address = address;
+
+    char *at = reserve_output(out, MAX_FORMATTED_INSTRUCTION_SIZE);
+    u32 length = format_instruction(inst, format, at, MAX_FORMATTED_INSTRUCTION_SIZE);
+    at[length++] = '\n';
+    out->count += length;
+
+    stats->instruction_count += 1;
+}
+
+void disassemble_range(const u8 *data, u64 size, u64 begin, u64 end, Format_Options *format, Output_Buffer *out, Disasm_Stats *stats)
+{
+    Instruction inst;
+
+    u64 cursor = begin;
+    while (cursor < end) {
+        u64 next;
+        u8 valid = decode_unit(data, size, cursor, &inst, &next);
+        output_unit(out, format, data, cursor, valid, &inst, stats);
+        cursor = next;
+    }
+
+    stats->byte_count += cursor - begin;
+}
+
+//
+// Parallel disassembly
+//
+
+typedef struct {
+    u64 position;       // the start of the instruction on the path from the beginning of the chunk
+    u32 output_offset;  // where its text is starting in the output of the chunk
+    Disasm_Stats stats; // of the instructions before it
+} Sync_Point;
+
+typedef struct {
+    u64 begin;
+    u64 end;
+    u64 next;           // where the last instruction of the path from the begin is ending (can be after the end)
+
+    Output_Buffer output;
+    Disasm_Stats stats;
+
+    Sync_Point sync_points[DISASM_SYNC_POINT_COUNT];
+    u32 sync_point_count;
+
+    // The index of the sync point where the path from the begin+i is joining, or -1 if it's not found
+    s32 convergence[DISASM_CANDIDATE_COUNT];
+
+    u8 ready;
+} Disasm_Chunk;
+
+typedef struct {
+    const u8 *data;
+    u64 size;
+    Format_Options *format;
+
+    Disasm_Chunk *slots;    // the ring of the chunks which are in flight
+    u32 slot_count;
+
+    u64 chunk_count;
+    u64 next_chunk;         // the next chunk which is taken by a worker
+    u64 reconciled_count;   // the chunks which are already written by the main thread
+    u8 stop;
+
+    Mutex mutex;
+    Condition condition;
+} Disasm_Job;
+
+static void decode_chunk(Disasm_Job *job, Disasm_Chunk *chunk)
+{
+    const u8 *data = job->data;
+    u64 size = job->size;
+
+    Instruction inst;
+    chunk->output.count = 0;
+    chunk->sync_point_count = 0;
+    ZERO_MEMORY(&chunk->stats, sizeof(chunk->stats));
+
+    // The main path from the beginning of the chunk
+    u64 cursor = chunk->begin;
+    while (cursor < chunk->end) {
+        if (chunk->sync_point_count < DISASM_SYNC_POINT_COUNT) {
+            Sync_Point *point = &chunk->sync_points[chunk->sync_point_count++];
+            point->position = cursor;
+            point->output_offset = chunk->output.count;
+            point->stats = chunk->stats;
+        }
+
+        u64 next;
+        u8 valid = decode_unit(data, size, cursor, &inst, &next);
+        output_unit(&chunk->output, job->format, data, cursor, valid, &inst, &chunk->stats);
+        cursor = next;
+    }
+    chunk->next = cursor;
+
+    // The paths from the other start offsets: the 8086 code is self-synchronizing, so they are usually joining
+    // the main path after a few instructions
+    u64 last_position = chunk->sync_points[chunk->sync_point_count - 1].position;
+
+    chunk->convergence[0] = 0;
+    for (u32 i = 1; i < DISASM_CANDIDATE_COUNT; i++) {
+        chunk->convergence[i] = -1;
+
+        u64 position = chunk->begin + i;
+        u32 point = 0;
+        while (position < chunk->end && position <= last_position) {
+            while (chunk->sync_points[point].position < position) point++;
+
+            if (chunk->sync_points[point].position == position) {
+                chunk->convergence[i] = (s32)point;
+                break;
+            }
+
+            u64 next;
+            decode_unit(data, size, position, &inst, &next);
+            position = next;
+        }
+    }
+}
+
+static THREAD_PROC(disasm_worker)
+{
+    Disasm_Job *job = (Disasm_Job *)data;
+
+    mutex_lock(&job->mutex);
+    for (;;) {
+        // Not more chunks in flight than the slots (the output of every chunk is kept until it's written)
+        while (!job->stop && job->next_chunk < job->chunk_count && job->next_chunk >= job->reconciled_count + job->slot_count) {
+            condition_wait(&job->condition, &job->mutex);
+        }
+        if (job->stop || job->next_chunk >= job->chunk_count) break;
+
+        u64 index = job->next_chunk++;
+        Disasm_Chunk *chunk = &job->slots[index % job->slot_count];
+        mutex_unlock(&job->mutex);
+
+        chunk->begin = index * DISASM_CHUNK_SIZE;
+        chunk->end = chunk->begin + DISASM_CHUNK_SIZE < job->size ? chunk->begin + DISASM_CHUNK_SIZE : job->size;
+        decode_chunk(job, chunk);
+
+        mutex_lock(&job->mutex);
+        chunk->ready = 1;
+        condition_broadcast(&job->condition);
+    }
+    mutex_unlock(&job->mutex);
+
+    return 0;
+}
+
+static void add_stats(Disasm_Stats *result, Disasm_Stats *a, Disasm_Stats *b)
+{
+    result->instruction_count  += a->instruction_count  - b->instruction_count;
+    result->invalid_byte_count += a->invalid_byte_count - b->invalid_byte_count;
+}
+
+// Writes the chunk which is continuing the instruction stream at the entry, returns where the stream is going on
+static u64 reconcile_chunk(Disasm_Job *job, Disasm_Chunk *chunk, u64 entry, Output_Buffer *out, Disasm_Stats *stats)
+{
+    // The previous instruction is covering the whole chunk
+    if (entry >= chunk->end) return entry;
+
+    u64 offset = entry - chunk->begin;
+    s32 point = offset < DISASM_CANDIDATE_COUNT ? chunk->convergence[offset] : -1;
+
+    if (point < 0) {
+        // Not converged in the remembered part of the chunk, decoded again
+        Disasm_Stats range_stats = {0};
+        disassemble_range(job->data, job->size, entry, chunk->end, job->format, out, &range_stats);
+        stats->instruction_count  += range_stats.instruction_count;
+        stats->invalid_byte_count += range_stats.invalid_byte_count;
+        return entry + range_stats.byte_count;
+    }
+
+    // The instructions before the convergence
+    Sync_Point *sync = &chunk->sync_points[point];
+    Instruction inst;
+    for (u64 cursor = entry; cursor < sync->position;) {
+        u64 next;
+        u8 valid = decode_unit(job->data, job->size, cursor, &inst, &next);
+        output_unit(out, job->format, job->data, cursor, valid, &inst, stats);
+        cursor = next;
+    }
+
+    // And the rest is the same as the main path
+    write_output(out, chunk->output.data + sync->output_offset, chunk->output.count - sync->output_offset);
+    add_stats(stats, &chunk->stats, &sync->stats);
+
+    return chunk->next;
+}
+
+static void disassemble_parallel(const u8 *data, u64 size, Format_Options *format, int thread_count, Output_Buffer *out, Disasm_Stats *stats)
+{
+    Disasm_Job job = {0};
+    job.data = data;
+    job.size = size;
+    job.format = format;
+    job.chunk_count = (size + DISASM_CHUNK_SIZE - 1) / DISASM_CHUNK_SIZE;
+    job.slot_count = thread_count * 2;
+    job.slots = (Disasm_Chunk *)calloc(job.slot_count, sizeof(Disasm_Chunk));
+    mutex_init(&job.mutex);
+    condition_init(&job.condition);
+
+    for (u32 i = 0; i < job.slot_count; i++) {
+        job.slots[i].output.growable = 1;
+        job.slots[i].output.capacity = DISASM_CHUNK_SIZE * 4;
+        job.slots[i].output.data = (char *)malloc(job.slots[i].output.capacity);
+    }
+
+    Thread *threads = (Thread *)malloc(sizeof(Thread) * thread_count);
+    for (int i = 0; i < thread_count; i++) {
+        threads[i] = thread_start(disasm_worker, &job);
+    }
+
+    u64 entry = 0;
+    for (u64 index = 0; index < job.chunk_count; index++) {
+        Disasm_Chunk *chunk = &job.slots[index % job.slot_count];
+
+        mutex_lock(&job.mutex);
+        while (!chunk->ready) condition_wait(&job.condition, &job.mutex);
+        mutex_unlock(&job.mutex);
+
+        entry = reconcile_chunk(&job, chunk, entry, out, stats);
+
+        mutex_lock(&job.mutex);
+        chunk->ready = 0;
+        job.reconciled_count = index + 1;
+        if (out->failed) job.stop = 1;
+        condition_broadcast(&job.condition);
+        mutex_unlock(&job.mutex);
+
+        if (out->failed) break;
+    }
+
+    for (int i = 0; i < thread_count; i++) {
+        thread_join(threads[i]);
+    }
+
+    stats->byte_count = entry;
+
+    for (u32 i = 0; i < job.slot_count; i++) {
+        free(job.slots[i].output.data);
+    }
+    free(job.slots);
+    free(threads);
+}
+
+int disassemble_file(char *filename, Disasm_Options *options)
+{
+    u64 size = 0;
+    u8 *data = map_file(filename, &size);
+    if (data == NULL) {
+        fprintf(stderr, "[ERROR]: Failed to open %s file. Probably it is not exists (or empty).\n", filename);
+        return 1;
+    }
+    options->format.image_end = options->format.image_start + (u32)size;
+    if (options->format.debug_info) options->format.debug_info->image_size = (u32)size;
+
+    double start = seconds_now();
+
+    Output_Buffer out = {0};
+    out.capacity = DISASM_OUTPUT_BUFFER_SIZE;
+    out.data = (char *)malloc(out.capacity);
+
+    Disasm_Stats stats = {0};
+
+    int thread_count = options->thread_count > 0 ? options->thread_count : cpu_core_count();
+
+    if (thread_count > 1 && size > DISASM_CHUNK_SIZE) {
+        disassemble_parallel(data, size, &options->format, thread_count, &out, &stats);
+    } else {
+        thread_count = 1;
+
+        // Decoded in chunks, so the output of a huge file is not waiting for the whole file
+        for (u64 begin = 0; begin < size && !out.failed;) {
+            u64 end = begin + DISASM_CHUNK_SIZE < size ? begin + DISASM_CHUNK_SIZE : size;
+
+            u64 before = stats.byte_count;
+            disassemble_range(data, size, begin, end, &options->format, &out, &stats);
+
+            // The last instruction of the chunk can be continued in the next chunk
+            begin += stats.byte_count - before;
+        }
+    }
+
+    flush_output(&out);
+    stats.output_byte_count = out.written;
+
+    double seconds = seconds_now() - start;
+
+    if (options->print_stats) {
+        fprintf(stderr, "%llu bytes, %llu instructions, %llu invalid bytes, %d thread(s), %.3f s, %.2f MB/s input, %.2f MB/s output\n",
+            (unsigned long long)stats.byte_count, (unsigned long long)stats.instruction_count,
+            (unsigned long long)stats.invalid_byte_count, thread_count, seconds,
+            stats.byte_count / (1024.0 * 1024.0) / seconds, stats.output_byte_count / (1024.0 * 1024.0) / seconds);
+    }
+
+    free(out.data);
+    unmap_file(data, size);
+
+    return out.failed ? 1 : 0;
+}
+
+//
+// Recursive traversal
+//
+
+enum {
+    Byte_Code       = (1 << 0), // decoded as a part of an instruction
+    Byte_Inst_Start = (1 << 1),
+    Byte_Target     = (1 << 2), // a jump, a call or an entry point is pointing here
+};
+
+typedef struct {
+    u64 start;
+    u64 next;
+    Instruction inst;
+} Traced_Instruction;
+
+typedef struct {
+    const u8 *data;
+    u64 size;
+    u8 *map;                        // Byte_* flags of every byte of the file
+
+    Traced_Instruction *instructions;
+    u64 instruction_count;
+    u64 instruction_capacity;
+
+    u64 *worklist;
+    u64 worklist_count;
+    u64 worklist_capacity;
+} Traversal;
+
+static void push_work(Traversal *t, u64 offset)
+{
+    if (offset >= t->size) return;
+
+    t->map[offset] |= Byte_Target;
+    if (t->map[offset] & Byte_Code) return; // already decoded (or it's inside of an instruction)
+
+    if (t->worklist_count == t->worklist_capacity) {
+        t->worklist_capacity = t->worklist_capacity ? t->worklist_capacity * 2 : 1024;
+        t->worklist = (u64 *)realloc(t->worklist, t->worklist_capacity * sizeof(u64));
+        assert(t->worklist);
+    }
+    t->worklist[t->worklist_count++] = offset;
+}
+
+static u8 is_prefix_byte(u8 byte)
+{
+    return byte == 0xF0 || byte == 0xF2 || byte == 0xF3 || byte == 0x26 || byte == 0x2E || byte == 0x36 || byte == 0x3E;
+}
+
+static u8 is_conditional_jump(Mnemonic m)
+{
+    return (m >= Mnemonic_jo && m <= Mnemonic_jg) || (m >= Mnemonic_loopnz && m <= Mnemonic_jcxz);
+}
+
+static u8 is_relative_branch(Instruction *inst)
+{
+    return inst->operands[0].type == Operand_Relative_Immediate;
+}
+
+// Follows the control flow from the offset until a jump, a return or a byte which is already decoded
+static void trace_path(Traversal *t, u64 offset)
+{
+    while (offset < t->size && !(t->map[offset] & Byte_Code)) {
+        Instruction inst;
+        u64 next;
+        if (!decode_unit(t->data, t->size, offset, &inst, &next)) return; // it's data
+
+        // The instruction would overlap an already decoded one, the bytes stay data
+        for (u64 i = offset + 1; i < next; i++) {
+            if (t->map[i] & Byte_Code) return;
+        }
+
+        for (u64 i = offset; i < next; i++) t->map[i] |= Byte_Code;
+        t->map[offset] |= Byte_Inst_Start;
+
+        if (t->instruction_count == t->instruction_capacity) {
+            t->instruction_capacity = t->instruction_capacity ? t->instruction_capacity * 2 : 1024;
+            t->instructions = (Traced_Instruction *)realloc(t->instructions, t->instruction_capacity * sizeof(Traced_Instruction));
+            assert(t->instructions);
+        }
+        t->instructions[t->instruction_count++] = (Traced_Instruction){offset, next, inst};
+
+        Mnemonic m = inst.mnemonic;
+        if (is_relative_branch(&inst)) {
+            push_work(t, next + inst.operands[0].immediate);
+            if (m == Mnemonic_jmp) return;
+        } else if (m == Mnemonic_jmp || m == Mnemonic_ret || m == Mnemonic_retf || m == Mnemonic_iret || m == Mnemonic_hlt) {
+            // An indirect or far jump, the target is not known
+            return;
+        }
+
+        offset = next;
+    }
+}
+
+static int compare_traced_instructions(const void *a, const void *b)
+{
+    u64 x = ((const Traced_Instruction *)a)->start;
+    u64 y = ((const Traced_Instruction *)b)->start;
+    return x < y ? -1 : x > y;
+}
+
+static u8 has_mod_reg_rm(u8 op)
+{
+    return (op < 0x40 && (op & 7) < 4) || (op >= 0x80 && op <= 0x8F) || op == 0xC4 || op == 0xC5 || op == 0xC6 ||
+           op == 0xC7 || (op >= 0xD0 && op <= 0xD3) || (op >= 0xD8 && op <= 0xDF) || op == 0xF6 || op == 0xF7 ||
+           op == 0xFE || op == 0xFF;
+}
+
+// The NASM has its own choice when more encodings are exist for the same text (it's choosing the shortest one, the
+// accumulator forms, the reg,reg direction, ...). The instruction is printed as text only if the NASM is encoding it
+// to the same bytes, otherwise as db.
+static u8 nasm_encodes_same(const u8 *bytes, u32 length, Instruction *inst)
+{
+    u32 i = 0;
+    while (i < length && is_prefix_byte(bytes[i])) i++;
+
+    // The order of the more prefixes is not kept by the text
+    if (i > 1) return 0;
+
+    u8 has_memory = inst->operands[0].type == Operand_Memory || inst->operands[1].type == Operand_Memory;
+    if (i == 1 && (bytes[0] & 0xE7) == 0x26) {
+        // The segment prefix is lost without a memory operand (string instructions, far jumps)
+        if (!has_memory || bytes[1] == 0x9A || bytes[1] == 0xEA) return 0;
+
+        // The prefix of the default segment is dropped by some assemblers
+        Instruction_Operand *memory = inst->operands[0].type == Operand_Memory ? &inst->operands[0] : &inst->operands[1];
+        Effective_Address_Base base = memory->address.base;
+        Register default_segment = (base == Effective_Address_bp || base == Effective_Address_bp_si || base == Effective_Address_bp_di) ? Register_ss : Register_ds;
+        if (inst->extend_with_this_segment == default_segment) return 0;
+    }
+
+    // The assemblers are rejecting the rep without a string instruction and the lock without a memory destination
+    if (i == 1 && (bytes[0] == 0xF2 || bytes[0] == 0xF3) && !(bytes[1] >= 0xA4 && bytes[1] <= 0xAF && bytes[1] != 0xA8 && bytes[1] != 0xA9)) return 0;
+    if (i == 1 && bytes[0] == 0xF0) {
+        Mnemonic m = inst->mnemonic;
+        u8 lockable = m == Mnemonic_add || m == Mnemonic_adc || m == Mnemonic_and || m == Mnemonic_or || m == Mnemonic_sbb ||
+                      m == Mnemonic_sub || m == Mnemonic_xor || m == Mnemonic_not || m == Mnemonic_neg || m == Mnemonic_inc ||
+                      m == Mnemonic_dec || m == Mnemonic_xchg;
+        if (!lockable || inst->operands[0].type != Operand_Memory) return 0;
+        if (bytes[1] < 0x40 && (bytes[1] & 7) < 4 && (bytes[1] & 2)) return 0; // the reg,mem is swapped by the decoder
+    }
+
+    u8 op = bytes[i];
+    u8 *immediate_at = (u8 *)bytes + length; // after the last byte
+
+    if (has_mod_reg_rm(op)) {
+        u8 modrm = bytes[i+1];
+        u8 mod = modrm >> 6;
+        u8 reg = (modrm >> 3) & 7;
+        u8 rm  = modrm & 7;
+
+        if (mod == 1 && bytes[i+2] == 0 && rm != 6) return 0; // the zero displacement is dropped
+        if (mod == 2) {
+            s16 displacement = (s16)(bytes[i+2] | (bytes[i+3] << 8));
+            if (displacement >= -128 && displacement <= 127) return 0; // it would be a byte
+        }
+
+        if (mod == 3) {
+            if (((op < 0x40 && (op & 7) < 4) || (op >= 0x88 && op <= 0x8B)) && (op & 2)) return 0; // the reg,reg is d=0
+            if (op >= 0x84 && op <= 0x87 && reg != rm) return 0; // test/xchg reg,reg operand order
+            if (op == 0x87 && (reg == 0 || rm == 0)) return 0; // xchg ax, r16
+            if (op == 0xC6 || op == 0xC7 || op == 0x8F) return 0; // mov r, imm / pop r
+            if (op == 0xFF && (reg == 0 || reg == 1 || reg == 6)) return 0; // inc/dec/push r16
+            if ((op == 0x80 || op == 0x81) && rm == 0) return 0; // the accumulator forms
+            if ((op == 0xF6 || op == 0xF7) && reg == 0 && rm == 0) return 0; // test al/ax, imm
+            if (op == 0x8D || op == 0xC4 || op == 0xC5) return 0; // these need a memory operand
+            if (op == 0xFF && (reg == 3 || reg == 5)) return 0; // the far call/jmp too
+        }
+
+        if ((op >= 0x88 && op <= 0x8B) && mod == 0 && rm == 6 && reg == 0) return 0; // mov al/ax <-> [moffs]
+        if ((op == 0x8C || op == 0x8E) && reg > 3) return 0; // the sreg aliases
+        if (op == 0x8E && reg == 1) return 0; // mov cs
+        if ((op == 0xC6 || op == 0xC7 || op == 0x8F) && reg != 0) return 0; // the unused reg field is ignored by the cpu
+        if ((op >= 0xD0 && op <= 0xD3) && reg == 6) return 0; // the alias of the shl
+        if (op == 0x82) return 0; // the alias of the 0x80
+        if (op == 0x81) {
+            s16 immediate = (s16)(immediate_at[-2] | (immediate_at[-1] << 8));
+            if (immediate >= -128 && immediate <= 127) return 0; // it would be the 0x83
+        }
+        if ((op == 0xF6 || op == 0xF7) && reg == 1) return 0; // the alias of the test
+    } else {
+        if (op < 0x40 && (op & 7) == 5) {
+            // The alu ax, imm: it would be the 0x83 with the sign-extended byte
+            s16 immediate = (s16)(immediate_at[-2] | (immediate_at[-1] << 8));
+            if (immediate >= -128 && immediate <= 127) return 0;
+        }
+        if ((op == 0xC2 || op == 0xCA) && inst->operands[0].immediate == 0) return 0;
+    }
+
+    return 1;
+}
+
+static void output_printf(Output_Buffer *out, const char *format, ...)
+{
+    char *at = reserve_output(out, 256);
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(at, 256, format, args);
+    va_end(args);
+
+    out->count += length < 256 ? length : 255;
+}
+
+static void format_label(Debug_Info *debug_info, u64 offset, char *out, u32 capacity)
+{
+    const char *name;
+    u32 symbol_offset;
+    if (find_symbol(debug_info, (u32)offset, &name, &symbol_offset) && symbol_offset == 0) {
+        snprintf(out, capacity, "%s", name);
+    } else {
+        snprintf(out, capacity, "label_%04llX", (unsigned long long)offset);
+    }
+}
+
+static void output_data(Output_Buffer *out, const u8 *data, u64 start, u64 end)
+{
+    for (u64 i = start; i < end; i += 16) {
+        u64 count = end - i < 16 ? end - i : 16;
+        output_printf(out, "\tdb ");
+        for (u64 j = 0; j < count; j++) {
+            output_printf(out, j ? ", 0x%02x" : "0x%02x", data[i + j]);
+        }
+        output_printf(out, "\n");
+    }
+}
+
+static void output_traced_instruction(Output_Buffer *out, Traversal *t, Traced_Instruction *traced, Format_Options *format)
+{
+    Instruction *inst = &traced->inst;
+    const u8 *bytes = t->data + traced->start;
+    u32 length = (u32)(traced->next - traced->start);
+
+    u32 op_at = 0;
+    while (op_at < length && is_prefix_byte(bytes[op_at])) op_at++;
+    u8 op = bytes[op_at];
+
+    char text[MAX_FORMATTED_INSTRUCTION_SIZE];
+
+    if (is_relative_branch(inst)) {
+        u64 target = traced->next + inst->operands[0].immediate;
+        const char *keyword = op == 0xE9 ? "near " : (op == 0xE8 || (is_conditional_jump(inst->mnemonic) && op >= 0xE0)) ? "" : "short ";
+
+        char label[256];
+        if (target < t->size && (t->map[target] & Byte_Inst_Start)) {
+            format_label(format->debug_info, target, label, sizeof(label));
+        } else {
+            // Outside of the image, or into the middle of an instruction
+            snprintf(label, sizeof(label), "$%+lld", (long long)(target - traced->start));
+        }
+        snprintf(text, sizeof(text), "%s %s%s", mnemonic_name(inst->mnemonic), keyword, label);
+    } else {
+        Format_Options plain = {0};
+        plain.hide_address = 1;
+        inst->mem_address = (u32)traced->start;
+        text[format_instruction(inst, &plain, text, sizeof(text))] = '\0';
+
+        // The NASM names of the one byte forms
+        if (op == 0xCC) strcpy(text, "int3");
+        if (op == 0xD7) strcpy(text, "xlatb");
+    }
+
+    if (is_relative_branch(inst) ? op_at == 0 : nasm_encodes_same(bytes, length, inst)) {
+        output_printf(out, "\t%s", text);
+        if (!format->hide_address) output_printf(out, "\t; %08llX", (unsigned long long)traced->start);
+        output_printf(out, "\n");
+    } else {
+        output_printf(out, "\tdb ");
+        for (u32 i = 0; i < length; i++) {
+            output_printf(out, i ? ", 0x%02x" : "0x%02x", bytes[i]);
+        }
+        if (!format->hide_address) output_printf(out, "\t; %08llX %s\n", (unsigned long long)traced->start, text);
+        else                       output_printf(out, "\t; %s\n", text);
+    }
+}
+
+int disassemble_file_recursive(char *filename, Disasm_Options *options)
+{
+    u64 size = 0;
+    u8 *data = map_file(filename, &size);
+    if (data == NULL) {
+        fprintf(stderr, "[ERROR]: Failed to open %s file. Probably it is not exists (or empty).\n", filename);
+        return 1;
+    }
+    options->format.image_end = options->format.image_start + (u32)size;
+    if (options->format.debug_info) options->format.debug_info->image_size = (u32)size;
+
+    double start = seconds_now();
+
+    Traversal t = {0};
+    t.data = data;
+    t.size = size;
+    t.map = (u8 *)calloc(size, 1);
+
+    // The entry points: the start of the image, the given ones (e.g. the interrupt handlers) and the symbols
+    push_work(&t, 0);
+    for (u32 i = 0; i < options->entry_count; i++) {
+        push_work(&t, options->entries[i]);
+    }
+    Debug_Info *debug_info = options->format.debug_info;
+    if (debug_info && debug_info->symbol_header) {
+        for (u32 i = 0; i < debug_info->symbol_header->entry_count; i++) {
+            push_work(&t, debug_info->symbols[i].address);
+        }
+    }
+
+    while (t.worklist_count) {
+        trace_path(&t, t.worklist[--t.worklist_count]);
+    }
+
+    qsort(t.instructions, t.instruction_count, sizeof(Traced_Instruction), compare_traced_instructions);
+
+    Output_Buffer out = {0};
+    out.capacity = DISASM_OUTPUT_BUFFER_SIZE;
+    out.data = (char *)malloc(out.capacity);
+
+    output_printf(&out, "; %s\n\nbits 16\n\n", filename);
+
+    u64 code_bytes = 0;
+    u64 label_count = 0;
+    u64 next_instruction = 0;
+    for (u64 offset = 0; offset < size && !out.failed;) {
+        if ((t.map[offset] & (Byte_Target | Byte_Inst_Start)) == (Byte_Target | Byte_Inst_Start)) {
+            char label[256];
+            format_label(debug_info, offset, label, sizeof(label));
+            output_printf(&out, "%s:\n", label);
+            label_count += 1;
+        }
+
+        if (t.map[offset] & Byte_Inst_Start) {
+            Traced_Instruction *traced = &t.instructions[next_instruction++];
+            assert(traced->start == offset);
+
+            output_traced_instruction(&out, &t, traced, &options->format);
+            code_bytes += traced->next - traced->start;
+            offset = traced->next;
+            continue;
+        }
+
+        // The data is running until the next instruction
+        u64 end = offset + 1;
+        while (end < size && !(t.map[end] & Byte_Inst_Start)) end++;
+        output_data(&out, data, offset, end);
+        offset = end;
+    }
+
+    flush_output(&out);
+
+    double seconds = seconds_now() - start;
+
+    if (options->print_stats) {
+        fprintf(stderr, "%llu bytes, %llu instructions, %llu code bytes, %llu data bytes, %llu labels, %.3f s\n",
+            (unsigned long long)size, (unsigned long long)t.instruction_count, (unsigned long long)code_bytes,
+            (unsigned long long)(size - code_bytes), (unsigned long long)label_count, seconds);
+    }
+
+    free(out.data);
+    free(t.map);
+    free(t.instructions);
+    free(t.worklist);
+    unmap_file(data, size);
+
+    return out.failed ? 1 : 0;
+}
@@ -0,0 +1,71 @@
+#ifndef _H_DISASSEMBLER
+#define _H_DISASSEMBLER
+
+#include "sim86.h"
+#include "printer.h"
+#include "debug_info.h"
+
+// Streaming disassembler (--disasm) for binaries of any size. The file is mapped into the memory, decoded with
+// the decode_instruction() and formatted into large output buffers, which are written with one write per buffer.
+// It's not uses the CPU, so the 1 MiB memory limit and the run() loop are not involved.
+//
+// The bytes which are not valid instructions (unused opcodes, invalid group extensions, truncated instruction
+// at the end) are printed as "db 0x.." and the decoding continues at the next byte.
+//
+// With more than one thread the file is split into chunks which are decoded by the workers in parallel. The worker
+// doesn't know where the previous chunk ends (an instruction can cross the chunk boundary), so it decodes from
+// the start of the chunk and also walks the paths of the next few start offsets until they are converging into the
+// first path. The chunks are reconciled in order by the main thread: the end of the previous chunk selects the
+// path, only the few instructions before the convergence are decoded again. The output is the same as with one
+// thread, byte by byte.
+
+#define DISASM_OUTPUT_BUFFER_SIZE (4 * 1024 * 1024)
+#define DISASM_CHUNK_SIZE         (1024 * 1024)
+
+// The start offsets which are tried at the chunk boundary (an instruction with the prefixes is never longer)
+#define DISASM_CANDIDATE_COUNT    16
+// The first instructions of the chunk which are remembered for the convergence of the candidate paths
+#define DISASM_SYNC_POINT_COUNT   64
+
+#define DISASM_MAX_ENTRY_COUNT    64
+
+typedef struct {
+    char *data;
+    u32 count;
+    u32 capacity;
+    u64 written;  // total
+    u8 failed;    // the write is failed (e.g. the pipe is closed)
+    u8 growable;  // the buffer is grown instead of written to the stdout (the output of a chunk)
+} Output_Buffer;
+
+typedef struct {
+    u64 byte_count;
+    u64 instruction_count;
+    u64 invalid_byte_count;
+    u64 output_byte_count;
+} Disasm_Stats;
+
+typedef struct {
+    Format_Options format;  // the image_start is the address of the first byte of the file
+    u8 print_stats;         // to the stderr
+    int thread_count;       // 0 = all cores
+
+    // The entry points of the recursive traversal beside the start of the file (e.g. interrupt handlers)
+    u32 entries[DISASM_MAX_ENTRY_COUNT];
+    u32 entry_count;
+} Disasm_Options;
+
+// Disassembles the instructions which are starting in the [begin, end) range of the data. The last instruction can
+// continue after the end (but not after the size).
+void disassemble_range(const u8 *data, u64 size, u64 begin, u64 end, Format_Options *format, Output_Buffer *out, Disasm_Stats *stats);
+
+// Returns the process exit code
+int disassemble_file(char *filename, Disasm_Options *options);
+
+// Recursive traversal (--disasm --recursive): follows the jumps, the calls and the conditional branches from the
+// entry points with a worklist, so only the reachable bytes are decoded as code (every byte at most once) and the
+// rest is emitted as db. The branch targets are named labels and the output is reassembled by the NASM to the same
+// binary (the instructions with an other NASM encoding are emitted as db with the instruction in the comment).
+int disassemble_file_recursive(char *filename, Disasm_Options *options);
+
+#endif
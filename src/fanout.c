@@ -0,0 +1,465 @@
+#include "fanout.h"
+#include "simulator.h"
+#include "printer.h"
+#include "code_map.h"
+#include "batch.h"
+#include "platform.h"
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+
+///////////////////////////////////////////////////
+// Variants file
+
+typedef struct {
+    Fanout_Variant *variants;
+    u32 count;
+    u32 capacity;
+} Fanout_Variant_List;
+
+static Fanout_Variant *add_variant(Fanout_Variant_List *list, char *name)
+{
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->variants = (Fanout_Variant *)realloc(list->variants, sizeof(Fanout_Variant) * list->capacity);
+    }
+
+    Fanout_Variant *variant = &list->variants[list->count++];
+    ZERO_MEMORY(variant, sizeof(Fanout_Variant));
+    variant->name = strdup(name);
+
+    return variant;
+}
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Returns 0 if the patch is not valid
+static u8 parse_patch(char *token, Fanout_Patch *patch)
+{
+    char *value = strchr(token, '=');
+    if (!value) return 0;
+    *value++ = '\0';
+
+    ZERO_MEMORY(patch, sizeof(Fanout_Patch));
+
+    if (token[0] >= '0' && token[0] <= '9') {
+        u32 length = STR_LEN(value);
+        if (length == 0 || length % 2) return 0;
+
+        patch->type = Fanout_Patch_Memory;
+        patch->address = (u32)strtoul(token, NULL, 0);
+        patch->size = length / 2;
+        if ((u64)patch->address + patch->size > MAX_MEMORY) return 0;
+
+        patch->bytes = (u8 *)malloc(patch->size);
+        for (u32 i = 0; i < patch->size; i++) {
+            int hi = hex_digit(value[i * 2]);
+            int lo = hex_digit(value[i * 2 + 1]);
+            if (hi < 0 || lo < 0) {
+                free(patch->bytes);
+                return 0;
+            }
+            patch->bytes[i] = (u8)(hi << 4 | lo);
+        }
+        return 1;
+    }
+
+    patch->value = (u16)strtoul(value, NULL, 0);
+
+    if (STR_EQUAL(token, "ip")) {
+        patch->type = Fanout_Patch_Ip;
+        return 1;
+    }
+    if (STR_EQUAL(token, "flags")) {
+        patch->type = Fanout_Patch_Flags;
+        return 1;
+    }
+    for (Register reg = Register_ax; reg <= Register_ds; reg++) {
+        if (STR_EQUAL(token, register_name(reg))) {
+            patch->type = Fanout_Patch_Register;
+            patch->reg = reg;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static u8 load_variants(Fanout_Variant_List *list, char *filename)
+{
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) return 0;
+
+    u8 ok = 1;
+    u32 line_number = 0;
+
+    char line[4096];
+    while (fgets(line, sizeof(line), fp)) {
+        line_number += 1;
+
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        char *name = strtok(line, " \t\r\n");
+        if (name == NULL) continue;
+
+        Fanout_Variant *variant = add_variant(list, name);
+
+        char *token;
+        while ((token = strtok(NULL, " \t\r\n")) != NULL) {
+            variant->patches = (Fanout_Patch *)realloc(variant->patches, sizeof(Fanout_Patch) * (variant->patch_count + 1));
+
+            if (!parse_patch(token, &variant->patches[variant->patch_count])) {
+                fprintf(stderr, "[ERROR]: Invalid patch at %s:%u\n", filename, line_number);
+                ok = 0;
+                continue;
+            }
+            variant->patch_count += 1;
+        }
+    }
+
+    fclose(fp);
+    return ok;
+}
+
+static void free_variants(Fanout_Variant_List *list)
+{
+    for (u32 i = 0; i < list->count; i++) {
+        Fanout_Variant *variant = &list->variants[i];
+        for (u32 j = 0; j < variant->patch_count; j++) {
+            free(variant->patches[j].bytes);
+        }
+        free(variant->patches);
+        free(variant->name);
+    }
+    free(list->variants);
+}
+
+///////////////////////////////////////////////////
+// Run
+
+static void apply_patches(CPU *cpu, Fanout_Variant *variant)
+{
+    for (u32 i = 0; i < variant->patch_count; i++) {
+        Fanout_Patch *patch = &variant->patches[i];
+
+        switch (patch->type) {
+            case Fanout_Patch_Memory: {
+                memcpy(cpu->memory + patch->address, patch->bytes, patch->size);
+                if (cpu->code_map) {
+                    invalidate_code_range(cpu->code_map, patch->address, patch->size);
+                }
+                break;
+            }
+            case Fanout_Patch_Register: set_to_register(cpu, patch->reg, patch->value); break;
+            case Fanout_Patch_Ip:       cpu->ip = patch->value; break;
+            case Fanout_Patch_Flags:    cpu->flags = patch->value; break;
+        }
+    }
+}
+
+// Continues the CPU from the marker with the patches of the variant, and sets the result
+static void run_variant(CPU *cpu, Fanout_Variant *variant, u64 instruction_limit)
+{
+    double start = seconds_now();
+
+    u64 marker_count = cpu->instruction_count;
+    cpu->instruction_limit = instruction_limit ? marker_count + instruction_limit : 0;
+    cpu->terminate = 0;
+    cpu->exit_reason = Exit_Reason_None;
+
+    apply_patches(cpu, variant);
+    run(cpu);
+
+    variant->exit_reason       = cpu->exit_reason;
+    variant->instruction_count = cpu->instruction_count - marker_count;
+    variant->registers_hash    = hash_registers(cpu);
+    variant->memory_hash       = hash_memory(cpu);
+    variant->seconds           = seconds_now() - start;
+}
+
+#ifndef _WIN32
+
+// Sent by the child, it's smaller than the PIPE_BUF, so the write is atomic
+typedef struct {
+    u32 index;
+    u32 exit_reason;
+    u64 instruction_count;
+    u64 registers_hash;
+    u64 memory_hash;
+    double seconds;
+} Fanout_Result;
+
+static u8 read_result(int fd, Fanout_Result *result)
+{
+    u8 *at = (u8 *)result;
+    u32 remaining = sizeof(Fanout_Result);
+    while (remaining) {
+        ssize_t count = read(fd, at, remaining);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return 0;
+        at += count;
+        remaining -= count;
+    }
+    return 1;
+}
+
+// Returns the average seconds of the fork() calls
+static double run_variants(CPU *cpu, Fanout_Variant_List *list, Fanout_Options *options, int process_count)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        fprintf(stderr, "[ERROR]: Failed to create the pipe\n");
+        for (u32 i = 0; i < list->count; i++) list->variants[i].crashed = 1;
+        return 0;
+    }
+
+    // The children are exiting with the _exit(), the buffered output must not be written twice
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t *pids = (pid_t *)calloc(list->count ? list->count : 1, sizeof(pid_t));
+    double fork_seconds = 0;
+
+    u32 next = 0;
+    u32 running = 0;
+    u32 unread = 0; // the results of the exited children which are not read yet
+
+    while (next < list->count || running) {
+        while (running < (u32)process_count && next < list->count) {
+            double start = seconds_now();
+            pid_t pid = fork();
+            fork_seconds += seconds_now() - start;
+
+            if (pid == 0) {
+                close(fds[0]);
+
+                Fanout_Variant *variant = &list->variants[next];
+                run_variant(cpu, variant, options->instruction_limit);
+
+                Fanout_Result result = {0};
+                result.index             = next;
+                result.exit_reason       = variant->exit_reason;
+                result.instruction_count = variant->instruction_count;
+                result.registers_hash    = variant->registers_hash;
+                result.memory_hash       = variant->memory_hash;
+                result.seconds           = variant->seconds;
+
+                u8 ok = write(fds[1], &result, sizeof(result)) == sizeof(result);
+                _exit(ok ? 0 : 1);
+            }
+
+            if (pid < 0) {
+                list->variants[next].crashed = 1;
+            } else {
+                pids[next] = pid;
+                running += 1;
+            }
+            next += 1;
+        }
+
+        if (running == 0) break;
+
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        running -= 1;
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            unread += 1;
+        } else {
+            for (u32 i = 0; i < next; i++) {
+                if (pids[i] == pid) list->variants[i].crashed = 1;
+            }
+        }
+
+        // Only the results which are surely in the pipe, so the read never blocks
+        while (unread) {
+            Fanout_Result result;
+            if (!read_result(fds[0], &result) || result.index >= list->count) break;
+            unread -= 1;
+
+            Fanout_Variant *variant = &list->variants[result.index];
+            variant->exit_reason       = (Exit_Reason)result.exit_reason;
+            variant->instruction_count = result.instruction_count;
+            variant->registers_hash    = result.registers_hash;
+            variant->memory_hash       = result.memory_hash;
+            variant->seconds           = result.seconds;
+        }
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    free(pids);
+
+    return list->count ? fork_seconds / list->count : 0;
+}
+
+#else
+
+// One by one, the marker state is copied back before every variant
+static double run_variants(CPU *cpu, Fanout_Variant_List *list, Fanout_Options *options, int process_count)
+{
+    // The pre-decoded instructions of a patched variant would be wrong for the next one
+    destroy_code_map(cpu);
+
+    CPU marker = *cpu;
+    marker.memory = (u8 *)malloc(MAX_MEMORY + MEMORY_PADDING);
+    assert(marker.memory);
+    memcpy(marker.memory, cpu->memory, MAX_MEMORY + MEMORY_PADDING);
+
+    double restore_seconds = 0;
+    for (u32 i = 0; i < list->count; i++) {
+        double start = seconds_now();
+        u8 *memory = cpu->memory;
+        *cpu = marker;
+        cpu->memory = memory;
+        memcpy(cpu->memory, marker.memory, MAX_MEMORY + MEMORY_PADDING);
+        restore_seconds += seconds_now() - start;
+
+        run_variant(cpu, &list->variants[i], options->instruction_limit);
+    }
+
+    free(marker.memory);
+
+    return list->count ? restore_seconds / list->count : 0;
+}
+
+#endif
+
+static void write_fanout_report(FILE *fp, Fanout_Variant_List *list, u64 marker_count, int process_count,
+                                double marker_seconds, double seconds, double start_seconds)
+{
+    double variant_seconds = 0;
+    u32 crashed_count = 0;
+    for (u32 i = 0; i < list->count; i++) {
+        if (list->variants[i].crashed) crashed_count += 1;
+        else                           variant_seconds += list->variants[i].seconds;
+    }
+    u32 finished_count = list->count - crashed_count;
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"marker_instructions\": %llu,\n", (unsigned long long)marker_count);
+    fprintf(fp, "  \"marker_seconds\": %.6f,\n", marker_seconds);
+    fprintf(fp, "  \"processes\": %d,\n", process_count);
+    fprintf(fp, "  \"seconds\": %.6f,\n", seconds);
+    fprintf(fp, "  \"variants\": %u,\n", list->count);
+    fprintf(fp, "  \"crashed\": %u,\n", crashed_count);
+    fprintf(fp, "  \"average_start_us\": %.3f,\n", start_seconds * 1e6);
+    fprintf(fp, "  \"average_variant_us\": %.3f,\n", finished_count ? variant_seconds / finished_count * 1e6 : 0.0);
+    fprintf(fp, "  \"results\": [\n");
+
+    for (u32 i = 0; i < list->count; i++) {
+        Fanout_Variant *variant = &list->variants[i];
+
+        fprintf(fp, "    {\"name\": ");
+        write_json_string(fp, variant->name);
+
+        if (variant->crashed) {
+            fprintf(fp, ", \"crashed\": true");
+        } else {
+            fprintf(fp, ", \"exit_reason\": \"%s\", \"instructions\": %llu, \"microseconds\": %.3f",
+                exit_reason_name(variant->exit_reason), (unsigned long long)variant->instruction_count, variant->seconds * 1e6);
+            fprintf(fp, ", \"registers_hash\": \"%016llx\", \"memory_hash\": \"%016llx\"",
+                (unsigned long long)variant->registers_hash, (unsigned long long)variant->memory_hash);
+        }
+
+        fprintf(fp, "}%s\n", i + 1 < list->count ? "," : "");
+    }
+
+    fprintf(fp, "  ]\n");
+    fprintf(fp, "}\n");
+}
+
+int run_fanout(char *binary_filename, char *variants_filename, Fanout_Options *options)
+{
+    if (!options->at_port && !options->at_address) {
+        fprintf(stderr, "[ERROR]: The --fanout needs a marker (--fanout_at_port or --fanout_at_address)\n");
+        return 1;
+    }
+
+    Fanout_Variant_List list = {0};
+    if (!load_variants(&list, variants_filename)) {
+        fprintf(stderr, "[ERROR]: Failed to load the variants from %s\n", variants_filename);
+        free_variants(&list);
+        return 1;
+    }
+
+    CPU cpu = {0};
+    cpu.trace = NULL; // quiet, the processes are running at the same time
+    cpu.graphics = NULL; // headless, the children inherit it, see the graphics.h
+    cpu.model = options->model;
+    cpu.predecode = 1;
+    cpu.idle_skip = 1;
+    boot(&cpu);
+
+    if (!load_executable(&cpu, binary_filename)) {
+        fprintf(stderr, "[ERROR]: Failed to open %s file. Probably it is not exists.\n", binary_filename);
+        free_variants(&list);
+        return 1;
+    }
+
+    // To the marker, once
+    double marker_start = seconds_now();
+    cpu.instruction_limit = options->instruction_limit;
+    cpu.stop_at_port      = options->at_port;
+    cpu.stop_port         = options->port;
+    cpu.stop_at_address   = options->at_address;
+    cpu.stop_address      = options->address;
+    run(&cpu);
+    double marker_seconds = seconds_now() - marker_start;
+
+    cpu.stop_at_port = 0;
+    cpu.stop_at_address = 0;
+
+    if (cpu.exit_reason != Exit_Reason_Stop_Port && cpu.exit_reason != Exit_Reason_Stop_Address) {
+        fprintf(stderr, "[ERROR]: The marker is not reached (%s after %llu instructions)\n",
+                exit_reason_name(cpu.exit_reason), (unsigned long long)cpu.instruction_count);
+        destroy_code_map(&cpu);
+        free(cpu.memory);
+        free_variants(&list);
+        return 1;
+    }
+
+    int process_count = options->process_count > 0 ? options->process_count : cpu_core_count();
+    if (process_count > FANOUT_MAX_PROCESS_COUNT) process_count = FANOUT_MAX_PROCESS_COUNT;
+
+    u64 marker_count = cpu.instruction_count;
+    double start = seconds_now();
+    double start_seconds = run_variants(&cpu, &list, options, process_count);
+    double seconds = seconds_now() - start;
+
+    FILE *fp = stdout;
+    if (options->report_filename) {
+        fp = fopen(options->report_filename, "w");
+        if (fp == NULL) {
+            fprintf(stderr, "[ERROR]: Failed to open %s file.\n", options->report_filename);
+            fp = stdout;
+        }
+    }
+
+    write_fanout_report(fp, &list, marker_count, process_count, marker_seconds, seconds, start_seconds);
+
+    if (fp != stdout) fclose(fp);
+
+    int exit_code = 0;
+    for (u32 i = 0; i < list.count; i++) {
+        if (list.variants[i].crashed) exit_code = 1;
+    }
+
+    destroy_code_map(&cpu);
+    free(cpu.memory);
+    free_variants(&list);
+
+    return exit_code;
+}
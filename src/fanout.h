@@ -0,0 +1,72 @@
+#ifndef _H_FANOUT
+#define _H_FANOUT
+
+#include "sim86.h"
+
+// Fan-out mode (--fanout <variants>): runs the binary once to a marker (a write to the --fanout_at_port, or the
+// instruction at the --fanout_at_address), then every variant continues from that state with its own input patch.
+// Every variant runs in a forked process, so the warmed-up memory is shared copy-on-write and the start of a variant
+// is a fork() and the patch, not the boot and the load. The child sends its result (the hashes of the batch mode)
+// to the parent through a pipe. At most --threads variants are running at the same time.
+//
+// There is no fork() on Windows, there the variants are running one by one in the same process, the memory is
+// copied back from the marker state before every variant.
+//
+// Variants file, one variant per line:
+//
+//     # name   patches
+//     small    0x10=0100 cx=10
+//     large    0x10=ff7f cx=1000 flags=0
+//
+// The patch is <absolute address>=<hex bytes> (the bytes in the memory order), or <register>=<value> where the
+// register is ax..di, es..ds, ip or flags.
+
+#define FANOUT_MAX_PROCESS_COUNT 256 // the results of the running processes have to fit into the pipe buffer
+
+typedef enum {
+    Fanout_Patch_Memory,
+    Fanout_Patch_Register,
+    Fanout_Patch_Ip,
+    Fanout_Patch_Flags,
+} Fanout_Patch_Type;
+
+typedef struct {
+    Fanout_Patch_Type type;
+    Register reg;
+    u32 address;
+    u16 value;
+
+    u8 *bytes;
+    u32 size;
+} Fanout_Patch;
+
+typedef struct {
+    char *name;
+    Fanout_Patch *patches;
+    u32 patch_count;
+
+    // Result
+    u8 crashed;             // the process is exited without a result
+    Exit_Reason exit_reason;
+    u64 instruction_count;  // after the marker
+    u64 registers_hash;
+    u64 memory_hash;
+    double seconds;         // of the variant, without the fork
+} Fanout_Variant;
+
+typedef struct {
+    u8 at_port;
+    u16 port;
+    u8 at_address;
+    u32 address;
+
+    int process_count;      // 0 = all cores
+    u64 instruction_limit;  // for the marker, and for every variant after the marker
+    char *report_filename;  // NULL = stdout
+    const CPU_Model *model; // NULL = the 8086
+} Fanout_Options;
+
+// Returns the process exit code
+int run_fanout(char *binary_filename, char *variants_filename, Fanout_Options *options);
+
+#endif
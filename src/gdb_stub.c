@@ -0,0 +1,469 @@
+#include "gdb_stub.h"
+#include "simulator.h"
+#include "code_map.h"
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// The register numbers of the i386 GDB, the rest is not sent
+#define GDB_REGISTER_COUNT 16
+
+static u32 get_gdb_register(CPU *cpu, u32 number)
+{
+    if (number < 8)   return get_from_register(cpu, (Register)(Register_ax + number));
+    if (number == 8)  return cpu->ip;
+    if (number == 9)  return cpu->flags;
+    if (number == 10) return get_from_register(cpu, Register_cs);
+    if (number == 11) return get_from_register(cpu, Register_ss);
+    if (number == 12) return get_from_register(cpu, Register_ds);
+    if (number == 13) return get_from_register(cpu, Register_es);
+    return 0; // fs, gs
+}
+
+static void set_gdb_register(CPU *cpu, u32 number, u32 value)
+{
+    u16 word = (u16)value;
+    if (number < 8)        set_to_register(cpu, (Register)(Register_ax + number), word);
+    else if (number == 8)  cpu->ip = word;
+    else if (number == 9)  cpu->flags = word;
+    else if (number == 10) set_to_register(cpu, Register_cs, word);
+    else if (number == 11) set_to_register(cpu, Register_ss, word);
+    else if (number == 12) set_to_register(cpu, Register_ds, word);
+    else if (number == 13) set_to_register(cpu, Register_es, word);
+}
+
+static s32 hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Parses the hex number at the cursor and moves the cursor after it
+static u32 parse_hex(char **cursor)
+{
+    u32 value = 0;
+    s32 digit;
+    while ((digit = hex_value(**cursor)) >= 0) {
+        value = (value << 4) | (u32)digit;
+        (*cursor)++;
+    }
+    return value;
+}
+
+// The register values are little endian byte strings
+static char *write_hex_u32(char *out, u32 value)
+{
+    for (u32 i = 0; i < 4; i++) {
+        u8 byte = (u8)(value >> (i * 8));
+        *out++ = hex_digits[byte >> 4];
+        *out++ = hex_digits[byte & 15];
+    }
+    return out;
+}
+
+static u32 read_hex_u32(char *in)
+{
+    u32 value = 0;
+    for (u32 i = 0; i < 4; i++) {
+        s32 high = hex_value(in[i * 2]);
+        s32 low = hex_value(in[i * 2 + 1]);
+        if (high < 0 || low < 0) break;
+        value |= (u32)((high << 4) | low) << (i * 8);
+    }
+    return value;
+}
+
+static THREAD_PROC(gdb_reader)
+{
+    Gdb_Stub *stub = (Gdb_Stub *)data;
+    u8 buffer[512];
+
+    for (;;) {
+        u32 count = socket_read(stub->socket, buffer, sizeof(buffer));
+
+        mutex_lock(&stub->mutex);
+        if (count == 0) {
+            stub->closed = 1;
+            condition_broadcast(&stub->changed);
+            mutex_unlock(&stub->mutex);
+            store_release_u32(&stub->stop_requested, 1);
+            break;
+        }
+
+        for (u32 i = 0; i < count; i++) {
+            // The interrupt is out of the packets, the running execution sees it at the next check
+            if (buffer[i] == 0x03) {
+                store_release_u32(&stub->stop_requested, 1);
+                continue;
+            }
+
+            while (stub->input_write - stub->input_read == GDB_INPUT_SIZE) {
+                condition_wait(&stub->changed, &stub->mutex);
+            }
+            stub->input[stub->input_write++ % GDB_INPUT_SIZE] = buffer[i];
+            condition_broadcast(&stub->changed);
+        }
+        mutex_unlock(&stub->mutex);
+    }
+
+    return 0;
+}
+
+// Returns -1 if the connection is closed
+static s32 next_byte(Gdb_Stub *stub)
+{
+    s32 byte = -1;
+
+    mutex_lock(&stub->mutex);
+    while (stub->input_read == stub->input_write && !stub->closed) {
+        condition_wait(&stub->changed, &stub->mutex);
+    }
+    if (stub->input_read != stub->input_write) {
+        byte = stub->input[stub->input_read++ % GDB_INPUT_SIZE];
+        condition_broadcast(&stub->changed);
+    }
+    mutex_unlock(&stub->mutex);
+
+    return byte;
+}
+
+// Reads the next "$<data>#<checksum>" packet into the buffer (zero terminated), the acks and the garbage before it
+// are skipped. Returns the length of the data or -1 if the connection is closed.
+static s32 read_packet(Gdb_Stub *stub, char *packet, u32 capacity)
+{
+    for (;;) {
+        s32 byte;
+        do {
+            byte = next_byte(stub);
+            if (byte < 0) return -1;
+        } while (byte != '$');
+
+        u32 length = 0;
+        u8 checksum = 0;
+        for (;;) {
+            byte = next_byte(stub);
+            if (byte < 0) return -1;
+            if (byte == '#') break;
+
+            checksum += (u8)byte;
+            if (length + 1 < capacity) packet[length++] = (char)byte;
+        }
+        packet[length] = 0;
+
+        s32 high = next_byte(stub);
+        s32 low = next_byte(stub);
+        if (high < 0 || low < 0) return -1;
+
+        u8 valid = hex_value((char)high) >= 0 && hex_value((char)low) >= 0 &&
+                   (u8)((hex_value((char)high) << 4) | hex_value((char)low)) == checksum;
+        if (stub->no_ack) return (s32)length;
+
+        socket_write(stub->socket, valid ? "+" : "-", 1);
+        if (valid) return (s32)length;
+    }
+}
+
+static void send_packet(Gdb_Stub *stub, const char *data)
+{
+    static char buffer[GDB_MAX_PACKET_SIZE + 4];
+    u32 length = 0;
+    u8 checksum = 0;
+
+    buffer[length++] = '$';
+    for (const char *c = data; *c && length < GDB_MAX_PACKET_SIZE; c++) {
+        buffer[length++] = *c;
+        checksum += (u8)*c;
+    }
+    buffer[length++] = '#';
+    buffer[length++] = hex_digits[checksum >> 4];
+    buffer[length++] = hex_digits[checksum & 15];
+
+    // The ack of the GDB is skipped by the next read_packet(), the packet is not sent again
+    socket_write(stub->socket, buffer, length);
+}
+
+static u8 handle_breakpoint_packet(Gdb_Stub *stub, char *packet)
+{
+    u8 insert = packet[0] == 'Z';
+    char *cursor = packet + 1;
+    u32 type = parse_hex(&cursor);
+    if (*cursor++ != ',') return 0;
+    u32 address = parse_hex(&cursor);
+    if (*cursor++ != ',') return 0;
+    u32 size = parse_hex(&cursor);
+
+    if (address >= MAX_MEMORY) return 0;
+
+    switch (type) {
+    case 0:   // software
+    case 1: { // hardware
+        if (insert) set_breakpoint(stub->breakpoints, address);
+        else        clear_breakpoint(stub->breakpoints, address);
+        return 1;
+    }
+    case 2:   // write
+    case 3:   // read
+    case 4: { // access
+        u8 watch_type = type == 2 ? Watch_Write : type == 3 ? Watch_Read : Watch_Read | Watch_Write;
+        if (insert) return add_watchpoint(stub->breakpoints, address, size, watch_type);
+        remove_watchpoints(stub->breakpoints, address);
+        return 1;
+    }
+    }
+    return 0;
+}
+
+// The stop reply after the resume
+static void format_stop(Gdb_Stub *stub, CPU *cpu, Debug_Stop stop, u8 interrupted)
+{
+    Breakpoints *breakpoints = stub->breakpoints;
+
+    switch (stop) {
+    case Debug_Stop_Watchpoint: {
+        Watchpoint *watchpoint = &breakpoints->watchpoints[breakpoints->hit_watchpoint];
+        const char *kind = watchpoint->type == Watch_Write ? "watch" : watchpoint->type == Watch_Read ? "rwatch" : "awatch";
+        sprintf(stub->last_stop, "T05%s:%x;", kind, breakpoints->hit_address);
+    } break;
+
+    case Debug_Stop_Exit: {
+        if (cpu->exit_reason == Exit_Reason_Unhandled_Instruction) sprintf(stub->last_stop, "S04"); // SIGILL
+        else if (cpu->exit_reason == Exit_Reason_Divide_Error)     sprintf(stub->last_stop, "S08"); // SIGFPE
+        else if (cpu->exit_reason == Exit_Reason_Bound_Range)      sprintf(stub->last_stop, "S0b"); // SIGSEGV
+        else if (cpu->exit_reason == Exit_Reason_Program_Exit)     sprintf(stub->last_stop, "W%02x", cpu->hle->exit_code);
+        else                                                       sprintf(stub->last_stop, "W00");
+    } break;
+
+    default: {
+        sprintf(stub->last_stop, interrupted ? "S02" : "S05"); // SIGINT, SIGTRAP
+    } break;
+    }
+}
+
+static void resume(Gdb_Stub *stub, CPU *cpu, u8 single_step)
+{
+    Debug_Stop stop;
+    u8 interrupted = 0;
+
+    if (single_step) {
+        stop = debug_continue(cpu, stub->breakpoints, 1);
+    } else {
+        // The packets are not handled here, the reader thread only sets the flag
+        for (;;) {
+            stop = debug_continue(cpu, stub->breakpoints, GDB_STOP_CHECK_INTERVAL);
+            if (stop != Debug_Stop_Step_Count) break;
+            if (load_acquire_u32(&stub->stop_requested)) {
+                interrupted = 1;
+                break;
+            }
+        }
+    }
+
+    format_stop(stub, cpu, stop, interrupted);
+    send_packet(stub, stub->last_stop);
+}
+
+static void handle_query(Gdb_Stub *stub, char *packet)
+{
+    if (strncmp(packet, "qSupported", 10) == 0) {
+        char reply[64];
+        sprintf(reply, "PacketSize=%x;QStartNoAckMode+", GDB_MAX_PACKET_SIZE);
+        send_packet(stub, reply);
+    } else if (STR_EQUAL(packet, "qAttached")) {
+        send_packet(stub, "1");
+    } else if (STR_EQUAL(packet, "qC")) {
+        send_packet(stub, "QC1");
+    } else if (STR_EQUAL(packet, "qfThreadInfo")) {
+        send_packet(stub, "m1");
+    } else if (STR_EQUAL(packet, "qsThreadInfo")) {
+        send_packet(stub, "l");
+    } else if (strncmp(packet, "qSymbol", 7) == 0) {
+        send_packet(stub, "OK");
+    } else if (STR_EQUAL(packet, "QStartNoAckMode")) {
+        send_packet(stub, "OK");
+        stub->no_ack = 1;
+    } else {
+        send_packet(stub, "");
+    }
+}
+
+// Returns 0 when the session is over (killed or detached)
+static u8 handle_packet(Gdb_Stub *stub, CPU *cpu, char *packet, u8 *detached)
+{
+    static char reply[GDB_MAX_PACKET_SIZE];
+
+    switch (packet[0]) {
+    case '?': {
+        send_packet(stub, stub->last_stop);
+    } break;
+
+    case 'g': {
+        char *out = reply;
+        for (u32 i = 0; i < GDB_REGISTER_COUNT; i++) {
+            out = write_hex_u32(out, get_gdb_register(cpu, i));
+        }
+        *out = 0;
+        send_packet(stub, reply);
+    } break;
+
+    case 'G': {
+        u32 length = (u32)strlen(packet + 1);
+        for (u32 i = 0; i < GDB_REGISTER_COUNT && (i + 1) * 8 <= length; i++) {
+            set_gdb_register(cpu, i, read_hex_u32(packet + 1 + i * 8));
+        }
+        send_packet(stub, "OK");
+    } break;
+
+    case 'p': {
+        char *cursor = packet + 1;
+        u32 number = parse_hex(&cursor);
+        *write_hex_u32(reply, get_gdb_register(cpu, number)) = 0;
+        send_packet(stub, number < GDB_REGISTER_COUNT ? reply : "E01");
+    } break;
+
+    case 'P': {
+        char *cursor = packet + 1;
+        u32 number = parse_hex(&cursor);
+        if (*cursor++ != '=' || number >= GDB_REGISTER_COUNT) {
+            send_packet(stub, "E01");
+            break;
+        }
+        set_gdb_register(cpu, number, read_hex_u32(cursor));
+        send_packet(stub, "OK");
+    } break;
+
+    case 'm': {
+        char *cursor = packet + 1;
+        u32 address = parse_hex(&cursor);
+        u32 size = *cursor++ == ',' ? parse_hex(&cursor) : 0;
+        if (address >= MAX_MEMORY || size > MAX_MEMORY - address || size * 2 >= sizeof(reply)) {
+            send_packet(stub, "E01");
+            break;
+        }
+
+        // Directly from the memory, the watchpoints are not hit by the debugger
+        for (u32 i = 0; i < size; i++) {
+            u8 byte = cpu->memory[address + i];
+            reply[i * 2]     = hex_digits[byte >> 4];
+            reply[i * 2 + 1] = hex_digits[byte & 15];
+        }
+        reply[size * 2] = 0;
+        send_packet(stub, reply);
+    } break;
+
+    case 'M': {
+        char *cursor = packet + 1;
+        u32 address = parse_hex(&cursor);
+        u32 size = *cursor++ == ',' ? parse_hex(&cursor) : 0;
+        if (*cursor++ != ':' || address >= MAX_MEMORY || size > MAX_MEMORY - address || strlen(cursor) < size * 2) {
+            send_packet(stub, "E01");
+            break;
+        }
+
+        for (u32 i = 0; i < size; i++) {
+            cpu->memory[address + i] = (u8)((hex_value(cursor[i * 2]) << 4) | hex_value(cursor[i * 2 + 1]));
+        }
+        if (size) invalidate_code(cpu->code_map, address, size);
+        send_packet(stub, "OK");
+    } break;
+
+    case 'Z':
+    case 'z': {
+        send_packet(stub, handle_breakpoint_packet(stub, packet) ? "OK" : "E01");
+    } break;
+
+    // @Todo: the resume address of the "c addr" and the "s addr" is ignored
+    case 'c': {
+        resume(stub, cpu, 0);
+    } break;
+
+    case 's': {
+        resume(stub, cpu, 1);
+    } break;
+
+    case 'q':
+    case 'Q': {
+        handle_query(stub, packet);
+    } break;
+
+    case 'H':
+    case 'T': {
+        send_packet(stub, "OK");
+    } break;
+
+    case 'D': {
+        send_packet(stub, "OK");
+        *detached = 1;
+        return 0;
+    }
+
+    case 'k': {
+        cpu->exit_reason = Exit_Reason_User_Quit;
+        return 0;
+    }
+
+    case 'v': {
+        if (strncmp(packet, "vKill", 5) == 0) {
+            send_packet(stub, "OK");
+            cpu->exit_reason = Exit_Reason_User_Quit;
+            return 0;
+        }
+        send_packet(stub, "");
+    } break;
+
+    default: {
+        send_packet(stub, "");
+    } break;
+    }
+
+    return 1;
+}
+
+int run_gdb_stub(CPU *cpu, char *address)
+{
+    static Gdb_Stub stub;
+
+    fprintf(stderr, "gdb: waiting for the connection at %s\n", address);
+    stub.socket = accept_local_connection(address);
+    if (stub.socket == INVALID_SOCKET_HANDLE) {
+        fprintf(stderr, "[ERROR]: Failed to accept the gdb connection at %s\n", address);
+        return 1;
+    }
+    fprintf(stderr, "gdb: connected\n");
+
+    mutex_init(&stub.mutex);
+    condition_init(&stub.changed);
+    stub.breakpoints = create_breakpoints();
+    cpu->breakpoints = stub.breakpoints;
+    sprintf(stub.last_stop, "S05");
+
+    stub.reader = thread_start(gdb_reader, &stub);
+
+    static char packet[GDB_MAX_PACKET_SIZE];
+    u8 detached = 0;
+    for (;;) {
+        // The interrupt while it's stopped is meaningless, the next continue should not stop at once
+        store_release_u32(&stub.stop_requested, 0);
+
+        s32 length = read_packet(&stub, packet, sizeof(packet));
+        if (length < 0) break;
+        if (length == 0) continue;
+
+        if (!handle_packet(&stub, cpu, packet, &detached)) break;
+    }
+
+    socket_shutdown(stub.socket);
+    thread_join(stub.reader);
+    socket_close(stub.socket);
+
+    cpu->breakpoints = NULL;
+    destroy_breakpoints(stub.breakpoints);
+
+    if (detached) {
+        // The cpu->graphics is NULL, the main doesn't open the window for the gdb stub
+        fprintf(stderr, "gdb: detached\n");
+        run(cpu);
+    }
+
+    return 0;
+}
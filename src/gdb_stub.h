@@ -0,0 +1,48 @@
+#ifndef _H_GDB_STUB
+#define _H_GDB_STUB
+
+#include "sim86.h"
+#include "breakpoints.h"
+#include "platform.h"
+
+// GDB remote serial protocol server (--gdb <port> or --gdb unix:<path>), on the localhost only:
+//
+//     gdb -ex "set architecture i8086" -ex "target remote localhost:1234"
+//
+// The registers are the i386 ones of the GDB (eax..edi, eip, eflags, cs, ss, ds, es, fs, gs) with the 8086
+// values, fs and gs are always 0. The memory addresses are physical (linear) addresses, so the current instruction
+// is at $cs*16+$eip. The software and the hardware breakpoints are the same (the bitmap of the breakpoints.h,
+// the memory is never patched), the watchpoints are the write, read and access watchpoints of the breakpoints.h.
+//
+// The socket is read by its own thread, which queues the packets and only sets the stop_requested flag at the
+// interrupt (Ctrl-C) of the GDB. The execution checks that flag once per GDB_STOP_CHECK_INTERVAL instructions,
+// otherwise it's the debug_continue() loop of the debugger.
+
+#define GDB_STOP_CHECK_INTERVAL 4096
+#define GDB_MAX_PACKET_SIZE     4096
+#define GDB_INPUT_SIZE          8192
+
+typedef struct {
+    Socket socket;
+    Thread reader;
+
+    // Written by the reader thread, read by the main thread
+    Mutex mutex;
+    Condition changed;
+    u8 input[GDB_INPUT_SIZE]; // ring buffer
+    u32 input_read;
+    u32 input_write;
+    u8 closed;
+
+    volatile u32 stop_requested;
+
+    Breakpoints *breakpoints;
+    u8 no_ack;
+    char last_stop[64]; // the reply of the '?'
+} Gdb_Stub;
+
+// Waits for the GDB at the address, then serves it until it's detached or killed or the connection is closed.
+// Returns the process exit code.
+int run_gdb_stub(CPU *cpu, char *address);
+
+#endif
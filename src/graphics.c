@@ -0,0 +1,100 @@
+#include "graphics.h"
+
+#ifdef GRAPHICS_ENABLED
+
+#include "SDL.h"
+
+struct Graphics {
+    SDL_Surface *screen;
+    u64 frame_cycle; // the cycle count of the last frame
+};
+
+Graphics *open_graphics(void)
+{
+    if (SDL_Init(SDL_INIT_VIDEO) != 0) return NULL;
+
+    SDL_Surface *screen = SDL_SetVideoMode(GRAPHICS_X, GRAPHICS_Y, 8*2, 0);
+    if (!screen) {
+        SDL_Quit();
+        return NULL;
+    }
+    SDL_EnableUNICODE(1);
+    SDL_EnableKeyRepeat(500, 30);
+
+    Graphics *graphics = ALLOC_MEMORY(Graphics);
+    assert(graphics);
+    graphics->screen = screen;
+    graphics->frame_cycle = 0;
+
+    return graphics;
+}
+
+void close_graphics(Graphics *graphics)
+{
+    if (!graphics) return;
+
+    SDL_Quit();
+    free(graphics);
+}
+
+// The video memory is bottom-up
+static void swap_framebuffer_vertically(u16 *pixels, u32 width, u32 height)
+{
+    u16 row[GRAPHICS_X];
+    for (u32 y = 0; y < height / 2; y++) {
+        u16 *top = pixels + y * width;
+        u16 *bottom = pixels + (height - 1 - y) * width;
+        memcpy(row, top, width * sizeof(u16));
+        memcpy(top, bottom, width * sizeof(u16));
+        memcpy(bottom, row, width * sizeof(u16));
+    }
+}
+
+// The 16 bit pixels of the video memory at the 0, scaled 2x
+static void present_frame(Graphics *graphics, CPU *cpu)
+{
+    u16 *pxptr = (u16 *)graphics->screen->pixels;
+    u16 *vid_mem_base = (u16 *)&cpu->memory[0];
+
+    u32 j = 0;
+    for (u32 i = 0; i < (GRAPHICS_X/2)*(GRAPHICS_Y/2); i++) {
+        u16 color = vid_mem_base[i];
+
+        if (j != 0 && (j % GRAPHICS_X) == 0) {
+            j += GRAPHICS_X;
+        }
+
+        pxptr[j] = color;
+        pxptr[j+1] = color;
+        pxptr[j+GRAPHICS_X] = color;
+        pxptr[j+GRAPHICS_X+1] = color;
+
+        j += 2;
+    }
+
+    swap_framebuffer_vertically(pxptr, GRAPHICS_X, GRAPHICS_Y);
+    SDL_Flip(graphics->screen);
+}
+
+void update_graphics(CPU *cpu)
+{
+    Graphics *graphics = cpu->graphics;
+    if (!graphics) return;
+
+    // The cycle count is restarted by the reset() and the restore
+    if (cpu->cycle_count - graphics->frame_cycle >= GRAPHICS_FRAME_CYCLES || cpu->cycle_count < graphics->frame_cycle) {
+        graphics->frame_cycle = cpu->cycle_count;
+        present_frame(graphics, cpu);
+
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {}
+    }
+}
+
+#else
+
+Graphics *open_graphics(void) { return NULL; }
+void close_graphics(Graphics *graphics) {}
+void update_graphics(CPU *cpu) {}
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef _H_GRAPHICS
+#define _H_GRAPHICS
+
+#include "sim86.h"
+
+// The SDL window of the graphics guests, only in the build with the -DGRAPHICS_ENABLED (see the Makefile). The
+// main opens it once, the headless runs (the batch, the fanout, the gdb stub, the library, the tools) never set the
+// cpu->graphics. The run() calls the update_graphics() after every block, it presents a frame of the video memory
+// after every GRAPHICS_FRAME_CYCLES emulated cycles. So the frame rate follows the emulated time, the paced run (a
+// run() per burst) draws the same frames as one long run().
+
+#define GRAPHICS_X 256
+#define GRAPHICS_Y 256
+#define GRAPHICS_FRAME_CYCLES (I8086_CLOCK_HZ / 30)
+
+// Returns NULL without the GRAPHICS_ENABLED or if the window can't be opened
+Graphics *open_graphics(void);
+void close_graphics(Graphics *graphics);
+
+void update_graphics(CPU *cpu);
+
+#endif
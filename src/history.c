@@ -0,0 +1,316 @@
+#include "history.h"
+#include "simulator.h"
+#include "code_map.h"
+
+static void capture_state(CPU *cpu, Machine_State *state)
+{
+    state->instruction_count = cpu->instruction_count;
+    state->cycle_count = cpu->cycle_count;
+    state->halted_cycles = cpu->halted_cycles;
+    state->next_event_cycle = cpu->next_event_cycle;
+    state->decoder_cursor = cpu->decoder_cursor;
+    state->ip = cpu->ip;
+    state->flags = cpu->flags;
+    state->halted = cpu->halted;
+    state->event_scheduled = cpu->event_scheduled;
+    memcpy(state->regmem, cpu->regmem, sizeof(state->regmem));
+    memcpy(state->memory_padding, cpu->memory + MAX_MEMORY, MEMORY_PADDING);
+}
+
+static void apply_state(CPU *cpu, Machine_State *state)
+{
+    cpu->instruction_count = state->instruction_count;
+    cpu->cycle_count = state->cycle_count;
+    cpu->halted_cycles = state->halted_cycles;
+    cpu->next_event_cycle = state->next_event_cycle;
+    cpu->decoder_cursor = state->decoder_cursor;
+    cpu->ip = state->ip;
+    cpu->flags = state->flags;
+    cpu->halted = state->halted;
+    cpu->event_scheduled = state->event_scheduled;
+    memcpy(cpu->regmem, state->regmem, sizeof(cpu->regmem));
+    memcpy(cpu->memory + MAX_MEMORY, state->memory_padding, MEMORY_PADDING);
+
+    cpu->terminate = 0;
+    cpu->exit_reason = Exit_Reason_None;
+}
+
+// The memory is changed behind the set_data_to_memory()
+static void restore_memory(CPU *cpu, u32 address, const u8 *data, u32 size)
+{
+    memcpy(cpu->memory + address, data, size);
+    if (cpu->code_map) {
+        invalidate_code_range(cpu->code_map, address, size);
+    }
+}
+
+u64 history_memory_usage(History *history)
+{
+    return history->page_bytes +
+           (u64)history->entry_capacity * sizeof(Journal_Entry) +
+           (u64)history->write_capacity * sizeof(Journal_Write) +
+           (u64)history->checkpoint_capacity * sizeof(Checkpoint);
+}
+
+static Checkpoint *last_checkpoint(History *history)
+{
+    return &history->checkpoints[history->checkpoint_count - 1];
+}
+
+static void drop_oldest_checkpoint(History *history)
+{
+    memmove(history->checkpoints, history->checkpoints + 1, (history->checkpoint_count - 1) * sizeof(Checkpoint));
+    history->checkpoint_count -= 1;
+
+    // The copies before the oldest checkpoint are never restored
+    u32 oldest = history->checkpoints[0].id;
+    for (u32 p = 0; p < HISTORY_PAGE_COUNT; p++) {
+        Page_History *page = &history->pages[p];
+
+        u32 dropped = 0;
+        while (dropped < page->count && page->copies[dropped].checkpoint < oldest) {
+            free(page->copies[dropped].data);
+            history->page_bytes -= HISTORY_PAGE_SIZE;
+            dropped += 1;
+        }
+        if (dropped) {
+            memmove(page->copies, page->copies + dropped, (page->count - dropped) * sizeof(Page_Copy));
+            page->count -= dropped;
+        }
+    }
+}
+
+static void make_checkpoint(History *history, CPU *cpu)
+{
+    if (history->checkpoint_count == history->checkpoint_capacity) {
+        history->checkpoint_capacity = history->checkpoint_capacity ? history->checkpoint_capacity * 2 : 64;
+        history->checkpoints = (Checkpoint *)realloc(history->checkpoints, history->checkpoint_capacity * sizeof(Checkpoint));
+        assert(history->checkpoints);
+    }
+
+    Checkpoint *checkpoint = &history->checkpoints[history->checkpoint_count];
+    checkpoint->id = history->checkpoint_count ? last_checkpoint(history)->id + 1 : 0;
+    capture_state(cpu, &checkpoint->state);
+    history->checkpoint_count += 1;
+
+    history->entry_count = 0;
+    history->write_count = 0;
+
+    while (history->checkpoint_count > 1 && history_memory_usage(history) > history->history_bytes) {
+        drop_oldest_checkpoint(history);
+    }
+}
+
+History *create_history(CPU *cpu, u64 checkpoint_interval, u64 history_bytes)
+{
+    History *history = (History *)calloc(1, sizeof(History));
+    assert(history);
+
+    history->checkpoint_interval = checkpoint_interval ? checkpoint_interval : HISTORY_DEFAULT_INTERVAL;
+    history->history_bytes = history_bytes ? history_bytes : HISTORY_DEFAULT_BYTES;
+
+    make_checkpoint(history, cpu);
+    cpu->history = history;
+
+    return history;
+}
+
+void destroy_history(CPU *cpu)
+{
+    History *history = cpu->history;
+    if (!history) return;
+
+    for (u32 p = 0; p < HISTORY_PAGE_COUNT; p++) {
+        for (u32 i = 0; i < history->pages[p].count; i++) {
+            free(history->pages[p].copies[i].data);
+        }
+        free(history->pages[p].copies);
+    }
+    free(history->checkpoints);
+    free(history->entries);
+    free(history->writes);
+    free(history);
+
+    cpu->history = NULL;
+}
+
+void history_step_begin(History *history, CPU *cpu)
+{
+    // The journal of the interval can be large (e.g. a lot of rep movsw), then the checkpoint is made earlier
+    u64 journal_bytes = (u64)history->entry_count * sizeof(Journal_Entry) + (u64)history->write_count * sizeof(Journal_Write);
+    if (cpu->instruction_count - last_checkpoint(history)->state.instruction_count >= history->checkpoint_interval ||
+        journal_bytes > history->history_bytes / 4) {
+        make_checkpoint(history, cpu);
+    }
+
+    if (history->entry_count == history->entry_capacity) {
+        history->entry_capacity = history->entry_capacity ? history->entry_capacity * 2 : 1024;
+        history->entries = (Journal_Entry *)realloc(history->entries, history->entry_capacity * sizeof(Journal_Entry));
+        assert(history->entries);
+    }
+
+    Journal_Entry *entry = &history->entries[history->entry_count++];
+    capture_state(cpu, &entry->state);
+    entry->write_start = history->write_count;
+}
+
+void history_memory_write(History *history, CPU *cpu, u32 address, u32 size)
+{
+    if (history->entry_count) {
+        if (history->write_count == history->write_capacity) {
+            history->write_capacity = history->write_capacity ? history->write_capacity * 2 : 1024;
+            history->writes = (Journal_Write *)realloc(history->writes, history->write_capacity * sizeof(Journal_Write));
+            assert(history->writes);
+        }
+
+        Journal_Write *write = &history->writes[history->write_count++];
+        write->address = address;
+        write->size = (u8)size;
+        memcpy(write->old_bytes, cpu->memory + address, size);
+    }
+
+    // The first write of the page after the checkpoint copies the page (the word write can touch two pages)
+    u32 checkpoint = last_checkpoint(history)->id;
+    for (u32 p = address >> HISTORY_PAGE_SHIFT; p <= (address + size - 1) >> HISTORY_PAGE_SHIFT; p++) {
+        if (p >= HISTORY_PAGE_COUNT) break; // the padding is in the state
+
+        Page_History *page = &history->pages[p];
+        if (page->count && page->copies[page->count - 1].checkpoint == checkpoint) continue;
+
+        if (page->count == page->capacity) {
+            page->capacity = page->capacity ? page->capacity * 2 : 4;
+            page->copies = (Page_Copy *)realloc(page->copies, page->capacity * sizeof(Page_Copy));
+            assert(page->copies);
+        }
+
+        Page_Copy *copy = &page->copies[page->count++];
+        copy->checkpoint = checkpoint;
+        copy->data = (u8 *)malloc(HISTORY_PAGE_SIZE);
+        assert(copy->data);
+        memcpy(copy->data, cpu->memory + (p << HISTORY_PAGE_SHIFT), HISTORY_PAGE_SIZE);
+        history->page_bytes += HISTORY_PAGE_SIZE;
+    }
+}
+
+u64 history_start(History *history)
+{
+    return history->checkpoints[0].state.instruction_count;
+}
+
+// Restores the checkpoint (by index), the later checkpoints and the journal are dropped
+static void restore_checkpoint(History *history, CPU *cpu, u32 index)
+{
+    u32 id = history->checkpoints[index].id;
+
+    for (u32 p = 0; p < HISTORY_PAGE_COUNT; p++) {
+        Page_History *page = &history->pages[p];
+
+        // The first copy at or after the checkpoint has the content at the checkpoint, the page is not written
+        // between them
+        u32 first = page->count;
+        while (first > 0 && page->copies[first - 1].checkpoint >= id) first--;
+        if (first == page->count) continue;
+
+        restore_memory(cpu, p << HISTORY_PAGE_SHIFT, page->copies[first].data, HISTORY_PAGE_SIZE);
+
+        for (u32 i = first; i < page->count; i++) {
+            free(page->copies[i].data);
+            history->page_bytes -= HISTORY_PAGE_SIZE;
+        }
+        page->count = first;
+    }
+
+    apply_state(cpu, &history->checkpoints[index].state);
+
+    history->checkpoint_count = index + 1;
+    history->entry_count = 0;
+    history->write_count = 0;
+}
+
+static void undo_last_entry(History *history, CPU *cpu)
+{
+    Journal_Entry *entry = &history->entries[--history->entry_count];
+
+    while (history->write_count > entry->write_start) {
+        Journal_Write *write = &history->writes[--history->write_count];
+        restore_memory(cpu, write->address, write->old_bytes, write->size);
+    }
+
+    apply_state(cpu, &entry->state);
+}
+
+// Executes forward to the instruction count without the trace. Returns 1 if the stop proc is matched, the last
+// match is in the last_match.
+static u8 execute_to(CPU *cpu, u64 instruction_count, History_Stop_Proc stop, void *user, u64 *last_match)
+{
+    FILE *trace = cpu->trace;
+    cpu->trace = NULL;
+
+    u8 found = 0;
+    while (cpu->instruction_count < instruction_count) {
+        if (stop && stop(cpu, user)) {
+            *last_match = cpu->instruction_count;
+            found = 1;
+        }
+        if (!step_instruction(cpu)) break;
+    }
+
+    cpu->trace = trace;
+    return found;
+}
+
+// The last checkpoint before the instruction count, -1 if there is no one
+static s32 checkpoint_before(History *history, u64 instruction_count)
+{
+    for (s32 i = (s32)history->checkpoint_count - 1; i >= 0; i--) {
+        if (history->checkpoints[i].state.instruction_count < instruction_count) return i;
+    }
+    return -1;
+}
+
+u8 history_go_to(History *history, CPU *cpu, u64 instruction_count)
+{
+    if (instruction_count < history_start(history)) return 0;
+
+    if (instruction_count < cpu->instruction_count) {
+        if (history->entry_count && history->entries[0].state.instruction_count <= instruction_count) {
+            while (cpu->instruction_count > instruction_count) {
+                undo_last_entry(history, cpu);
+            }
+            return 1;
+        }
+
+        s32 index = checkpoint_before(history, instruction_count + 1);
+        if (index < 0) return 0;
+        restore_checkpoint(history, cpu, (u32)index);
+    }
+
+    u64 unused;
+    execute_to(cpu, instruction_count, NULL, NULL, &unused);
+
+    return cpu->instruction_count == instruction_count;
+}
+
+u8 history_find_last(History *history, CPU *cpu, History_Stop_Proc stop, void *user)
+{
+    u64 original = cpu->instruction_count;
+    u64 end = original;
+
+    // The intervals from the latest one, every interval is executed forward to find the last match in it
+    s32 index;
+    while ((index = checkpoint_before(history, end)) >= 0) {
+        u64 start = history->checkpoints[index].state.instruction_count;
+        restore_checkpoint(history, cpu, (u32)index);
+
+        u64 last_match;
+        if (execute_to(cpu, end, stop, user, &last_match)) {
+            history_go_to(history, cpu, last_match);
+            return 1;
+        }
+
+        end = start;
+    }
+
+    history_go_to(history, cpu, original);
+    return 0;
+}
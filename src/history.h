@@ -0,0 +1,116 @@
+#ifndef _H_HISTORY
+#define _H_HISTORY
+
+#include "sim86.h"
+
+// Execution history for the reverse debugging (see the debugger.h). Two parts:
+//
+// - Checkpoints at every checkpoint_interval instruction: the registers and the pages which are written after the
+//   checkpoint. The page is copied at its first write after the checkpoint (copy-on-first-write), so the copy is
+//   the content at the checkpoint, and the pages which are not written are not copied. The memory at the
+//   checkpoint K is restored from the first copy of every page which is made at K or later.
+//
+// - Undo journal since the last checkpoint: the registers before every instruction and the old bytes of every
+//   memory write, so the reverse step is only the undo of the last entry. The journal is cleared at every
+//   checkpoint, before a checkpoint the reverse step restores the previous checkpoint and executes forward.
+//
+// The execution is deterministic, so the forward execution from a checkpoint is the same as the original one.
+//
+// The memory usage is bounded by the history_bytes: the oldest checkpoints (and their page copies) are dropped,
+// and a new checkpoint is made early if the journal of the interval is too large.
+
+#define HISTORY_PAGE_SHIFT 12
+#define HISTORY_PAGE_SIZE  (1 << HISTORY_PAGE_SHIFT)
+#define HISTORY_PAGE_COUNT (MAX_MEMORY >> HISTORY_PAGE_SHIFT)
+
+#define HISTORY_DEFAULT_INTERVAL (16 * 1024)
+#define HISTORY_DEFAULT_BYTES    (64 * 1024 * 1024)
+
+// Everything of the CPU which is changed by the execution (beside the memory)
+typedef struct {
+    u64 instruction_count;
+    u64 cycle_count;
+    u64 halted_cycles;
+    u64 next_event_cycle;
+    u32 decoder_cursor;
+    u16 ip;
+    u16 flags;
+    u8 halted;
+    u8 event_scheduled;
+    u8 regmem[64];
+    u8 memory_padding[MEMORY_PADDING];
+} Machine_State;
+
+typedef struct {
+    Machine_State state;
+    u32 write_start;  // the index of the first write of the instruction in the journal writes
+} Journal_Entry;
+
+typedef struct {
+    u32 address;
+    u8 old_bytes[2];
+    u8 size;
+} Journal_Write;
+
+typedef struct {
+    u32 checkpoint;   // the id of the checkpoint, the content is the memory at that checkpoint
+    u8 *data;
+} Page_Copy;
+
+typedef struct {
+    Page_Copy *copies; // ordered by the checkpoint
+    u32 count;
+    u32 capacity;
+} Page_History;
+
+typedef struct {
+    u32 id;
+    Machine_State state;
+} Checkpoint;
+
+struct History {
+    u64 checkpoint_interval;
+    u64 history_bytes;
+
+    // The ids are increasing, the first one is the oldest which is kept
+    Checkpoint *checkpoints;
+    u32 checkpoint_count;
+    u32 checkpoint_capacity;
+
+    Page_History pages[HISTORY_PAGE_COUNT];
+    u64 page_bytes;
+
+    Journal_Entry *entries;
+    u32 entry_count;
+    u32 entry_capacity;
+    Journal_Write *writes;
+    u32 write_count;
+    u32 write_capacity;
+};
+
+// Starts the history from the current state (the first checkpoint). The 0 arguments are the defaults.
+History *create_history(CPU *cpu, u64 checkpoint_interval, u64 history_bytes);
+void destroy_history(CPU *cpu);
+
+// Called by the step_instruction() before the decoding
+void history_step_begin(History *history, CPU *cpu);
+// Called by the set_data_to_memory() before the write
+void history_memory_write(History *history, CPU *cpu, u32 address, u32 size);
+
+// The instruction count of the oldest state which can be restored
+u64 history_start(History *history);
+
+// Restores the state before the instruction_count-th instruction (restores a checkpoint and executes forward if
+// it's needed, without the trace). Returns 0 if it's before the history_start() or it's not reachable.
+u8 history_go_to(History *history, CPU *cpu, u64 instruction_count);
+
+// Returns 1 if the execution has to stop before the next instruction (e.g. a breakpoint)
+typedef u8 (*History_Stop_Proc)(CPU *cpu, void *user);
+
+// Restores the state before the last instruction where the stop proc returns 1, before the current
+// instruction_count. Returns 0 if there is no such instruction in the history (then the state is not changed).
+u8 history_find_last(History *history, CPU *cpu, History_Stop_Proc stop, void *user);
+
+u64 history_memory_usage(History *history);
+
+#endif
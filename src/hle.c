@@ -0,0 +1,515 @@
+#include "hle.h"
+#include "simulator.h"
+#include "code_map.h"
+#include "trace.h"
+#include "history.h"
+#include "breakpoints.h"
+
+#include <errno.h>
+#ifdef _WIN32
+#include <conio.h>
+#include <io.h>
+#else
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+static u8 is_terminal(FILE *fp)
+{
+#ifdef _WIN32
+    return _isatty(_fileno(fp)) != 0;
+#else
+    return isatty(fileno(fp)) != 0;
+#endif
+}
+
+// The DOS paths are up to 128 bytes with the 0
+#define HLE_MAX_PATH 128
+
+void init_hle(Hle *hle, CPU *cpu)
+{
+    ZERO_MEMORY(hle, sizeof(Hle));
+
+    hle->trapped[0x10] = 1;
+    hle->trapped[0x20] = 1;
+    hle->trapped[0x16] = 1;
+    hle->trapped[0x21] = 1;
+
+    hle->input = stdin;
+    hle->output = stdout;
+
+    // The key check of a terminal polls the descriptor, a line which is read into the buffer of the stdio at once
+    // wouldn't be seen by the poll() after its first key. Only the terminal, the redirected input keeps its buffer
+    // (it's never polled, see the is_key_ready()).
+    if (is_terminal(hle->input)) {
+        setvbuf(hle->input, NULL, _IONBF, 0);
+    }
+
+    // Below the video memory (the 640 KB). The .COM and the .EXE own the first block (it can be resized by the ES=PSP),
+    // otherwise it's above the stack of the ss=0 and the image if it's down there.
+    hle->memory_end = 0xA000;
+    if (cpu->psp_segment) {
+        hle->memory_start = cpu->psp_segment;
+        hle->blocks[0].segment = cpu->psp_segment;
+        hle->blocks[0].paragraphs = cpu->program_paragraphs;
+        hle->block_count = 1;
+        return;
+    }
+
+    hle->memory_start = 0x1000;
+    u32 image_end = (cpu->exec_end + 15) >> 4;
+    if (cpu->exec_start < 0xA0000 && image_end > hle->memory_start) {
+        hle->memory_start = image_end < hle->memory_end ? (u16)image_end : hle->memory_end;
+    }
+}
+
+void close_hle(Hle *hle)
+{
+    for (u32 handle = 3; handle < HLE_MAX_FILES; handle++) {
+        if (hle->files[handle]) {
+            fclose(hle->files[handle]);
+            hle->files[handle] = NULL;
+        }
+    }
+}
+
+///////////////////////////////////////////////////
+// :Guest_Memory
+//
+// The services read and write the guest memory in bulk, not by the set_data_to_memory(), so they do the same
+// bookkeeping for the whole range.
+
+// The bytes at the segment:offset, cut at the end of the segment (no wrap around) and at the end of the memory
+static u32 guest_span(CPU *cpu, Register segment_reg, u16 offset, u32 count, u32 *address)
+{
+    *address = calc_segment_address_with_absolute_offset(cpu, segment_reg, offset);
+
+    u32 max_count = 0x10000 - offset;
+    if (count > max_count) count = max_count;
+    if (count > MAX_MEMORY - *address) count = MAX_MEMORY - *address;
+
+    return count;
+}
+
+static void before_guest_write(CPU *cpu, u32 address, u32 size)
+{
+    if (size == 0) return;
+
+    invalidate_code(cpu->code_map, address, size);
+    if (cpu->breakpoints) {
+        check_watchpoints(cpu->breakpoints, address, size, Watch_Write);
+    }
+    if (cpu->history) {
+        // The journal keeps up to a word of the old bytes per write
+        for (u32 offset = 0; offset < size; offset += 2) {
+            history_memory_write(cpu->history, cpu, address + offset, size - offset < 2 ? 1 : 2);
+        }
+    }
+}
+
+static void after_guest_write(CPU *cpu, u32 address, u32 size)
+{
+    if (cpu->trace_writer) {
+        for (u32 offset = 0; offset < size; offset += 2) {
+            u8 wide = size - offset >= 2;
+            u16 data = wide ? BYTE_LOHI_TO_HILO(cpu->memory[address + offset], cpu->memory[address + offset + 1])
+                            : cpu->memory[address + offset];
+            trace_memory_write(cpu->trace_writer, address + offset, data, wide);
+        }
+    }
+}
+
+///////////////////////////////////////////////////
+// :Results
+
+static void hle_success(CPU *cpu)
+{
+    cpu->flags &= ~F_CARRY;
+}
+
+static void hle_error(CPU *cpu, u16 error_code)
+{
+    set_to_register(cpu, Register_ax, error_code);
+    cpu->flags |= F_CARRY;
+}
+
+static void hle_output(Hle *hle, const void *data, u32 size)
+{
+    if (hle->output && size) {
+        fwrite(data, 1, size, hle->output);
+    }
+}
+
+static void hle_terminate(CPU *cpu, Hle *hle, u8 exit_code)
+{
+    hle->exit_code = exit_code;
+    cpu->terminate = 1;
+    cpu->block_end = 1;
+    cpu->exit_reason = Exit_Reason_Program_Exit;
+}
+
+///////////////////////////////////////////////////
+// :Keyboard
+
+// 1 if the read_input_byte() doesn't block: the peeked key is kept, or the terminal has a key. The redirected input
+// (a file or a pipe) is the keys of a script, it's always ready, the read waits for the next byte or the end.
+static u8 is_key_ready(Hle *hle)
+{
+    if (hle->has_pending_key) return 1;
+    if (!is_terminal(hle->input)) return 1;
+
+#ifdef _WIN32
+    return _kbhit() != 0;
+#else
+    struct pollfd p = {fileno(hle->input), POLLIN, 0};
+    return poll(&p, 1, 0) > 0;
+#endif
+}
+
+// The console of the Windows is in the line mode, the fgetc() would wait for the enter, so its keys are read by
+// the _getch() (the enter is the '\r' there)
+static int read_input_byte(Hle *hle)
+{
+#ifdef _WIN32
+    if (is_terminal(hle->input)) return _getch();
+#endif
+    return fgetc(hle->input);
+}
+
+// The host new line is the enter key, 0 at the end of the input. The peek doesn't wait for the key, the peeked
+// key is kept for the next read (the key read and the handle 0).
+static u8 read_key(Hle *hle, u8 peek, u8 *key)
+{
+    *key = 0;
+    if (!hle->input) return 0;
+
+    if (hle->has_pending_key) {
+        if (!peek) hle->has_pending_key = 0;
+        *key = hle->pending_key == '\n' ? '\r' : hle->pending_key;
+        return 1;
+    }
+    if (peek && !is_key_ready(hle)) return 0;
+
+    int c = read_input_byte(hle);
+    if (c == EOF) return 0;
+
+    if (peek) {
+        hle->pending_key = (u8)c;
+        hle->has_pending_key = 1;
+    }
+
+    *key = c == '\n' ? '\r' : (u8)c;
+    return 1;
+}
+
+static u8 keyboard_service(CPU *cpu, Hle *hle, u8 ah)
+{
+    u8 key;
+    switch (ah) {
+        case 0x00:
+        case 0x10: {
+            read_key(hle, 0, &key);
+            set_to_register(cpu, Register_ax, key);
+        } break;
+
+        case 0x01:
+        case 0x11: {
+            if (read_key(hle, 1, &key)) {
+                set_to_register(cpu, Register_ax, key);
+                cpu->flags &= ~F_ZERO;
+            } else {
+                cpu->flags |= F_ZERO;
+            }
+        } break;
+
+        default: return 0;
+    }
+
+    return 1;
+}
+
+///////////////////////////////////////////////////
+// :Files
+
+static FILE *file_of_handle(Hle *hle, u16 handle)
+{
+    return handle >= 3 && handle < HLE_MAX_FILES ? hle->files[handle] : NULL;
+}
+
+// Copies the ASCIIZ path at the ds:dx, returns 0 if it has no 0 in the first HLE_MAX_PATH bytes
+static u8 read_path(CPU *cpu, char *path)
+{
+    u32 address;
+    u32 size = guest_span(cpu, Register_ds, get_from_register(cpu, Register_dx), HLE_MAX_PATH, &address);
+
+    u8 *end = (u8 *)memchr(cpu->memory + address, 0, size);
+    if (!end) return 0;
+
+    memcpy(path, cpu->memory + address, end - (cpu->memory + address) + 1);
+    return 1;
+}
+
+static void open_file(CPU *cpu, Hle *hle, const char *mode)
+{
+    char path[HLE_MAX_PATH];
+    if (!read_path(cpu, path)) {
+        hle_error(cpu, HLE_ERROR_FILE_NOT_FOUND);
+        return;
+    }
+
+    u16 handle = 3;
+    while (handle < HLE_MAX_FILES && hle->files[handle]) handle++;
+    if (handle == HLE_MAX_FILES) {
+        hle_error(cpu, HLE_ERROR_TOO_MANY_FILES);
+        return;
+    }
+
+    FILE *file = fopen(path, mode);
+    if (!file) {
+        hle_error(cpu, errno == ENOENT ? HLE_ERROR_FILE_NOT_FOUND : HLE_ERROR_ACCESS_DENIED);
+        return;
+    }
+
+    hle->files[handle] = file;
+    set_to_register(cpu, Register_ax, handle);
+    hle_success(cpu);
+}
+
+// The ah=3Fh and the ah=40h, the transfer is between the host file and the guest memory at the ds:dx
+static void transfer_file(CPU *cpu, Hle *hle, u8 write)
+{
+    u16 handle = get_from_register(cpu, Register_bx);
+    u32 address;
+    u32 count = guest_span(cpu, Register_ds, get_from_register(cpu, Register_dx), get_from_register(cpu, Register_cx), &address);
+
+    u32 done = 0;
+    if (write) {
+        if (handle == 1 || handle == 2) {
+            hle_output(hle, cpu->memory + address, count);
+            done = count;
+        } else {
+            FILE *file = file_of_handle(hle, handle);
+            if (!file) {
+                hle_error(cpu, HLE_ERROR_INVALID_HANDLE);
+                return;
+            }
+            done = (u32)fwrite(cpu->memory + address, 1, count, file);
+        }
+    } else {
+        FILE *file = handle == 0 ? hle->input : file_of_handle(hle, handle);
+        if (!file) {
+            hle_error(cpu, HLE_ERROR_INVALID_HANDLE);
+            return;
+        }
+
+        before_guest_write(cpu, address, count);
+
+        // The key of the check (ah=01h) is the first byte of the input
+        u32 pending = 0;
+        if (handle == 0 && hle->has_pending_key && count) {
+            cpu->memory[address] = hle->pending_key;
+            hle->has_pending_key = 0;
+            pending = 1;
+        }
+
+        done = pending + (u32)fread(cpu->memory + address + pending, 1, count - pending, file);
+        after_guest_write(cpu, address, done);
+    }
+
+    set_to_register(cpu, Register_ax, done);
+    hle_success(cpu);
+}
+
+static void close_file(CPU *cpu, Hle *hle)
+{
+    u16 handle = get_from_register(cpu, Register_bx);
+    if (handle < 3) {
+        hle_success(cpu);
+        return;
+    }
+
+    FILE *file = file_of_handle(hle, handle);
+    if (!file) {
+        hle_error(cpu, HLE_ERROR_INVALID_HANDLE);
+        return;
+    }
+
+    fclose(file);
+    hle->files[handle] = NULL;
+    hle_success(cpu);
+}
+
+///////////////////////////////////////////////////
+// :Memory
+
+static u32 find_memory_block(Hle *hle, u16 segment)
+{
+    for (u32 index = 0; index < hle->block_count; index++) {
+        if (hle->blocks[index].segment == segment) return index;
+    }
+    return hle->block_count;
+}
+
+// The first block which fits between the allocated ones
+static void allocate_memory(CPU *cpu, Hle *hle)
+{
+    u32 paragraphs = get_from_register(cpu, Register_bx);
+    u32 largest = 0;
+
+    u32 start = hle->memory_start;
+    for (u32 index = 0; index <= hle->block_count; index++) {
+        u32 end = index < hle->block_count ? hle->blocks[index].segment : hle->memory_end;
+        u32 free_paragraphs = end - start;
+
+        if (free_paragraphs >= paragraphs && hle->block_count < HLE_MAX_BLOCKS) {
+            memmove(&hle->blocks[index + 1], &hle->blocks[index], (hle->block_count - index) * sizeof(Hle_Block));
+            hle->blocks[index].segment = (u16)start;
+            hle->blocks[index].paragraphs = (u16)paragraphs;
+            hle->block_count++;
+
+            set_to_register(cpu, Register_ax, start);
+            hle_success(cpu);
+            return;
+        }
+        if (free_paragraphs > largest) largest = free_paragraphs;
+
+        if (index < hle->block_count) {
+            start = hle->blocks[index].segment + hle->blocks[index].paragraphs;
+        }
+    }
+
+    hle_error(cpu, HLE_ERROR_NOT_ENOUGH_MEMORY);
+    set_to_register(cpu, Register_bx, largest);
+}
+
+static void free_memory(CPU *cpu, Hle *hle)
+{
+    u32 index = find_memory_block(hle, get_from_register(cpu, Register_es));
+    if (index == hle->block_count) {
+        hle_error(cpu, HLE_ERROR_INVALID_BLOCK);
+        return;
+    }
+
+    hle->block_count--;
+    memmove(&hle->blocks[index], &hle->blocks[index + 1], (hle->block_count - index) * sizeof(Hle_Block));
+    hle_success(cpu);
+}
+
+// It grows up to the next block, the bx is the largest size at the error
+static void resize_memory(CPU *cpu, Hle *hle)
+{
+    u32 index = find_memory_block(hle, get_from_register(cpu, Register_es));
+    if (index == hle->block_count) {
+        hle_error(cpu, HLE_ERROR_INVALID_BLOCK);
+        return;
+    }
+
+    Hle_Block *block = &hle->blocks[index];
+    u32 end = index + 1 < hle->block_count ? hle->blocks[index + 1].segment : hle->memory_end;
+    u32 max_paragraphs = end - block->segment;
+    u16 paragraphs = get_from_register(cpu, Register_bx);
+
+    if (paragraphs > max_paragraphs) {
+        hle_error(cpu, HLE_ERROR_NOT_ENOUGH_MEMORY);
+        set_to_register(cpu, Register_bx, max_paragraphs);
+        return;
+    }
+
+    block->paragraphs = paragraphs;
+    hle_success(cpu);
+}
+
+///////////////////////////////////////////////////
+// :Services
+
+static u8 video_service(CPU *cpu, Hle *hle, u8 ah)
+{
+    if (ah != 0x0E) return 0;
+
+    u8 c = get_from_register(cpu, Register_al);
+    hle_output(hle, &c, 1);
+    return 1;
+}
+
+static u8 dos_service(CPU *cpu, Hle *hle, u8 ah)
+{
+    switch (ah) {
+        case 0x00: hle_terminate(cpu, hle, 0); break;
+        case 0x4C: hle_terminate(cpu, hle, get_from_register(cpu, Register_al)); break;
+
+        case 0x02: {
+            u8 c = get_from_register(cpu, Register_dl);
+            hle_output(hle, &c, 1);
+            set_to_register(cpu, Register_al, c);
+        } break;
+
+        case 0x09: {
+            u32 address;
+            u32 size = guest_span(cpu, Register_ds, get_from_register(cpu, Register_dx), 0x10000, &address);
+            u8 *end = (u8 *)memchr(cpu->memory + address, '$', size);
+            hle_output(hle, cpu->memory + address, end ? (u32)(end - (cpu->memory + address)) : size);
+            set_to_register(cpu, Register_al, '$');
+        } break;
+
+        case 0x3C: open_file(cpu, hle, "w+b"); break;
+        case 0x3D: {
+            // @Incomplete: The write only mode needs the read access on the host too, the sharing modes are ignored
+            u8 mode = get_from_register(cpu, Register_al) & 0x07;
+            if (mode > 2) {
+                hle_error(cpu, HLE_ERROR_INVALID_ACCESS);
+            } else {
+                open_file(cpu, hle, mode == 0 ? "rb" : "r+b");
+            }
+        } break;
+        case 0x3E: close_file(cpu, hle); break;
+        case 0x3F: transfer_file(cpu, hle, 0); break;
+        case 0x40: transfer_file(cpu, hle, 1); break;
+
+        case 0x48: allocate_memory(cpu, hle); break;
+        case 0x49: free_memory(cpu, hle); break;
+        case 0x4A: resize_memory(cpu, hle); break;
+
+        default: return 0;
+    }
+
+    return 1;
+}
+
+u8 hle_interrupt(CPU *cpu, u8 interrupt_type)
+{
+    Hle *hle = cpu->hle;
+    if (!hle->trapped[interrupt_type]) return 0;
+
+    u8 ah = get_from_register(cpu, Register_ah);
+    TRACE(cpu, "\n\t\t@hle: int %02xh, ah=%02xh", interrupt_type, ah);
+
+    u8 handled = 0;
+    switch (interrupt_type) {
+        case 0x10: handled = video_service(cpu, hle, ah); break;
+        case 0x16: handled = keyboard_service(cpu, hle, ah); break;
+        case 0x20: hle_terminate(cpu, hle, 0); handled = 1; break;
+        case 0x21: handled = dos_service(cpu, hle, ah); break;
+    }
+
+    if (!handled) {
+        hle->fallback_count++;
+        u16 vector = interrupt_type * 4;
+        if (cpu->memory[vector] == 0 && cpu->memory[vector + 1] == 0 && cpu->memory[vector + 2] == 0 && cpu->memory[vector + 3] == 0) {
+            fprintf(stderr, "[WARNING]: int %02xh, ah=%02xh is not emulated and the guest has no handler\n", interrupt_type, ah);
+        }
+        return 0;
+    }
+
+    // Every service has an effect outside of the registers (the output, the input, the files, the memory blocks),
+    // so the loop of the calls is not an idle loop
+    cpu->side_effect_count++;
+    hle->call_count++;
+    return 1;
+}
+
+void print_hle_stats(FILE *dest, Hle *hle)
+{
+    fprintf(dest, "hle: %llu calls, %llu fallbacks, %u memory blocks, exit code %u\n",
+            (unsigned long long)hle->call_count, (unsigned long long)hle->fallback_count, hle->block_count,
+            hle->exit_code);
+}
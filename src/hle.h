@@ -0,0 +1,83 @@
+#ifndef _H_HLE
+#define _H_HLE
+
+#include "sim86.h"
+
+// High-level emulation of the BIOS and the DOS (--hle): the int instruction of a trapped vector is run by native
+// code instead of the handler of the guest, so the guest needs no BIOS or DOS image in its memory. The
+// execute_instruction() calls the hle_interrupt() before the execute_interrupt(), the service is picked by the ah.
+// The results are in the registers and in the flags (the CF of the DOS errors, the ZF of the key check) as after the
+// iret, the run continues after the int. The services which are not here fall back to the execute_interrupt(), so
+// to the vector of the guest.
+//
+//     int 10h  ah=0Eh  teletype output of the al
+//     int 16h  ah=00h  read a key into the al (ah=10h too), the ah (the scan code) is 0
+//              ah=01h  check for a key (ah=11h too) without waiting, ZF=1 if there is none, otherwise it's in the al
+//     int 20h          terminate, the exit code is 0 (the ret of the .COM is here, see the loader.h)
+//     int 21h  ah=02h  character output of the dl
+//              ah=09h  output of the '$' terminated string at the ds:dx
+//              ah=3Ch  create (truncate) the file of the ASCIIZ path at the ds:dx, ah=3Dh open it (al = the mode)
+//              ah=3Eh  close the bx, ah=3Fh read, ah=40h write the cx bytes at the ds:dx (the count is in the ax)
+//              ah=48h  allocate bx paragraphs (the segment is in the ax), ah=49h free the es, ah=4Ah resize the es
+//              ah=00h, ah=4Ch  terminate (Exit_Reason_Program_Exit), the al is the exit code (0 at the ah=00h)
+//
+// The errors set the CF and the DOS error code in the ax. The file reads and writes go straight between the host
+// file and the guest memory (the fread() and fwrite() of the ds:dx), without a buffer in between. The handles 0, 1
+// and 2 are the input and the output, they can't be closed.
+//
+// The memory of the ah=48h is the paragraphs between the memory_start and the memory_end, the blocks are kept here,
+// not in the guest memory.
+// @Incomplete: No MCB chain in the guest memory, a guest which walks it won't find the blocks.
+// @Incomplete: The timer (int 8) and the other hardware interrupts are never trapped, only the int instruction.
+
+#define HLE_MAX_FILES  20
+#define HLE_MAX_BLOCKS 64
+
+// The DOS error codes in the ax
+#define HLE_ERROR_FILE_NOT_FOUND    0x02
+#define HLE_ERROR_TOO_MANY_FILES    0x04
+#define HLE_ERROR_ACCESS_DENIED     0x05
+#define HLE_ERROR_INVALID_HANDLE    0x06
+#define HLE_ERROR_NOT_ENOUGH_MEMORY 0x08
+#define HLE_ERROR_INVALID_BLOCK     0x09
+#define HLE_ERROR_INVALID_ACCESS    0x0C
+
+typedef struct {
+    u16 segment;
+    u16 paragraphs;
+} Hle_Block;
+
+struct Hle {
+    u8 trapped[256];            // the vectors which are run natively, see the init_hle()
+
+    FILE *input;                // the keyboard and the handle 0
+    u8 pending_key;             // the byte of the key check (ah=01h), it's read by the next key read or the handle 0
+    u8 has_pending_key;
+    FILE *output;               // the teletype, the character output and the handles 1 and 2, NULL = discarded
+    FILE *files[HLE_MAX_FILES]; // the opened files by the handle, NULL = free (the first 3 are never used)
+
+    u16 memory_start;           // the first paragraph of the allocations
+    u16 memory_end;             // after the last one
+    Hle_Block blocks[HLE_MAX_BLOCKS]; // sorted by the segment
+    u32 block_count;
+
+    u8 exit_code;               // the al of the terminate
+
+    // Statistics
+    u64 call_count;             // the natively run services
+    u64 fallback_count;         // the trapped vectors which are run by the execute_interrupt()
+};
+
+// Traps the int 10h, 16h, 20h and 21h. The first memory block is the program of the .COM or the .EXE. For a flat
+// binary the memory starts above the first 64 KB (the stack of the ss=0) and after the loaded image if that is below
+// the 640 KB. So call it after the load_program().
+void init_hle(Hle *hle, CPU *cpu);
+// Closes the opened files
+void close_hle(Hle *hle);
+
+// Returns 1 if the interrupt is run, then the cpu->ip is not changed, 0 if the execute_interrupt() has to run it
+u8 hle_interrupt(CPU *cpu, u8 interrupt_type);
+
+void print_hle_stats(FILE *dest, Hle *hle);
+
+#endif
@@ -0,0 +1,169 @@
+// Throughput of the int 21h by the --hle against the emulated path (the handler of the guest, run instruction by
+// instruction). The guest calls the character output (ah=02h) or the string output of 16 bytes (ah=09h) in a loop,
+// the handler writes the bytes to a port, the hle discards them. The best of the repeats is printed:
+//
+//     mode      service    calls   ns/call   instructions/call   cycles/call
+//
+//     hle_bench [--calls N] [--repeat N]
+
+#include "sim86.h"
+#include "decoder.h"
+#include "simulator.h"
+#include "alu.h"
+#include "cpu_model.h"
+#include "graphics.h"
+#include "debug_info.h"
+#include "code_map.h"
+#include "trace.h"
+#include "history.h"
+#include "condition.h"
+#include "breakpoints.h"
+#include "hle.h"
+#include "platform.h"
+
+#include "sim86.c"
+#include "simulator.c"
+#include "alu.c"
+#include "cpu_model.c"
+#include "graphics.c"
+#include "decoder.c"
+#include "printer.c"
+#include "debug_info.c"
+#include "code_map.c"
+#include "trace.c"
+#include "history.c"
+#include "condition.c"
+#include "breakpoints.c"
+#include "hle.c"
+
+// The bl is the service, the bp is the count of the 1000 calls:
+//
+//         mov ax, 0xF000          handler: cmp ah, 2            string:  push si
+//         mov ds, ax                       jne string                    push ax
+//     outer:                               mov al, dl                    mov si, dx
+//         mov cx, 1000                     out 0xE9, al              next:    lodsb
+//     inner:                               iret                          cmp al, '$'
+//         mov ah, bl                                                     je done
+//         mov dl, 'x'                                                    out 0xE9, al
+//         mov dx, msg                                                    jmp next
+//         int 0x21                                                   done:    pop ax
+//         loop inner                                                     pop si
+//         dec bp                                                         iret
+//         jnz outer                                              msg: "0123456789abcdef$"
+//         hlt
+static const u8 bench_guest[] = {
+    0xb8, 0x00, 0xf0, 0x8e, 0xd8, 0xb9, 0xe8, 0x03, 0x88, 0xdc, 0xb2, 0x78,
+    0xba, 0x31, 0x01, 0xcd, 0x21, 0xe2, 0xf5, 0x4d, 0x75, 0xef, 0xf4, 0x80,
+    0xfc, 0x02, 0x75, 0x05, 0x88, 0xd0, 0xe6, 0xe9, 0xcf, 0x56, 0x50, 0x89,
+    0xd6, 0xac, 0x3c, 0x24, 0x74, 0x04, 0xe6, 0xe9, 0xeb, 0xf7, 0x58, 0x5e,
+    0xcf, 0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x61,
+    0x62, 0x63, 0x64, 0x65, 0x66, 0x24
+};
+#define BENCH_HANDLER_OFFSET 0x17
+
+typedef struct {
+    double seconds;
+    u64 instruction_count;
+    u64 cycle_count;
+    Exit_Reason exit_reason;
+} Bench_Result;
+
+// The same as the load_executable(), from the bench_guest
+static void load_bench_guest(CPU *cpu)
+{
+    u32 address = calc_inst_pointer_address(cpu);
+    memcpy(cpu->memory + address, bench_guest, sizeof(bench_guest));
+
+    cpu->loaded_executable_size = sizeof(bench_guest);
+    cpu->exec_start = address;
+    cpu->exec_end = address + sizeof(bench_guest);
+    cpu->image_base = address;
+
+    // The vector of the int 21h is the handler (the hle doesn't use it)
+    u32 vector = 0x21 * 4;
+    u16 handler = 0x0100 + BENCH_HANDLER_OFFSET;
+    cpu->memory[vector + 0] = handler & 0xFF;
+    cpu->memory[vector + 1] = handler >> 8;
+    cpu->memory[vector + 2] = 0x00;
+    cpu->memory[vector + 3] = 0xF0;
+
+    build_code_map(cpu);
+}
+
+static Bench_Result bench_run(CPU *cpu, Hle *hle, u8 service, u32 thousands)
+{
+    reset(cpu);
+    load_bench_guest(cpu);
+    set_to_register(cpu, Register_bx, service);
+    set_to_register(cpu, Register_bp, thousands);
+
+    if (hle) {
+        init_hle(hle, cpu);
+        hle->output = NULL;
+    }
+    cpu->hle = hle;
+
+    Bench_Result result = {0};
+    double start = seconds_now();
+    run(cpu);
+    result.seconds = seconds_now() - start;
+    result.instruction_count = cpu->instruction_count;
+    result.cycle_count = cpu->cycle_count;
+    result.exit_reason = cpu->exit_reason;
+
+    cpu->hle = NULL;
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    u32 call_count = 1000000;
+    int repeat = 5;
+
+    for (int i = 1; i < argc; i++) {
+        if (STR_EQUAL(argv[i], "--calls") && i+1 < argc) {
+            call_count = (u32)strtoul(argv[++i], NULL, 10);
+        } else if (STR_EQUAL(argv[i], "--repeat") && i+1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: hle_bench [--calls N] [--repeat N]\n");
+            return 1;
+        }
+    }
+
+    u32 thousands = call_count / 1000;
+    if (thousands == 0) thousands = 1;
+    if (thousands > 0xFFFF) thousands = 0xFFFF;
+    call_count = thousands * 1000;
+
+    CPU cpu = {0};
+    cpu.predecode = 1;
+    cpu.idle_skip = 1;
+    boot(&cpu);
+    assert(cpu.memory);
+
+    Hle hle;
+    static const u8 services[] = {0x02, 0x09};
+    static const char *const service_names[] = {"char", "string"};
+
+    printf("%-9s %-8s %10s %10s %20s %12s\n", "mode", "service", "calls", "ns/call", "instructions/call", "cycles/call");
+    for (u32 s = 0; s < ARRAY_SIZE(services); s++) {
+        for (u32 use_hle = 0; use_hle < 2; use_hle++) {
+            Bench_Result best = {0};
+            for (int r = 0; r < repeat; r++) {
+                Bench_Result result = bench_run(&cpu, use_hle ? &hle : NULL, services[s], thousands);
+                if (result.exit_reason != Exit_Reason_Halt) {
+                    fprintf(stderr, "[ERROR]: The guest is stopped by %s\n", exit_reason_name(result.exit_reason));
+                    return 1;
+                }
+                if (r == 0 || result.seconds < best.seconds) best = result;
+            }
+
+            printf("%-9s %-8s %10u %10.1f %20.1f %12.1f\n", use_hle ? "hle" : "emulated", service_names[s], call_count,
+                   best.seconds * 1e9 / call_count, (double)best.instruction_count / call_count,
+                   (double)best.cycle_count / call_count);
+        }
+    }
+
+    return 0;
+}
@@ -108,6 +108,18 @@ typedef enum {
     Mnemonic_div,
     Mnemonic_idiv,
 
+    // 80186, see the i80186table.h
+    Mnemonic_pusha,
+    Mnemonic_popa,
+    Mnemonic_bound,
+    Mnemonic_insb,
+    Mnemonic_insw,
+    Mnemonic_outsb,
+    Mnemonic_outsw,
+    Mnemonic_enter,
+    Mnemonic_leave,
+    Mnemonic_imul_imm, // the imul reg, r/m, imm (0x69, 0x6B), its own mnemonic so the mul/div of the 8086 don't check it
+
     Mnemonic_db,
 
     Mnemonic_grp1,
@@ -130,6 +142,7 @@ struct i8086_Inst_Table {
     const char* arg1;
     const char* arg2;
     Instruction_Type type;
+    const char* arg3; // only the imul reg, r/m, imm of the 80186 has a third operand
 };
 
 static const i8086_Inst_Table i8086_inst_table[] = {
@@ -0,0 +1,279 @@
+#include "libsim86.h"
+
+#include "sim86.h"
+#include "decoder.h"
+#include "simulator.h"
+#include "alu.h"
+#include "cpu_model.h"
+#include "graphics.h"
+#include "debug_info.h"
+#include "code_map.h"
+#include "trace.h"
+#include "history.h"
+#include "condition.h"
+#include "breakpoints.h"
+#include "hle.h"
+
+#include "sim86.c"
+#include "simulator.c"
+#include "alu.c"
+#include "cpu_model.c"
+#include "graphics.c"
+#include "decoder.c"
+#include "printer.c"
+#include "debug_info.c"
+#include "code_map.c"
+#include "trace.c"
+#include "history.c"
+#include "condition.c"
+#include "breakpoints.c"
+#include "hle.c"
+
+struct Sim86 {
+    CPU cpu;
+};
+
+const char *sim86_status_name(Sim86_Status status)
+{
+    static const char *const status_names[] = {
+        [Sim86_Status_Ok]                    = "ok",
+        [Sim86_Status_End_Of_Image]          = "end_of_image",
+        [Sim86_Status_Unhandled_Instruction] = "unhandled_instruction",
+        [Sim86_Status_Divide_Error]          = "divide_error",
+        [Sim86_Status_Halted]                = "halted",
+        [Sim86_Status_Invalid_Argument]      = "invalid_argument",
+        [Sim86_Status_Out_Of_Memory]         = "out_of_memory",
+        [Sim86_Status_Out_Of_Range]          = "out_of_range",
+    };
+
+    if ((u32)status >= ARRAY_SIZE(status_names)) return "unknown";
+
+    return status_names[status];
+}
+
+static Sim86_Status status_from_exit_reason(Exit_Reason reason)
+{
+    switch (reason) {
+        case Exit_Reason_None:                  return Sim86_Status_Ok;
+        case Exit_Reason_End_Of_Image:          return Sim86_Status_End_Of_Image;
+        case Exit_Reason_Unhandled_Instruction: return Sim86_Status_Unhandled_Instruction;
+        case Exit_Reason_Divide_Error:          return Sim86_Status_Divide_Error;
+        case Exit_Reason_Bound_Range:           return Sim86_Status_Unhandled_Instruction; // the int 5 has no handler
+        case Exit_Reason_Halt:                  return Sim86_Status_Halted;
+        default:                                return Sim86_Status_Ok; // the limits of the library are not stored in the cpu
+    }
+}
+
+static u8 to_internal_register(Sim86_Register reg, Register *result)
+{
+    if (reg >= Sim86_Register_ax && reg <= Sim86_Register_di) {
+        *result = (Register)(Register_ax + (reg - Sim86_Register_ax));
+        return 1;
+    }
+    if (reg >= Sim86_Register_es && reg <= Sim86_Register_ds) {
+        *result = (Register)(Register_es + (reg - Sim86_Register_es));
+        return 1;
+    }
+    return 0;
+}
+
+Sim86_Status sim86_create(Sim86 **sim)
+{
+    if (!sim) return Sim86_Status_Invalid_Argument;
+
+    Sim86 *result = (Sim86 *)malloc(sizeof(Sim86));
+    if (!result) return Sim86_Status_Out_Of_Memory;
+
+    ZERO_MEMORY(result, sizeof(Sim86));
+    result->cpu.trace = NULL; // the library never prints
+    result->cpu.idle_skip = 1;
+
+    boot(&result->cpu);
+    if (!result->cpu.memory) {
+        free(result);
+        return Sim86_Status_Out_Of_Memory;
+    }
+
+    *sim = result;
+    return Sim86_Status_Ok;
+}
+
+void sim86_destroy(Sim86 *sim)
+{
+    if (!sim) return;
+
+    destroy_code_map(&sim->cpu);
+    free(sim->cpu.memory);
+    free(sim);
+}
+
+Sim86_Status sim86_reset(Sim86 *sim)
+{
+    if (!sim) return Sim86_Status_Invalid_Argument;
+
+    reset(&sim->cpu);
+    sim->cpu.exec_start = 0;
+    sim->cpu.exec_end = 0;
+    sim->cpu.image_base = 0;
+    sim->cpu.loaded_executable_size = 0;
+
+    return Sim86_Status_Ok;
+}
+
+Sim86_Status sim86_set_cpu(Sim86 *sim, const char *model)
+{
+    if (!sim || !model) return Sim86_Status_Invalid_Argument;
+
+    const CPU_Model *found = find_cpu_model(model);
+    if (!found) return Sim86_Status_Invalid_Argument;
+
+    sim->cpu.model = found;
+    destroy_code_map(&sim->cpu);
+
+    return Sim86_Status_Ok;
+}
+
+Sim86_Status sim86_load_image(Sim86 *sim, uint16_t segment, uint16_t offset, const void *image, uint32_t size)
+{
+    if (!sim || (!image && size)) return Sim86_Status_Invalid_Argument;
+
+    CPU *cpu = &sim->cpu;
+
+    u32 address = ((u32)segment << 4) + offset;
+    if (address + (u64)size > MAX_MEMORY) return Sim86_Status_Out_Of_Range;
+
+    memcpy(cpu->memory + address, image, size);
+
+    set_to_register(cpu, Register_cs, segment);
+    cpu->ip = offset;
+
+    cpu->loaded_executable_size = size;
+    cpu->exec_start = address;
+    cpu->exec_end = address + size;
+    cpu->image_base = address;
+
+    cpu->terminate = 0;
+    cpu->exit_reason = Exit_Reason_None;
+
+    return Sim86_Status_Ok;
+}
+
+Sim86_Status sim86_step(Sim86 *sim)
+{
+    if (!sim) return Sim86_Status_Invalid_Argument;
+
+    CPU *cpu = &sim->cpu;
+
+    // The program is already finished
+    if (cpu->exit_reason != Exit_Reason_None) return status_from_exit_reason(cpu->exit_reason);
+
+    if (calc_inst_pointer_address(cpu) >= cpu->exec_end) {
+        cpu->exit_reason = Exit_Reason_End_Of_Image;
+        return Sim86_Status_End_Of_Image;
+    }
+
+    step_instruction(cpu);
+
+    return status_from_exit_reason(cpu->exit_reason);
+}
+
+Sim86_Status sim86_run(Sim86 *sim, uint64_t max_instructions, uint64_t max_cycles, Sim86_Run_Result *result)
+{
+    if (!sim || (max_instructions == 0 && max_cycles == 0)) return Sim86_Status_Invalid_Argument;
+
+    CPU *cpu = &sim->cpu;
+
+    u64 start_instructions = cpu->instruction_count;
+    u64 start_cycles = cpu->cycle_count;
+
+    // The program is already finished
+    if (cpu->exit_reason != Exit_Reason_None) return status_from_exit_reason(cpu->exit_reason);
+
+    if (calc_inst_pointer_address(cpu) >= cpu->exec_end) {
+        cpu->exit_reason = Exit_Reason_End_Of_Image;
+        return Sim86_Status_End_Of_Image;
+    }
+
+    // The budgets are the limits of the run(), which checks them only between the blocks
+    cpu->instruction_limit = max_instructions ? start_instructions + max_instructions : 0;
+    cpu->cycle_limit = max_cycles ? start_cycles + max_cycles : 0;
+    run(cpu);
+    cpu->instruction_limit = 0;
+    cpu->cycle_limit = 0;
+
+    if (cpu->exit_reason == Exit_Reason_Instruction_Limit || cpu->exit_reason == Exit_Reason_Cycle_Limit) {
+        cpu->exit_reason = Exit_Reason_None;
+    }
+    Sim86_Status status = status_from_exit_reason(cpu->exit_reason);
+
+    if (result) {
+        result->instructions = cpu->instruction_count - start_instructions;
+        result->cycles = cpu->cycle_count - start_cycles;
+    }
+
+    return status;
+}
+
+uint64_t sim86_instruction_count(Sim86 *sim)
+{
+    return sim ? sim->cpu.instruction_count : 0;
+}
+
+uint64_t sim86_cycle_count(Sim86 *sim)
+{
+    return sim ? sim->cpu.cycle_count : 0;
+}
+
+Sim86_Status sim86_read_memory(Sim86 *sim, uint32_t address, void *dest, uint32_t size)
+{
+    if (!sim || (!dest && size)) return Sim86_Status_Invalid_Argument;
+    if ((u64)address + size > MAX_MEMORY) return Sim86_Status_Out_Of_Range;
+
+    memcpy(dest, sim->cpu.memory + address, size);
+    return Sim86_Status_Ok;
+}
+
+Sim86_Status sim86_write_memory(Sim86 *sim, uint32_t address, const void *src, uint32_t size)
+{
+    if (!sim || (!src && size)) return Sim86_Status_Invalid_Argument;
+    if ((u64)address + size > MAX_MEMORY) return Sim86_Status_Out_Of_Range;
+
+    memcpy(sim->cpu.memory + address, src, size);
+    return Sim86_Status_Ok;
+}
+
+Sim86_Status sim86_get_register(Sim86 *sim, Sim86_Register reg, uint16_t *value)
+{
+    if (!sim || !value) return Sim86_Status_Invalid_Argument;
+
+    Register internal;
+    if (reg == Sim86_Register_ip) {
+        *value = sim->cpu.ip;
+    } else if (reg == Sim86_Register_flags) {
+        *value = sim->cpu.flags;
+    } else if (to_internal_register(reg, &internal)) {
+        *value = get_from_register(&sim->cpu, internal);
+    } else {
+        return Sim86_Status_Invalid_Argument;
+    }
+
+    return Sim86_Status_Ok;
+}
+
+Sim86_Status sim86_set_register(Sim86 *sim, Sim86_Register reg, uint16_t value)
+{
+    if (!sim) return Sim86_Status_Invalid_Argument;
+
+    Register internal;
+    if (reg == Sim86_Register_ip) {
+        sim->cpu.ip = value;
+    } else if (reg == Sim86_Register_flags) {
+        sim->cpu.flags = value;
+    } else if (to_internal_register(reg, &internal)) {
+        set_to_register(&sim->cpu, internal, value);
+    } else {
+        return Sim86_Status_Invalid_Argument;
+    }
+
+    return Sim86_Status_Ok;
+}
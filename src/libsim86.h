@@ -0,0 +1,103 @@
+#ifndef _H_LIBSIM86
+#define _H_LIBSIM86
+
+// Embeddable simulator API. Build the libsim86.c into the host program (or into a static library, see the
+// Makefile "lib" target), this header is the only one which is required. Nothing is printed, every function
+// returns a status code, and every simulator is independent, so more can be used on more threads.
+//
+//     Sim86 *sim;
+//     sim86_create(&sim);
+//     sim86_load_image(sim, 0xF000, 0x0100, code, code_size);
+//
+//     Sim86_Run_Result result;
+//     while (sim86_run(sim, 0, 10000, &result) == Sim86_Status_Ok) {
+//         // the cycle budget is ran out, but the program is not finished
+//     }
+//
+//     uint16_t ax;
+//     sim86_get_register(sim, Sim86_Register_ax, &ax);
+//     sim86_destroy(sim);
+
+#include <stdint.h>
+
+#define SIM86_MEMORY_SIZE (1024 * 1024)
+
+typedef struct Sim86 Sim86;
+
+typedef enum {
+    Sim86_Status_Ok,                    // the budget is ran out, the execution can be continued
+
+    Sim86_Status_End_Of_Image,          // the ip is left the loaded image
+    Sim86_Status_Unhandled_Instruction,
+    Sim86_Status_Divide_Error,
+    Sim86_Status_Halted,                // the hlt is executed with the interrupts disabled
+
+    Sim86_Status_Invalid_Argument,
+    Sim86_Status_Out_Of_Memory,
+    Sim86_Status_Out_Of_Range,          // the address range is not fit into the memory
+
+    Sim86_Status_Count,
+} Sim86_Status;
+
+typedef enum {
+    Sim86_Register_ax,
+    Sim86_Register_cx,
+    Sim86_Register_dx,
+    Sim86_Register_bx,
+    Sim86_Register_sp,
+    Sim86_Register_bp,
+    Sim86_Register_si,
+    Sim86_Register_di,
+
+    Sim86_Register_es,
+    Sim86_Register_cs,
+    Sim86_Register_ss,
+    Sim86_Register_ds,
+
+    Sim86_Register_ip,
+    Sim86_Register_flags,
+
+    Sim86_Register_Count,
+} Sim86_Register;
+
+typedef struct {
+    uint64_t instructions; // executed by this call
+    uint64_t cycles;       // estimated clock cycles of this call (of the cpu, see the sim86_set_cpu())
+} Sim86_Run_Result;
+
+const char *sim86_status_name(Sim86_Status status);
+
+Sim86_Status sim86_create(Sim86 **sim);
+void sim86_destroy(Sim86 *sim);
+
+// Clears the memory and the registers, so the same simulator can be reused for the next run
+Sim86_Status sim86_reset(Sim86 *sim);
+
+// Selects the emulated cpu: "8086" (the default), "8088" or "80186". The code which is decoded before is decoded
+// again by the new model.
+Sim86_Status sim86_set_cpu(Sim86 *sim, const char *model);
+
+// Copies the image to segment:offset, then sets the cs:ip to it. The execution ends when the ip leaves the image.
+Sim86_Status sim86_load_image(Sim86 *sim, uint16_t segment, uint16_t offset, const void *image, uint32_t size);
+
+// Executes one instruction (with its prefixes)
+Sim86_Status sim86_step(Sim86 *sim);
+
+// Executes until the program ends or one of the budgets is ran out (0 = no limit, but at least one of them is required).
+// The instruction budget is exact, the cycle budget is checked after the blocks (a jump or 4096 instructions), so it
+// can be overrun by the last block.
+// The result is optional.
+Sim86_Status sim86_run(Sim86 *sim, uint64_t max_instructions, uint64_t max_cycles, Sim86_Run_Result *result);
+
+// Totals since the last reset
+uint64_t sim86_instruction_count(Sim86 *sim);
+uint64_t sim86_cycle_count(Sim86 *sim);
+
+// The addresses are absolute (20 bit) addresses
+Sim86_Status sim86_read_memory(Sim86 *sim, uint32_t address, void *dest, uint32_t size);
+Sim86_Status sim86_write_memory(Sim86 *sim, uint32_t address, const void *src, uint32_t size);
+
+Sim86_Status sim86_get_register(Sim86 *sim, Sim86_Register reg, uint16_t *value);
+Sim86_Status sim86_set_register(Sim86 *sim, Sim86_Register reg, uint16_t value);
+
+#endif
@@ -0,0 +1,261 @@
+#include "loader.h"
+#include "simulator.h"
+#include "code_map.h"
+#include "platform.h"
+
+#define MZ_HEADER_SIZE 0x1C
+
+// The fields of the MZ header, the words are little endian
+typedef struct {
+    u16 last_page_bytes;     // 02h, 0 = the last 512 byte page is full
+    u16 page_count;          // 04h
+    u16 relocation_count;    // 06h
+    u16 header_paragraphs;   // 08h
+    u16 min_alloc;           // 0Ah, the paragraphs needed after the image
+    u16 max_alloc;           // 0Ch
+    u16 ss;                  // 0Eh, relative to the load segment
+    u16 sp;                  // 10h
+    u16 ip;                  // 14h
+    u16 cs;                  // 16h, relative to the load segment
+    u16 relocation_offset;   // 18h, the table of the offset:segment pairs in the file
+} Mz_Header;
+
+static inline u16 get_u16_le(const u8 *data)
+{
+    return BYTE_LOHI_TO_HILO(data[0], data[1]);
+}
+
+static inline void put_u16_le(u8 *data, u16 value)
+{
+    data[0] = value & 0xFF;
+    data[1] = value >> 8;
+}
+
+// The 3 letters of the DOS extension, case insensitive
+static u8 has_dos_extension(char *filename, const char *extension)
+{
+    size_t length = strlen(filename);
+    if (length < 4) return 0;
+
+    char *at = filename + length - 4;
+    return at[0] == '.' && (at[1] | 0x20) == extension[0] && (at[2] | 0x20) == extension[1] && (at[3] | 0x20) == extension[2];
+}
+
+// The signature ("MZ", or "ZM" by the old linkers) and the header has to point into the file
+static u8 parse_mz_header(const u8 *data, u64 size, Mz_Header *header)
+{
+    if (size < MZ_HEADER_SIZE) return 0;
+    if (!((data[0] == 'M' && data[1] == 'Z') || (data[0] == 'Z' && data[1] == 'M'))) return 0;
+
+    header->last_page_bytes   = get_u16_le(data + 0x02);
+    header->page_count        = get_u16_le(data + 0x04);
+    header->relocation_count  = get_u16_le(data + 0x06);
+    header->header_paragraphs = get_u16_le(data + 0x08);
+    header->min_alloc         = get_u16_le(data + 0x0A);
+    header->max_alloc         = get_u16_le(data + 0x0C);
+    header->ss                = get_u16_le(data + 0x0E);
+    header->sp                = get_u16_le(data + 0x10);
+    header->ip                = get_u16_le(data + 0x14);
+    header->cs                = get_u16_le(data + 0x16);
+    header->relocation_offset = get_u16_le(data + 0x18);
+
+    if ((u64)header->header_paragraphs * 16 > size) return 0;
+    if (header->relocation_offset + (u64)header->relocation_count * 4 > size) return 0;
+
+    return 1;
+}
+
+static void build_psp(CPU *cpu, u16 psp_segment, u16 paragraphs)
+{
+    u8 *psp = cpu->memory + ((u32)psp_segment << 4);
+    ZERO_MEMORY(psp, 0x100);
+
+    psp[0x00] = 0xCD; // int 20h
+    psp[0x01] = 0x20;
+    put_u16_le(psp + 0x02, psp_segment + paragraphs);
+    psp[0x50] = 0xCD; // int 21h
+    psp[0x51] = 0x21;
+    psp[0x52] = 0xCB; // retf
+    psp[0x80] = 0;    // the length of the command tail
+    psp[0x81] = 0x0D;
+
+    cpu->psp_segment = psp_segment;
+    cpu->program_paragraphs = paragraphs;
+}
+
+static u8 load_flat(CPU *cpu, const u8 *data, u32 size, Load_Info *info)
+{
+    u32 address = calc_inst_pointer_address(cpu);
+    if (address + (u64)size > MAX_MEMORY) return 0;
+
+    if (size) memcpy(cpu->memory + address, data, size);
+
+    cpu->loaded_executable_size = size;
+    cpu->exec_start = address;
+    cpu->exec_end = address + size;
+    cpu->image_base = address;
+
+    info->format = Executable_Flat;
+    info->image_size = size;
+    return 1;
+}
+
+static u8 load_com(CPU *cpu, const u8 *data, u32 size, Load_Info *info)
+{
+    if (size > LOADER_MAX_COM_SIZE) return 0;
+
+    u16 psp_segment = LOADER_PSP_SEGMENT;
+    u32 psp_address = (u32)psp_segment << 4;
+    build_psp(cpu, psp_segment, LOADER_MEMORY_END - psp_segment);
+    if (size) memcpy(cpu->memory + psp_address + 0x100, data, size);
+
+    // The return address of the ret is the int 20h
+    put_u16_le(cpu->memory + psp_address + 0xFFFE, 0);
+
+    set_to_register(cpu, Register_cs, psp_segment);
+    set_to_register(cpu, Register_ds, psp_segment);
+    set_to_register(cpu, Register_es, psp_segment);
+    set_to_register(cpu, Register_ss, psp_segment);
+    set_to_register(cpu, Register_sp, 0xFFFE);
+    TRACE(cpu, "\n");
+    cpu->ip = 0x0100;
+
+    // The PSP is in the image, so the int 20h can be executed
+    cpu->loaded_executable_size = size;
+    cpu->exec_start = psp_address;
+    cpu->exec_end = psp_address + 0x100 + size;
+    cpu->image_base = psp_address + 0x100;
+
+    info->format = Executable_Com;
+    info->image_size = size;
+    return 1;
+}
+
+// Adds the load segment to the segment words at the offset:segment pairs of the table. One linear pass over the
+// table in the mapped file, every fix-up is a word of the image which is already in the guest memory.
+static void apply_relocations(u8 *memory, const u8 *table, u32 count, u16 load_segment)
+{
+    for (u32 index = 0; index < count; index++) {
+        const u8 *entry = table + index * 4;
+        u32 offset = get_u16_le(entry);
+        u32 segment = get_u16_le(entry + 2);
+
+        // The padding of the memory is after the last byte, so the word at the FFFFFh can be written
+        u32 address = ((((segment + load_segment) & 0xFFFF) << 4) + offset) & SEGMENT_MASK;
+        put_u16_le(memory + address, get_u16_le(memory + address) + load_segment);
+    }
+}
+
+static u8 load_exe(CPU *cpu, const u8 *data, u32 size, Mz_Header *header, Load_Info *info)
+{
+    u32 header_size = header->header_paragraphs * 16;
+    u32 image_end = header->page_count * 512;
+    if (header->last_page_bytes && image_end >= 512) {
+        image_end -= 512 - header->last_page_bytes;
+    }
+    if (image_end > size) image_end = size; // the linkers don't always round the page count
+    if (header_size > image_end) return 0;
+
+    u32 image_size = image_end - header_size;
+    u32 image_paragraphs = (image_size + 15) >> 4;
+
+    u16 psp_segment = LOADER_PSP_SEGMENT;
+    u16 load_segment = psp_segment + 0x10;
+    u32 available = LOADER_MEMORY_END - psp_segment;
+    u32 min_paragraphs = 0x10 + image_paragraphs + header->min_alloc;
+    u32 max_paragraphs = 0x10 + image_paragraphs + header->max_alloc;
+    if (min_paragraphs > available) return 0;
+
+    build_psp(cpu, psp_segment, (u16)(max_paragraphs < available ? max_paragraphs : available));
+
+    u32 load_address = (u32)load_segment << 4;
+    memcpy(cpu->memory + load_address, data + header_size, image_size);
+    apply_relocations(cpu->memory, data + header->relocation_offset, header->relocation_count, load_segment);
+
+    set_to_register(cpu, Register_cs, load_segment + header->cs);
+    set_to_register(cpu, Register_ds, psp_segment);
+    set_to_register(cpu, Register_es, psp_segment);
+    set_to_register(cpu, Register_ss, load_segment + header->ss);
+    set_to_register(cpu, Register_sp, header->sp);
+    TRACE(cpu, "\n");
+    cpu->ip = header->ip;
+
+    cpu->loaded_executable_size = image_size;
+    cpu->exec_start = (u32)psp_segment << 4;
+    cpu->exec_end = load_address + image_size;
+    cpu->image_base = load_address;
+
+    info->format = Executable_Exe;
+    info->image_size = image_size;
+    info->relocation_count = header->relocation_count;
+    return 1;
+}
+
+u8 load_program(CPU *cpu, char *filename, Load_Info *info)
+{
+    Load_Info local_info;
+    if (!info) info = &local_info;
+    ZERO_MEMORY(info, sizeof(Load_Info));
+
+    double start = seconds_now();
+
+    u64 size = 0;
+    u8 *data = map_file(filename, &size);
+    if (!data) {
+        // The empty file is not mapped, it's an empty flat binary
+        FILE *fp = fopen(filename, "rb");
+        if (fp == NULL) {
+            return 0;
+        }
+        fseek(fp, 0, SEEK_END);
+        long fsize = ftell(fp);
+        fclose(fp);
+        if (fsize != 0) {
+            return 0;
+        }
+    }
+
+    // Only the DOS programs can have the MZ header (the DOS loads an .EXE named as .COM too), any other file is flat
+    // even if it starts with the "MZ" bytes
+    u8 is_exe = has_dos_extension(filename, "exe");
+    u8 is_com = has_dos_extension(filename, "com");
+
+    u8 loaded = 0;
+    Mz_Header header;
+    if (size > MAX_MEMORY) {
+        loaded = 0;
+    } else if ((is_exe || is_com) && parse_mz_header(data, size, &header)) {
+        loaded = load_exe(cpu, data, (u32)size, &header, info);
+    } else if (is_com) {
+        loaded = load_com(cpu, data, (u32)size, info);
+    } else {
+        loaded = load_flat(cpu, data, (u32)size, info);
+    }
+
+    unmap_file(data, size);
+    info->seconds = seconds_now() - start;
+    if (!loaded) {
+        return 0;
+    }
+
+    if (cpu->predecode && !cpu->decode_only) {
+        build_code_map(cpu);
+    }
+
+    return 1;
+}
+
+u8 load_executable(CPU *cpu, char *filename)
+{
+    return load_program(cpu, filename, NULL);
+}
+
+const char *executable_format_name(Executable_Format format)
+{
+    switch (format) {
+        case Executable_Flat: return "flat";
+        case Executable_Com:  return "com";
+        case Executable_Exe:  return "exe";
+    }
+    return "unknown";
+}
@@ -0,0 +1,45 @@
+#ifndef _H_LOADER
+#define _H_LOADER
+
+#include "sim86.h"
+
+// The executables are loaded from the mapped file (the map_file() of the platform.h), copied once into the guest
+// memory. The format is picked by the name, the .EXE and the .COM by the content too:
+//
+//     .EXE   the "MZ" header: the load image after the header is copied to the LOADER_PSP_SEGMENT + 10h, then the
+//            segment words of the relocation table are fixed up in one pass over the table. The cs:ip and the ss:sp
+//            are from the header (relative to the load segment), the ds and the es are the PSP.
+//     .COM   the whole file to the LOADER_PSP_SEGMENT:0100, the cs, ds, es and ss are the PSP, the sp is FFFEh and
+//            the word there is 0, so the ret jumps to the int 20h at the PSP:0000. With the "MZ" header it's an .EXE.
+//     else   the flat binary, to the F000:0100 (the cs:ip of the reset()), without a PSP.
+//
+// The PSP (the 256 bytes before the .COM and the .EXE) has the int 20h at the 00h, the segment after the memory of
+// the program at the 02h, the int 21h + retf at the 50h and an empty command tail at the 80h. The program gets the
+// memory up to the LOADER_MEMORY_END as the DOS gives it (the .EXE up to its maximum allocation), see the
+// cpu->psp_segment and the cpu->program_paragraphs.
+// @Incomplete: No environment (the segment at the 2Ch is 0), no command line arguments.
+
+#define LOADER_PSP_SEGMENT 0x0100
+#define LOADER_MEMORY_END  0xA000 // the 640 KB, in paragraphs
+#define LOADER_MAX_COM_SIZE 0xFF00
+
+typedef enum {
+    Executable_Flat,
+    Executable_Com,
+    Executable_Exe,
+} Executable_Format;
+
+typedef struct {
+    Executable_Format format;
+    u32 image_size;          // the bytes copied into the guest memory
+    u32 relocation_count;
+    double seconds;          // the map, the copy and the relocations (without the code map, see the build_code_map())
+} Load_Info;
+
+// Returns 0 if the file can't be read or it doesn't fit into the memory, the info can be NULL
+u8 load_program(CPU *cpu, char *filename, Load_Info *info);
+u8 load_executable(CPU *cpu, char *filename);
+
+const char *executable_format_name(Executable_Format format);
+
+#endif
@@ -1,20 +1,122 @@
 #include "sim86.h"
 #include "decoder.h"
 #include "simulator.h"
+#include "alu.h"
+#include "cpu_model.h"
+#include "graphics.h"
+#include "debug_info.h"
+#include "code_map.h"
+#include "trace.h"
+#include "history.h"
+#include "condition.h"
+#include "breakpoints.h"
+#include "hle.h"
+#include "loader.h"
+#include "debugger.h"
+#include "snapshot.h"
+#include "fanout.h"
+#include "batch.h"
+#include "disassembler.h"
+#include "gdb_stub.h"
+#include "pacing.h"
 
 #include "sim86.c"
 #include "simulator.c"
+#include "alu.c"
+#include "cpu_model.c"
+#include "graphics.c"
 #include "decoder.c"
 #include "printer.c"
+#include "debug_info.c"
+#include "code_map.c"
+#include "trace.c"
+#include "history.c"
+#include "condition.c"
+#include "breakpoints.c"
+#include "hle.c"
+#include "loader.c"
+#include "debugger.c"
+#include "snapshot.c"
+#include "batch.c"
+#include "fanout.c"
+#include "disassembler.c"
+#include "gdb_stub.c"
+#include "pacing.c"
+
+// Runs until the snapshot point (the instruction count or the address of the next instruction), writes the
+// snapshot, then continues the run
+static void run_with_snapshot(CPU *cpu, char *filename, u64 at_count, u8 at_address, u32 address, u8 print_stats)
+{
+    u64 limit = cpu->instruction_limit;
+    if (at_count && (limit == 0 || at_count < limit)) {
+        cpu->instruction_limit = at_count;
+    }
+    cpu->stop_at_address = at_address;
+    cpu->stop_address = address;
+
+    run(cpu);
+
+    cpu->instruction_limit = limit;
+    cpu->stop_at_address = 0;
+
+    u8 reached = cpu->exit_reason == Exit_Reason_Stop_Address ||
+                 (cpu->exit_reason == Exit_Reason_Instruction_Limit && at_count && cpu->instruction_count == at_count);
+    if (!reached) {
+        fprintf(stderr, "[WARNING]: The snapshot point is not reached, no snapshot is written\n");
+        return;
+    }
+
+    if (!save_snapshot(cpu, filename)) {
+        fprintf(stderr, "[WARNING]: Failed to write %s\n", filename);
+    } else if (print_stats) {
+        fprintf(stderr, "snapshot: %s at %llu instructions\n", filename, (unsigned long long)cpu->instruction_count);
+    }
+
+    if (limit && cpu->instruction_count >= limit) {
+        cpu->exit_reason = Exit_Reason_Instruction_Limit;
+        return;
+    }
+
+    cpu->exit_reason = Exit_Reason_None;
+    run(cpu);
+}
 
 int main(int argc, char **argv)
 {
     assert(argc > 1);
 
     CPU cpu = {0};
-    boot(&cpu);
+    cpu.trace = stdout;
+    cpu.predecode = 1;
+    cpu.idle_skip = 1;
 
     u8 dump_out = 0;
+    u8 load_symbols = 0;
+    u8 disassemble = 0;
+    u8 recursive = 0;
+    u8 print_stats = 0;
+    Disasm_Options disasm_options = {0};
+
+    char *batch_path = NULL;
+    Batch_Options batch_options = {0};
+    batch_options.instruction_limit = 100000000;
+
+    char *cfg_filename = NULL;
+    char *trace_filename = NULL;
+
+    char *snapshot_filename = NULL;
+    char *restore_filename = NULL;
+    u64 snapshot_at = 0;
+    u8 snapshot_at_address = 0;
+    u32 snapshot_address = 0;
+    char *fanout_filename = NULL;
+    Fanout_Options fanout_options = {0};
+    Debugger debugger = {0};
+    char *gdb_address = NULL;
+    u32 timer_hz = 0;
+    Pacing pacing = {0};
+    u8 use_hle = 0;
+    Hle hle;
 
     char *input_filename = NULL;
 
@@ -32,12 +134,136 @@ int main(int argc, char **argv)
                     // instead of this boolean
                     cpu.debug_mode = 1;
                 }
+                else if (STR_EQUAL(argv[i], "--gdb") && i+1 < argc) {
+                    // GDB remote serial protocol server at the port or the unix:<path>, see the gdb_stub.h
+                    gdb_address = argv[++i];
+                }
+                else if (STR_EQUAL(argv[i], "--checkpoint_interval") && i+1 < argc) {
+                    // The history of the reverse debugging, see the history.h
+                    debugger.checkpoint_interval = strtoull(argv[++i], NULL, 10);
+                }
+                else if (STR_EQUAL(argv[i], "--history_mb") && i+1 < argc) {
+                    debugger.history_bytes = strtoull(argv[++i], NULL, 10) * 1024 * 1024;
+                }
                 else if (STR_EQUAL(argv[i], "--hide_inst_mem_addr")) {
                     cpu.hide_inst_mem_addr = 1;
                 }
                 else if (STR_EQUAL(argv[i], "--show_raw_bin")) {
                     cpu.show_raw_bin = 1;
                 }
+                else if (STR_EQUAL(argv[i], "--symbols")) {
+                    // Annotates the output with the labels and the source lines from the <binary>.syms
+                    // and <binary>.lines which are written by the assembler
+                    load_symbols = 1;
+                }
+                else if (STR_EQUAL(argv[i], "--disasm")) {
+                    // Streaming disassembler for binaries of any size, see the disassembler.h
+                    disassemble = 1;
+                }
+                else if (STR_EQUAL(argv[i], "--recursive")) {
+                    recursive = 1;
+                }
+                else if (STR_EQUAL(argv[i], "--entry") && i+1 < argc) {
+                    if (disasm_options.entry_count < DISASM_MAX_ENTRY_COUNT) {
+                        disasm_options.entries[disasm_options.entry_count++] = (u32)strtoul(argv[++i], NULL, 0);
+                    }
+                }
+                else if (STR_EQUAL(argv[i], "--stats")) {
+                    print_stats = 1;
+                }
+                else if (STR_EQUAL(argv[i], "--no_predecode")) {
+                    // Decodes every instruction at the execution, see the code_map.h
+                    cpu.predecode = 0;
+                }
+                else if (STR_EQUAL(argv[i], "--no_idle_skip")) {
+                    // Executes every iteration of the idle loops, see the skip_idle_loop()
+                    cpu.idle_skip = 0;
+                }
+                else if (STR_EQUAL(argv[i], "--cfg") && i+1 < argc) {
+                    // Writes the control-flow graph of the load-time analysis in Graphviz DOT
+                    cfg_filename = argv[++i];
+                }
+                else if (STR_EQUAL(argv[i], "--trace_file") && i+1 < argc) {
+                    // Records the binary trace of the execution, see the trace.h and the trace_tool.c
+                    trace_filename = argv[++i];
+                }
+                else if (STR_EQUAL(argv[i], "--quiet")) {
+                    // No text trace of the execution
+                    cpu.trace = NULL;
+                }
+                else if (STR_EQUAL(argv[i], "--snapshot") && i+1 < argc) {
+                    // Saves the machine at the --snapshot_at instruction count or before the instruction at the
+                    // --snapshot_at_address (absolute), then continues the run, see the snapshot.h
+                    snapshot_filename = argv[++i];
+                }
+                else if (STR_EQUAL(argv[i], "--snapshot_at") && i+1 < argc) {
+                    snapshot_at = strtoull(argv[++i], NULL, 10);
+                }
+                else if (STR_EQUAL(argv[i], "--snapshot_at_address") && i+1 < argc) {
+                    snapshot_at_address = 1;
+                    snapshot_address = (u32)strtoul(argv[++i], NULL, 0);
+                }
+                else if (STR_EQUAL(argv[i], "--restore") && i+1 < argc) {
+                    // Continues the run of the snapshot instead of loading the binary
+                    restore_filename = argv[++i];
+                }
+                else if (STR_EQUAL(argv[i], "--fanout") && i+1 < argc) {
+                    // Runs every variant of the file from the marker in a forked process, see the fanout.h
+                    fanout_filename = argv[++i];
+                }
+                else if (STR_EQUAL(argv[i], "--fanout_at_port") && i+1 < argc) {
+                    fanout_options.at_port = 1;
+                    fanout_options.port = (u16)strtoul(argv[++i], NULL, 0);
+                }
+                else if (STR_EQUAL(argv[i], "--fanout_at_address") && i+1 < argc) {
+                    fanout_options.at_address = 1;
+                    fanout_options.address = (u32)strtoul(argv[++i], NULL, 0);
+                }
+                else if (STR_EQUAL(argv[i], "--batch") && i+1 < argc) {
+                    // Runs every binary of a directory or a manifest file, see the batch.h
+                    batch_path = argv[++i];
+                }
+                else if (STR_EQUAL(argv[i], "--threads") && i+1 < argc) {
+                    batch_options.thread_count = atoi(argv[++i]);
+                }
+                else if (STR_EQUAL(argv[i], "--report") && i+1 < argc) {
+                    batch_options.report_filename = argv[++i];
+                }
+                else if (STR_EQUAL(argv[i], "--limit") && i+1 < argc) {
+                    u64 limit = strtoull(argv[++i], NULL, 10);
+                    batch_options.instruction_limit = limit;
+                    cpu.instruction_limit = limit;
+                }
+                else if (STR_EQUAL(argv[i], "--cycle_limit") && i+1 < argc) {
+                    u64 limit = strtoull(argv[++i], NULL, 10);
+                    batch_options.cycle_limit = limit;
+                    cpu.cycle_limit = limit;
+                }
+                else if (STR_EQUAL(argv[i], "--mhz") && i+1 < argc) {
+                    // Real-time pacing to this clock frequency (e.g. 4.77 or 8), see the pacing.h
+                    pacing.hz = atof(argv[++i]) * 1e6;
+                }
+                else if (STR_EQUAL(argv[i], "--turbo")) {
+                    // As fast as it can, no pacing
+                    pacing.hz = 0;
+                }
+                else if (STR_EQUAL(argv[i], "--cpu") && i+1 < argc) {
+                    // The opcodes, the alu and the cycles of the model, see the cpu_model.h
+                    cpu.model = find_cpu_model(argv[++i]);
+                    if (!cpu.model) {
+                        printf("\n[ERROR]: Unknown cpu: %s (8086, 8088 or 80186)\n", argv[i]);
+                        assert(0);
+                    }
+                    batch_options.model = cpu.model;
+                }
+                else if (STR_EQUAL(argv[i], "--hle")) {
+                    // The int 10h, 16h and 21h are run natively, no BIOS or DOS is needed, see the hle.h
+                    use_hle = 1;
+                }
+                else if (STR_EQUAL(argv[i], "--timer_hz") && i+1 < argc) {
+                    // The timer interrupt (int 8) at this frequency of the 4.77 MHz clock, it wakes up the hlt
+                    timer_hz = (u32)strtoul(argv[++i], NULL, 10);
+                }
             } else {
                 input_filename = argv[i];
                 continue;
@@ -45,12 +271,166 @@ int main(int argc, char **argv)
         }
     }
 
+    // The history of the debugger restores the Machine_State only, the rc and the rs would run the hle services again
+    // against the host files and the input
+    // @Incomplete: Journal the results of the hle services in the history and replay them
+    if (use_hle && cpu.debug_mode) {
+        fprintf(stderr, "[ERROR]: The --hle can't be used with the --debug, the reverse execution would repeat the host I/O\n");
+        return 1;
+    }
+
+    // The snapshot doesn't have the opened host files and the memory blocks of the hle, see the snapshot.h
+    if (use_hle && restore_filename) {
+        fprintf(stderr, "[ERROR]: The --hle can't be used with the --restore, the snapshot has no hle state\n");
+        return 1;
+    }
+
     // printf("\nbinary: %s\n\n", input_filename);
     // cpu.out = fopen("./port.out", "w");
 
+    if (batch_path) {
+        return run_batch(batch_path, &batch_options);
+    }
+
+    if (fanout_filename) {
+        fanout_options.process_count     = batch_options.thread_count;
+        fanout_options.instruction_limit = batch_options.instruction_limit;
+        fanout_options.report_filename   = batch_options.report_filename;
+        fanout_options.model             = cpu.model;
+        return run_fanout(input_filename, fanout_filename, &fanout_options);
+    }
+
+    if (disassemble) {
+        Disasm_Options options = disasm_options;
+        options.format.hide_address   = cpu.hide_inst_mem_addr;
+        options.format.show_raw_bytes = cpu.show_raw_bin;
+        options.print_stats           = print_stats;
+        options.thread_count          = batch_options.thread_count;
+
+        Debug_Info debug_info;
+        // The image is the whole file, the disassembler sets the image_size when it's mapped
+        if (load_symbols && load_debug_info(&debug_info, input_filename, 0)) {
+            options.format.debug_info = &debug_info;
+        }
+
+        return recursive ? disassemble_file_recursive(input_filename, &options) : disassemble_file(input_filename, &options);
+    }
+
+    Load_Info load_info = {0};
     boot(&cpu);
-    load_executable(&cpu, input_filename);
-    run(&cpu);
+    if (restore_filename) {
+        if (!restore_snapshot(&cpu, restore_filename)) {
+            printf("\n[ERROR]: Failed to restore %s snapshot. Probably it is not exists or it's not a snapshot.\n", restore_filename);
+            assert(0);
+        }
+    }
+    else if (!load_program(&cpu, input_filename, &load_info)) {
+        printf("\n[ERROR]: Failed to open %s file. Probably it is not exists.\n", input_filename);
+        assert(0);
+    }
+
+    Debug_Info debug_info;
+    if (load_symbols && input_filename) {
+        if (load_debug_info(&debug_info, input_filename, cpu.exec_end - cpu.image_base)) {
+            cpu.debug_info = &debug_info;
+        } else {
+            fprintf(stderr, "[WARNING]: No debug info is found for %s\n", input_filename);
+        }
+    }
+
+    if (use_hle) {
+        init_hle(&hle, &cpu);
+        cpu.hle = &hle;
+    }
+
+    if (timer_hz && !restore_filename) {
+        u64 period = I8086_CLOCK_HZ / timer_hz;
+        schedule_interrupt(&cpu, 8, cpu.cycle_count + period, period ? period : 1);
+    }
+
+    if (cfg_filename) {
+        if (!cpu.code_map) {
+            fprintf(stderr, "[WARNING]: No control-flow graph without the pre-decoding\n");
+        } else if (!write_code_map_dot(cpu.code_map, cfg_filename)) {
+            fprintf(stderr, "[WARNING]: Failed to write %s\n", cfg_filename);
+        }
+    }
+
+    if (trace_filename) {
+        cpu.trace_writer = open_trace_writer(&cpu, trace_filename);
+        if (!cpu.trace_writer) {
+            fprintf(stderr, "[WARNING]: Failed to create %s\n", trace_filename);
+        }
+    }
+
+    // Once for the whole run, the paced run calls the run() per burst (NULL without the GRAPHICS_ENABLED). The gdb
+    // stub is headless, like the batch and the fanout.
+    if (!cpu.decode_only && !gdb_address) {
+        cpu.graphics = open_graphics();
+    }
+
+    double run_start = seconds_now();
+    if (snapshot_filename && (snapshot_at || snapshot_at_address)) {
+        run_with_snapshot(&cpu, snapshot_filename, snapshot_at, snapshot_at_address, snapshot_address, print_stats);
+    } else if (gdb_address) {
+        run_gdb_stub(&cpu, gdb_address);
+    } else if (cpu.debug_mode && !cpu.decode_only) {
+        run_debugger(&cpu, &debugger);
+    } else {
+        if (pacing.hz > 0) {
+            run_paced(&cpu, &pacing);
+        } else {
+            run(&cpu);
+        }
+    }
+    double run_seconds = seconds_now() - run_start;
+
+    if (cpu.trace_writer) {
+        if (!close_trace_writer(cpu.trace_writer, &cpu)) {
+            fprintf(stderr, "[WARNING]: Failed to write %s\n", trace_filename);
+        }
+        cpu.trace_writer = NULL;
+    }
+
+    if (print_stats && !restore_filename) {
+        fprintf(stderr, "load: %.3f ms, %s, %u bytes, %u relocations\n", load_info.seconds * 1000.0,
+                executable_format_name(load_info.format), load_info.image_size, load_info.relocation_count);
+    }
+    if (print_stats && cpu.code_map) {
+        Code_Map *map = cpu.code_map;
+        fprintf(stderr, "analysis: %.3f ms, %u instructions, %u blocks\n",
+                map->build_seconds * 1000.0, map->static_instruction_count, map->block_count);
+        fprintf(stderr, "run: %.3f ms, %llu pre-decoded, %llu decoded, %llu invalidated\n",
+                run_seconds * 1000.0, (unsigned long long)map->hit_count, (unsigned long long)map->miss_count,
+                (unsigned long long)map->invalidation_count);
+    } else if (print_stats) {
+        fprintf(stderr, "run: %.3f ms\n", run_seconds * 1000.0);
+    }
+    if (print_stats) {
+        fprintf(stderr, "exit: %s, %llu instructions, %llu cycles (%llu halted)\n", exit_reason_name(cpu.exit_reason),
+                (unsigned long long)cpu.instruction_count, (unsigned long long)cpu.cycle_count,
+                (unsigned long long)cpu.halted_cycles);
+        if (pacing.hz > 0) {
+            print_pacing_stats(stderr, &pacing);
+        }
+        fprintf(stderr, "idle: %llu loops skipped, %llu cycles (%.1f%%)\n", (unsigned long long)cpu.idle_skip_count,
+                (unsigned long long)cpu.skipped_cycles, cpu.cycle_count ? cpu.skipped_cycles * 100.0 / cpu.cycle_count : 0.0);
+        if (cpu.hle) {
+            print_hle_stats(stderr, cpu.hle);
+        }
+    }
+
+    destroy_code_map(&cpu);
+    if (cpu.debug_info) {
+        unload_debug_info(cpu.debug_info);
+    }
+    if (cpu.hle) {
+        close_hle(cpu.hle);
+    }
+    if (cpu.graphics) {
+        close_graphics(cpu.graphics);
+        cpu.graphics = NULL;
+    }
 
     // if (dump_out) {
     //     FILE *fp = fopen("memory_dump.data", "w");
@@ -58,5 +438,6 @@ int main(int argc, char **argv)
     //     fwrite(cpu.memory, 1, 65556, fp);
     // }
 
-    return 0;
+    // The exit code of the guest program at the terminate of the DOS
+    return cpu.exit_reason == Exit_Reason_Program_Exit ? hle.exit_code : 0;
 }
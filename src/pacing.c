@@ -0,0 +1,68 @@
+#include "pacing.h"
+#include "simulator.h"
+#include "platform.h"
+
+void run_paced(CPU *cpu, Pacing *pacing)
+{
+    u64 cycle_limit = cpu->cycle_limit;
+    u64 burst_cycles = (u64)(pacing->hz * PACING_BURST_SECONDS);
+    if (burst_cycles == 0) burst_cycles = 1;
+
+    double start = seconds_now();
+    double schedule_start = start;
+    u64 start_cycles = cpu->cycle_count;
+
+    for (;;) {
+        u64 burst_end = cpu->cycle_count + burst_cycles;
+        cpu->cycle_limit = cycle_limit && cycle_limit < burst_end ? cycle_limit : burst_end;
+
+        double run_start = seconds_now();
+        run(cpu);
+        pacing->busy_seconds += seconds_now() - run_start;
+        pacing->burst_count += 1;
+
+        cpu->cycle_limit = cycle_limit;
+        if (cpu->exit_reason != Exit_Reason_Cycle_Limit || (cycle_limit && cpu->cycle_count >= cycle_limit)) {
+            break;
+        }
+        cpu->exit_reason = Exit_Reason_None;
+
+        // The burst can be longer than the burst_cycles (the limit is checked after the blocks), the target is
+        // always the emulated time of the cycle count
+        double target = schedule_start + (double)(cpu->cycle_count - start_cycles) / pacing->hz;
+        double now = seconds_now();
+        if (now < target) {
+            sleep_seconds(target - now);
+            pacing->sleep_count += 1;
+            now = seconds_now();
+        }
+
+        double error = now - target;
+        double abs_error = error < 0 ? -error : error;
+        pacing->error_sum += error;
+        pacing->error_abs_sum += abs_error;
+        if (abs_error > (pacing->error_max < 0 ? -pacing->error_max : pacing->error_max)) pacing->error_max = error;
+        if (error > PACING_BURST_SECONDS) pacing->late_count += 1;
+
+        if (error > PACING_MAX_LAG_SECONDS) {
+            schedule_start += error;
+            pacing->resync_count += 1;
+        }
+    }
+
+    pacing->wall_seconds += seconds_now() - start;
+}
+
+void print_pacing_stats(FILE *dest, Pacing *pacing)
+{
+    u64 count = pacing->burst_count > 1 ? pacing->burst_count - 1 : 1; // the last burst is not measured
+    double mean = pacing->error_sum / count;
+    double jitter = pacing->error_abs_sum / count;
+
+    fprintf(dest, "pacing: %.3f MHz, %llu bursts, %llu sleeps, busy %.1f%% of %.3f s\n", pacing->hz / 1e6,
+            (unsigned long long)pacing->burst_count, (unsigned long long)pacing->sleep_count,
+            pacing->wall_seconds > 0 ? pacing->busy_seconds * 100.0 / pacing->wall_seconds : 0.0, pacing->wall_seconds);
+    fprintf(dest, "jitter: %.1f us (mean error %+.1f us), max %+.1f us, %llu late, %llu resyncs\n", jitter * 1e6,
+            mean * 1e6, pacing->error_max * 1e6, (unsigned long long)pacing->late_count,
+            (unsigned long long)pacing->resync_count);
+}
@@ -0,0 +1,38 @@
+#ifndef _H_PACING
+#define _H_PACING
+
+#include "sim86.h"
+
+// Real-time pacing (--mhz <frequency>, --turbo turns it off): the run is cut into bursts of PACING_BURST_SECONDS of
+// emulated time (the cycle limit of the run()), after every burst the emulated time is compared to the monotonic
+// host clock and the rest of the burst is slept away. The host cpu is used only for the emulated work, an idle
+// guest (hlt, or an idle loop, see the skip_idle_loop()) is slept through in one sleep per burst.
+//
+// The error is the host time after the burst (and the sleep) minus the time when the burst should end. If the host
+// is behind by more than PACING_MAX_LAG_SECONDS (it's too slow, or the process was stopped), the lost time is not
+// caught up, the schedule is moved instead.
+
+#define PACING_BURST_SECONDS   0.002
+#define PACING_MAX_LAG_SECONDS 0.1
+
+typedef struct {
+    double hz;               // the target frequency of the emulated clock
+
+    // Statistics
+    u64 burst_count;
+    u64 sleep_count;
+    u64 late_count;          // the bursts which are ended later than one burst time
+    u64 resync_count;        // the schedule is moved, see the PACING_MAX_LAG_SECONDS
+    double busy_seconds;     // in the run()
+    double wall_seconds;
+    double error_sum;        // seconds
+    double error_abs_sum;    // the jitter is the mean of the absolute errors
+    double error_max;        // the largest absolute one, with its sign
+} Pacing;
+
+// Runs until the run() is stopped for another reason than the burst end (the cpu->cycle_limit of the caller is kept)
+void run_paced(CPU *cpu, Pacing *pacing);
+
+void print_pacing_stats(FILE *dest, Pacing *pacing);
+
+#endif
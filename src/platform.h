@@ -0,0 +1,421 @@
+#ifndef _H_PLATFORM
+#define _H_PLATFORM
+
+// Minimal platform layer (file mapping, threads, timer, file system), so the same code builds with the cl (build.bat)
+// and with the gcc/clang (link with -lpthread).
+
+#include "sim86.h"
+
+#ifdef _WIN32
+
+#include <winsock2.h> // before the windows.h
+#include <windows.h>
+#pragma comment(lib, "ws2_32.lib")
+
+typedef HANDLE Thread;
+typedef DWORD (WINAPI *Thread_Proc)(void *);
+#define THREAD_PROC(_name) DWORD WINAPI _name(void *data)
+
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE Condition;
+
+typedef SOCKET Socket;
+#define INVALID_SOCKET_HANDLE INVALID_SOCKET
+
+// Maps the whole file read-only, returns NULL if it's failed (or the file is empty)
+static inline u8 *map_file(char *filename, u64 *size)
+{
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file, &file_size);
+    *size = (u64)file_size.QuadPart;
+
+    HANDLE mapping = *size ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+    CloseHandle(file);
+    if (mapping == NULL) return NULL;
+
+    u8 *data = (u8 *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+
+    return data;
+}
+
+static inline void unmap_file(u8 *data, u64 size)
+{
+    if (data) UnmapViewOfFile(data);
+}
+
+static inline Thread thread_start(Thread_Proc proc, void *data)
+{
+    return CreateThread(NULL, 0, proc, data, 0, NULL);
+}
+
+static inline void thread_join(Thread t)
+{
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+
+static inline void mutex_init(Mutex *m)   { InitializeCriticalSection(m); }
+static inline void mutex_lock(Mutex *m)   { EnterCriticalSection(m); }
+static inline void mutex_unlock(Mutex *m) { LeaveCriticalSection(m); }
+
+static inline void condition_init(Condition *c)           { InitializeConditionVariable(c); }
+static inline void condition_wait(Condition *c, Mutex *m) { SleepConditionVariableCS(c, m, INFINITE); }
+static inline void condition_broadcast(Condition *c)      { WakeAllConditionVariable(c); }
+
+// The flags which are shared by the threads without a lock
+static inline u32 load_acquire_u32(volatile u32 *value)          { return (u32)InterlockedCompareExchange((volatile LONG *)value, 0, 0); }
+static inline void store_release_u32(volatile u32 *value, u32 v) { InterlockedExchange((volatile LONG *)value, (LONG)v); }
+
+// Listens on the 127.0.0.1:port (the "unix:<path>" is not supported on Windows) and accepts one connection
+static inline Socket accept_local_connection(const char *address)
+{
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) return INVALID_SOCKET_HANDLE;
+    if (strncmp(address, "unix:", 5) == 0) return INVALID_SOCKET_HANDLE;
+
+    Socket server = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (server == INVALID_SOCKET_HANDLE) return INVALID_SOCKET_HANDLE;
+
+    struct sockaddr_in local = {0};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    local.sin_port = htons((u16)atoi(address));
+
+    BOOL reuse = TRUE;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+
+    Socket client = INVALID_SOCKET_HANDLE;
+    if (bind(server, (struct sockaddr *)&local, sizeof(local)) == 0 && listen(server, 1) == 0) {
+        client = accept(server, NULL, NULL);
+    }
+    closesocket(server);
+
+    if (client != INVALID_SOCKET_HANDLE) {
+        BOOL no_delay = TRUE;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (const char *)&no_delay, sizeof(no_delay));
+    }
+    return client;
+}
+
+// Returns the number of the read bytes, 0 if the connection is closed or it's failed
+static inline u32 socket_read(Socket s, void *buffer, u32 size)
+{
+    int count = recv(s, (char *)buffer, (int)size, 0);
+    return count > 0 ? (u32)count : 0;
+}
+
+static inline u8 socket_write(Socket s, const void *data, u32 size)
+{
+    const char *at = (const char *)data;
+    while (size) {
+        int written = send(s, at, (int)size, 0);
+        if (written <= 0) return 0;
+        at += written;
+        size -= written;
+    }
+    return 1;
+}
+
+// Wakes up the blocked socket_read() of the other thread, the socket is closed after that thread is joined
+static inline void socket_shutdown(Socket s)
+{
+    shutdown(s, SD_BOTH);
+}
+
+static inline void socket_close(Socket s)
+{
+    closesocket(s);
+}
+
+static inline int cpu_core_count()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+}
+
+static inline double seconds_now()
+{
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+}
+
+// The resolution is the scheduler tick (about 1-16 ms), the caller measures the real time after it
+static inline void sleep_seconds(double seconds)
+{
+    if (seconds > 0) Sleep((DWORD)(seconds * 1000.0));
+}
+
+// Writes the whole buffer to the standard output (without the stdio buffering), returns 0 if it's failed
+static inline u8 write_stdout(const void *data, u64 size)
+{
+    HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
+    const u8 *at = (const u8 *)data;
+    while (size) {
+        DWORD chunk = size > 0x40000000 ? 0x40000000 : (DWORD)size;
+        DWORD written = 0;
+        if (!WriteFile(out, at, chunk, &written, NULL) || written == 0) return 0;
+        at += written;
+        size -= written;
+    }
+    return 1;
+}
+
+static inline u8 is_directory(char *path)
+{
+    DWORD attributes = GetFileAttributesA(path);
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+// Calls the proc with the name of every regular file in the directory (not recursive)
+static inline void for_each_file_in_directory(char *path, void (*proc)(char *name, void *user), void *user)
+{
+    char pattern[1024];
+    snprintf(pattern, sizeof(pattern), "%s\\*", path);
+
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(pattern, &data);
+    if (find == INVALID_HANDLE_VALUE) return;
+
+    do {
+        if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+            proc(data.cFileName, user);
+        }
+    } while (FindNextFileA(find, &data));
+
+    FindClose(find);
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+typedef pthread_t Thread;
+typedef void *(*Thread_Proc)(void *);
+#define THREAD_PROC(_name) void *_name(void *data)
+
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Condition;
+
+typedef int Socket;
+#define INVALID_SOCKET_HANDLE -1
+
+// Maps the whole file read-only, returns NULL if it's failed (or the file is empty)
+static inline u8 *map_file(char *filename, u64 *size)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    *size = (u64)st.st_size;
+
+    void *data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    return data == MAP_FAILED ? NULL : (u8 *)data;
+}
+
+static inline void unmap_file(u8 *data, u64 size)
+{
+    if (data) munmap(data, size);
+}
+
+static inline Thread thread_start(Thread_Proc proc, void *data)
+{
+    Thread t;
+    int err = pthread_create(&t, NULL, proc, data);
+    assert(err == 0);
+    return t;
+}
+
+static inline void thread_join(Thread t)
+{
+    pthread_join(t, NULL);
+}
+
+static inline void mutex_init(Mutex *m)   { pthread_mutex_init(m, NULL); }
+static inline void mutex_lock(Mutex *m)   { pthread_mutex_lock(m); }
+static inline void mutex_unlock(Mutex *m) { pthread_mutex_unlock(m); }
+
+static inline void condition_init(Condition *c)           { pthread_cond_init(c, NULL); }
+static inline void condition_wait(Condition *c, Mutex *m) { pthread_cond_wait(c, m); }
+static inline void condition_broadcast(Condition *c)      { pthread_cond_broadcast(c); }
+
+// The flags which are shared by the threads without a lock
+static inline u32 load_acquire_u32(volatile u32 *value)          { return __atomic_load_n(value, __ATOMIC_ACQUIRE); }
+static inline void store_release_u32(volatile u32 *value, u32 v) { __atomic_store_n(value, v, __ATOMIC_RELEASE); }
+
+// Listens on the 127.0.0.1:port, or on the UNIX socket of the "unix:<path>", and accepts one connection
+static inline Socket accept_local_connection(const char *address)
+{
+    Socket server;
+    if (strncmp(address, "unix:", 5) == 0) {
+        struct sockaddr_un local = {0};
+        local.sun_family = AF_UNIX;
+        snprintf(local.sun_path, sizeof(local.sun_path), "%s", address + 5);
+        unlink(local.sun_path);
+
+        server = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (server < 0) return INVALID_SOCKET_HANDLE;
+        if (bind(server, (struct sockaddr *)&local, sizeof(local)) != 0) {
+            close(server);
+            return INVALID_SOCKET_HANDLE;
+        }
+    } else {
+        struct sockaddr_in local = {0};
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        local.sin_port = htons((u16)atoi(address));
+
+        server = socket(AF_INET, SOCK_STREAM, 0);
+        if (server < 0) return INVALID_SOCKET_HANDLE;
+
+        int reuse = 1;
+        setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(server, (struct sockaddr *)&local, sizeof(local)) != 0) {
+            close(server);
+            return INVALID_SOCKET_HANDLE;
+        }
+    }
+
+    Socket client = INVALID_SOCKET_HANDLE;
+    if (listen(server, 1) == 0) {
+        do {
+            client = accept(server, NULL, NULL);
+        } while (client < 0 && errno == EINTR);
+    }
+    close(server);
+
+    // Only one connection is accepted, the path is not needed anymore
+    if (strncmp(address, "unix:", 5) == 0) unlink(address + 5);
+
+    if (client >= 0 && strncmp(address, "unix:", 5) != 0) {
+        int no_delay = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    }
+    return client < 0 ? INVALID_SOCKET_HANDLE : client;
+}
+
+// Returns the number of the read bytes, 0 if the connection is closed or it's failed
+static inline u32 socket_read(Socket s, void *buffer, u32 size)
+{
+    for (;;) {
+        ssize_t count = recv(s, buffer, size, 0);
+        if (count < 0 && errno == EINTR) continue;
+        return count > 0 ? (u32)count : 0;
+    }
+}
+
+static inline u8 socket_write(Socket s, const void *data, u32 size)
+{
+    const u8 *at = (const u8 *)data;
+    while (size) {
+        ssize_t written = send(s, at, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return 0;
+        at += written;
+        size -= written;
+    }
+    return 1;
+}
+
+// Wakes up the blocked socket_read() of the other thread, the socket is closed after that thread is joined
+static inline void socket_shutdown(Socket s)
+{
+    shutdown(s, SHUT_RDWR);
+}
+
+static inline void socket_close(Socket s)
+{
+    close(s);
+}
+
+static inline int cpu_core_count()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static inline double seconds_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// The caller measures the real time after it, the sleep can be longer
+static inline void sleep_seconds(double seconds)
+{
+    if (seconds <= 0) return;
+
+    struct timespec ts;
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - (double)ts.tv_sec) * 1e9);
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+}
+
+// Writes the whole buffer to the standard output (without the stdio buffering), returns 0 if it's failed
+static inline u8 write_stdout(const void *data, u64 size)
+{
+    const u8 *at = (const u8 *)data;
+    while (size) {
+        ssize_t written = write(STDOUT_FILENO, at, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return 0;
+        at += written;
+        size -= written;
+    }
+    return 1;
+}
+
+static inline u8 is_directory(char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Calls the proc with the name of every regular file in the directory (not recursive)
+static inline void for_each_file_in_directory(char *path, void (*proc)(char *name, void *user), void *user)
+{
+    DIR *dir = opendir(path);
+    if (dir == NULL) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char full_path[1024];
+        snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
+
+        struct stat st;
+        if (stat(full_path, &st) == 0 && S_ISREG(st.st_mode)) {
+            proc(entry->d_name, user);
+        }
+    }
+
+    closedir(dir);
+}
+
+#endif
+
+#endif
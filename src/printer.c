@@ -1,9 +1,10 @@
 #include "printer.h"
+#include "debug_info.h"
 
 // @Todo: Remove the reg param
 const char *mnemonic_name(Mnemonic m)
 {
-    static const char *mnemonic_name_lookup[] = {
+    static const char *const mnemonic_name_lookup[] = {
         [Mnemonic_mov]     = "mov",
         [Mnemonic_add]     = "add",
         [Mnemonic_adc]     = "adc",
@@ -101,6 +102,18 @@ const char *mnemonic_name(Mnemonic m)
         [Mnemonic_div]     = "div",
         [Mnemonic_idiv]    = "idiv",
 
+        // 80186
+        [Mnemonic_pusha]   = "pusha",
+        [Mnemonic_popa]    = "popa",
+        [Mnemonic_bound]   = "bound",
+        [Mnemonic_insb]    = "insb",
+        [Mnemonic_insw]    = "insw",
+        [Mnemonic_outsb]   = "outsb",
+        [Mnemonic_outsw]   = "outsw",
+        [Mnemonic_enter]   = "enter",
+        [Mnemonic_leave]   = "leave",
+        [Mnemonic_imul_imm] = "imul",
+
         // DB (define-byte) pseudo-instruction
         [Mnemonic_db]      = "db",
 
@@ -133,7 +146,7 @@ const char *mnemonic_name(Mnemonic m)
 
 const char *register_name(Register reg)
 {
-    static const char *register_names[] = {
+    static const char *const register_names[] = {
         "al", "cl", "dl", "bl",
         "ah", "ch", "dh", "bh",
         "ax", "cx", "dx", "bx",
@@ -147,85 +160,201 @@ const char *register_name(Register reg)
     return register_names[reg];
 }
 
-void print_flags(u16 flags)
+const char *exit_reason_name(Exit_Reason reason)
+{
+    static const char *const exit_reason_names[] = {
+        [Exit_Reason_None]                  = "none",
+        [Exit_Reason_End_Of_Image]          = "end_of_image",
+        [Exit_Reason_Unhandled_Instruction] = "unhandled_instruction",
+        [Exit_Reason_Divide_Error]          = "divide_error",
+        [Exit_Reason_Instruction_Limit]     = "instruction_limit",
+        [Exit_Reason_User_Quit]             = "user_quit",
+        [Exit_Reason_Stop_Address]          = "stop_address",
+        [Exit_Reason_Stop_Port]             = "stop_port",
+        [Exit_Reason_Halt]                  = "halt",
+        [Exit_Reason_Cycle_Limit]           = "cycle_limit",
+        [Exit_Reason_Bound_Range]           = "bound_range",
+        [Exit_Reason_Program_Exit]          = "program_exit",
+    };
+
+    assert(reason < ARRAY_SIZE(exit_reason_names));
+
+    return exit_reason_names[reason];
+}
+
+void print_flags(FILE *dest, u16 flags)
 {
     if (flags & F_SIGNED) {
-        printf(" SF");
+        fprintf(dest, " SF");
     }
     if (flags & F_ZERO) {
-        printf(" ZF");
+        fprintf(dest, " ZF");
     }
     if (flags & F_CARRY) {
-        printf(" CF");
+        fprintf(dest, " CF");
     }
     if (flags & F_PARITY) {
-        printf(" PF");
+        fprintf(dest, " PF");
     }
     if (flags & F_OVERFLOW) {
-        printf(" OF");
+        fprintf(dest, " OF");
     }
     if (flags & F_AUXILIARY) {
-        printf(" AF");
+        fprintf(dest, " AF");
     }
     if (flags & F_INTERRUPT) {
-        printf(" IF");
+        fprintf(dest, " IF");
     }
     if (flags & F_DIRECTION) {
-        printf(" DF");
+        fprintf(dest, " DF");
     }
     if (flags & F_TRAP) {
-        printf(" TF");
+        fprintf(dest, " TF");
     }
 }
 
-void print_out_formated_flags(u16 old_flags, u16 new_flags)
+void print_out_formated_flags(CPU *cpu, u16 old_flags, u16 new_flags)
 {
-    printf("\n\t\t@flags: [");
-    print_flags(old_flags);
-    printf(" ] -> [");
-    print_flags(new_flags);
-    printf(" ]");
+    if (!cpu->trace) return;
+
+    fprintf(cpu->trace, "\n\t\t@flags: [");
+    print_flags(cpu->trace, old_flags);
+    fprintf(cpu->trace, " ] -> [");
+    print_flags(cpu->trace, new_flags);
+    fprintf(cpu->trace, " ]");
 }
 
-void print_instruction(CPU *cpu, u8 with_end_line)
+///////////////////////////////////////////////////
+// Instruction formatting
+//
+// The instructions are formatted into a buffer without the printf family, so the same code is fast enough for
+// the trace (print_instruction) and for the disassembling of large binaries (disassembler.c).
+
+typedef struct {
+    char *at;
+    char *end; // the writer never writes past this, the text is truncated instead
+} Text_Writer;
+
+static inline void append_char(Text_Writer *w, char c)
+{
+    if (w->at < w->end) *w->at++ = c;
+}
+
+static inline void append_cstr(Text_Writer *w, const char *str)
+{
+    while (*str && w->at < w->end) *w->at++ = *str++;
+}
+
+static void append_unsigned(Text_Writer *w, u32 value)
+{
+    char digits[10];
+    int count = 0;
+    do {
+        digits[count++] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+
+    while (count) append_char(w, digits[--count]);
+}
+
+// The same as the "%d" (or the "%+d" with the force_sign)
+static void append_signed(Text_Writer *w, s32 value, u8 force_sign)
+{
+    if (value < 0) {
+        append_char(w, '-');
+        append_unsigned(w, (u32)0 - (u32)value);
+    } else {
+        if (force_sign) append_char(w, '+');
+        append_unsigned(w, (u32)value);
+    }
+}
+
+static void append_hex(Text_Writer *w, u32 value, int digit_count, u8 uppercase)
+{
+    const char *hex_digits = uppercase ? "0123456789ABCDEF" : "0123456789abcdef";
+    for (int i = digit_count - 1; i >= 0; i--) {
+        append_char(w, hex_digits[(value >> (4*i)) & 0xF]);
+    }
+}
+
+// The "; label+offset file:line" comment, if the debug info is loaded
+static void append_source_location(Text_Writer *w, Debug_Info *debug_info, u32 image_offset)
 {
-    FILE *dest = stdout;
+    const char *symbol_name;
+    u32 symbol_offset;
+    const char *file;
+    u32 line;
+
+    u8 has_symbol = find_symbol(debug_info, image_offset, &symbol_name, &symbol_offset);
+    u8 has_line = find_source_line(debug_info, image_offset, &file, &line);
+    if (!has_symbol && !has_line) return;
+
+    append_cstr(w, "\t;");
+    if (has_symbol) {
+        append_char(w, ' ');
+        append_cstr(w, symbol_name);
+        if (symbol_offset) {
+            append_char(w, '+');
+            append_unsigned(w, symbol_offset);
+        }
+    }
+    if (has_line) {
+        append_char(w, ' ');
+        append_cstr(w, file);
+        append_char(w, ':');
+        append_unsigned(w, line);
+    }
+}
 
-    Instruction *instruction = &cpu->instruction;
+u32 format_instruction(Instruction *instruction, Format_Options *options, char *out, u32 capacity)
+{
+    Text_Writer writer = {out, out + capacity - 1};
+    Text_Writer *w = &writer;
 
-    if (cpu->show_raw_bin) {
+    if (options->show_raw_bytes) {
         for (int i = 0; i < instruction->size; i++) {
             u8 b = (instruction->raw >> (8*(instruction->size-i-1))) & 0xFF;
-            fprintf(dest, "%02x ", b);
+            append_hex(w, b, 2, 0);
+            append_char(w, ' ');
         }
-        fprintf(dest, "\n");
+        append_char(w, '\n');
+    }
+
+    // The label header, if a symbol is defined exactly at this instruction
+    const char *symbol_name;
+    u32 symbol_offset;
+    u8 in_image = instruction->mem_address >= options->image_start && instruction->mem_address < options->image_end;
+    u32 image_offset = instruction->mem_address - options->image_start;
+    if (in_image && find_symbol(options->debug_info, image_offset, &symbol_name, &symbol_offset) && symbol_offset == 0) {
+        append_cstr(w, symbol_name);
+        append_cstr(w, ":\n");
     }
 
-    if (!cpu->hide_inst_mem_addr) {
-        fprintf(dest, "%08X\t", instruction->mem_address);
+    if (!options->hide_address) {
+        append_hex(w, instruction->mem_address, 8, 1);
+        append_char(w, '\t');
     }
 
+    if (instruction->flags & Inst_Lock) {
+        append_cstr(w, "lock ");
+    }
     if (instruction->flags & Inst_Repz) {
-        fprintf(dest, "repz ");
+        append_cstr(w, "repz ");
     }
     if (instruction->flags & Inst_Repnz) {
-        fprintf(dest, "repnz ");
+        append_cstr(w, "repnz ");
     }
 
-    fprintf(dest, "%s", mnemonic_name(instruction->mnemonic));
-
-    if (instruction->flags & Inst_Lock) {
-        fprintf(dest, "lock ");
-    }
+    append_cstr(w, mnemonic_name(instruction->mnemonic));
 
     const char *separator = " ";
-    for (u8 j = 0; j < 2; j++) {
+    for (u8 j = 0; j < ARRAY_SIZE(instruction->operands); j++) {
         Instruction_Operand *op = &instruction->operands[j];
         if (op->type == Operand_None) {
             continue;
         }
 
-        fprintf(dest, "%s", separator);
+        append_cstr(w, separator);
         separator = ", ";
 
         switch (op->type) {
@@ -236,50 +365,55 @@ void print_instruction(CPU *cpu, u8 with_end_line)
                 Register_Access *reg_access = register_access(op->reg, op->flags);
                 Register reg_enum = reg_access->reg;
 
-                fprintf(dest, "%s", register_name(reg_enum));
+                append_cstr(w, register_name(reg_enum));
 
                 break;
             }
             case Operand_Memory: {
                 // @Cleanup:
                 if (&instruction->operands[0] == op && !(instruction->flags & Inst_Far)) {
-                    fprintf(dest, "%s ", (instruction->flags & Inst_Wide) ? "word" : "byte");
+                    append_cstr(w, (instruction->flags & Inst_Wide) ? "word " : "byte ");
                 }
 
                 // @Todo: CleanUp
                 if (instruction->flags & Inst_Segment) {
                     if (instruction->extend_with_this_segment != Register_none) {
                         // segment prefix
-                        fprintf(dest, "%s:", register_name(instruction->extend_with_this_segment));
+                        append_cstr(w, register_name(instruction->extend_with_this_segment));
+                        append_char(w, ':');
                     } else {
                         // segment at direct address
                         u16 segment = op->address.segment;
                         u16 offset = op->address.displacement;
-                        fprintf(dest, "%d:%d", segment, offset);
+                        append_unsigned(w, segment);
+                        append_char(w, ':');
+                        append_unsigned(w, offset);
                         break;
                     }
                 }
 
                 if (&instruction->operands[0] == op && instruction->flags & Inst_Far) {
-                    fprintf(dest, "far ");
+                    append_cstr(w, "far ");
                 }
 
-                char const *r_m_base[] = {"","bx+si","bx+di","bp+si","bp+di","si","di","bp","bx"};
-                fprintf(dest, "[%s", r_m_base[op->address.base]);
-                if (op->address.displacement) {
-                    fprintf(dest, "%+d", op->address.displacement);
+                static const char *const r_m_base[] = {"","bx+si","bx+di","bp+si","bp+di","si","di","bp","bx"};
+                append_char(w, '[');
+                append_cstr(w, r_m_base[op->address.base]);
+                if (op->address.displacement || op->address.base == Effective_Address_direct) {
+                    append_signed(w, op->address.displacement, 1);
                 }
-                fprintf(dest, "]");
+                append_char(w, ']');
 
                 break;
             }
             case Operand_Immediate: {
-                fprintf(dest, "%d", op->immediate);
+                append_signed(w, op->immediate, 0);
 
                 break;
             }
             case Operand_Relative_Immediate: {
-                fprintf(dest, "$%+d", op->immediate+instruction->size);
+                append_char(w, '$');
+                append_signed(w, op->immediate+instruction->size, 1);
 
                 break;
             }
@@ -290,8 +424,30 @@ void print_instruction(CPU *cpu, u8 with_end_line)
 
     }
 
+    if (in_image) {
+        append_source_location(w, options->debug_info, image_offset);
+    }
+
+    return (u32)(w->at - out);
+}
+
+void print_instruction(CPU *cpu, u8 with_end_line)
+{
+    FILE *dest = cpu->trace;
+    if (!dest) return;
+
+    Format_Options options = {0};
+    options.hide_address   = cpu->hide_inst_mem_addr;
+    options.show_raw_bytes = cpu->show_raw_bin;
+    options.debug_info     = cpu->debug_info;
+    options.image_start    = cpu->image_base;
+    options.image_end      = cpu->exec_end;
+
+    char buffer[MAX_FORMATTED_INSTRUCTION_SIZE];
+    u32 length = format_instruction(&cpu->instruction, &options, buffer, sizeof(buffer));
     if (with_end_line) {
-        fprintf(dest, "\n");
+        buffer[length++] = '\n';
     }
 
+    fwrite(buffer, 1, length, dest);
 }
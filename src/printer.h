@@ -5,9 +5,26 @@
 
 const char *mnemonic_name(Mnemonic m);
 const char *register_name(Register reg);
+const char *exit_reason_name(Exit_Reason reason);
 
-void print_flags(u16 flags);
-void print_out_formated_flags(u16 old_flags, u16 new_flags);
+void print_flags(FILE *dest, u16 flags);
+void print_out_formated_flags(CPU *cpu, u16 old_flags, u16 new_flags);
+
+// Enough for every instruction, the symbol and the file names are truncated if it's necessary
+#define MAX_FORMATTED_INSTRUCTION_SIZE 512
+
+typedef struct {
+    u8 hide_address;
+    u8 show_raw_bytes;
+
+    Debug_Info *debug_info; // optional
+    u32 image_start;        // the addresses of the debug info are relative to this
+    u32 image_end;          // after the last byte, the instructions outside of the image are not annotated
+} Format_Options;
+
+// Formats the instruction (without the line break) into the out, returns the length. The output is truncated
+// at the capacity-1, so there is always a place for the line break.
+u32 format_instruction(Instruction *instruction, Format_Options *options, char *out, u32 capacity);
 
 void print_instruction(CPU *cpu, u8 with_end_line);
 
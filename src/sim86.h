@@ -22,6 +22,8 @@ typedef unsigned long u64;
 #define STR_LEN(x) (x != NULL ? strlen(x) : 0)
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof(arr)[0])
 
+#define TRACE(_cpu, ...) { if ((_cpu)->trace) fprintf((_cpu)->trace, __VA_ARGS__); }
+
 #define ALLOC_MEMORY(_type) (_type *)malloc(sizeof(_type));
 
 #define NOT_DEFINED -1
@@ -42,6 +44,9 @@ typedef unsigned long u64;
 
 #define MAX_MEMORY (1024 * 1024)
 
+#define I8086_CLOCK_HZ 4772727 // the IBM PC (14.31818 MHz / 3)
+#define MEMORY_PADDING 16
+
 // These are the real place of the
 #define F_CARRY      (1 << 0)
 #define F_PARITY     (1 << 2)
@@ -193,7 +198,7 @@ typedef struct {
   Mnemonic mnemonic;
   Instruction_Type type;
   Instruction_Flag flags;
-  Instruction_Operand operands[2];
+  Instruction_Operand operands[3]; // the third is only used by the imul reg, r/m, imm of the 80186
 
   Register extend_with_this_segment;
 
@@ -206,33 +211,110 @@ typedef struct {
 
 } Instruction;
 
+typedef struct Debug_Info Debug_Info; // see the debug_info.h
+typedef struct Code_Map Code_Map;     // see the code_map.h
+typedef struct Trace_Writer Trace_Writer; // see the trace.h
+typedef struct History History;           // see the history.h
+typedef struct Breakpoints Breakpoints;   // see the breakpoints.h
+typedef struct CPU_Model CPU_Model;       // see the cpu_model.h
+typedef struct Hle Hle;                   // see the hle.h
+typedef struct Graphics Graphics;         // see the graphics.h
+
+// Why the run() is returned
+typedef enum {
+    Exit_Reason_None,
+
+    Exit_Reason_End_Of_Image,           // the ip left the loaded executable
+    Exit_Reason_Unhandled_Instruction,
+    Exit_Reason_Divide_Error,           // without a handler of the int 0 (its vector is 0:0)
+    Exit_Reason_Instruction_Limit,
+    Exit_Reason_User_Quit,              // "q" or "exit" at the --debug prompt
+    Exit_Reason_Stop_Address,           // the next instruction is at the cpu->stop_address
+    Exit_Reason_Stop_Port,              // the out instruction is written to the cpu->stop_port
+    Exit_Reason_Halt,                   // the hlt is executed and no interrupt can wake it up
+    Exit_Reason_Cycle_Limit,
+    Exit_Reason_Bound_Range,            // the bound of the 80186 is failed without a handler of the int 5
+    Exit_Reason_Program_Exit,           // the terminate of the DOS (int 21h, ah=4Ch) by the --hle
+
+    Exit_Reason_Count,
+} Exit_Reason;
+
 typedef struct {
     u32 loaded_executable_size; // @Todo: Remove
+    u32 exec_start; // absolute address of the first byte of the loaded image
     u32 exec_end;
+    u32 image_base; // absolute address of the program itself (after the PSP and the MZ header), the debug info is relative to it
+    u16 psp_segment;        // the PSP of the loaded .COM or .EXE, 0 for the flat binary (see the loader.h)
+    u16 program_paragraphs; // the memory of the program from the PSP
     u32 decoder_cursor;
 
     Instruction instruction; // current instruction
 
     u16 ip;
     u16 flags;
-    u8 regmem[64]; // The "accessible" register values are stored here
+    u8 regmem[64]; // The "accessible" register values are stored here, the words are little endian (al, ah = ax)
 
     u8* memory;
 
     u8 terminate;
+    Exit_Reason exit_reason;
+
+    u64 instruction_count;
+    u64 instruction_limit; // 0 = unlimited
+    u32 stop_address;      // absolute, the run() returns before the instruction (not before the first one)
+    u8 stop_at_address;
+    u16 stop_port;         // the run() returns after the out to this port (a marker of the guest)
+    u8 stop_at_port;
+    u64 cycle_count;       // estimated clock cycles, see the cpu->model->estimate_cycles
+    u64 cycle_limit;       // 0 = unlimited, checked at the end of the blocks (see the run())
+
+    u8 block_end;          // set by the execute_instruction() at the control transfer, the hlt and the stop
+    u8 halted;             // the hlt is executed, the cpu sleeps until the next interrupt
+    u64 halted_cycles;     // the cycles which are skipped by the hlt
+
+    // The scheduled interrupt (the timer tick), it's delivered at the end of the block if the interrupts are enabled
+    u8 event_scheduled;
+    u8 event_interrupt;    // the interrupt type
+    u64 next_event_cycle;
+    u64 event_period;      // the event is scheduled again after this many cycles, 0 = only once
+
+    // The idle loops, see the run_block()
+    u32 block_start;       // absolute address of the current block
+    u8 idle_candidate;     // the previous block is jumped back to its own start
+    u64 side_effect_count; // the memory writes and the port outputs
+    u64 idle_skip_count;
+    u64 skipped_cycles;
 
     // Options
+    const CPU_Model *model; // the opcodes, the alu and the cycles of the emulated cpu, the reset() sets the 8086 if NULL
     u8 dump_out;
     u8 decode_only;
     u8 hide_inst_mem_addr;
     u8 show_raw_bin;
     u8 debug_mode;
+    u8 idle_skip;           // the idle loops are fast-forwarded to the next interrupt (or to the limits)
+
+    Debug_Info *debug_info; // NULL if the --symbols is not set or the tables are not found
+
+    u8 predecode;           // the load_program() builds the code_map
+    Code_Map *code_map;     // the pre-decoded instructions and the CFG of the loaded image, NULL if it's not built
+
+    // Every trace of the decoder and the execution goes here, NULL means quiet. There is no other global output,
+    // so more CPU can run on more threads at the same time.
+    FILE *trace;
+
+    Trace_Writer *trace_writer; // the binary trace (--trace_file), NULL if it's not recorded
+    History *history;           // the execution history of the reverse debugging, NULL if it's not recorded
+    Breakpoints *breakpoints;   // the breakpoints and the watchpoints of the debugger, NULL without the debugger
+    Hle *hle;                   // the natively run BIOS and DOS services, NULL without the --hle
+    Graphics *graphics;         // the window of the video memory, NULL = headless (see the graphics.h)
 
     FILE *out; // @Debug
 
 } CPU;
 
 #define REG_ACCUMULATOR 0
+#define REG_STACK_POINTER 4
 Register_Access *register_access(u32 reg, u32 flags);
 Register_Access *register_access_by_enum(Register reg);
 
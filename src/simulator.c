@@ -1,21 +1,18 @@
 #include "simulator.h"
 #include "decoder.h"
 #include "printer.h"
+#include "code_map.h"
+#include "trace.h"
+#include "history.h"
+#include "breakpoints.h"
+#include "alu.h"
+#include "cpu_model.h"
+#include "graphics.h"
 
 #include <time.h>
 #include <sys/timeb.h>
 #include <memory.h>
 
-#ifdef GRAPHICS_ENABLED
-
-#include "SDL.h"
-#define VIDEO_RAM_SIZE 0x10000
-#define GRAPHICS_UPDATE_DELAY 360000
-
-#endif
-
-#define SIGN_BIT(__wide) (__wide ? (1 << 15) : (1 << 7))
-#define MASK_BY_WIDTH(__wide) (__wide ? 0xffff : 0xff)
 #define SEGMENT_MASK 0xFFFFF // 20bit
 
 // @Cleanup: remove this register_access mess
@@ -23,8 +20,7 @@ u16 get_data_from_register(CPU *cpu, Register_Access *src_reg)
 {
     u16 index = src_reg->index;
     if (src_reg->size == 2) {
-        u16 data = *(u16 *)(cpu->regmem+index);
-        return BYTE_SWAP(data);
+        return *(u16 *)(cpu->regmem+index);
     }
 
     return cpu->regmem[index];
@@ -35,11 +31,11 @@ void set_data_to_register(CPU *cpu, Register_Access *dest_reg, u16 data)
 {
     // @Debug
     u16 current_data = get_data_from_register(cpu, dest_reg);
-    printf(" \n\t\t@%s: %#02x -> %#02x ", register_name(dest_reg->reg), current_data, data);
+    TRACE(cpu, " \n\t\t@%s: %#02x -> %#02x ", register_name(dest_reg->reg), current_data, data);
 
     u16 index = dest_reg->index;
     if (dest_reg->size == 2) {
-        *(u16 *)(cpu->regmem+index) = BYTE_SWAP(data);
+        *(u16 *)(cpu->regmem+index) = data;
         return;
     }
 
@@ -52,17 +48,10 @@ void set_data_to_register(CPU *cpu, Register_Access *dest_reg, u16 data)
 #define set_to_register(_cpu, _reg_enum, _data) \
     set_data_to_register(_cpu, register_access_by_enum(_reg_enum), _data)
 
-u32 calc_absolute_memory_address(CPU *cpu, Effective_Address_Expression *expr)
+// The 16 bit offset of the effective address (the lea), without the segment
+u16 calc_effective_address(CPU *cpu, Effective_Address_Expression *expr)
 {
     u16 address = 0;
-    u16 segment = expr->segment; // This a constant segment value like in the asm: jmp 5312:2891
-    u32 mask = 0xFFFF; // 16bit mask
-
-    Register extended_with_this_segment_reg = cpu->instruction.extend_with_this_segment;
-    if ((cpu->instruction.flags & Inst_Segment) && extended_with_this_segment_reg != Register_none) {
-        segment = get_from_register(cpu, extended_with_this_segment_reg);
-        mask = SEGMENT_MASK;
-    }
 
     switch (expr->base) {
         case Effective_Address_direct:
@@ -107,7 +96,23 @@ u32 calc_absolute_memory_address(CPU *cpu, Effective_Address_Expression *expr)
             assert(0);
     }
 
-    u32 result = ((segment << 4) + address + expr->displacement) & mask;
+    return address + expr->displacement;
+}
+
+// The segment is the prefix of the instruction, otherwise the ss for the bp based addresses and the ds for the rest
+u32 calc_absolute_memory_address(CPU *cpu, Effective_Address_Expression *expr)
+{
+    u16 address = calc_effective_address(cpu, expr);
+
+    Register segment_reg = cpu->instruction.extend_with_this_segment;
+    if (!(cpu->instruction.flags & Inst_Segment) || segment_reg == Register_none) {
+        u8 is_bp_based = expr->base == Effective_Address_bp || expr->base == Effective_Address_bp_si ||
+                         expr->base == Effective_Address_bp_di;
+        segment_reg = is_bp_based ? Register_ss : Register_ds;
+    }
+    u16 segment = get_from_register(cpu, segment_reg);
+
+    u32 result = ((segment << 4) + address) & SEGMENT_MASK;
 
     //printf("\n\t\t*[%#02x]", result);
     return result;
@@ -144,16 +149,26 @@ u32 calc_segment_address_with_absolute_offset(CPU *cpu, Register segment_reg, u1
     return (((segment << 4) + offset)) & SEGMENT_MASK;
 }
 
+// Without the watchpoint check, the address is already masked
+static u16 read_memory(CPU *cpu, u32 address)
+{
+    // The words are little endian and can be at an odd address
+    if (cpu->instruction.flags & Inst_Wide) {
+        return BYTE_LOHI_TO_HILO(cpu->memory[address], cpu->memory[address+1]);
+    }
+
+    return cpu->memory[address];
+}
+
 u16 get_data_from_memory(CPU *cpu, u32 address)
 {
     address = address & SEGMENT_MASK;
 
-    if (cpu->instruction.flags & Inst_Wide) {
-        u16 data = *(u16 *)(cpu->memory+address);
-        return BYTE_SWAP(data);
+    if (cpu->breakpoints) {
+        check_watchpoints(cpu->breakpoints, address, (cpu->instruction.flags & Inst_Wide) ? 2 : 1, Watch_Read);
     }
 
-    return cpu->memory[address];
+    return read_memory(cpu, address);
 }
 
 void set_data_to_memory(CPU *cpu, u32 address, u16 data)
@@ -161,11 +176,24 @@ void set_data_to_memory(CPU *cpu, u32 address, u16 data)
     address = address & SEGMENT_MASK; 
     
     // @Todo: @Debug: Print out the memory address in this format 0000:0xFFF, so with the segment and the offset
-    u16 current_data = get_data_from_memory(cpu, address); // @Debug
-    printf("\n\t\t[%d]: %#02x -> %#02x", address, current_data, data);
+    u16 current_data = read_memory(cpu, address); // @Debug
+    TRACE(cpu, "\n\t\t[%d]: %#02x -> %#02x", address, current_data, data);
+
+    invalidate_code(cpu->code_map, address, (cpu->instruction.flags & Inst_Wide) ? 2 : 1);
+    cpu->side_effect_count++;
+    if (cpu->breakpoints) {
+        check_watchpoints(cpu->breakpoints, address, (cpu->instruction.flags & Inst_Wide) ? 2 : 1, Watch_Write);
+    }
+    if (cpu->history) {
+        history_memory_write(cpu->history, cpu, address, (cpu->instruction.flags & Inst_Wide) ? 2 : 1);
+    }
+    if (cpu->trace_writer) {
+        trace_memory_write(cpu->trace_writer, address, data, cpu->instruction.flags & Inst_Wide);
+    }
 
     if (cpu->instruction.flags & Inst_Wide) {
-        *(u16 *)(cpu->memory+address) = BYTE_SWAP(data);
+        cpu->memory[address] = data & 0xFF;
+        cpu->memory[address+1] = data >> 8;
         return;
     }
 
@@ -202,11 +230,32 @@ void set_to_operand(CPU *cpu, Instruction_Operand *op, u16 data)
         set_data_to_memory(cpu, address, data);
     }
     else {
-        printf("\n[ERROR]: How do you wannna put value in the immediate?\n");
-        assert(0);
+        TRACE(cpu, "\n[ERROR]: How do you wannna put value in the immediate?\n");
+        cpu->terminate = 1;
+        cpu->block_end = 1;
+        cpu->exit_reason = Exit_Reason_Unhandled_Instruction;
     }
 }
 
+// The stack and the interrupt vectors are words, whatever the width of the current instruction is (the int, the
+// hlt and the scheduled interrupt are byte instructions)
+static u16 get_word_from_memory(CPU *cpu, u32 address)
+{
+    u32 flags = cpu->instruction.flags;
+    cpu->instruction.flags |= Inst_Wide;
+    u16 data = get_data_from_memory(cpu, address);
+    cpu->instruction.flags = flags;
+    return data;
+}
+
+static void set_word_to_memory(CPU *cpu, u32 address, u16 data)
+{
+    u32 flags = cpu->instruction.flags;
+    cpu->instruction.flags |= Inst_Wide;
+    set_data_to_memory(cpu, address, data);
+    cpu->instruction.flags = flags;
+}
+
 void stack_push(CPU *cpu, u16 data)
 {
     u16 sp_val = get_from_register(cpu, Register_sp);
@@ -214,13 +263,13 @@ void stack_push(CPU *cpu, u16 data)
     set_to_register(cpu, Register_sp, sp_val);
 
     u32 absolute_address = calc_stack_pointer_address(cpu);
-    set_data_to_memory(cpu, absolute_address, data);
+    set_word_to_memory(cpu, absolute_address, data);
 }
 
 u16 stack_pop(CPU *cpu)
 {
     u32 absolute_address = calc_stack_pointer_address(cpu);
-    u16 data = get_data_from_memory(cpu, absolute_address);
+    u16 data = get_word_from_memory(cpu, absolute_address);
 
     u16 sp_val = get_from_register(cpu, Register_sp);
     sp_val += 2;
@@ -241,7 +290,7 @@ void stack_pop_flags(CPU *cpu)
     cpu->flags = 0;
     cpu->flags |= stack_pop(cpu);
 
-    print_out_formated_flags(old_flags, cpu->flags);
+    print_out_formated_flags(cpu, old_flags, cpu->flags);
 }
 
 void execute_interrupt(CPU *cpu, u16 interrupt_type)
@@ -254,60 +303,491 @@ void execute_interrupt(CPU *cpu, u16 interrupt_type)
     // The interrupt pointer address is 4 byte, the first 2 byte refer to the offset (ip)
     // and the remained 2 byte is the segment (cs) of the address.
     u16 interrupt_address = interrupt_type * 4;
-    u16 ip_val = get_data_from_memory(cpu, interrupt_address);
-    u16 cs_val = get_data_from_memory(cpu, interrupt_address+2);
+    u16 ip_val = get_word_from_memory(cpu, interrupt_address);
+    u16 cs_val = get_word_from_memory(cpu, interrupt_address+2);
 
     cpu->ip = ip_val;
     set_to_register(cpu, Register_cs, cs_val);
 }
 
-void update_parity_flag(CPU *cpu, u32 result)
+// The exceptions are the interrupts of the cpu (the divide error, the bound and the invalid opcode of the 80186).
+// Without a handler (the vector is 0:0, nothing has set it up) the run is stopped at the instruction instead, then
+// 0 is returned. Otherwise the cpu->ip is the handler.
+static u8 raise_exception(CPU *cpu, u8 interrupt_type, u16 return_ip, Exit_Reason exit_reason)
 {
-    cpu->flags &= ~(F_PARITY);
+    u16 vector = interrupt_type * 4;
+    if (get_word_from_memory(cpu, vector) == 0 && get_word_from_memory(cpu, vector + 2) == 0) {
+        cpu->terminate = 1;
+        cpu->block_end = 1;
+        cpu->exit_reason = exit_reason;
+        return 0;
+    }
 
-    u8 ones = 0;
-    u8 size = (cpu->instruction.flags & Inst_Wide) ? 16 : 8;
-    for (u8 i = 0; i < size; i++) {
-        if (result & (1<<i)) ones++;
+    cpu->ip = return_ip;
+    execute_interrupt(cpu, interrupt_type);
+    cpu->block_end = 1;
+    return 1;
+}
+
+static void print_changed_flags(CPU *cpu, u16 flags_before)
+{
+    if (cpu->flags != flags_before) {
+        print_out_formated_flags(cpu, flags_before, cpu->flags);
+    }
+}
+
+// The far pointer of the jmp far, the call far, the lds and the les: the immediate segment:offset (the Ap operand),
+// or the offset then the segment at the memory operand
+static void load_far_pointer(CPU *cpu, Instruction_Operand *op, u16 *segment, u16 *offset)
+{
+    Instruction *i = &cpu->instruction;
+    if ((i->flags & Inst_Segment) && i->extend_with_this_segment == Register_none) {
+        *segment = op->address.segment;
+        *offset  = op->address.displacement;
+        return;
     }
 
-    cpu->flags |= ((ones % 2) == 0) ? F_PARITY : 0;
+    u32 address = calc_absolute_memory_address(cpu, &op->address);
+    *offset  = get_word_from_memory(cpu, address);
+    *segment = get_word_from_memory(cpu, address + 2);
 }
 
-void update_common_flags(CPU *cpu, u32 result)
+// The condition of the conditional jumps by the flags
+static u8 jump_condition(Mnemonic mnemonic, u16 flags)
 {
-    u8 is_wide = cpu->instruction.flags & Inst_Wide;
-    u32 sign_bit = SIGN_BIT(is_wide);
+    u8 CF = !!(flags & F_CARRY);
+    u8 PF = !!(flags & F_PARITY);
+    u8 ZF = !!(flags & F_ZERO);
+    u8 SF = !!(flags & F_SIGNED);
+    u8 OF = !!(flags & F_OVERFLOW);
+
+    switch (mnemonic) {
+        case Mnemonic_jo:  return OF;
+        case Mnemonic_jno: return !OF;
+        case Mnemonic_jb:  return CF;
+        case Mnemonic_jnb: return !CF;
+        case Mnemonic_jz:  return ZF;
+        case Mnemonic_jnz: return !ZF;
+        case Mnemonic_jbe: return CF | ZF;
+        case Mnemonic_ja:  return !(CF | ZF);
+        case Mnemonic_js:  return SF;
+        case Mnemonic_jns: return !SF;
+        case Mnemonic_jp:  return PF;
+        case Mnemonic_jnp: return !PF;
+        case Mnemonic_jl:  return SF ^ OF;
+        case Mnemonic_jnl: return !(SF ^ OF);
+        case Mnemonic_jle: return (SF ^ OF) | ZF;
+        case Mnemonic_jg:  return !((SF ^ OF) | ZF);
+        default:           return 0;
+    }
+}
 
-    cpu->flags &= (~(F_SIGNED|F_ZERO));
+// :IO
+// There is no device behind the ports yet, the reads are the open bus (all bits set), which never changes.
+// @Todo: A device whose state changes with the time (e.g. the counter of the 8253) has to count its reads
+// in the cpu->side_effect_count, otherwise the loop which polls it is skipped as an idle loop.
+static u16 read_port(CPU *cpu, u16 port)
+{
+    return 0xFFFF;
+}
 
-    cpu->flags |= (result & sign_bit ? F_SIGNED : 0);
-    cpu->flags |= (result & MASK_BY_WIDTH(is_wide)) == 0 ? F_ZERO : 0;
+static void write_port(CPU *cpu, u16 port, u16 data)
+{
+    cpu->side_effect_count++;
 
-    update_parity_flag(cpu, result);
+    // @Debug
+    if (cpu->out) {
+        fprintf(cpu->out, "%d : %d\n", port, data);
+    }
+
+    if (cpu->stop_at_port && port == cpu->stop_port) {
+        cpu->terminate = 1;
+        cpu->block_end = 1;
+        cpu->exit_reason = Exit_Reason_Stop_Port;
+    }
 }
 
-void update_log_flags(CPU *cpu, u32 result)
+// movs, cmps, scas, lods, stos (and the ins, outs of the 80186) with the rep prefixes. The port of the ins and the
+// outs is the dx. The source is the ds:si (the segment prefix replaces the ds),
+// the destination is the es:di. Returns the number of the executed repeats (1 without the prefix).
+// @Incomplete: The 8086 takes the interrupts between the repeats, here the whole rep is one instruction.
+static u32 execute_string_instruction(CPU *cpu, Instruction *i, u8 is_wide)
 {
-    cpu->flags &= (~(F_OVERFLOW|F_CARRY|F_AUXILIARY));
-    update_common_flags(cpu, result);
+    u8 repeat = (i->flags & (Inst_Repz|Inst_Repnz)) != 0;
+    u16 cx = repeat ? get_from_register(cpu, Register_cx) : 1;
+
+    u16 step = is_wide ? 2 : 1;
+    if (cpu->flags & F_DIRECTION) step = -step;
+
+    Register source_segment = Register_ds;
+    if ((i->flags & Inst_Segment) && i->extend_with_this_segment != Register_none) {
+        source_segment = i->extend_with_this_segment;
+    }
+    Register accumulator = is_wide ? Register_ax : Register_al;
+    Alu_Binary_Function *compare = cpu->model->alu_binary_functions[Mnemonic_cmp][is_wide];
+
+    u16 flags_before = cpu->flags;
+    u32 count = 0;
+
+    while (cx != 0) {
+        u32 source      = calc_segment_address_with_register_offset(cpu, source_segment, Register_si);
+        u32 destination = calc_segment_address_with_register_offset(cpu, Register_es, Register_di);
+        u8 uses_si = 1;
+        u8 uses_di = 1;
+        u8 is_compare = 0;
+
+        switch (i->mnemonic) {
+            case Mnemonic_movsb:
+            case Mnemonic_movsw: {
+                set_data_to_memory(cpu, destination, get_data_from_memory(cpu, source));
+                break;
+            }
+            case Mnemonic_cmpsb:
+            case Mnemonic_cmpsw: {
+                compare(get_data_from_memory(cpu, source), get_data_from_memory(cpu, destination), &cpu->flags);
+                is_compare = 1;
+                break;
+            }
+            case Mnemonic_scasb:
+            case Mnemonic_scasw: {
+                compare(get_from_register(cpu, accumulator), get_data_from_memory(cpu, destination), &cpu->flags);
+                uses_si = 0;
+                is_compare = 1;
+                break;
+            }
+            case Mnemonic_lodsb:
+            case Mnemonic_lodsw: {
+                set_to_register(cpu, accumulator, get_data_from_memory(cpu, source));
+                uses_di = 0;
+                break;
+            }
+            case Mnemonic_stosb:
+            case Mnemonic_stosw: {
+                set_data_to_memory(cpu, destination, get_from_register(cpu, accumulator));
+                uses_si = 0;
+                break;
+            }
+            case Mnemonic_insb:
+            case Mnemonic_insw: {
+                set_data_to_memory(cpu, destination, read_port(cpu, get_from_register(cpu, Register_dx)));
+                uses_si = 0;
+                break;
+            }
+            case Mnemonic_outsb:
+            case Mnemonic_outsw: {
+                write_port(cpu, get_from_register(cpu, Register_dx), get_data_from_memory(cpu, source));
+                uses_di = 0;
+                break;
+            }
+            default: {
+                assert(0);
+            }
+        }
+
+        if (uses_si) set_to_register(cpu, Register_si, get_from_register(cpu, Register_si) + step);
+        if (uses_di) set_to_register(cpu, Register_di, get_from_register(cpu, Register_di) + step);
+
+        cx -= 1;
+        count += 1;
+
+        // The repe stops at the first difference, the repne at the first match
+        if (repeat && is_compare && !!(cpu->flags & F_ZERO) != !!(i->flags & Inst_Repz)) {
+            break;
+        }
+    }
+
+    if (repeat) {
+        set_to_register(cpu, Register_cx, cx);
+    }
+    print_changed_flags(cpu, flags_before);
+
+    return count;
 }
 
-void update_arith_flags(CPU *cpu, u32 result, u32 OF, u32 AF)
+// Effective address calculation time (8086 manual, table 2-20), the segment override costs +2
+u32 effective_address_cycles(Instruction *i, Instruction_Operand *op)
 {
-    u32 flags_before = cpu->flags;
+    if (op->type != Operand_Memory) return 0;
 
-    u32 sign_bit = SIGN_BIT(cpu->instruction.flags & Inst_Wide);
-    u32 CF = result & (sign_bit << 1);
+    u32 cycles = 0;
+    u8 has_displacement = op->address.displacement != 0;
 
-    cpu->flags &= (~(F_CARRY|F_OVERFLOW|F_AUXILIARY));
-    cpu->flags |= CF ? F_CARRY : 0;
-    cpu->flags |= OF ? F_OVERFLOW : 0;
-    cpu->flags |= AF ? F_AUXILIARY : 0;
+    switch (op->address.base) {
+        case Effective_Address_direct: cycles = 6; break;
+        case Effective_Address_si:
+        case Effective_Address_di:
+        case Effective_Address_bp:
+        case Effective_Address_bx:     cycles = has_displacement ? 9 : 5; break;
+        case Effective_Address_bp_di:
+        case Effective_Address_bx_si:  cycles = has_displacement ? 11 : 7; break;
+        case Effective_Address_bp_si:
+        case Effective_Address_bx_di:  cycles = has_displacement ? 12 : 8; break;
+    }
 
-    update_common_flags(cpu, result);
+    if ((i->flags & Inst_Segment) && i->extend_with_this_segment != Register_none) {
+        cycles += 2;
+    }
 
-    print_out_formated_flags(flags_before, cpu->flags);
+    return cycles;
+}
+
+// Estimates the clock cycles of the executed instruction based on the 8086 manual (table 2-21). The memory
+// operands include the effective address time. Unknown instructions are counted as 4 cycles.
+// @Incomplete: The +4 cycles of the word transfers at odd addresses are not counted.
+u32 estimate_instruction_cycles(CPU *cpu, Instruction *i, u8 branch_taken, u32 repeat_count)
+{
+    Instruction_Operand *left  = &i->operands[0];
+    Instruction_Operand *right = &i->operands[1];
+
+    u8 left_mem  = left->type == Operand_Memory;
+    u8 right_mem = right->type == Operand_Memory;
+    u8 right_imm = right->type == Operand_Immediate;
+    u8 left_acc  = left->type == Operand_Register && left->reg == REG_ACCUMULATOR && !(left->flags & Inst_Segment);
+    u8 is_wide   = (i->flags & Inst_Wide) ? 1 : 0;
+
+    u32 ea = effective_address_cycles(i, left) + effective_address_cycles(i, right);
+
+    switch (i->mnemonic) {
+        case Mnemonic_mov: {
+            // The accumulator <-> direct address forms (A0-A3) have no EA time
+            if ((left_acc && right_mem && right->address.base == Effective_Address_direct) ||
+                (left_mem && left->address.base == Effective_Address_direct && right->type == Operand_Register &&
+                 right->reg == REG_ACCUMULATOR && !(right->flags & Inst_Segment))) {
+                return 10;
+            }
+            if (left_mem)  return (right_imm ? 10 : 9) + ea;
+            if (right_mem) return 8 + ea;
+            if (right_imm) return 4;
+            return 2;
+        }
+        case Mnemonic_add:
+        case Mnemonic_adc:
+        case Mnemonic_sub:
+        case Mnemonic_sbb:
+        case Mnemonic_and:
+        case Mnemonic_or:
+        case Mnemonic_xor: {
+            if (left_mem)  return (right_imm ? 17 : 16) + ea;
+            if (right_mem) return 9 + ea;
+            if (right_imm) return 4;
+            return 3;
+        }
+        case Mnemonic_cmp: {
+            if (left_mem)  return (right_imm ? 10 : 9) + ea;
+            if (right_mem) return 9 + ea;
+            if (right_imm) return 4;
+            return 3;
+        }
+        case Mnemonic_test: {
+            if (left_mem)  return (right_imm ? 11 : 9) + ea;
+            if (right_mem) return 9 + ea;
+            if (right_imm) return left_acc ? 4 : 5;
+            return 3;
+        }
+        case Mnemonic_inc:
+        case Mnemonic_dec: {
+            if (left_mem) return 15 + ea;
+            return is_wide ? 2 : 3;
+        }
+        case Mnemonic_not:
+        case Mnemonic_neg: {
+            return left_mem ? 16 + ea : 3;
+        }
+        // The shift count of the cl (or of the byte immediate of the 80186) is in the repeat_count
+        case Mnemonic_shl: case Mnemonic_shr: case Mnemonic_sar:
+        case Mnemonic_rol: case Mnemonic_ror: case Mnemonic_rcl: case Mnemonic_rcr: {
+            if (right->type == Operand_Register || repeat_count > 1) return (left_mem ? 20 + ea : 8) + 4*repeat_count;
+            return left_mem ? 15 + ea : 2;
+        }
+        // The multiply and the divide times depend on the operands, these are the minimums
+        case Mnemonic_mul: {
+            return (is_wide ? 118 : 70) + (left_mem ? 6 + ea : 0);
+        }
+        case Mnemonic_imul: {
+            return (is_wide ? 128 : 80) + (left_mem ? 6 + ea : 0);
+        }
+        case Mnemonic_div: {
+            return (is_wide ? 144 : 80) + (left_mem ? 6 + ea : 0);
+        }
+        case Mnemonic_idiv: {
+            return (is_wide ? 165 : 101) + (left_mem ? 6 + ea : 0);
+        }
+        case Mnemonic_cbw:  return 2;
+        case Mnemonic_cwd:  return 5;
+        case Mnemonic_daa:
+        case Mnemonic_das:  return 4;
+        case Mnemonic_aaa:
+        case Mnemonic_aas:  return 8;
+        case Mnemonic_aam:  return 83;
+        case Mnemonic_aad:  return 60;
+        case Mnemonic_xchg: {
+            if (left_mem || right_mem) return 17 + ea;
+            return i->size == 1 ? 3 : 4; // the short form is with the ax
+        }
+        case Mnemonic_lea:  return 2 + ea;
+        case Mnemonic_lds:
+        case Mnemonic_les:  return 16 + ea;
+        case Mnemonic_xlat: return 11;
+        case Mnemonic_lahf:
+        case Mnemonic_sahf: return 4;
+        case Mnemonic_jmp: {
+            if (i->flags & Inst_Far) return left_mem && !(i->flags & Inst_Segment) ? 24 + ea : 15;
+            if (left_mem) return 18 + ea;
+            return left->type == Operand_Register ? 11 : 15;
+        }
+        case Mnemonic_call: {
+            if (i->flags & Inst_Far) return left_mem && !(i->flags & Inst_Segment) ? 37 + ea : 28;
+            if (left_mem) return 21 + ea;
+            return left->type == Operand_Register ? 16 : 19;
+        }
+        case Mnemonic_ret:  return left->type == Operand_Immediate ? 12 : 8;
+        case Mnemonic_retf: return left->type == Operand_Immediate ? 17 : 18;
+        case Mnemonic_jo: case Mnemonic_jno: case Mnemonic_jb: case Mnemonic_jnb:
+        case Mnemonic_jz: case Mnemonic_jnz: case Mnemonic_jbe: case Mnemonic_ja:
+        case Mnemonic_js: case Mnemonic_jns: case Mnemonic_jp: case Mnemonic_jnp:
+        case Mnemonic_jl: case Mnemonic_jnl: case Mnemonic_jle: case Mnemonic_jg: {
+            return branch_taken ? 16 : 4;
+        }
+        case Mnemonic_loop:   return branch_taken ? 17 : 5;
+        case Mnemonic_loopz:  return branch_taken ? 18 : 6;
+        case Mnemonic_loopnz: return branch_taken ? 19 : 5;
+        case Mnemonic_jcxz:   return branch_taken ? 18 : 6;
+        case Mnemonic_push: {
+            if (left_mem) return 16 + ea;
+            if (left->type == Operand_Immediate) return 10; // 80186
+            return (left->flags & Inst_Segment) ? 10 : 11;
+        }
+        case Mnemonic_pop: {
+            return left_mem ? 17 + ea : 8;
+        }
+        case Mnemonic_pushf: return 10;
+        case Mnemonic_popf:  return 8;
+        case Mnemonic_int:   return 51;
+        case Mnemonic_into:  return branch_taken ? 53 : 4;
+        case Mnemonic_iret:  return 24;
+        case Mnemonic_movsb:
+        case Mnemonic_movsw: {
+            if (i->flags & (Inst_Repz|Inst_Repnz)) return 9 + 17*repeat_count;
+            return 18;
+        }
+        case Mnemonic_cmpsb:
+        case Mnemonic_cmpsw: {
+            if (i->flags & (Inst_Repz|Inst_Repnz)) return 9 + 22*repeat_count;
+            return 22;
+        }
+        case Mnemonic_scasb:
+        case Mnemonic_scasw: {
+            if (i->flags & (Inst_Repz|Inst_Repnz)) return 9 + 15*repeat_count;
+            return 15;
+        }
+        case Mnemonic_lodsb:
+        case Mnemonic_lodsw: {
+            if (i->flags & (Inst_Repz|Inst_Repnz)) return 9 + 13*repeat_count;
+            return 12;
+        }
+        case Mnemonic_stosb:
+        case Mnemonic_stosw: {
+            if (i->flags & (Inst_Repz|Inst_Repnz)) return 9 + 10*repeat_count;
+            return 11;
+        }
+        // The instructions of the 80186 (80186 manual, the effective address is included)
+        case Mnemonic_pusha: return 36;
+        case Mnemonic_popa:  return 51;
+        case Mnemonic_bound: return 33;
+        case Mnemonic_imul_imm: return right_mem ? 29 : 22;
+        case Mnemonic_enter: {
+            u32 level = right->immediate & 0x1F;
+            if (level == 0) return 15;
+            return level == 1 ? 25 : 22 + 16*(level - 1);
+        }
+        case Mnemonic_leave: return 8;
+        case Mnemonic_insb:  case Mnemonic_insw:
+        case Mnemonic_outsb: case Mnemonic_outsw: {
+            if (i->flags & (Inst_Repz|Inst_Repnz)) return 8 + 8*repeat_count;
+            return 14;
+        }
+        case Mnemonic_in:    return right->type == Operand_Immediate ? 10 : 8;
+        case Mnemonic_out:   return 8;
+        case Mnemonic_hlt:   return 2;
+        case Mnemonic_nop:
+        case Mnemonic_wait:  return 3;
+        case Mnemonic_clc: case Mnemonic_cmc: case Mnemonic_stc:
+        case Mnemonic_cld: case Mnemonic_std: case Mnemonic_cli: case Mnemonic_sti: {
+            return 2;
+        }
+        default: {
+            return 4;
+        }
+    }
+}
+
+// The word transfers of the memory and the stack (8086 manual, the "transfers" column of the table 2-21). The
+// string instructions are repeated repeat_count times.
+static u32 count_word_transfers(Instruction *i, u8 branch_taken, u32 repeat_count)
+{
+    Instruction_Operand *left  = &i->operands[0];
+    Instruction_Operand *right = &i->operands[1];
+
+    u8 left_mem = left->type == Operand_Memory;
+    u8 is_wide  = (i->flags & Inst_Wide) ? 1 : 0;
+    u32 memory  = (left_mem || right->type == Operand_Memory) ? is_wide : 0; // one word operand in the memory
+
+    switch (i->mnemonic) {
+        // The memory destination is read and written
+        case Mnemonic_add: case Mnemonic_adc: case Mnemonic_sub: case Mnemonic_sbb:
+        case Mnemonic_and: case Mnemonic_or:  case Mnemonic_xor: case Mnemonic_inc:
+        case Mnemonic_dec: case Mnemonic_not: case Mnemonic_neg:
+        case Mnemonic_shl: case Mnemonic_shr: case Mnemonic_sar:
+        case Mnemonic_rol: case Mnemonic_ror: case Mnemonic_rcl: case Mnemonic_rcr: {
+            return left_mem ? 2*is_wide : memory;
+        }
+        case Mnemonic_xchg: return 2*memory;
+        case Mnemonic_mov:  case Mnemonic_cmp: case Mnemonic_test:
+        case Mnemonic_mul:  case Mnemonic_imul:
+        case Mnemonic_div:  case Mnemonic_idiv: case Mnemonic_imul_imm: {
+            return memory;
+        }
+        case Mnemonic_lds:
+        case Mnemonic_les:   return 2;
+        case Mnemonic_push:
+        case Mnemonic_pop:   return left_mem ? 2 : 1;
+        case Mnemonic_pushf:
+        case Mnemonic_popf:  return 1;
+        case Mnemonic_jmp: {
+            if (!left_mem || (i->flags & Inst_Segment)) return 0;
+            return (i->flags & Inst_Far) ? 2 : 1;
+        }
+        case Mnemonic_call: {
+            if (i->flags & Inst_Far) return left_mem && !(i->flags & Inst_Segment) ? 4 : 2;
+            return left_mem ? 2 : 1;
+        }
+        case Mnemonic_ret:   return 1;
+        case Mnemonic_retf:  return 2;
+        case Mnemonic_int:   return 5;
+        case Mnemonic_into:  return branch_taken ? 5 : 0;
+        case Mnemonic_iret:  return 3;
+        case Mnemonic_movsw:
+        case Mnemonic_cmpsw: return 2*repeat_count;
+        case Mnemonic_scasw: case Mnemonic_lodsw: case Mnemonic_stosw:
+        case Mnemonic_insw:  case Mnemonic_outsw: {
+            return repeat_count;
+        }
+        case Mnemonic_pusha:
+        case Mnemonic_popa:  return 8;
+        case Mnemonic_bound: return 2;
+        case Mnemonic_enter: {
+            u32 level = right->immediate & 0x1F;
+            return level ? 2*level : 1;
+        }
+        case Mnemonic_leave: return 1;
+        default:             return 0;
+    }
+}
+
+// The 8088 is the 8086 with an 8-bit data bus, every word transfer takes two bus cycles (+4 clocks)
+u32 estimate_8088_cycles(CPU *cpu, Instruction *i, u8 branch_taken, u32 repeat_count)
+{
+    return estimate_instruction_cycles(cpu, i, branch_taken, repeat_count) + 4*count_word_transfers(i, branch_taken, repeat_count);
 }
 
 void execute_instruction(CPU *cpu)
@@ -318,195 +798,273 @@ void execute_instruction(CPU *cpu)
     Instruction_Operand *left_op  = &i->operands[0];
     Instruction_Operand *right_op = &i->operands[1];
 
-    s32 left_val  = get_from_operand(cpu, left_op);
-    s32 right_val = get_from_operand(cpu, right_op);
+    // The operands which are not read are not fetched, so they don't hit the read watchpoints: the destination of the
+    // mov and the pop is only written, the lea only computes the address (the les and the lds read the far pointer
+    // by the load_far_pointer())
+    u8 left_is_read  = i->mnemonic != Mnemonic_mov && i->mnemonic != Mnemonic_pop;
+    u8 right_is_read = i->mnemonic != Mnemonic_lea && i->mnemonic != Mnemonic_les && i->mnemonic != Mnemonic_lds;
 
-    u32 sign_bit = SIGN_BIT(is_wide);
-    u32 mask = MASK_BY_WIDTH(is_wide);
+    u16 left_val  = left_is_read  ? get_from_operand(cpu, left_op)  : 0;
+    u16 right_val = right_is_read ? get_from_operand(cpu, right_op) : 0;
 
     // @Debug
     u32 ip_before = cpu->ip;
     u32 ip_after  = cpu->ip;
 
+    u32 repeat_count = 0; // for the cycle estimation of the repeated string instructions and the shifts by the cl
+    u8 divide_error = 0;
+
     switch (i->mnemonic) {
-        // :Arithmatic
         case Mnemonic_mov: {
             set_to_operand(cpu, left_op, right_val);
             break;
         }
-        case Mnemonic_add: {
-            u32 result = (left_val & mask) + (right_val & mask);
-
-            u32 OF = (~(left_val ^ right_val) & (left_val ^ result)) & sign_bit;
-
-            // This is the same as above, just "unpacked" for visibility purpose
-            // u32 OF = 0;
-            // if ((left_val & sign_bit) == (right_val & sign_bit)) {
-            //    // The commented out part with /**/ is not required, because we already know at this point that the left and right
-            //    // sign extension the same
-            //    if ((left_val & sign_bit) != (result & sign_bit) /*&& (right_val & sign_bit) != (result & sign_bit)*/) {
-            //        OF = 1;
-            //    }
-            // }
-
-            u32 AF = ((left_val & 0xf) + (right_val & 0xf)) & 0x10;
-
-            update_arith_flags(cpu, result, OF, AF);
-            set_to_operand(cpu, left_op, result);
-
-            break;
-        }
-        case Mnemonic_sub: {
-            u32 result = left_val - right_val;
+        // :Arithmatic :Logical :Shift :Rotate
+        // The byte or the word version of the operation is picked by the width, see the alu.h
+        case Mnemonic_add: case Mnemonic_adc: case Mnemonic_sub: case Mnemonic_sbb:
+        case Mnemonic_inc: case Mnemonic_dec: case Mnemonic_neg: case Mnemonic_not:
+        case Mnemonic_and: case Mnemonic_or:  case Mnemonic_xor:
+        case Mnemonic_shl: case Mnemonic_shr: case Mnemonic_sar:
+        case Mnemonic_rol: case Mnemonic_ror: case Mnemonic_rcl: case Mnemonic_rcr: {
+            u16 flags_before = cpu->flags;
+            u16 result = cpu->model->alu_binary_functions[i->mnemonic][is_wide](left_val, right_val, &cpu->flags);
             set_to_operand(cpu, left_op, result);
+            print_changed_flags(cpu, flags_before);
 
-            u32 OF = ((left_val ^ right_val) & (left_val ^ result)) & sign_bit;
-            u32 AF = ((left_val & 0xf) - (right_val & 0xf)) & 0x10;
-
-            update_arith_flags(cpu, result, OF, AF);
-
+            if (right_op->type != Operand_None) {
+                repeat_count = right_val & 0xFF; // the shift count of the cl (or of the immediate)
+            }
             break;
         }
-        case Mnemonic_cmp: {
-            u32 result = left_val - right_val;
-
-            u32 OF = ((left_val ^ right_val) & (left_val ^ result)) & sign_bit;
-            u32 AF = ((left_val & 0xf) - (right_val & 0xf)) & 0x10;
-            update_arith_flags(cpu, result, OF, AF);
-
+        case Mnemonic_cmp:
+        case Mnemonic_test: {
+            u16 flags_before = cpu->flags;
+            cpu->model->alu_binary_functions[i->mnemonic][is_wide](left_val, right_val, &cpu->flags);
+            print_changed_flags(cpu, flags_before);
             break;
         }
-        case Mnemonic_div: {
-            u16 divisior = left_val;
-            
-            if (divisior == 0) {
-                // @Todo: execute an interrupt? @Incomplete
-                assert(0);
-            } 
+        case Mnemonic_mul:
+        case Mnemonic_imul:
+        case Mnemonic_div:
+        case Mnemonic_idiv: {
+            u16 flags_before = cpu->flags;
+
+            u16 ax = get_from_register(cpu, Register_ax);
+            u16 dx = get_from_register(cpu, Register_dx);
+
+            if (!cpu->model->alu_multiply_functions[i->mnemonic][is_wide](&ax, &dx, left_val, &cpu->flags)) {
+                divide_error = 1;
+                break;
+            }
 
+            set_to_register(cpu, Register_ax, ax);
             if (is_wide) {
-                u16 divident = get_from_register(cpu, Register_ax);
-                u32 unmasked_result = (u32)divident / (u32)divisior;
-                u16 remainder = divident % divisior;
-                
-                set_to_register(cpu, Register_ax, unmasked_result);
-                set_to_register(cpu, Register_dx, remainder);
-                
-                update_arith_flags(cpu, unmasked_result, 0, 0);
-            } else {
-                u16 divident = get_from_register(cpu, Register_ax);
-                u32 unmasked_result = (u32)divident / (u32)divisior;
-                u8 remainder = divident % divisior;
-                
-                set_to_register(cpu, Register_al, unmasked_result);
-                set_to_register(cpu, Register_ah, remainder);
-                
-                update_arith_flags(cpu, unmasked_result, 0, 0);
+                set_to_register(cpu, Register_dx, dx);
             }
-
+            print_changed_flags(cpu, flags_before);
             break;
         }
-        case Mnemonic_inc: {
-            u32 result = left_val+1;
-            set_to_operand(cpu, left_op, result);
-            update_arith_flags(cpu, result, 0, 0);
+        // The imul reg, r/m, imm of the 80186, the low word of the product goes to the reg
+        case Mnemonic_imul_imm: {
+            u16 flags_before = cpu->flags;
+
+            u16 product = right_val;
+            u16 high;
+            cpu->model->alu_multiply_functions[Mnemonic_imul][1](&product, &high, i->operands[2].immediate, &cpu->flags);
+            set_to_operand(cpu, left_op, product);
+            print_changed_flags(cpu, flags_before);
             break;
         }
-        case Mnemonic_dec: {
-            u32 result = left_val-1;
-            set_to_operand(cpu, left_op, result);
-            update_arith_flags(cpu, result, 0, 0);
+        case Mnemonic_cbw: {
+            set_to_register(cpu, Register_ax, (s8)get_from_register(cpu, Register_al));
             break;
         }
-        case Mnemonic_mul: {
-            u32 result = left_val * right_val;
-            set_to_operand(cpu, left_op, result);
-            update_arith_flags(cpu, result, 0, 0);
+        case Mnemonic_cwd: {
+            set_to_register(cpu, Register_dx, (get_from_register(cpu, Register_ax) & 0x8000) ? 0xFFFF : 0);
             break;
         }
-        // :Logical
-        case Mnemonic_test: {
-            u32 result = left_val &= right_val;
-            update_log_flags(cpu, result);
+        // :Decimal
+        case Mnemonic_daa:
+        case Mnemonic_das:
+        case Mnemonic_aaa:
+        case Mnemonic_aas: {
+            u16 ax = get_from_register(cpu, Register_ax);
+            u16 flags_before = cpu->flags;
+
+            switch (i->mnemonic) {
+                case Mnemonic_daa: ax = alu_daa(ax, &cpu->flags); break;
+                case Mnemonic_das: ax = alu_das(ax, &cpu->flags); break;
+                case Mnemonic_aaa: ax = alu_aaa(ax, &cpu->flags); break;
+                default:           ax = alu_aas(ax, &cpu->flags); break;
+            }
+
+            set_to_register(cpu, Register_ax, ax);
+            print_changed_flags(cpu, flags_before);
             break;
         }
-        case Mnemonic_and: {
-            u32 result = left_val &= right_val;
-            set_to_operand(cpu, left_op, result);
-            update_log_flags(cpu, result);
+        case Mnemonic_aam:
+        case Mnemonic_aad: {
+            // The base 10 is not decoded as an operand (it's not printed)
+            u8 base = left_op->type == Operand_Immediate ? left_val : 10;
+            u16 ax = get_from_register(cpu, Register_ax);
+            u16 flags_before = cpu->flags;
+
+            if (i->mnemonic == Mnemonic_aad) {
+                ax = alu_aad(ax, base, &cpu->flags);
+            } else if (!alu_aam(&ax, base, &cpu->flags)) {
+                divide_error = 1;
+                break;
+            }
+
+            set_to_register(cpu, Register_ax, ax);
+            print_changed_flags(cpu, flags_before);
             break;
         }
-        case Mnemonic_not: {
-            u32 result = ~left_val;
-            set_to_operand(cpu, left_op, result);
+        // :Move
+        case Mnemonic_xchg: {
+            set_to_operand(cpu, left_op, right_val);
+            set_to_operand(cpu, right_op, left_val);
             break;
         }
-        case Mnemonic_or: {
-            u32 result = left_val |= right_val;
-            set_to_operand(cpu, left_op, result);
-            update_log_flags(cpu, result);
+        case Mnemonic_lea: {
+            set_to_operand(cpu, left_op, calc_effective_address(cpu, &right_op->address));
             break;
         }
-        case Mnemonic_xor: {
-            u32 result = left_val ^= right_val;
-            set_to_operand(cpu, left_op, result);
-            update_log_flags(cpu, result);
+        case Mnemonic_lds:
+        case Mnemonic_les: {
+            u16 segment, offset;
+            load_far_pointer(cpu, right_op, &segment, &offset);
+            set_to_operand(cpu, left_op, offset);
+            set_to_register(cpu, i->mnemonic == Mnemonic_lds ? Register_ds : Register_es, segment);
             break;
         }
-        // :Flow
-        case Mnemonic_jmp: {
-            assert(!(i->flags & Inst_Far)); // @Todo: Unimplemented
-            ip_after += i->operands[0].immediate;
+        case Mnemonic_xlat: {
+            Register segment_reg = Register_ds;
+            if ((i->flags & Inst_Segment) && i->extend_with_this_segment != Register_none) {
+                segment_reg = i->extend_with_this_segment;
+            }
+            u16 offset = get_from_register(cpu, Register_bx) + get_from_register(cpu, Register_al);
+            u32 address = calc_segment_address_with_absolute_offset(cpu, segment_reg, offset);
+            set_to_register(cpu, Register_al, get_data_from_memory(cpu, address));
+            break;
+        }
+        case Mnemonic_lahf: {
+            set_to_register(cpu, Register_ah, cpu->flags & 0xFF);
             break;
         }
-        case Mnemonic_jl: {
-            u8 SF = !!(cpu->flags & F_SIGNED);
-            u8 OF = !!(cpu->flags & F_OVERFLOW);
-            if (SF ^ OF) {
-                ip_after += i->operands[0].immediate;
+        case Mnemonic_sahf: {
+            u16 flags_before = cpu->flags;
+            u16 mask = F_SIGNED|F_ZERO|F_AUXILIARY|F_PARITY|F_CARRY;
+            cpu->flags = (cpu->flags & ~mask) | (get_from_register(cpu, Register_ah) & mask);
+            print_changed_flags(cpu, flags_before);
+            break;
+        }
+        // :Flow
+        case Mnemonic_jmp: {
+            if (i->flags & Inst_Far) {
+                u16 segment, offset;
+                load_far_pointer(cpu, left_op, &segment, &offset);
+
+                set_to_register(cpu, Register_cs, segment);
+                ip_after = offset - i->size; // the size is added at the end
+                cpu->block_end = 1;
+                break;
+            }
+
+            if (left_op->type == Operand_Relative_Immediate) {
+                ip_after += left_op->immediate;
+            } else {
+                ip_after = left_val - i->size; // jmp reg/[mem]
             }
             break;
         }
-        case Mnemonic_jle: {
-            u8 SF = !!(cpu->flags & F_SIGNED);
-            u8 OF = !!(cpu->flags & F_OVERFLOW);
-            u8 ZF = !!(cpu->flags & F_ZERO);
-            if (((SF ^ OF) | ZF) == 1) {
-                ip_after += i->operands[0].immediate;
+        case Mnemonic_call: {
+            u16 return_ip = ip_before + i->size;
+
+            if (i->flags & Inst_Far) {
+                u16 segment, offset;
+                load_far_pointer(cpu, left_op, &segment, &offset);
+
+                stack_push(cpu, get_from_register(cpu, Register_cs));
+                stack_push(cpu, return_ip);
+                set_to_register(cpu, Register_cs, segment);
+                ip_after = offset - i->size;
+                cpu->block_end = 1;
+                break;
+            }
+
+            stack_push(cpu, return_ip);
+            if (left_op->type == Operand_Relative_Immediate) {
+                ip_after += left_op->immediate;
+            } else {
+                ip_after = left_val - i->size; // call reg/[mem]
             }
+            break;
         }
-        case Mnemonic_jz: {
-            if (cpu->flags & F_ZERO) {
-                ip_after += i->operands[0].immediate;
+        // The immediate of the ret is the size of the arguments, they are popped after the return address
+        case Mnemonic_ret: {
+            u16 ip_val = stack_pop(cpu);
+            if (left_op->type == Operand_Immediate) {
+                set_to_register(cpu, Register_sp, get_from_register(cpu, Register_sp) + left_val);
             }
+
+            ip_after = ip_val - i->size;
+            cpu->block_end = 1;
             break;
         }
-        case Mnemonic_jnz: {
-            if (!(cpu->flags & F_ZERO)) {
-                ip_after += i->operands[0].immediate;
+        case Mnemonic_retf: {
+            u16 ip_val = stack_pop(cpu);
+            u16 cs_val = stack_pop(cpu);
+            set_to_register(cpu, Register_cs, cs_val);
+            if (left_op->type == Operand_Immediate) {
+                set_to_register(cpu, Register_sp, get_from_register(cpu, Register_sp) + left_val);
             }
+
+            ip_after = ip_val - i->size;
+            cpu->block_end = 1;
             break;
         }
-        case Mnemonic_ja: {
-            if (!(cpu->flags & F_ZERO) && !(cpu->flags & F_CARRY)) {
-                ip_after += i->operands[0].immediate;
+        case Mnemonic_jo:  case Mnemonic_jno: case Mnemonic_jb:  case Mnemonic_jnb:
+        case Mnemonic_jz:  case Mnemonic_jnz: case Mnemonic_jbe: case Mnemonic_ja:
+        case Mnemonic_js:  case Mnemonic_jns: case Mnemonic_jp:  case Mnemonic_jnp:
+        case Mnemonic_jl:  case Mnemonic_jnl: case Mnemonic_jle: case Mnemonic_jg: {
+            if (jump_condition(i->mnemonic, cpu->flags)) {
+                ip_after += left_op->immediate;
             }
             break;
         }
-        case Mnemonic_loop: {
+        case Mnemonic_loop:
+        case Mnemonic_loopz:
+        case Mnemonic_loopnz: {
             u16 cx_data = get_from_register(cpu, Register_cx);
             cx_data -= 1;
             set_to_register(cpu, Register_cx, cx_data);
 
-            if (cx_data != 0) {
-                ip_after += i->operands[0].immediate;
+            u8 ZF = !!(cpu->flags & F_ZERO);
+            u8 taken = cx_data != 0;
+            if (i->mnemonic == Mnemonic_loopz)  taken &= ZF;
+            if (i->mnemonic == Mnemonic_loopnz) taken &= !ZF;
+
+            if (taken) {
+                ip_after += left_op->immediate;
             }
 
             break;
         }
+        case Mnemonic_jcxz: {
+            if (get_from_register(cpu, Register_cx) == 0) {
+                ip_after += left_op->immediate;
+            }
+            break;
+        }
         // :Stack
         case Mnemonic_push: {
-            u16 data = get_from_operand(cpu, left_op);
+            u16 data = left_val;
+            // The 8086 pushes the sp after the decrement
+            if (left_op->type == Operand_Register && !(left_op->flags & Inst_Segment) && (left_op->flags & Inst_Wide) &&
+                left_op->reg == REG_STACK_POINTER) {
+                data -= 2;
+            }
             stack_push(cpu, data);
             break;
         }
@@ -523,229 +1081,541 @@ void execute_instruction(CPU *cpu)
             stack_pop_flags(cpu);
             break;
         }
-        // ???
+        // The sp is pushed as it was before the pusha, the popa skips it
+        case Mnemonic_pusha: {
+            u16 sp = get_from_register(cpu, Register_sp);
+            stack_push(cpu, get_from_register(cpu, Register_ax));
+            stack_push(cpu, get_from_register(cpu, Register_cx));
+            stack_push(cpu, get_from_register(cpu, Register_dx));
+            stack_push(cpu, get_from_register(cpu, Register_bx));
+            stack_push(cpu, sp);
+            stack_push(cpu, get_from_register(cpu, Register_bp));
+            stack_push(cpu, get_from_register(cpu, Register_si));
+            stack_push(cpu, get_from_register(cpu, Register_di));
+            break;
+        }
+        case Mnemonic_popa: {
+            set_to_register(cpu, Register_di, stack_pop(cpu));
+            set_to_register(cpu, Register_si, stack_pop(cpu));
+            set_to_register(cpu, Register_bp, stack_pop(cpu));
+            stack_pop(cpu);
+            set_to_register(cpu, Register_bx, stack_pop(cpu));
+            set_to_register(cpu, Register_dx, stack_pop(cpu));
+            set_to_register(cpu, Register_cx, stack_pop(cpu));
+            set_to_register(cpu, Register_ax, stack_pop(cpu));
+            break;
+        }
+        // enter size, level: the bp is pushed, then the frame pointers of the outer procedures (level-1 of them,
+        // from the old frame) and the new frame pointer, then the size bytes are allocated for the locals
+        case Mnemonic_enter: {
+            u16 size = left_val;
+            u8 level = right_val & 0x1F;
+
+            u16 bp = get_from_register(cpu, Register_bp);
+            stack_push(cpu, bp);
+            u16 frame = get_from_register(cpu, Register_sp);
+
+            if (level > 0) {
+                for (u8 n = 1; n < level; n++) {
+                    bp -= 2;
+                    stack_push(cpu, get_word_from_memory(cpu, calc_segment_address_with_absolute_offset(cpu, Register_ss, bp)));
+                }
+                stack_push(cpu, frame);
+            }
+
+            set_to_register(cpu, Register_bp, frame);
+            set_to_register(cpu, Register_sp, get_from_register(cpu, Register_sp) - size);
+            break;
+        }
+        case Mnemonic_leave: {
+            set_to_register(cpu, Register_sp, get_from_register(cpu, Register_bp));
+            set_to_register(cpu, Register_bp, stack_pop(cpu));
+            break;
+        }
+        // The signed index (the reg) has to be between the two words of the memory (inclusive), otherwise it's the
+        // int 5, which returns to the bound itself
+        case Mnemonic_bound: {
+            u32 address = calc_absolute_memory_address(cpu, &right_op->address);
+            s16 lower = (s16)right_val;
+            s16 upper = (s16)get_word_from_memory(cpu, address + 2);
+            s16 index = (s16)left_val;
+
+            if (index < lower || index > upper) {
+                if (!raise_exception(cpu, 5, ip_before, Exit_Reason_Bound_Range)) {
+                    return;
+                }
+                ip_after = cpu->ip - i->size;
+            }
+            break;
+        }
+        // :Flags
+        case Mnemonic_clc: {
+            cpu->flags &= ~F_CARRY;
+            break;
+        }
+        case Mnemonic_stc: {
+            cpu->flags |= F_CARRY;
+            break;
+        }
+        case Mnemonic_cmc: {
+            cpu->flags ^= F_CARRY;
+            break;
+        }
         case Mnemonic_cld: {
             cpu->flags &= ~F_DIRECTION;
             break;
         }
+        case Mnemonic_std: {
+            cpu->flags |= F_DIRECTION;
+            break;
+        }
+        case Mnemonic_cli: {
+            cpu->flags &= ~F_INTERRUPT;
+            break;
+        }
+        case Mnemonic_sti: {
+            cpu->flags |= F_INTERRUPT;
+            break;
+        }
+        // There is no coprocessor, so the wait never waits
+        case Mnemonic_nop:
+        case Mnemonic_wait: {
+            break;
+        }
         // :Interrupt
         // case Mnemonic_int3: // We're decoding the int3 as int and 3 immediate value
+        // The return address is the next instruction, the size is added at the end
         case Mnemonic_int: {
-            u16 interrupt_type = get_from_operand(cpu, left_op);
+            u8 interrupt_type = left_val;
+            // The trapped services of the --hle are run natively, then the run continues after the int
+            if (cpu->hle && hle_interrupt(cpu, interrupt_type)) {
+                break;
+            }
+            cpu->ip = ip_before + i->size;
             execute_interrupt(cpu, interrupt_type);
+            ip_after = cpu->ip - i->size;
+            cpu->block_end = 1;
             break;
         }
         case Mnemonic_into: {
             if (cpu->flags & F_OVERFLOW) {
+                cpu->ip = ip_before + i->size;
                 execute_interrupt(cpu, 4);
+                ip_after = cpu->ip - i->size;
+                cpu->block_end = 1;
             }
             break;
         }
         case Mnemonic_iret: {
-            cpu->ip = stack_pop(cpu);
+            u16 ip_val = stack_pop(cpu);
             u16 cs_val = stack_pop(cpu);
             set_to_register(cpu, Register_cs, cs_val);
 
             stack_pop_flags(cpu);
 
+            ip_after = ip_val - i->size;
+            cpu->block_end = 1;
+            break;
+        }
+        // The cpu sleeps at the end of the block, see the finish_block()
+        case Mnemonic_hlt: {
+            cpu->halted = 1;
+            cpu->block_end = 1;
             break;
         }
         // :String
-        case Mnemonic_movsb: {
-            // @Todo: rep
-            u16 ds_val = get_from_register(cpu, Register_ds);
-            u16 si_val = get_from_register(cpu, Register_si);
-            u32 src_address = (ds_val << 4) + si_val;
-
-            u16 di_val = get_from_register(cpu, Register_di);
-            u16 es_val = get_from_register(cpu, Register_es);
-            u32 dest_adress = (es_val << 4) + di_val;
-
-            u16 data = get_data_from_memory(cpu, src_address);
-            set_data_to_memory(cpu, dest_adress, data);
-
-            if (cpu->flags & F_DIRECTION) {
-                si_val -= 1;
-                di_val -= 1;
-            } else {
-                si_val += 1;
-                di_val += 1;
-            }
-
+        case Mnemonic_movsb: case Mnemonic_movsw:
+        case Mnemonic_cmpsb: case Mnemonic_cmpsw:
+        case Mnemonic_scasb: case Mnemonic_scasw:
+        case Mnemonic_lodsb: case Mnemonic_lodsw:
+        case Mnemonic_stosb: case Mnemonic_stosw:
+        case Mnemonic_insb:  case Mnemonic_insw:
+        case Mnemonic_outsb: case Mnemonic_outsw: {
+            repeat_count = execute_string_instruction(cpu, i, is_wide);
             break;
         }
-        case Mnemonic_stosw: {
-            // @Todo: Repeat if the repeat Prefix (REP/REPE/REPZ or REPNE/REPNZ)
-            //  (repeated based on the value in the CX register)
-            assert(!(i->flags & Inst_Repnz)); // @Todo
-
-            u16 cx = 1;
-            if (i->flags & Inst_Repz) {
-                cx = get_from_register(cpu, Register_cx);
+        // :IO
+        case Mnemonic_in: {
+            set_to_operand(cpu, left_op, read_port(cpu, right_val));
+            break;
+        }
+        case Mnemonic_out: {
+            write_port(cpu, left_val, right_val);
+            break;
+        }
+        default: {
+            // The 80186 raises the int 6 at the undefined opcodes, it returns to the same instruction
+            if (cpu->model->invalid_opcode_interrupt && (i->mnemonic == Mnemonic_db || i->mnemonic == Mnemonic_invalid)) {
+                if (!raise_exception(cpu, 6, ip_before, Exit_Reason_Unhandled_Instruction)) {
+                    return;
+                }
+                ip_after = cpu->ip - i->size;
+                break;
             }
 
-            while (cx != 0) {
-                u32 addresss = calc_segment_address_with_register_offset(cpu, Register_es, Register_di);
+            TRACE(cpu, "\n[WARNING]: This instruction: %s is not handled yet!\n", mnemonic_name(i->mnemonic));
+            cpu->terminate = 1; // @Temporary
+            cpu->block_end = 1;
+            cpu->exit_reason = Exit_Reason_Unhandled_Instruction;
+        }
+    }
 
-                s32 ax = get_from_register(cpu, Register_ax);
-                set_data_to_memory(cpu, addresss, ax);
+    // The divide error is the int 0, the 8086 pushes the address of the next instruction
+    if (divide_error) {
+        if (!raise_exception(cpu, 0, ip_before + i->size, Exit_Reason_Divide_Error)) {
+            return;
+        }
+        ip_after = cpu->ip - i->size;
+    }
 
-                u16 di = get_from_register(cpu, Register_di);
-                if (cpu->flags & F_DIRECTION) di -= 2;
-                else                          di += 2;
+    // @Incomplete: A jump to the next instruction (displacement 0) is counted as a not taken branch
+    u8 branch_taken = ip_after != ip_before;
+    cpu->block_end |= branch_taken;
+    cpu->cycle_count += cpu->model->estimate_cycles(cpu, i, branch_taken, repeat_count);
 
-                set_to_register(cpu, Register_di, di);
+    // This instruction pointer data will provide us the next instruction location from the cpu->instructions array which indexed
+    // based on the instruction byte index at loaded binary file.
+    // @Bug @Todo: This will cause a bug if the ip address overflow, because if we incremented the ip value,
+    //  then the cs register value has to be incremented too if the ip register value is left his range.
+    ip_after += i->size;
+    cpu->ip = ip_after;
 
-                cx -= 1;
-            };
+    TRACE(cpu, "\n\t\t@ip: %#02x -> %#02x\n", ip_before, cpu->ip);
+    TRACE(cpu, "\n");
+}
 
-            if (i->flags & Inst_Repz) {
-                set_to_register(cpu, Register_cx, cx);
-            }
+// Returns 0 if the file is not exists or it's not fit into the memory
+// Clears the memory, the registers and the run state, but keeps the options
+void reset(CPU *cpu)
+{
+    destroy_code_map(cpu);
 
-            break;
-        }
-        case Mnemonic_stosb: {
-            // @Todo: Repeat if the repeat Prefix (REP/REPE/REPZ or REPNE/REPNZ)
-            //  (repeated based on the value in the CX register)
-            assert(!(i->flags & Inst_Repnz)); // @Todo
+    if (!cpu->model) {
+        cpu->model = &cpu_models[CPU_Model_8086];
+    }
 
-            u16 cx = 1;
-            if (i->flags & Inst_Repz) {
-                cx = get_from_register(cpu, Register_cx);
-            }
+    ZERO_MEMORY(cpu->memory, MAX_MEMORY + MEMORY_PADDING);
+    ZERO_MEMORY(cpu->regmem, 64);
+    ZERO_MEMORY(&cpu->instruction, sizeof(Instruction));
 
-            while (cx != 0) {
-                Effective_Address_Expression expr = {.base=Effective_Address_di};
-                u32 absolute_address = calc_absolute_memory_address(cpu, &expr);
+    cpu->flags = 0;
+    cpu->terminate = 0;
+    cpu->exit_reason = Exit_Reason_None;
+    cpu->instruction_count = 0;
+    cpu->cycle_count = 0;
+    cpu->block_end = 0;
+    cpu->halted = 0;
+    cpu->halted_cycles = 0;
+    cpu->event_scheduled = 0;
+    cpu->block_start = 0;
+    cpu->idle_candidate = 0;
+    cpu->side_effect_count = 0;
+    cpu->idle_skip_count = 0;
+    cpu->skipped_cycles = 0;
+    cpu->psp_segment = 0;
+    cpu->program_paragraphs = 0;
 
-                s32 al = get_from_register(cpu, Register_al);
-                set_data_to_memory(cpu, absolute_address, al);
+    // @Cleanup: This is a little-bit wierdo, two different register set
+    set_to_register(cpu, Register_cs, 0xf000);
+    TRACE(cpu, "\n");
+    cpu->ip = 0x0100;
+}
 
-                u16 di = get_from_register(cpu, Register_di);
-                if (cpu->flags & F_DIRECTION) di -= 1;
-                else                          di += 1;
+void boot(CPU *cpu)
+{
+    // The padding is there, so the decoder and the word access at the end of the memory can't read out of the buffer
+    cpu->memory = (u8*)malloc(MAX_MEMORY + MEMORY_PADDING);
+    if (cpu->memory) {
+        reset(cpu);
+    }
+}
 
-                set_to_register(cpu, Register_di, di);
+// Decodes the next instruction with its prefixes, the ip is moved to the last part. Returns 0 if the prefixes are
+// running out of the image.
+static u8 decode_instruction_with_prefixes(CPU *cpu)
+{
+    decode_next_instruction(cpu);
 
-                cx -= 1;
-            };
+    while (cpu->instruction.is_prefix) {
+        // The prefix is not executed or printed alone, it's extends the next instruction (nasm syntax too).
 
-            if (i->flags & Inst_Repz) {
-                set_to_register(cpu, Register_cx, cx);
-            }
+        // This is a special case, the cpu->decoder_cursor have an absolute address, so we have to "reverse" this absolute address
+        // which are calculated with the segment register and the instruction pointer (ip) register offset.
+        u16 cs_segment = get_from_register(cpu, Register_cs);
+        cpu->ip = cpu->decoder_cursor - (cs_segment << 4);
 
-            break;
+        if (calc_inst_pointer_address(cpu) >= cpu->exec_end) {
+            cpu->exit_reason = Exit_Reason_End_Of_Image;
+            return 0;
         }
-        // :IO
-        case Mnemonic_out: {
-            u16 port = left_val;
-            u16 data = right_val;
 
-            // @Debug
-            fprintf(cpu->out, "%d : %d\n", port, data);
-        
-            break;
+        decode_next_instruction(cpu);
+    }
+
+    return 1;
+}
+
+// Decodes the next instruction (with its prefixes) and executes it, without the checks of the run state. Returns 0
+// if the prefixes are running out of the image.
+static u8 execute_next_instruction(CPU *cpu)
+{
+    if (cpu->history) {
+        history_step_begin(cpu->history, cpu);
+    }
+
+    u32 address = calc_inst_pointer_address(cpu);
+
+    Predecoded_Instruction *predecoded = find_predecoded(cpu->code_map, address);
+    if (predecoded) {
+        cpu->instruction = predecoded->inst;
+        cpu->ip += predecoded->prefix_length; // the ip is at the last part, as after the decoding of the prefixes
+        cpu->decoder_cursor = address + predecoded->length;
+        cpu->code_map->hit_count++;
+    } else {
+        if (!decode_instruction_with_prefixes(cpu)) {
+            return 0;
         }
-        default: {
-            printf("\n[WARNING]: This instruction: %s is not handled yet!\n", mnemonic_name(i->mnemonic));
-            cpu->terminate = 1; // @Temporary
+
+        if (cpu->code_map) {
+            cpu->code_map->miss_count++;
+            store_predecoded(cpu->code_map, address, &cpu->instruction, cpu->decoder_cursor - address, calc_inst_pointer_address(cpu) - address);
         }
     }
 
-    // This instruction pointer data will provide us the next instruction location from the cpu->instructions array which indexed
-    // based on the instruction byte index at loaded binary file.
-    // @Bug @Todo: This will cause a bug if the ip address overflow, because if we incremented the ip value,
-    //  then the cs register value has to be incremented too if the ip register value is left his range.
-    ip_after += i->size;
-    cpu->ip = ip_after;
+    if (cpu->trace_writer) {
+        trace_step_begin(cpu->trace_writer, cpu, address);
+    }
+
+    print_instruction(cpu, 0);
+    execute_instruction(cpu);
+    cpu->instruction_count++;
 
-    printf("\n\t\t@ip: %#02x -> %#02x\n", ip_before, cpu->ip);
-    printf("\n");
+    if (cpu->trace_writer) {
+        trace_step_end(cpu->trace_writer, cpu);
+    }
+
+    return 1;
+}
+
+void schedule_interrupt(CPU *cpu, u8 interrupt_type, u64 cycle, u64 period)
+{
+    cpu->event_scheduled = 1;
+    cpu->event_interrupt = interrupt_type;
+    cpu->next_event_cycle = cycle;
+    cpu->event_period = period;
 }
 
-void load_executable(CPU *cpu, char *filename)
+static void deliver_event(CPU *cpu)
 {
-    FILE *fp = fopen(filename, "rb");
-    if (fp == NULL) {
-        printf("\n[ERROR]: Failed to open %s file. Probably it is not exists.\n", filename);
-        assert(0);
+    TRACE(cpu, "\n\t\t@interrupt: %u at %llu cycles\n", cpu->event_interrupt, (unsigned long long)cpu->cycle_count);
+    execute_interrupt(cpu, cpu->event_interrupt);
+
+    if (cpu->event_period) {
+        // The missed ticks are dropped, as the interrupt controller has only one pending request
+        while (cpu->next_event_cycle <= cpu->cycle_count) {
+            cpu->next_event_cycle += cpu->event_period;
+        }
+    } else {
+        cpu->event_scheduled = 0;
     }
+}
 
-    fseek(fp, 0, SEEK_END);
-    u32 fsize = ftell(fp);
-    rewind(fp);
+// The checks of the run state after a block. The interrupt is delivered and the halted cpu is woken up only after
+// the control transfer (cpu->block_end), so the stepping and the run() are delivering it at the same instruction.
+// Returns 0 if the execution is stopped, the cpu->exit_reason tells why.
+static u8 finish_block(CPU *cpu)
+{
+    u8 control_transfer = cpu->block_end;
+    cpu->block_end = 0;
 
-    assert(fsize+1 <= MAX_MEMORY);
+    // @Temporary
+    if (cpu->terminate) {
+        return 0;
+    }
 
-    u32 inst_absolute_address = calc_inst_pointer_address(cpu);
-    fread(&cpu->memory[inst_absolute_address], fsize, 1, fp);
-    fclose(fp);
+    if (cpu->halted) {
+        if (!cpu->event_scheduled || !(cpu->flags & F_INTERRUPT)) {
+            cpu->exit_reason = Exit_Reason_Halt;
+            return 0;
+        }
 
-    cpu->loaded_executable_size = fsize;
-    cpu->exec_end = inst_absolute_address + fsize;
+        // Sleeps to the next event, but not over the cycle limit (then it's still halted, it can be continued)
+        u64 wake_cycle = cpu->next_event_cycle > cpu->cycle_count ? cpu->next_event_cycle : cpu->cycle_count;
+        if (cpu->cycle_limit && wake_cycle > cpu->cycle_limit) {
+            if (cpu->cycle_limit > cpu->cycle_count) {
+                cpu->halted_cycles += cpu->cycle_limit - cpu->cycle_count;
+                cpu->cycle_count = cpu->cycle_limit;
+            }
+            cpu->exit_reason = Exit_Reason_Cycle_Limit;
+            return 0;
+        }
+
+        cpu->halted_cycles += wake_cycle - cpu->cycle_count;
+        cpu->cycle_count = wake_cycle;
+        cpu->halted = 0;
+        control_transfer = 1;
+    }
+
+    if (control_transfer && cpu->event_scheduled && (cpu->flags & F_INTERRUPT) && cpu->cycle_count >= cpu->next_event_cycle) {
+        deliver_event(cpu);
+    }
+
+    u32 address = calc_inst_pointer_address(cpu);
+    if (address >= cpu->exec_end) {
+        cpu->exit_reason = Exit_Reason_End_Of_Image;
+        return 0;
+    }
+
+    // The skipped iterations would be missing from the trace, the history and the stepping of the debugger
+    cpu->idle_candidate = control_transfer && address == cpu->block_start && cpu->idle_skip &&
+                          !cpu->trace && !cpu->trace_writer && !cpu->history && !cpu->breakpoints;
+    cpu->block_start = address;
+
+    if (cpu->instruction_limit && cpu->instruction_count >= cpu->instruction_limit) {
+        cpu->exit_reason = Exit_Reason_Instruction_Limit;
+        return 0;
+    }
+
+    if (cpu->cycle_limit && cpu->cycle_count >= cpu->cycle_limit) {
+        cpu->exit_reason = Exit_Reason_Cycle_Limit;
+        return 0;
+    }
+
+    if (cpu->stop_at_address && address == cpu->stop_address) {
+        cpu->exit_reason = Exit_Reason_Stop_Address;
+        return 0;
+    }
+
+    return 1;
 }
 
-void boot(CPU *cpu)
+// Decodes the next instruction (with its prefixes) and executes it. Returns 0 if the execution is stopped,
+// the cpu->exit_reason tells why.
+u8 step_instruction(CPU *cpu)
 {
-    cpu->memory = (u8*)malloc(MAX_MEMORY);
-    ZERO_MEMORY(cpu->memory, MAX_MEMORY);
-    ZERO_MEMORY(cpu->regmem, 64);
+    if (cpu->halted) {
+        return finish_block(cpu);
+    }
 
-    // @Cleanup: This is a little-bit wierdo, two different register set
-    set_to_register(cpu, Register_cs, 0xf000);
-    printf("\n");
-    cpu->ip = 0x0100;
+    if (!execute_next_instruction(cpu)) {
+        return 0;
+    }
+
+    return finish_block(cpu);
 }
 
-void run(CPU *cpu)
+typedef struct {
+    u8 regmem[64];
+    u16 flags;
+    u64 side_effect_count;
+    u64 instruction_count;
+    u64 cycle_count;
+} Idle_Check;
+
+// The block is one iteration of a loop (it's started and ended at the same address, see the cpu->idle_candidate).
+// If the iteration has no side effect and the registers and the flags are the same after it, every next iteration
+// is the same until an interrupt changes something (the memory, the ports and the registers are changed only by the
+// cpu). Then the iterations to the next scheduled interrupt, or to the limits, are skipped, only the counters are
+// moved. The run is stopped (or the interrupt is delivered) at the end of the same iteration as without the skip.
+static void skip_idle_loop(CPU *cpu, Idle_Check *check)
 {
-    char input[128] = {0};
+    if (cpu->side_effect_count != check->side_effect_count || cpu->halted || cpu->terminate) return;
+    if (calc_inst_pointer_address(cpu) != cpu->block_start) return;
+    if (cpu->flags != check->flags || memcmp(cpu->regmem, check->regmem, sizeof(cpu->regmem)) != 0) return;
 
-    // if (cpu->decode_only) {
-    //     printf("bits 16\n\n");
-    // }
+    u64 iteration_instructions = cpu->instruction_count - check->instruction_count;
+    u64 iteration_cycles = cpu->cycle_count - check->cycle_count;
+    if (iteration_instructions == 0 || iteration_instructions > IDLE_MAX_LOOP_SIZE || iteration_cycles == 0) return;
 
-#ifdef GRAPHICS_ENABLED
-    u16 GRAPHICS_X = 256;
-    u16 GRAPHICS_Y = GRAPHICS_X;
+    u64 target_cycle = 0; // 0 = there is no one
+    if (cpu->event_scheduled && (cpu->flags & F_INTERRUPT)) {
+        target_cycle = cpu->next_event_cycle;
+    }
+    if (cpu->cycle_limit && (!target_cycle || cpu->cycle_limit < target_cycle)) {
+        target_cycle = cpu->cycle_limit;
+    }
 
-    SDL_Surface *sdl_screen;
-    SDL_Event sdl_event;
+    // The first iteration which is ended at or after the target
+    u64 iterations = 0;
+    if (target_cycle > cpu->cycle_count) {
+        iterations = (target_cycle - cpu->cycle_count + iteration_cycles - 1) / iteration_cycles;
+    }
+    if (cpu->instruction_limit) {
+        u64 remaining = cpu->instruction_limit > cpu->instruction_count ? cpu->instruction_limit - cpu->instruction_count : 0;
+        u64 max_iterations = remaining / iteration_instructions;
+        if (!target_cycle || max_iterations < iterations) iterations = max_iterations;
+    }
+    if (iterations == 0) return;
 
-    SDL_Init(SDL_INIT_VIDEO);
-    sdl_screen = SDL_SetVideoMode(GRAPHICS_X, GRAPHICS_Y, 8*2, 0);
-    SDL_EnableUNICODE(1);
-    SDL_EnableKeyRepeat(500, 30);
+    cpu->instruction_count += iterations * iteration_instructions;
+    cpu->cycle_count       += iterations * iteration_cycles;
+    cpu->skipped_cycles    += iterations * iteration_cycles;
+    cpu->idle_skip_count   += 1;
+}
 
-    int pixel_colors[16];
-    int vid_addr_lookup[VIDEO_RAM_SIZE];
-    u32 *vid_mem_base; 
+// Executes the instructions until the end of the block: the control transfer or the stop (see the cpu->block_end),
+// the sequential run out of the image, or RUN_BLOCK_SIZE instructions. Inside the block only the cpu->block_end and
+// the decoder cursor are tested, the cs:ip, the limits and the interrupts are checked by the finish_block().
+static u8 run_block(CPU *cpu)
+{
+    if (cpu->halted) {
+        return finish_block(cpu);
+    }
 
-    vid_mem_base = (u32*)&cpu->memory[0];
+    // The instruction limit is exact, the stop address is checked after every instruction
+    u64 budget = RUN_BLOCK_SIZE;
+    if (cpu->instruction_limit) {
+        if (cpu->instruction_count >= cpu->instruction_limit) {
+            cpu->exit_reason = Exit_Reason_Instruction_Limit;
+            return 0;
+        }
+        u64 remaining = cpu->instruction_limit - cpu->instruction_count;
+        if (remaining < budget) budget = remaining;
+    }
+    if (cpu->stop_at_address) {
+        budget = 1;
+    }
 
-	for (int i = 0; i < 16; i++) {
-        pixel_colors[i] = 0xFF*(((i & 1) << 24) + ((i & 2) << 15) + ((i & 4) << 6) + ((i & 8) >> 3));
+    Idle_Check check;
+    u8 idle_candidate = cpu->idle_candidate;
+    if (idle_candidate) {
+        memcpy(check.regmem, cpu->regmem, sizeof(check.regmem));
+        check.flags             = cpu->flags;
+        check.side_effect_count = cpu->side_effect_count;
+        check.instruction_count = cpu->instruction_count;
+        check.cycle_count       = cpu->cycle_count;
     }
 
-	for (int i = 0; i < GRAPHICS_X * GRAPHICS_Y / 4; i++) {
-		vid_addr_lookup[i] = i / GRAPHICS_X * (GRAPHICS_X / 8) + (i / 2) % (GRAPHICS_X / 8) + 0x2000*((4 * i / GRAPHICS_X) % 4);
+    do {
+        if (!execute_next_instruction(cpu)) {
+            return 0;
+        }
+    } while (!cpu->block_end && --budget && cpu->decoder_cursor < cpu->exec_end);
+
+    if (idle_candidate && cpu->block_end) {
+        skip_idle_loop(cpu, &check);
     }
-#endif
 
-    u32 timer = 0;
+    return finish_block(cpu);
+}
 
-    do {
-        timer++;
-        decode_next_instruction(cpu);
+void run(CPU *cpu)
+{
+    char input[128] = {0};
 
+    // if (cpu->decode_only) {
+    //     printf("bits 16\n\n");
+    // }
+
+    do {
         // @Todo: The i8086 contains the debug flag so later we simulate this too
         // instead of this boolean
+        // The execution is stepped by the run_debugger() (see the debugger.h), this is the stepping of the --decode
         if (cpu->debug_mode) {
             //printf(">> Press enter to the next instruction\n");
 __de:;
-            fgets(input, sizeof(input), stdin);
-            if (STR_EQUAL("exit\n", input) || input[0] == 'q') {
+            if (fgets(input, sizeof(input), stdin) == NULL || STR_EQUAL("exit\n", input) || input[0] == 'q') {
+                cpu->exit_reason = Exit_Reason_User_Quit;
                 return;
             }
             if (input[0] != '\n') {
@@ -753,19 +1623,9 @@ __de:;
             }
         }
 
-        if (cpu->instruction.is_prefix) {
-            // If we have a prefix, then we don't want to run or print it. We will print at at the next
-            // instruction decode, because we're using the nasm syntax.
-
-            // This is a special case, the cpu->decoder_cursor have an absolute address, so we have to "reverse" this absolute address
-            // which are calculated with the segment register and the instruction pointer (ip) register offset.
-            u16 cs_segment = get_from_register(cpu, Register_cs);
-            cpu->ip = cpu->decoder_cursor - (cs_segment << 4);
-
-            continue;
-        }
-
         if (cpu->decode_only) {
+            decode_next_instruction(cpu);
+
             // We have to update this "manually", because here we only printing and not executing, so the ip won't update!
             // @Incomplete: The problem will appear if the in the instruction the DW or DB directive is defined, because those
             // just raw memory but we must guess somehow which is code and which is just raw data. Maybe we can make context analysis,
@@ -776,56 +1636,27 @@ __de:;
             u16 cs_segment = get_from_register(cpu, Register_cs);
             cpu->ip = cpu->decoder_cursor - (cs_segment << 4);
 
+            if (cpu->instruction.is_prefix) {
+                // If we have a prefix, then we don't want to print it. We will print at at the next
+                // instruction decode, because we're using the nasm syntax.
+                continue;
+            }
+
             print_instruction(cpu, 1);
 
         } else {
-            print_instruction(cpu, 0);
-            execute_instruction(cpu);
-
-            // @Temporary
-            if (cpu->terminate) {
+            // The prompt steps one instruction
+            if (!(cpu->debug_mode ? step_instruction(cpu) : run_block(cpu))) {
                 return;
             }
-        }
-
-#ifdef GRAPHICS_ENABLED
-        if ((timer % GRAPHICS_UPDATE_DELAY) == 0) {
-            u32 pixels = GRAPHICS_X*GRAPHICS_Y;
-
-/*
-            // 1x scale
-            for (u32 i = 0; i < pixels; i++) {
-                u16 *pxptr = ((u16*)sdl_screen->pixels); 
-                u16 color = ((u16*)vid_mem_base)[i];
-                pxptr[i] = BYTE_SWAP(color);
-            } 
-*/
-
-            // 2x scale
-            u32 y = 0;
-            u32 j = 0;
-            for (u32 i = 0; i < (GRAPHICS_X/2)*(GRAPHICS_Y/2); i++) {
-                u16 *pxptr = ((u16*)sdl_screen->pixels); 
-                u16 color = BYTE_SWAP(((u16*)vid_mem_base)[i]);
-
-                if (j!=0 && ((j) % GRAPHICS_X) == 0) {
-                    j += GRAPHICS_X;
-                }
-
-                pxptr[j] = color;
-                pxptr[j+1] = color;
-                pxptr[j+GRAPHICS_X] = color;
-                pxptr[j+GRAPHICS_X+1] = color;
-
-                j+=2;
+            if (cpu->graphics) {
+                update_graphics(cpu);
             }
-
-            swapFramebufferVertically((u16*)sdl_screen->pixels, GRAPHICS_X, GRAPHICS_Y);
-            SDL_Flip(sdl_screen);
         }
-#endif
 
-    // @Todo: Another option to check end of the executable?
-    } while (calc_inst_pointer_address(cpu) < cpu->exec_end);
 
+    // The end of the execution is checked by the run_block()
+    } while (!cpu->decode_only || calc_inst_pointer_address(cpu) < cpu->exec_end);
+
+    cpu->exit_reason = Exit_Reason_End_Of_Image;
 }
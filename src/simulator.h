@@ -8,8 +8,23 @@ u32 calc_stack_pointer_address(CPU *cpu);
 
 u16 get_data_from_register(CPU *cpu, Register_Access *src_reg);
 
-void load_executable(CPU *cpu, char *filename);
+// The clock cycles of the executed instruction, see the cpu->model->estimate_cycles
+u32 estimate_instruction_cycles(CPU *cpu, Instruction *i, u8 branch_taken, u32 repeat_count);
+u32 estimate_8088_cycles(CPU *cpu, Instruction *i, u8 branch_taken, u32 repeat_count);
+void reset(CPU *cpu);
 void boot(CPU *cpu);
+// The run() checks the state (the end of the image, the limits, the scheduled interrupt) only between the blocks,
+// a block ends at the control transfer or after this many instructions
+#define RUN_BLOCK_SIZE 4096
+
+// The longest loop (in instructions) which can be skipped as an idle loop, see the skip_idle_loop()
+#define IDLE_MAX_LOOP_SIZE 16
+
+u8 step_instruction(CPU *cpu);
 void run(CPU *cpu);
 
+// The interrupt is delivered at the first block end after the cycle when the interrupts are enabled, and it wakes
+// up the hlt. The period is in cycles, 0 = only once. There is one scheduled interrupt, this replaces it.
+void schedule_interrupt(CPU *cpu, u8 interrupt_type, u64 cycle, u64 period);
+
 #endif
@@ -0,0 +1,140 @@
+#include "snapshot.h"
+#include "simulator.h"
+#include "cpu_model.h"
+#include "code_map.h"
+#include "platform.h"
+
+static u8 is_zero_page(u8 *page)
+{
+    u64 *words = (u64 *)page;
+    for (u32 i = 0; i < SNAPSHOT_PAGE_SIZE / sizeof(u64); i++) {
+        if (words[i]) return 0;
+    }
+    return 1;
+}
+
+u8 save_snapshot(CPU *cpu, char *filename)
+{
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) return 0;
+
+    // The header is padded to a page, so every stored page is page aligned in the file
+    assert(sizeof(Snapshot_Header) <= SNAPSHOT_PAGE_SIZE);
+    u8 *header_page = (u8 *)calloc(1, SNAPSHOT_PAGE_SIZE);
+    assert(header_page);
+
+    Snapshot_Header *header = (Snapshot_Header *)header_page;
+    header->magic = SNAPSHOT_MAGIC;
+    header->version = SNAPSHOT_VERSION;
+    header->page_size = SNAPSHOT_PAGE_SIZE;
+    header->model = cpu->model->type;
+
+    header->instruction_count = cpu->instruction_count;
+    header->cycle_count = cpu->cycle_count;
+    header->halted_cycles = cpu->halted_cycles;
+    header->next_event_cycle = cpu->next_event_cycle;
+    header->event_period = cpu->event_period;
+    header->event_scheduled = cpu->event_scheduled;
+    header->event_interrupt = cpu->event_interrupt;
+    header->halted = cpu->halted;
+    header->exec_start = cpu->exec_start;
+    header->exec_end = cpu->exec_end;
+    header->image_base = cpu->image_base;
+    header->loaded_executable_size = cpu->loaded_executable_size;
+    header->decoder_cursor = cpu->decoder_cursor;
+    header->psp_segment = cpu->psp_segment;
+    header->program_paragraphs = cpu->program_paragraphs;
+    header->ip = cpu->ip;
+    header->flags = cpu->flags;
+    memcpy(header->regmem, cpu->regmem, sizeof(header->regmem));
+    memcpy(header->memory_padding, cpu->memory + MAX_MEMORY, MEMORY_PADDING);
+
+    for (u32 page = 0; page < SNAPSHOT_PAGE_COUNT; page++) {
+        if (!is_zero_page(cpu->memory + page * SNAPSHOT_PAGE_SIZE)) {
+            header->stored[page] = 1;
+            header->page_count += 1;
+        }
+    }
+
+    u8 ok = fwrite(header_page, SNAPSHOT_PAGE_SIZE, 1, fp) == 1;
+    for (u32 page = 0; page < SNAPSHOT_PAGE_COUNT && ok; page++) {
+        if (header->stored[page]) {
+            ok = fwrite(cpu->memory + page * SNAPSHOT_PAGE_SIZE, SNAPSHOT_PAGE_SIZE, 1, fp) == 1;
+        }
+    }
+
+    if (fclose(fp) != 0) ok = 0;
+    free(header_page);
+
+    return ok;
+}
+
+u8 restore_snapshot(CPU *cpu, char *filename)
+{
+    u64 size;
+    u8 *data = map_file(filename, &size);
+    if (!data) return 0;
+
+    Snapshot_Header *header = (Snapshot_Header *)data;
+    if (size < SNAPSHOT_PAGE_SIZE || header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION ||
+        header->page_size != SNAPSHOT_PAGE_SIZE || size < (u64)(header->page_count + 1) * SNAPSHOT_PAGE_SIZE) {
+        unmap_file(data, size);
+        return 0;
+    }
+
+    // Every stored flag is a page in the file, the flags of a corrupt header would copy past the mapping
+    u32 stored_count = 0;
+    for (u32 page = 0; page < SNAPSHOT_PAGE_COUNT; page++) {
+        stored_count += header->stored[page] != 0;
+    }
+    if (stored_count != header->page_count) {
+        unmap_file(data, size);
+        return 0;
+    }
+
+    if (header->model != cpu->model->type) {
+        const char *name = header->model < CPU_Model_Count ? cpu_models[header->model].name : "unknown";
+        fprintf(stderr, "[WARNING]: The snapshot is of the %s cpu, it can't be restored on the %s (see the --cpu)\n", name, cpu->model->name);
+        unmap_file(data, size);
+        return 0;
+    }
+
+    reset(cpu);
+
+    u8 *page_data = data + SNAPSHOT_PAGE_SIZE;
+    for (u32 page = 0; page < SNAPSHOT_PAGE_COUNT; page++) {
+        if (header->stored[page]) {
+            memcpy(cpu->memory + page * SNAPSHOT_PAGE_SIZE, page_data, SNAPSHOT_PAGE_SIZE);
+            page_data += SNAPSHOT_PAGE_SIZE;
+        }
+    }
+    memcpy(cpu->memory + MAX_MEMORY, header->memory_padding, MEMORY_PADDING);
+
+    cpu->instruction_count = header->instruction_count;
+    cpu->cycle_count = header->cycle_count;
+    cpu->halted_cycles = header->halted_cycles;
+    cpu->next_event_cycle = header->next_event_cycle;
+    cpu->event_period = header->event_period;
+    cpu->event_scheduled = header->event_scheduled;
+    cpu->event_interrupt = header->event_interrupt;
+    cpu->halted = header->halted;
+    cpu->exec_start = header->exec_start;
+    cpu->exec_end = header->exec_end;
+    cpu->image_base = header->image_base;
+    cpu->loaded_executable_size = header->loaded_executable_size;
+    cpu->decoder_cursor = header->decoder_cursor;
+    cpu->psp_segment = header->psp_segment;
+    cpu->program_paragraphs = header->program_paragraphs;
+    cpu->ip = header->ip;
+    cpu->flags = header->flags;
+    memcpy(cpu->regmem, header->regmem, sizeof(cpu->regmem));
+
+    unmap_file(data, size);
+
+    // The analysis starts from the restored cs:ip, the code before it is decoded at the first execution
+    if (cpu->predecode && !cpu->decode_only) {
+        build_code_map(cpu);
+    }
+
+    return 1;
+}
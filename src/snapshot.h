@@ -0,0 +1,64 @@
+#ifndef _H_SNAPSHOT
+#define _H_SNAPSHOT
+
+#include "sim86.h"
+
+// Machine snapshot (--snapshot, --restore): the registers, the flags, the ip, the counters, the loaded image range,
+// the halt and the scheduled interrupt, and the memory. There is no other device with its own state yet (the video
+// memory of the graphics is a part of the memory, and the out port is only printed), so this is the whole machine.
+//
+// Only the pages which are not all zero are stored. The pages are aligned to SNAPSHOT_PAGE_SIZE in the file, the
+// restore maps the file and copies the stored pages, the rest of the memory is cleared.
+//
+// The snapshot is taken between two instructions, so the restored run continues exactly as the original run
+// would continue (the same trace, the same final state).
+//
+// @Incomplete: The state of the --hle (the opened host files and the memory blocks) is not stored, the --restore
+// can't be used with the --hle.
+
+#define SNAPSHOT_MAGIC     0x4D363853 // "S86M"
+#define SNAPSHOT_VERSION   6
+#define SNAPSHOT_PAGE_SIZE 4096
+#define SNAPSHOT_PAGE_COUNT (MAX_MEMORY / SNAPSHOT_PAGE_SIZE)
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 page_size;
+    u32 page_count;         // the stored pages, they are following the header in the order of the address
+    u32 model;              // the CPU_Model_Type, the restore needs the same --cpu (the opcodes and the cycles differ)
+
+    u64 instruction_count;
+    u64 cycle_count;
+    u64 halted_cycles;
+
+    u64 next_event_cycle;   // the scheduled interrupt, see the schedule_interrupt()
+    u64 event_period;
+    u8 event_scheduled;
+    u8 event_interrupt;
+    u8 halted;
+
+    u32 exec_start;
+    u32 exec_end;
+    u32 image_base;
+    u32 loaded_executable_size;
+    u32 decoder_cursor;
+    u16 psp_segment;        // see the loader.h
+    u16 program_paragraphs;
+
+    u16 ip;
+    u16 flags;
+    u8 regmem[64];
+    u8 memory_padding[MEMORY_PADDING]; // the word write at the last byte of the memory goes here
+
+    u8 stored[SNAPSHOT_PAGE_COUNT];    // 1 if the page is stored
+} Snapshot_Header;
+
+// Returns 0 if the file can't be written
+u8 save_snapshot(CPU *cpu, char *filename);
+
+// The CPU has to be booted. Returns 0 if the file is not a valid snapshot or it is of an other cpu model (the CPU
+// is not changed then).
+u8 restore_snapshot(CPU *cpu, char *filename);
+
+#endif
@@ -0,0 +1,525 @@
+#include "trace.h"
+#include "simulator.h"
+#include "platform.h"
+
+static inline u8 *put_varint(u8 *at, u64 value)
+{
+    while (value >= 0x80) {
+        *at++ = (u8)(value | 0x80);
+        value >>= 7;
+    }
+    *at++ = (u8)value;
+    return at;
+}
+
+static inline u64 zigzag(s64 value)
+{
+    return ((u64)value << 1) ^ (u64)(value >> 63);
+}
+
+static inline s64 unzigzag(u64 value)
+{
+    return (s64)(value >> 1) ^ -(s64)(value & 1);
+}
+
+static void put_u32_le(u8 *at, u32 value)
+{
+    for (u32 i = 0; i < 4; i++) at[i] = (u8)(value >> (i * 8));
+}
+
+static void put_u64_le(u8 *at, u64 value)
+{
+    for (u32 i = 0; i < 8; i++) at[i] = (u8)(value >> (i * 8));
+}
+
+static u32 get_u32_le(const u8 *at)
+{
+    u32 value = 0;
+    for (u32 i = 0; i < 4; i++) value |= (u32)at[i] << (i * 8);
+    return value;
+}
+
+static u64 get_u64_le(const u8 *at)
+{
+    u64 value = 0;
+    for (u32 i = 0; i < 8; i++) value |= (u64)at[i] << (i * 8);
+    return value;
+}
+
+// The word registers in the order of the mask bits, the same as the get_data_from_register() is reading them
+static inline u16 trace_register(CPU *cpu, u32 n)
+{
+    return *(u16 *)(cpu->regmem + n * 2);
+}
+
+///////////////////////////////////////////////////
+// Writer
+
+static THREAD_PROC(trace_flush_worker)
+{
+    Trace_Writer *writer = (Trace_Writer *)data;
+
+    mutex_lock(&writer->mutex);
+    for (;;) {
+        while (writer->flushed_count == writer->submitted_count && !writer->closing) {
+            condition_wait(&writer->condition, &writer->mutex);
+        }
+        if (writer->flushed_count == writer->submitted_count) break; // closing, and everything is written
+
+        u32 block = writer->flushed_count % TRACE_BLOCK_COUNT;
+        u32 size = writer->block_sizes[block];
+        mutex_unlock(&writer->mutex);
+
+        if (fwrite(writer->ring + (u64)block * TRACE_BLOCK_SIZE, 1, size, writer->file) != size) {
+            writer->failed = 1;
+        }
+
+        mutex_lock(&writer->mutex);
+        writer->flushed_count += 1;
+        condition_broadcast(&writer->condition);
+    }
+    mutex_unlock(&writer->mutex);
+
+    return 0;
+}
+
+static void submit_block(Trace_Writer *writer)
+{
+    mutex_lock(&writer->mutex);
+
+    writer->block_sizes[writer->submitted_count % TRACE_BLOCK_COUNT] = writer->fill;
+    writer->submitted_count += 1;
+    condition_broadcast(&writer->condition);
+
+    // The next block is free when it's written out
+    while (writer->submitted_count - writer->flushed_count >= TRACE_BLOCK_COUNT) {
+        condition_wait(&writer->condition, &writer->mutex);
+    }
+
+    mutex_unlock(&writer->mutex);
+
+    writer->submitted_bytes += writer->fill;
+    writer->fill = 0;
+}
+
+// Returns the place for at most TRACE_MAX_PIECE_SIZE bytes, the end of the written bytes has to be committed
+static inline u8 *reserve_piece(Trace_Writer *writer)
+{
+    if (writer->fill + TRACE_MAX_PIECE_SIZE > TRACE_BLOCK_SIZE) {
+        submit_block(writer);
+    }
+    return writer->ring + (u64)(writer->submitted_count % TRACE_BLOCK_COUNT) * TRACE_BLOCK_SIZE + writer->fill;
+}
+
+static inline void commit_piece(Trace_Writer *writer, u8 *end)
+{
+    u8 *block = writer->ring + (u64)(writer->submitted_count % TRACE_BLOCK_COUNT) * TRACE_BLOCK_SIZE;
+    writer->fill = (u32)(end - block);
+}
+
+static void write_keyframe(Trace_Writer *writer)
+{
+    if (writer->keyframe_count == writer->keyframe_capacity) {
+        writer->keyframe_capacity = writer->keyframe_capacity ? writer->keyframe_capacity * 2 : 64;
+        writer->keyframes = (Trace_Keyframe *)realloc(writer->keyframes, writer->keyframe_capacity * sizeof(Trace_Keyframe));
+        assert(writer->keyframes);
+    }
+
+    u8 *at = reserve_piece(writer);
+
+    Trace_Keyframe *keyframe = &writer->keyframes[writer->keyframe_count++];
+    keyframe->offset = writer->submitted_bytes + writer->fill;
+    keyframe->step = writer->step_count;
+
+    at = put_varint(at, Trace_Mask_Keyframe);
+    at = put_varint(at, writer->step_count);
+    at = put_varint(at, writer->next_address);
+    at = put_varint(at, writer->write_end);
+    for (u32 n = 0; n < TRACE_REGISTER_COUNT; n++) {
+        *at++ = (u8)writer->registers[n];
+        *at++ = (u8)(writer->registers[n] >> 8);
+    }
+    *at++ = (u8)writer->flags;
+    *at++ = (u8)(writer->flags >> 8);
+
+    commit_piece(writer, at);
+}
+
+Trace_Writer *open_trace_writer(CPU *cpu, char *filename)
+{
+    FILE *file = fopen(filename, "wb");
+    if (!file) return NULL;
+
+    Trace_Writer *writer = (Trace_Writer *)calloc(1, sizeof(Trace_Writer));
+    assert(writer);
+    writer->file = file;
+    writer->ring = (u8 *)malloc((u64)TRACE_BLOCK_SIZE * TRACE_BLOCK_COUNT);
+    assert(writer->ring);
+
+    u8 header[TRACE_HEADER_SIZE] = {0};
+    memcpy(header, TRACE_MAGIC, 4);
+    header[4] = TRACE_VERSION;
+    put_u32_le(header + 8, cpu->exec_start);
+    put_u32_le(header + 12, cpu->exec_end);
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header)) writer->failed = 1;
+    writer->submitted_bytes = TRACE_HEADER_SIZE;
+
+    writer->next_address = calc_inst_pointer_address(cpu);
+    for (u32 n = 0; n < TRACE_REGISTER_COUNT; n++) {
+        writer->registers[n] = trace_register(cpu, n);
+    }
+    writer->flags = cpu->flags;
+
+    mutex_init(&writer->mutex);
+    condition_init(&writer->condition);
+    writer->thread = thread_start(trace_flush_worker, writer);
+
+    return writer;
+}
+
+u8 close_trace_writer(Trace_Writer *writer, CPU *cpu)
+{
+    // The final state, so the replay knows where the execution is stopped
+    writer->next_address = calc_inst_pointer_address(cpu);
+    write_keyframe(writer);
+    if (writer->fill) {
+        submit_block(writer);
+    }
+    u64 stream_end = writer->submitted_bytes;
+
+    mutex_lock(&writer->mutex);
+    writer->closing = 1;
+    condition_broadcast(&writer->condition);
+    mutex_unlock(&writer->mutex);
+    thread_join(writer->thread);
+
+    u8 tail[16];
+    for (u32 i = 0; i < writer->keyframe_count; i++) {
+        put_u64_le(tail, writer->keyframes[i].offset);
+        put_u64_le(tail + 8, writer->keyframes[i].step);
+        if (fwrite(tail, 1, 16, writer->file) != 16) writer->failed = 1;
+    }
+
+    u8 index_tail[TRACE_INDEX_TAIL_SIZE];
+    put_u64_le(index_tail, writer->keyframe_count);
+    put_u64_le(index_tail + 8, stream_end);
+    put_u64_le(index_tail + 16, writer->step_count);
+    memcpy(index_tail + 24, TRACE_INDEX_MAGIC, 4);
+    if (fwrite(index_tail, 1, sizeof(index_tail), writer->file) != sizeof(index_tail)) writer->failed = 1;
+
+    if (fclose(writer->file) != 0) writer->failed = 1;
+
+    u8 ok = !writer->failed;
+
+    free(writer->ring);
+    free(writer->writes);
+    free(writer->keyframes);
+    free(writer);
+
+    return ok;
+}
+
+void trace_step_begin(Trace_Writer *writer, CPU *cpu, u32 address)
+{
+    // The bytes are taken before the execution, the instruction can overwrite itself
+    u32 length = cpu->decoder_cursor - address;
+    writer->address = address;
+    if (length > TRACE_MAX_INSTRUCTION_LENGTH) length = TRACE_MAX_INSTRUCTION_LENGTH;
+    writer->length = (u8)length;
+    memcpy(writer->bytes, cpu->memory + writer->address, length);
+
+    writer->write_count = 0;
+}
+
+void trace_memory_write(Trace_Writer *writer, u32 address, u16 data, u8 wide)
+{
+    if (writer->write_count == writer->write_capacity) {
+        writer->write_capacity = writer->write_capacity ? writer->write_capacity * 2 : 256;
+        writer->writes = (Trace_Write *)realloc(writer->writes, writer->write_capacity * sizeof(Trace_Write));
+        assert(writer->writes);
+    }
+
+    Trace_Write *write = &writer->writes[writer->write_count++];
+    write->address = address;
+    write->data = wide ? data : (data & 0xFF);
+    write->wide = wide ? 1 : 0;
+}
+
+void trace_step_end(Trace_Writer *writer, CPU *cpu)
+{
+    if (writer->step_count % TRACE_KEYFRAME_INTERVAL == 0) {
+        write_keyframe(writer);
+    }
+
+    u16 registers[TRACE_REGISTER_COUNT];
+    u32 mask = 0;
+    for (u32 n = 0; n < TRACE_REGISTER_COUNT; n++) {
+        registers[n] = trace_register(cpu, n);
+        if (registers[n] != writer->registers[n]) mask |= Trace_Mask_Registers << n;
+    }
+    if (cpu->flags != writer->flags) mask |= Trace_Mask_Flags;
+    if (writer->write_count) mask |= Trace_Mask_Writes;
+
+    u8 *at = reserve_piece(writer);
+    at = put_varint(at, mask);
+    at = put_varint(at, zigzag((s64)writer->address - (s64)writer->next_address));
+    *at++ = writer->length;
+    memcpy(at, writer->bytes, writer->length);
+    at += writer->length;
+
+    for (u32 n = 0; n < TRACE_REGISTER_COUNT; n++) {
+        if (mask & (Trace_Mask_Registers << n)) {
+            at = put_varint(at, zigzag((s16)(registers[n] - writer->registers[n])));
+            writer->registers[n] = registers[n];
+        }
+    }
+    if (mask & Trace_Mask_Flags) {
+        at = put_varint(at, cpu->flags ^ writer->flags);
+        writer->flags = cpu->flags;
+    }
+    commit_piece(writer, at);
+
+    if (mask & Trace_Mask_Writes) {
+        at = reserve_piece(writer);
+        at = put_varint(at, writer->write_count);
+
+        for (u32 i = 0; i < writer->write_count; i++) {
+            if (i % 8 == 0) {
+                commit_piece(writer, at);
+                at = reserve_piece(writer);
+            }
+
+            Trace_Write *write = &writer->writes[i];
+            at = put_varint(at, zigzag((s64)write->address - (s64)writer->write_end) << 1 | write->wide);
+            *at++ = (u8)write->data;
+            if (write->wide) *at++ = (u8)(write->data >> 8);
+
+            writer->write_end = write->address + 1 + write->wide;
+        }
+        commit_piece(writer, at);
+    }
+
+    writer->next_address = writer->address + writer->length;
+    writer->step_count += 1;
+}
+
+///////////////////////////////////////////////////
+// Reader
+
+u8 open_trace_reader(Trace_Reader *reader, char *filename)
+{
+    ZERO_MEMORY(reader, sizeof(Trace_Reader));
+
+    reader->data = map_file(filename, &reader->size);
+    if (!reader->data) return 0;
+
+    if (reader->size < TRACE_HEADER_SIZE || memcmp(reader->data, TRACE_MAGIC, 4) != 0 || reader->data[4] != TRACE_VERSION) {
+        close_trace_reader(reader);
+        return 0;
+    }
+
+    reader->exec_start = get_u32_le(reader->data + 8);
+    reader->exec_end = get_u32_le(reader->data + 12);
+    reader->stream_end = reader->size;
+    reader->cursor = TRACE_HEADER_SIZE;
+
+    // The index at the end, if the writer is closed
+    if (reader->size >= TRACE_HEADER_SIZE + TRACE_INDEX_TAIL_SIZE) {
+        const u8 *tail = reader->data + reader->size - TRACE_INDEX_TAIL_SIZE;
+        u64 count = get_u64_le(tail);
+        u64 stream_end = get_u64_le(tail + 8);
+
+        if (memcmp(tail + 24, TRACE_INDEX_MAGIC, 4) == 0 && stream_end >= TRACE_HEADER_SIZE &&
+            count <= (reader->size - TRACE_INDEX_TAIL_SIZE - stream_end) / 16 &&
+            stream_end + count * 16 + TRACE_INDEX_TAIL_SIZE == reader->size) {
+            reader->stream_end = stream_end;
+            reader->step_count = get_u64_le(tail + 16);
+            reader->keyframe_count = (u32)count;
+            reader->keyframes = (Trace_Keyframe *)malloc((count ? count : 1) * sizeof(Trace_Keyframe));
+            assert(reader->keyframes);
+
+            const u8 *at = reader->data + stream_end;
+            for (u64 i = 0; i < count; i++, at += 16) {
+                reader->keyframes[i].offset = get_u64_le(at);
+                reader->keyframes[i].step = get_u64_le(at + 8);
+            }
+        }
+    }
+
+    return 1;
+}
+
+void close_trace_reader(Trace_Reader *reader)
+{
+    unmap_file(reader->data, reader->size);
+    free(reader->keyframes);
+    free(reader->writes);
+    ZERO_MEMORY(reader, sizeof(Trace_Reader));
+}
+
+static inline u8 get_varint(Trace_Reader *reader, u64 *value)
+{
+    u64 result = 0;
+    for (u32 shift = 0; shift < 64; shift += 7) {
+        if (reader->cursor >= reader->stream_end) return 0;
+
+        u8 byte = reader->data[reader->cursor++];
+        result |= (u64)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static inline u8 get_bytes(Trace_Reader *reader, void *out, u64 size)
+{
+    if (reader->stream_end - reader->cursor < size) return 0;
+    memcpy(out, reader->data + reader->cursor, size);
+    reader->cursor += size;
+    return 1;
+}
+
+static u8 read_keyframe(Trace_Reader *reader)
+{
+    u64 step, address, write_end;
+    u8 state[TRACE_REGISTER_COUNT * 2 + 2];
+    if (!get_varint(reader, &step) || !get_varint(reader, &address) || !get_varint(reader, &write_end) ||
+        !get_bytes(reader, state, sizeof(state))) {
+        return 0;
+    }
+
+    reader->next_step = step;
+    reader->next_address = (u32)address;
+    reader->write_end = (u32)write_end;
+    for (u32 n = 0; n < TRACE_REGISTER_COUNT; n++) {
+        reader->registers[n] = (u16)(state[n * 2] | state[n * 2 + 1] << 8);
+    }
+    reader->flags = (u16)(state[TRACE_REGISTER_COUNT * 2] | state[TRACE_REGISTER_COUNT * 2 + 1] << 8);
+
+    return 1;
+}
+
+u8 read_trace_step(Trace_Reader *reader, Trace_Step *step)
+{
+    u64 mask;
+    for (;;) {
+        if (reader->cursor >= reader->stream_end) return 0;
+
+        if (!get_varint(reader, &mask)) goto corrupt;
+        if (!(mask & Trace_Mask_Keyframe)) break;
+        if (!read_keyframe(reader)) goto corrupt;
+    }
+
+    u64 value;
+    if (!get_varint(reader, &value)) goto corrupt;
+    step->index = reader->next_step;
+    step->address = (u32)((s64)reader->next_address + unzigzag(value));
+    step->changed = (u32)mask;
+
+    if (!get_bytes(reader, &step->length, 1) || step->length > TRACE_MAX_INSTRUCTION_LENGTH ||
+        !get_bytes(reader, step->bytes, step->length)) {
+        goto corrupt;
+    }
+
+    for (u32 n = 0; n < TRACE_REGISTER_COUNT; n++) {
+        if (mask & (Trace_Mask_Registers << n)) {
+            if (!get_varint(reader, &value)) goto corrupt;
+            reader->registers[n] = (u16)(reader->registers[n] + unzigzag(value));
+        }
+    }
+    if (mask & Trace_Mask_Flags) {
+        if (!get_varint(reader, &value)) goto corrupt;
+        reader->flags ^= (u16)value;
+    }
+
+    step->write_count = 0;
+    if (mask & Trace_Mask_Writes) {
+        u64 count;
+        if (!get_varint(reader, &count) || count > reader->stream_end - reader->cursor) goto corrupt;
+
+        if (count > reader->write_capacity) {
+            reader->write_capacity = (u32)count;
+            reader->writes = (Trace_Write *)realloc(reader->writes, count * sizeof(Trace_Write));
+            assert(reader->writes);
+        }
+
+        for (u64 i = 0; i < count; i++) {
+            Trace_Write *write = &reader->writes[i];
+
+            u8 data[2] = {0};
+            if (!get_varint(reader, &value)) goto corrupt;
+            write->wide = value & 1;
+            write->address = (u32)((s64)reader->write_end + unzigzag(value >> 1));
+            if (!get_bytes(reader, data, 1 + write->wide)) goto corrupt;
+            write->data = (u16)(data[0] | data[1] << 8);
+
+            reader->write_end = write->address + 1 + write->wide;
+        }
+        step->write_count = (u32)count;
+    }
+    step->writes = reader->writes;
+
+    memcpy(step->registers, reader->registers, sizeof(step->registers));
+    step->flags = reader->flags;
+
+    reader->next_address = step->address + step->length;
+    reader->next_step += 1;
+
+    return 1;
+
+corrupt:
+    reader->corrupt = 1;
+    reader->cursor = reader->stream_end;
+    return 0;
+}
+
+static u64 seek_to_keyframe(Trace_Reader *reader, s64 found)
+{
+    reader->corrupt = 0;
+    if (found < 0) {
+        // No index (or before the first keyframe), the trace is starting with a keyframe
+        reader->cursor = TRACE_HEADER_SIZE;
+        reader->next_step = 0;
+        return 0;
+    }
+
+    reader->cursor = reader->keyframes[found].offset;
+    reader->next_step = reader->keyframes[found].step;
+    return reader->keyframes[found].step;
+}
+
+u64 seek_trace_reader(Trace_Reader *reader, u64 step)
+{
+    s64 found = -1;
+    s64 lo = 0, hi = (s64)reader->keyframe_count - 1;
+    while (lo <= hi) {
+        s64 mid = (lo + hi) / 2;
+        if (reader->keyframes[mid].step <= step) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    return seek_to_keyframe(reader, found);
+}
+
+u64 seek_trace_reader_to_offset(Trace_Reader *reader, u64 offset)
+{
+    s64 found = -1;
+    s64 lo = 0, hi = (s64)reader->keyframe_count - 1;
+    while (lo <= hi) {
+        s64 mid = (lo + hi) / 2;
+        if (reader->keyframes[mid].offset <= offset) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    return seek_to_keyframe(reader, found);
+}
@@ -0,0 +1,184 @@
+#ifndef _H_TRACE
+#define _H_TRACE
+
+#include "sim86.h"
+#include "platform.h"
+
+// Binary execution trace (--trace_file). Every step is one record with the address and the bytes of the
+// instruction, the changed registers, the flags and the memory writes. The record is delta encoded against the
+// state after the previous step and the numbers are varints (LEB128), so a typical step is 4-8 bytes.
+//
+// The records are written into a ring of blocks, a full block is written to the file by a background thread, so
+// the simulation doesn't wait for the disk (only if the whole ring is full).
+//
+// A keyframe (the full state) is written at every TRACE_KEYFRAME_INTERVAL step, and their offsets are appended
+// to the end of the file at the close. The reader can start from any keyframe, so the tools can jump into the
+// middle of the trace (see the trace_tool.c).
+//
+// File layout:
+//
+//     header    "S86T", u8 version, 3 bytes reserved, u32 exec_start, u32 exec_end
+//     records   ... until the stream_end
+//     index     {u64 offset, u64 step} * count, u64 count, u64 stream_end, u64 step_count, "S86I"
+//
+// The index is missing if the writer is not closed (e.g. the process is crashed), then the whole file is read as
+// records and the keyframes are found by reading.
+//
+// Record:
+//
+//     varint mask                             Trace_Mask bits
+//     keyframe only:
+//         varint step, varint address, varint write_end, u16 registers[12], u16 flags
+//     otherwise:
+//         varint zigzag(address - next)       next = the address + length of the previous step
+//         u8 length, bytes[length]            at most TRACE_MAX_INSTRUCTION_LENGTH (with the prefixes)
+//         varint zigzag(new - old)            for every changed register, in the order of the mask bits
+//         varint new ^ old                    if the flags are changed
+//         varint count, writes[count]         if there are writes
+//
+// Write: varint (zigzag(address - write_end) << 1 | wide), u8 data[1 + wide]
+//        write_end = the address + size of the previous write
+
+#define TRACE_MAGIC         "S86T"
+#define TRACE_INDEX_MAGIC   "S86I"
+#define TRACE_VERSION       1
+#define TRACE_HEADER_SIZE   16
+#define TRACE_INDEX_TAIL_SIZE (3 * 8 + 4)
+
+#define TRACE_BLOCK_SIZE    (256 * 1024)
+#define TRACE_BLOCK_COUNT   64 // 16 MiB ring
+#define TRACE_KEYFRAME_INTERVAL 65536
+
+// The bytes of the longer instructions (a lot of repeated prefixes) are truncated
+#define TRACE_MAX_INSTRUCTION_LENGTH 16
+
+// ax, cx, dx, bx, sp, bp, si, di, es, cs, ss, ds (the word registers of the regmem)
+#define TRACE_REGISTER_COUNT 12
+
+// The piece of a record which is reserved in the block at once
+#define TRACE_MAX_PIECE_SIZE 128
+
+typedef enum {
+    Trace_Mask_Flags     = (1 << 0),
+    Trace_Mask_Writes    = (1 << 1),
+    Trace_Mask_Registers = (1 << 2), // the ax, the next bits are the next registers
+    Trace_Mask_Keyframe  = (1 << 14),
+} Trace_Mask;
+
+typedef struct {
+    u32 address;
+    u16 data;
+    u8 wide;
+} Trace_Write;
+
+typedef struct {
+    u64 offset;
+    u64 step;
+} Trace_Keyframe;
+
+struct Trace_Writer {
+    FILE *file;
+    u8 failed;
+
+    // The ring, the blocks are counted from the start (the block is at the count % TRACE_BLOCK_COUNT)
+    u8 *ring;
+    u32 block_sizes[TRACE_BLOCK_COUNT];
+    u32 submitted_count;    // filled by the simulation
+    u32 flushed_count;      // written by the flush thread
+    u32 fill;               // bytes in the current block
+    u64 submitted_bytes;    // the file offset of the current block
+    u8 closing;
+
+    Mutex mutex;
+    Condition condition;
+    Thread thread;
+
+    // The state after the last written step
+    u64 step_count;
+    u32 next_address;
+    u32 write_end;
+    u16 registers[TRACE_REGISTER_COUNT];
+    u16 flags;
+
+    // The current step
+    u32 address;
+    u8 length;
+    u8 bytes[TRACE_MAX_INSTRUCTION_LENGTH];
+    Trace_Write *writes;
+    u32 write_count;
+    u32 write_capacity;
+
+    Trace_Keyframe *keyframes;
+    u32 keyframe_count;
+    u32 keyframe_capacity;
+};
+
+// Starts the trace from the current state of the CPU, returns NULL if the file can't be created
+Trace_Writer *open_trace_writer(CPU *cpu, char *filename);
+// Writes the final state, the remaining records and the index, returns 0 if any write is failed
+u8 close_trace_writer(Trace_Writer *writer, CPU *cpu);
+
+// Called by the step_instruction() after the decoding (the address is the first prefix), and after the execution
+void trace_step_begin(Trace_Writer *writer, CPU *cpu, u32 address);
+void trace_step_end(Trace_Writer *writer, CPU *cpu);
+// Called by the set_data_to_memory()
+void trace_memory_write(Trace_Writer *writer, u32 address, u16 data, u8 wide);
+
+///////////////////////////////////////////////////
+// Reader
+
+typedef struct {
+    u64 index;
+    u32 address;
+    u8 length;
+    u8 bytes[TRACE_MAX_INSTRUCTION_LENGTH];
+
+    u32 changed;            // Trace_Mask
+    u16 registers[TRACE_REGISTER_COUNT]; // after the step
+    u16 flags;
+
+    Trace_Write *writes;    // owned by the reader, valid until the next read
+    u32 write_count;
+} Trace_Step;
+
+typedef struct {
+    u8 *data;
+    u64 size;
+    u64 stream_end;
+    u64 cursor;
+    u8 corrupt;
+
+    u32 exec_start;
+    u32 exec_end;
+
+    // From the index, the keyframe_count is 0 if there is no index
+    Trace_Keyframe *keyframes;
+    u32 keyframe_count;
+    u64 step_count;
+
+    // The state after the last read step
+    u64 next_step;
+    u32 next_address;
+    u32 write_end;
+    u16 registers[TRACE_REGISTER_COUNT];
+    u16 flags;
+
+    Trace_Write *writes;
+    u32 write_capacity;
+} Trace_Reader;
+
+// Returns 0 if the file can't be read or it's not a trace
+u8 open_trace_reader(Trace_Reader *reader, char *filename);
+void close_trace_reader(Trace_Reader *reader);
+
+// Returns 0 at the end of the trace (or if it's corrupt, see the reader->corrupt)
+u8 read_trace_step(Trace_Reader *reader, Trace_Step *step);
+
+// Moves to the last keyframe at or before the step (needs the index), the next read returns the step of the keyframe.
+// Returns the step of the keyframe.
+u64 seek_trace_reader(Trace_Reader *reader, u64 step);
+
+// Moves to the last keyframe which starts at or before the offset, returns its step
+u64 seek_trace_reader_to_offset(Trace_Reader *reader, u64 offset);
+
+#endif
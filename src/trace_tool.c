@@ -0,0 +1,400 @@
+// Tool for the binary traces which are recorded with the --trace_file (see the trace.h).
+//
+//     trace_tool print  <trace> [--from N] [--count N]   the steps as text
+//     trace_tool stats  <trace>                          the size and the decoding speed
+//     trace_tool replay <trace> <binary>                 replays the writes on the image, checks the instruction
+//                                                        bytes and prints the final state (and the batch hashes)
+//     trace_tool diff   <a> <b> [--context N]            the first step where the two traces are different
+//
+// Every command takes the --cpu <model> of the recorded run (the 8086 by default), it's not stored in the trace.
+//
+// The diff compares the files byte by byte first (the encoding is deterministic, so the same steps are the same
+// bytes), then only decodes from the last keyframe before the first different byte.
+
+#include "sim86.h"
+#include "decoder.h"
+#include "simulator.h"
+#include "alu.h"
+#include "cpu_model.h"
+#include "graphics.h"
+#include "debug_info.h"
+#include "code_map.h"
+#include "trace.h"
+#include "history.h"
+#include "condition.h"
+#include "breakpoints.h"
+#include "hle.h"
+#include "loader.h"
+#include "batch.h"
+#include "platform.h"
+
+#include "sim86.c"
+#include "simulator.c"
+#include "alu.c"
+#include "cpu_model.c"
+#include "graphics.c"
+#include "decoder.c"
+#include "printer.c"
+#include "debug_info.c"
+#include "code_map.c"
+#include "trace.c"
+#include "history.c"
+#include "condition.c"
+#include "breakpoints.c"
+#include "hle.c"
+#include "loader.c"
+#include "batch.c"
+
+// The --cpu, the opcodes of the instructions and the model of the replay
+static const CPU_Model *trace_cpu_model = &cpu_models[CPU_Model_8086];
+
+static void format_step_instruction(Trace_Step *step, char *out, u32 capacity)
+{
+    Instruction inst;
+    Instruction prefix;
+    const Instruction *pending_prefix = NULL;
+
+    u32 cursor = 0;
+    for (;;) {
+        u32 size = decode_instruction(trace_cpu_model->opcodes, step->bytes + cursor, step->length - cursor, pending_prefix, &inst);
+        if (size == 0) {
+            snprintf(out, capacity, "%08X  (truncated)", step->address);
+            return;
+        }
+        if (!inst.is_prefix) break;
+
+        prefix = inst;
+        pending_prefix = &prefix;
+        cursor += size;
+    }
+
+    inst.mem_address = step->address;
+
+    Format_Options format = {0};
+    u32 length = format_instruction(&inst, &format, out, capacity);
+    out[length] = 0;
+}
+
+// The writes of a step which are printed, the rest is only counted
+#define PRINTED_WRITE_COUNT 8
+
+static void print_step(FILE *dest, const char *prefix, Trace_Step *step)
+{
+    char text[MAX_FORMATTED_INSTRUCTION_SIZE];
+    format_step_instruction(step, text, sizeof(text));
+
+    fprintf(dest, "%s#%-8llu %-40s", prefix, (unsigned long long)step->index, text);
+
+    for (u32 n = 0; n < TRACE_REGISTER_COUNT; n++) {
+        if (step->changed & (Trace_Mask_Registers << n)) {
+            fprintf(dest, " %s=%04x", register_name((Register)(Register_ax + n)), step->registers[n]);
+        }
+    }
+    if (step->changed & Trace_Mask_Flags) {
+        fprintf(dest, " flags=[");
+        print_flags(dest, step->flags);
+        fprintf(dest, " ]");
+    }
+    for (u32 i = 0; i < step->write_count; i++) {
+        if (i == PRINTED_WRITE_COUNT) {
+            fprintf(dest, " ... (%u writes)", step->write_count);
+            break;
+        }
+        Trace_Write *write = &step->writes[i];
+        fprintf(dest, write->wide ? " [%05x]=%04x" : " [%05x]=%02x", write->address, write->data);
+    }
+    fprintf(dest, "\n");
+}
+
+static u8 open_trace(Trace_Reader *reader, char *filename)
+{
+    if (!open_trace_reader(reader, filename)) {
+        fprintf(stderr, "[ERROR]: %s is not a trace (or it can't be opened)\n", filename);
+        return 0;
+    }
+    if (reader->keyframe_count == 0) {
+        fprintf(stderr, "[WARNING]: %s has no index (the recording is not closed), it's read from the start\n", filename);
+    }
+    return 1;
+}
+
+// A step of the context of the diff. The writes of the reader are valid only until the next read, so the printed
+// ones are copied.
+typedef struct {
+    Trace_Step step;
+    Trace_Write writes[PRINTED_WRITE_COUNT];
+} Context_Step;
+
+static void keep_context_step(Context_Step *dest, Trace_Step *step)
+{
+    dest->step = *step;
+    u32 count = step->write_count < PRINTED_WRITE_COUNT ? step->write_count : PRINTED_WRITE_COUNT;
+    if (count) memcpy(dest->writes, step->writes, count * sizeof(Trace_Write));
+    dest->step.writes = dest->writes;
+}
+
+static int print_trace(char *filename, u64 from, u64 count)
+{
+    Trace_Reader reader;
+    if (!open_trace(&reader, filename)) return 1;
+
+    seek_trace_reader(&reader, from);
+
+    Trace_Step step;
+    u64 printed = 0;
+    while (printed < count && read_trace_step(&reader, &step)) {
+        if (step.index < from) continue;
+        print_step(stdout, "", &step);
+        printed += 1;
+    }
+
+    int result = reader.corrupt ? 1 : 0;
+    if (reader.corrupt) fprintf(stderr, "[ERROR]: The trace is corrupt after the step %llu\n", (unsigned long long)reader.next_step);
+
+    close_trace_reader(&reader);
+    return result;
+}
+
+static int print_stats(char *filename)
+{
+    Trace_Reader reader;
+    if (!open_trace(&reader, filename)) return 1;
+
+    u64 step_count = 0;
+    u64 write_step_count = 0;
+    u64 write_count = 0;
+
+    double start = seconds_now();
+    Trace_Step step;
+    while (read_trace_step(&reader, &step)) {
+        step_count += 1;
+        write_count += step.write_count;
+        if (step.write_count) write_step_count += 1;
+    }
+    double seconds = seconds_now() - start;
+
+    u64 bytes = reader.stream_end - TRACE_HEADER_SIZE;
+    printf("steps:      %llu%s\n", (unsigned long long)step_count, reader.corrupt ? " (corrupt after)" : "");
+    printf("bytes:      %llu (%.2f per step)\n", (unsigned long long)bytes, step_count ? (double)bytes / step_count : 0.0);
+    printf("writes:     %llu in %llu steps\n", (unsigned long long)write_count, (unsigned long long)write_step_count);
+    printf("keyframes:  %u\n", reader.keyframe_count);
+    printf("decoding:   %.3f s, %.2f MB/s, %.2f M steps/s\n", seconds,
+           bytes / (1024.0 * 1024.0) / seconds, step_count / 1e6 / seconds);
+
+    int result = reader.corrupt ? 1 : 0;
+    close_trace_reader(&reader);
+    return result;
+}
+
+static int replay_trace(char *filename, char *binary_filename)
+{
+    Trace_Reader reader;
+    if (!open_trace(&reader, filename)) return 1;
+
+    CPU cpu = {0};
+    cpu.model = trace_cpu_model;
+    boot(&cpu);
+    if (!load_executable(&cpu, binary_filename)) {
+        fprintf(stderr, "[ERROR]: Failed to open %s file. Probably it is not exists.\n", binary_filename);
+        close_trace_reader(&reader);
+        return 1;
+    }
+    if (cpu.exec_start != reader.exec_start || cpu.exec_end != reader.exec_end) {
+        fprintf(stderr, "[WARNING]: The trace is recorded with an other image (%05x-%05x, not %05x-%05x)\n",
+                reader.exec_start, reader.exec_end, cpu.exec_start, cpu.exec_end);
+    }
+
+    u64 step_count = 0;
+    u64 mismatch_count = 0;
+
+    Trace_Step step;
+    while (read_trace_step(&reader, &step)) {
+        step_count += 1;
+
+        if (memcmp(cpu.memory + step.address, step.bytes, step.length) != 0) {
+            if (mismatch_count < 10) {
+                print_step(stderr, "[MISMATCH]: the memory has other instruction bytes: ", &step);
+            }
+            mismatch_count += 1;
+        }
+
+        // The same byte order as the set_data_to_memory()
+        for (u32 i = 0; i < step.write_count; i++) {
+            Trace_Write *write = &step.writes[i];
+            if (write->wide) {
+                cpu.memory[write->address] = write->data & 0xFF;
+                cpu.memory[write->address + 1] = write->data >> 8;
+            } else {
+                cpu.memory[write->address] = (u8)write->data;
+            }
+        }
+    }
+
+    // The final state is the last keyframe
+    for (u32 n = 0; n < TRACE_REGISTER_COUNT; n++) {
+        u16 value = reader.registers[n];
+        *(u16 *)(cpu.regmem + n * 2) = value;
+    }
+    cpu.flags = reader.flags;
+    cpu.ip = (u16)(reader.next_address - ((u32)reader.registers[9] << 4)); // cs
+
+    printf("steps: %llu, mismatches: %llu\n", (unsigned long long)step_count, (unsigned long long)mismatch_count);
+    for (u32 n = 0; n < TRACE_REGISTER_COUNT; n++) {
+        printf("%s: %04x\n", register_name((Register)(Register_ax + n)), reader.registers[n]);
+    }
+    printf("ip: %04x\nflags:", cpu.ip);
+    print_flags(stdout, cpu.flags);
+    printf("\nregisters_hash: %016llx\nmemory_hash: %016llx\n",
+           (unsigned long long)hash_registers(&cpu), (unsigned long long)hash_memory(&cpu));
+
+    int result = (reader.corrupt || mismatch_count) ? 1 : 0;
+    if (reader.corrupt) fprintf(stderr, "[ERROR]: The trace is corrupt after the step %llu\n", (unsigned long long)reader.next_step);
+
+    free(cpu.memory);
+    close_trace_reader(&reader);
+    return result;
+}
+
+static u8 steps_equal(Trace_Step *a, Trace_Step *b)
+{
+    if (a->address != b->address || a->length != b->length || memcmp(a->bytes, b->bytes, a->length) != 0) return 0;
+    if (memcmp(a->registers, b->registers, sizeof(a->registers)) != 0 || a->flags != b->flags) return 0;
+    if (a->write_count != b->write_count) return 0;
+
+    for (u32 i = 0; i < a->write_count; i++) {
+        if (a->writes[i].address != b->writes[i].address || a->writes[i].data != b->writes[i].data ||
+            a->writes[i].wide != b->writes[i].wide) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static u64 first_different_byte(const u8 *a, const u8 *b, u64 size)
+{
+    const u64 chunk = 64 * 1024;
+
+    u64 offset = 0;
+    while (offset + chunk <= size && memcmp(a + offset, b + offset, chunk) == 0) {
+        offset += chunk;
+    }
+    while (offset < size && a[offset] == b[offset]) {
+        offset += 1;
+    }
+    return offset;
+}
+
+static int diff_traces(char *filename_a, char *filename_b, u32 context)
+{
+    Trace_Reader a, b;
+    if (!open_trace(&a, filename_a)) return 1;
+    if (!open_trace(&b, filename_b)) {
+        close_trace_reader(&a);
+        return 1;
+    }
+
+    double start = seconds_now();
+
+    u64 limit = a.stream_end < b.stream_end ? a.stream_end : b.stream_end;
+    u64 offset = first_different_byte(a.data, b.data, limit);
+
+    if (offset == limit && a.stream_end == b.stream_end) {
+        printf("identical, %llu steps\n", (unsigned long long)a.step_count);
+        close_trace_reader(&a);
+        close_trace_reader(&b);
+        return 0;
+    }
+
+    // The keyframes before the offset are at the same place in both, if they are indexed
+    u64 keyframe_step = seek_trace_reader_to_offset(&a, offset);
+    if (seek_trace_reader_to_offset(&b, offset) != keyframe_step) {
+        seek_trace_reader(&a, 0);
+        seek_trace_reader(&b, 0);
+    }
+
+    Context_Step *history = (Context_Step *)calloc(context + 1, sizeof(Context_Step));
+    u64 history_count = 0;
+
+    Trace_Step step_a, step_b;
+    u8 has_a, has_b;
+    for (;;) {
+        has_a = read_trace_step(&a, &step_a);
+        has_b = read_trace_step(&b, &step_b);
+        if (!has_a || !has_b || !steps_equal(&step_a, &step_b)) break;
+
+        if (context) {
+            keep_context_step(&history[history_count % context], &step_a);
+            history_count += 1;
+        }
+    }
+
+    double seconds = seconds_now() - start;
+
+    u64 first = history_count > context ? history_count - context : 0;
+    for (u64 i = first; i < history_count; i++) {
+        print_step(stdout, "  ", &history[i % context].step);
+    }
+
+    if (!has_a && !has_b) {
+        // Only the index or the corrupt tail is different
+        printf("same steps, %s\n", (a.corrupt || b.corrupt) ? "one of the traces is corrupt" : "only the final state is different");
+    } else if (!has_a || !has_b) {
+        Trace_Step *longer = has_a ? &step_a : &step_b;
+        printf("divergence at step %llu: %s ends here\n", (unsigned long long)longer->index, has_a ? filename_b : filename_a);
+        print_step(stdout, has_a ? "a " : "b ", longer);
+    } else {
+        printf("divergence at step %llu:\n", (unsigned long long)step_a.index);
+        print_step(stdout, "a ", &step_a);
+        print_step(stdout, "b ", &step_b);
+    }
+    printf("(found in %.3f ms, decoded from the step %llu)\n", seconds * 1000.0, (unsigned long long)keyframe_step);
+
+    free(history);
+    close_trace_reader(&a);
+    close_trace_reader(&b);
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: trace_tool print <trace> [--from N] [--count N]\n"
+                        "       trace_tool stats <trace>\n"
+                        "       trace_tool replay <trace> <binary>\n"
+                        "       trace_tool diff <a> <b> [--context N]\n");
+        return 1;
+    }
+
+    char *command = argv[1];
+    char *files[2] = {NULL, NULL};
+    u32 file_count = 0;
+    u64 from = 0;
+    u64 count = (u64)-1;
+    u32 context = 8;
+
+    for (int i = 2; i < argc; i++) {
+        if (STR_EQUAL(argv[i], "--from") && i+1 < argc) {
+            from = strtoull(argv[++i], NULL, 10);
+        } else if (STR_EQUAL(argv[i], "--count") && i+1 < argc) {
+            count = strtoull(argv[++i], NULL, 10);
+        } else if (STR_EQUAL(argv[i], "--context") && i+1 < argc) {
+            context = (u32)atoi(argv[++i]);
+        } else if (STR_EQUAL(argv[i], "--cpu") && i+1 < argc) {
+            trace_cpu_model = find_cpu_model(argv[++i]);
+            if (!trace_cpu_model) {
+                fprintf(stderr, "[ERROR]: Unknown cpu: %s (8086, 8088 or 80186)\n", argv[i]);
+                return 1;
+            }
+        } else if (file_count < 2) {
+            files[file_count++] = argv[i];
+        }
+    }
+
+    if (STR_EQUAL(command, "print") && file_count >= 1)  return print_trace(files[0], from, count);
+    if (STR_EQUAL(command, "stats") && file_count >= 1)  return print_stats(files[0]);
+    if (STR_EQUAL(command, "replay") && file_count == 2) return replay_trace(files[0], files[1]);
+    if (STR_EQUAL(command, "diff") && file_count == 2)   return diff_traces(files[0], files[1], context);
+
+    fprintf(stderr, "[ERROR]: Unknown command or missing file: %s\n", command);
+    return 1;
+}